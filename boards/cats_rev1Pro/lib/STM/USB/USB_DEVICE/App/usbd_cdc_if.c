@@ -67,6 +67,8 @@ trace_command_buffer_t trace_command_buffer;
  */
 
 /* USER CODE BEGIN PRIVATE_DEFINES */
+/* Thread flag set when a transmission completes */
+#define CDC_TX_CPLT_FLAG 0x01U
 /* USER CODE END PRIVATE_DEFINES */
 
 /**
@@ -99,7 +101,8 @@ uint8_t UserRxBufferFS[APP_RX_DATA_SIZE];
 uint8_t UserTxBufferFS[APP_TX_DATA_SIZE];
 
 /* USER CODE BEGIN PRIVATE_VARIABLES */
-
+/* Thread waiting in CDC_Wait_Transmit_FS() */
+static volatile osThreadId_t tx_wait_thread = NULL;
 /* USER CODE END PRIVATE_VARIABLES */
 
 /**
@@ -321,12 +324,43 @@ static int8_t CDC_TransmitCplt_FS(uint8_t *Buf, uint32_t *Len, uint8_t epnum) {
   UNUSED(Buf);
   UNUSED(Len);
   UNUSED(epnum);
+  if (tx_wait_thread != NULL) {
+    osThreadFlagsSet(tx_wait_thread, CDC_TX_CPLT_FLAG);
+  }
   /* USER CODE END 13 */
   return result;
 }
 
 /* USER CODE BEGIN PRIVATE_FUNCTIONS_IMPLEMENTATION */
 
+/**
+ * @brief  CDC_Wait_Transmit_FS
+ *         Block the calling thread until the current transmission is complete.
+ *
+ * @param  timeout: Maximum wait time in ms
+ * @retval USBD_OK if the interface is ready to send, USBD_BUSY after the timeout and USBD_FAIL if it is not configured
+ */
+uint8_t CDC_Wait_Transmit_FS(uint32_t timeout) {
+  USBD_CDC_HandleTypeDef *hcdc = (USBD_CDC_HandleTypeDef *)hUsbDeviceFS.pClassData;
+  if (hcdc == NULL) {
+    return USBD_FAIL;
+  }
+  tx_wait_thread = osThreadGetId();
+  const uint32_t start = osKernelGetTickCount();
+  uint8_t result = USBD_OK;
+  /* the flag can be left over from an earlier transmission, TxState is what counts */
+  while (hcdc->TxState != 0) {
+    const uint32_t elapsed = osKernelGetTickCount() - start;
+    if (elapsed >= timeout) {
+      result = USBD_BUSY;
+      break;
+    }
+    osThreadFlagsWait(CDC_TX_CPLT_FLAG, osFlagsWaitAny, timeout - elapsed);
+  }
+  tx_wait_thread = NULL;
+  return result;
+}
+
 /* USER CODE END PRIVATE_FUNCTIONS_IMPLEMENTATION */
 
 /**
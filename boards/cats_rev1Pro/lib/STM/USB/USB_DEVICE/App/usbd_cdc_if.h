@@ -116,6 +116,7 @@ extern trace_command_buffer_t trace_command_buffer;
 uint8_t CDC_Transmit_FS(uint8_t* Buf, uint16_t Len);
 
 /* USER CODE BEGIN EXPORTED_FUNCTIONS */
+uint8_t CDC_Wait_Transmit_FS(uint32_t timeout);
 
 /* USER CODE END EXPORTED_FUNCTIONS */
 
@@ -21,6 +21,8 @@
 #include "cli/cli_commands.h"
 #include "util/log.h"
 #include "lfs/lfs_custom.h"
+#include "cli/settings_schema.h"
+#include "cli/settings_hash.h"
 
 #include <string.h>
 #include <stdio.h>
@@ -337,10 +339,10 @@ static void print_value_pointer(const char *cmdName, const cli_value_t *var, con
       case MODE_DIRECT:
         if ((var->type & VALUE_TYPE_MASK) == VAR_UINT32) {
           cli_printf("%lu", (uint32_t)value);
-          if ((uint32_t)value > var->config.u32_max) {
+          if ((uint32_t)value < var->config.minmax_u32.min || (uint32_t)value > var->config.minmax_u32.max) {
             value_is_corrupted = true;
           } else if (full) {
-            cli_printf(" 0 %lu", var->config.u32_max);
+            cli_printf(" %lu %lu", var->config.minmax_u32.min, var->config.minmax_u32.max);
           }
         } else {
           int min;
@@ -396,13 +398,16 @@ uint8_t get_word_length(char *bufBegin, char *bufEnd) {
 }
 
 uint16_t cli_get_setting_index(char *name, uint8_t length) {
-  for (uint32_t i = 0; i < value_table_entry_count; i++) {
-    const char *setting_name = value_table[i].name;
+  const uint32_t slot = cli_settings_hash(name, length, CLI_SETTINGS_HASH_SEED) >> (32 - CLI_SETTINGS_HASH_BITS);
+  if (settings_hash_slots[slot] == 0) {
+    return value_table_entry_count;
+  }
+  const uint16_t index = settings_hash_slots[slot] - 1;
+  const char *setting_name = value_table[index].name;
 
-    // ensure exact match when setting to prevent setting variables with shorter names
-    if (strncasecmp(name, setting_name, strlen(setting_name)) == 0 && length == strlen(setting_name)) {
-      return i;
-    }
+  // the hash only says where to look; ensure exact match to prevent setting variables with shorter names
+  if (length == strlen(setting_name) && strncasecmp(name, setting_name, length) == 0) {
+    return index;
   }
   return value_table_entry_count;
 }
@@ -420,7 +425,7 @@ void cli_print_var_range(const cli_value_t *var) {
     case (MODE_DIRECT): {
       switch (var->type & VALUE_TYPE_MASK) {
         case VAR_UINT32:
-          cli_print_linef("Allowed range: 0 - %lu", var->config.u32_max);
+          cli_print_linef("Allowed range: %lu - %lu", var->config.minmax_u32.min, var->config.minmax_u32.max);
           break;
         case VAR_UINT8:
         case VAR_UINT16:
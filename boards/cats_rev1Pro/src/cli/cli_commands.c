@@ -27,11 +27,23 @@
 #include "util/actions.h"
 #include "util/battery.h"
 #include "lfs/lfs_custom.h"
-
+#include "lfs/raw_partition.h"
+#include "lfs/flight_index.h"
+#include "lfs/erase_map.h"
+#include "lfs/storage_bench.h"
+#include "util/recorder.h"
+#include "util/cycle_counter.h"
+
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
 
+/** Private Constants **/
+
+/* flash_test writes and reads one sector per call */
+#define FLASH_TEST_CHUNK_SIZE 4096
+
 /** CLI command function declarations **/
 
 static void cli_cmd_help(const char *cmd_name, char *args);
@@ -54,8 +66,10 @@ static void cli_cmd_cd(const char *cmd_name, char *args);
 static void cli_cmd_rm(const char *cmd_name, char *args);
 
 static void cli_cmd_dump_flight(const char *cmd_name, char *args);
+static void cli_cmd_list_flights(const char *cmd_name, char *args);
 static void cli_cmd_parse_flight(const char *cmd_name, char *args);
 static void cli_cmd_parse_stats(const char *cmd_name, char *args);
+static void cli_cmd_rec_info(const char *cmd_name, char *args);
 
 static void cli_cmd_lfs_format(const char *cmd_name, char *args);
 static void cli_cmd_erase_flash(const char *cmd_name, char *args);
@@ -64,6 +78,7 @@ static void cli_cmd_erase_recordings(const char *cmd_name, char *args);
 static void cli_cmd_flash_write(const char *cmd_name, char *args);
 static void cli_cmd_flash_stop(const char *cmd_name, char *args);
 static void cli_cmd_flash_test(const char *cmd_name, char *args);
+static void cli_cmd_storage_bench(const char *cmd_name, char *args);
 
 /* List of CLI commands; should be sorted in alphabetical order. */
 const clicmd_t cmd_table[] = {
@@ -74,7 +89,9 @@ const clicmd_t cmd_table[] = {
     CLI_COMMAND_DEF("flash_test", "test the flash", NULL, cli_cmd_flash_test),
     CLI_COMMAND_DEF("flash_start_write", "set recorder state to REC_WRITE_TO_FLASH", NULL, cli_cmd_flash_write),
     CLI_COMMAND_DEF("flash_stop_write", "set recorder state to REC_FILL_QUEUE", NULL, cli_cmd_flash_stop),
-    CLI_COMMAND_DEF("flight_dump", "print a specific flight", "<flight_number>", cli_cmd_dump_flight),
+    CLI_COMMAND_DEF("flight_dump", "download a specific flight in binary form", "<flight_number> [offset]",
+                    cli_cmd_dump_flight),
+    CLI_COMMAND_DEF("flight_list", "list the recorded flights", NULL, cli_cmd_list_flights),
     CLI_COMMAND_DEF("flight_parse", "print a specific flight", "<flight_number>", cli_cmd_parse_flight),
     CLI_COMMAND_DEF("get", "get variable value", "[cmd_name]", cli_cmd_get),
     CLI_COMMAND_DEF("help", "display command help", "[search string]", cli_cmd_help),
@@ -83,11 +100,14 @@ const clicmd_t cmd_table[] = {
     CLI_COMMAND_DEF("ls", "list all files in current working directory", NULL, cli_cmd_ls),
     CLI_COMMAND_DEF("reboot", "reboot without saving", NULL, cli_cmd_reboot),
     CLI_COMMAND_DEF("rec_erase", "erase the recordings", NULL, cli_cmd_erase_recordings),
+    CLI_COMMAND_DEF("rec_info", "show the recorder telemetry of the current flight", NULL, cli_cmd_rec_info),
     CLI_COMMAND_DEF("rm", "remove a file", "<file_name>", cli_cmd_rm),
     CLI_COMMAND_DEF("save", "save configuration", NULL, cli_cmd_save),
     CLI_COMMAND_DEF("set", "change setting", "[<cmd_name>=<value>]", cli_cmd_set),
     CLI_COMMAND_DEF("stats", "print flight stats", "<flight_number>", cli_cmd_parse_stats),
     CLI_COMMAND_DEF("status", "show status", NULL, cli_cmd_status),
+    CLI_COMMAND_DEF("storage_bench", "measure the flash and file system latencies", "[history]",
+                    cli_cmd_storage_bench),
     CLI_COMMAND_DEF("version", "show version", NULL, cli_cmd_version),
 };
 
@@ -101,8 +121,14 @@ static void print_timer_config();
 
 static void cli_set_var(const cli_value_t *var, uint32_t value);
 
+static void format_storage();
+
 static void fill_buf(uint8_t *buf, size_t buf_sz);
 
+static void print_flash_throughput(const char *step, uint32_t num_bytes, uint32_t duration_us);
+
+static void print_history_limit(const cli_value_t *var);
+
 /** CLI command function definitions **/
 
 static void cli_cmd_help(const char *cmd_name, char *args) {
@@ -162,6 +188,7 @@ static void cli_cmd_get(const char *cmd_name, char *args) {
       cli_print_var(cmd_name, val, 0);
       cli_print_linefeed();
       cli_print_var_range(val);
+      print_history_limit(val);
       // cliPrintVarDefault(cmd_name, val);
 
       matched_commands++;
@@ -210,7 +237,7 @@ static void cli_cmd_set(const char *cmd_name, char *args) {
         if ((val->type & VALUE_TYPE_MASK) == VAR_UINT32) {
           uint32_t value = strtoul(eqptr, NULL, 10);
 
-          if (value <= val->config.u32_max) {
+          if (value >= val->config.minmax_u32.min && value <= val->config.minmax_u32.max) {
             cli_set_var(val, value);
             value_changed = true;
           }
@@ -319,6 +346,7 @@ static void cli_cmd_set(const char *cmd_name, char *args) {
     if (value_changed) {
       cli_printf("%s set to ", val->name);
       cli_print_var(cmd_name, val, 0);
+      print_history_limit(val);
     } else {
       cli_print_error_linef(cmd_name, "INVALID VALUE");
       cli_print_var_range(val);
@@ -347,8 +375,11 @@ static void cli_cmd_status(const char *cmd_name, char *args) {
   cli_printf("Mode:\t%s\n", p_boot_table->values[global_cats_config.config.boot_state]);
   cli_printf("State:\t%s\n", p_event_table->values[global_flight_state.flight_state - 1]);
   cli_printf("Voltage: %.2fV\n", (double)battery_voltage());
-  cli_printf("h: %.2fm, v: %.2fm/s, a: %.2fm/s^2", (double)global_kf_data.height, (double)global_kf_data.velocity,
+  cli_printf("h: %.2fm, v: %.2fm/s, a: %.2fm/s^2\n", (double)global_kf_data.height, (double)global_kf_data.velocity,
              (double)global_kf_data.acceleration);
+  const uint32_t erased = raw_partition_get_erased();
+  cli_printf("Flash: %lu KiB free, %lu KiB pre-erased (~%lu s of recording)", raw_partition_get_free() / 1024,
+             erased / 1024, erased / REC_NOMINAL_DATA_RATE);
 }
 
 static void cli_cmd_version(const char *cmd_name, char *args) {
@@ -402,7 +433,10 @@ static void cli_cmd_rm(const char *cmd_name, char *args) {
       free(full_path);
       return;
     }
-    int32_t rm_err = lfs_remove(&lfs, full_path);
+    /* flights are removed through the index, together with their stats file */
+    unsigned long flight_number = 0;
+    const bool is_flight = strstr(cwd, "flights") != NULL && sscanf(args, "flight_%lu", &flight_number) == 1;
+    int32_t rm_err = is_flight && flight_index_remove(flight_number) ? 0 : lfs_remove(&lfs, full_path);
     if (rm_err < 0) {
       cli_print_linef("File removal failed with %ld", rm_err);
     }
@@ -424,14 +458,38 @@ static void cli_cmd_dump_flight(const char *cmd_name, char *args) {
       cli_print_linef("\nFlight %lu doesn't exist", flight_idx);
       cli_print_linef("Number of recorded flights: %lu", flight_counter);
     } else {
+      /* An offset resumes an interrupted download */
+      const uint32_t offset = strtoul(endptr, NULL, 10);
       cli_print_linefeed();
-      dump_recording(flight_idx);
+      dump_recording(flight_idx, offset);
     }
   } else {
     cli_print_line("\nArgument not provided!");
   }
 }
 
+static void cli_cmd_list_flights(const char *cmd_name, char *args) {
+  const uint32_t newest = flight_index_get_newest();
+  cli_print_linef("\n%lu flights, %lu KiB free for the next one", flight_index_get_count(),
+                  raw_partition_get_free() / 1024);
+  if (newest == 0) {
+    return;
+  }
+  cli_print_line("Flight     Size  Liftoff [ms]  Max. Height [m]  Max. Velocity [m/s]  Max. Acceleration [m/s^2]");
+  for (uint32_t flight_number = flight_index_get_oldest(); flight_number <= newest; ++flight_number) {
+    flight_index_entry_t entry;
+    if (!flight_index_get(flight_number, &entry)) {
+      continue;
+    }
+    if (entry.flags & FLIGHT_INDEX_FLAG_STATS) {
+      cli_print_linef("%6lu %7luK %13lu %16.1f %20.1f %26.1f", flight_number, entry.size / 1024, entry.liftoff_ts,
+                      (double)entry.max_height, (double)entry.max_velocity, (double)entry.max_acceleration);
+    } else {
+      cli_print_linef("%6lu %7luK  no liftoff detected", flight_number, entry.size / 1024);
+    }
+  }
+}
+
 static void cli_cmd_parse_flight(const char *cmd_name, char *args) {
   /* TODO - count how many files in a directory here */
   char *endptr;
@@ -469,25 +527,29 @@ static void cli_cmd_parse_stats(const char *cmd_name, char *args) {
   }
 }
 
-static void cli_cmd_lfs_format(const char *cmd_name, char *args) {
-  cli_print_line("\nTrying LFS format");
-  lfs_format(&lfs, &lfs_cfg);
-  int err = lfs_mount(&lfs, &lfs_cfg);
-  if (err != 0) {
-    cli_print_linef("LFS mounting failed with error %d!", err);
-  } else {
-    cli_print_line("Mounting successful!");
-    /* create the flights directory */
-    lfs_mkdir(&lfs, "flights");
-    lfs_mkdir(&lfs, "stats");
+static void cli_cmd_rec_info(const char *cmd_name, char *args) {
+  cli_print_linefeed();
+  /* a live snapshot, the counters keep changing while it is printed */
+  print_rec_telemetry(&global_rec_telemetry);
+}
 
-    strncpy(cwd, "/", sizeof(cwd));
-  }
+static void cli_cmd_lfs_format(const char *cmd_name, char *args) {
+  cli_print_linefeed();
+  format_storage();
 }
 
 static void cli_cmd_erase_flash(const char *cmd_name, char *args) {
+  /* the recorder writes to the flash without waiting for the CLI */
+  if (global_recorder_status == REC_WRITE_TO_FLASH) {
+    cli_print_line("\nThe recorder is currently active, stop it first!");
+    return;
+  }
+  /* keeps the recorder from erasing ahead in the raw partition until it is formatted again */
+  osMutexAcquire(flash_mutex, osWaitForever);
   cli_print_line("\nErasing the flash, this might take a while...");
   w25q_chip_erase();
+  erase_map_reset();
+  lfs_legacy_layout = false;
   cli_print_line("Flash erased!");
   cli_print_line("Mounting LFS");
 
@@ -501,15 +563,21 @@ static void cli_cmd_erase_flash(const char *cmd_name, char *args) {
     int err2 = lfs_mount(&lfs, &lfs_cfg);
     if (err2 != 0) {
       cli_print_linef("LFS mounting failed again with error %d!", err2);
+      /* the raw partition still describes the erased flash */
+      raw_partition_check_layout();
+      osMutexRelease(flash_mutex);
       return;
     } else {
       cli_print_line("Mounting successful!");
     }
   }
   flight_counter = 0;
+  raw_partition_format();
   /* create the flights directory */
   lfs_mkdir(&lfs, "flights");
   lfs_mkdir(&lfs, "stats");
+  flight_index_init();
+  osMutexRelease(flash_mutex);
 
   strncpy(cwd, "/", sizeof(cwd));
 }
@@ -531,49 +599,114 @@ static void cli_cmd_flash_stop(const char *cmd_name, char *args) {
 }
 
 static void cli_cmd_flash_test(const char *cmd_name, char *args) {
-  uint8_t write_buf[256] = {0};
-  uint8_t read_buf[256] = {0};
-  fill_buf(write_buf, 256);
+  /* the recorder writes to the flash without waiting for the CLI */
+  if (global_recorder_status == REC_WRITE_TO_FLASH) {
+    cli_print_line("\nThe recorder is currently active, stop it first!");
+    return;
+  }
+  /* keeps the stack of the CLI task small */
+  static uint8_t test_buf[FLASH_TEST_CHUNK_SIZE];
+  uint8_t pattern[256] = {0};
+  fill_buf(pattern, sizeof(pattern));
+  for (uint32_t i = 0; i < sizeof(test_buf); i += sizeof(pattern)) {
+    memcpy(&test_buf[i], pattern, sizeof(pattern));
+  }
+  const uint32_t num_chunks = w25q.sector_count * w25q.sector_size / FLASH_TEST_CHUNK_SIZE;
+  /* only the flash calls are timed, not the progress output, the error handling and the comparison */
+  uint32_t flash_us = 0;
+  uint32_t start_cycles = 0;
+  /* keeps the recorder from erasing ahead in the raw partition until it is formatted again */
+  osMutexAcquire(flash_mutex, osWaitForever);
   cli_print_line("\nStep 1: Erasing the chip sector by sector...");
   w25q_chip_erase();
   for (uint32_t i = 0; i < w25q.sector_count; ++i) {
     if (i % 100 == 0) {
       cli_print_linef("%lu / %lu sectors erased...", i, w25q.sector_count);
     }
+    start_cycles = cycle_counter_get();
     w25q_status_e sector_erase_status = w25q_sector_erase(i);
+    flash_us += cycle_counter_to_us(cycle_counter_get() - start_cycles);
     if (sector_erase_status != W25Q_OK) {
       cli_print_linef("Sector erase error encountered at sector %lu; status %d", i, sector_erase_status);
       osDelay(5000);
     }
   }
+  start_cycles = cycle_counter_get();
+  w25q_sync();
+  flash_us += cycle_counter_to_us(cycle_counter_get() - start_cycles);
+  print_flash_throughput("Erase", w25q.sector_count * w25q.sector_size, flash_us);
   cli_print_line("Step 2: Sequential write test");
-  for (uint32_t i = 0; i < w25q.page_count; ++i) {
+  /* every sector is written from here on */
+  erase_map_reset();
+  flash_us = 0;
+  for (uint32_t i = 0; i < num_chunks; ++i) {
     if (i % 100 == 0) {
-      cli_print_linef("%lu / %lu pages written...", i, w25q.page_count);
+      cli_print_linef("%lu / %lu sectors written...", i, num_chunks);
     }
-    w25q_status_e write_status = w25q_write_buffer(write_buf, i * w25q.page_size, 256);
+    start_cycles = cycle_counter_get();
+    w25q_status_e write_status = w25q_write_buffer(test_buf, i * FLASH_TEST_CHUNK_SIZE, FLASH_TEST_CHUNK_SIZE);
+    flash_us += cycle_counter_to_us(cycle_counter_get() - start_cycles);
     if (write_status != W25Q_OK) {
-      cli_print_linef("Write error encountered at page %lu; status %d", i, write_status);
+      cli_print_linef("Write error encountered at sector %lu; status %d", i, write_status);
       osDelay(5000);
     }
   }
+  start_cycles = cycle_counter_get();
+  w25q_sync();
+  flash_us += cycle_counter_to_us(cycle_counter_get() - start_cycles);
+  print_flash_throughput("Write", num_chunks * FLASH_TEST_CHUNK_SIZE, flash_us);
   cli_print_line("Step 3: Sequential read test");
-  for (uint32_t i = 0; i < w25q.page_count; ++i) {
-    memset(read_buf, 0, 256);
+  flash_us = 0;
+  for (uint32_t i = 0; i < num_chunks; ++i) {
+    memset(test_buf, 0, sizeof(test_buf));
     if (i % 100 == 0) {
-      cli_print_linef("%lu / %lu pages read...", i, w25q.page_count);
+      cli_print_linef("%lu / %lu sectors read...", i, num_chunks);
     }
-    w25q_status_e read_status = w25q_read_buffer(read_buf, i * w25q.page_size, 256);
+    start_cycles = cycle_counter_get();
+    w25q_status_e read_status = w25q_read_buffer(test_buf, i * FLASH_TEST_CHUNK_SIZE, FLASH_TEST_CHUNK_SIZE);
+    flash_us += cycle_counter_to_us(cycle_counter_get() - start_cycles);
     if (read_status != W25Q_OK) {
-      cli_print_linef("Read error encountered at page %lu; status %d", i, read_status);
+      cli_print_linef("Read error encountered at sector %lu; status %d", i, read_status);
       osDelay(5000);
     }
-    if (memcmp(write_buf, read_buf, 256) != 0) {
-      cli_print_linef("Buffer mismatch at page %lu", i);
-      osDelay(5000);
+    for (uint32_t j = 0; j < sizeof(test_buf); j += sizeof(pattern)) {
+      if (memcmp(&test_buf[j], pattern, sizeof(pattern)) != 0) {
+        cli_print_linef("Buffer mismatch at page %lu", (i * FLASH_TEST_CHUNK_SIZE + j) / w25q.page_size);
+        osDelay(5000);
+      }
     }
   }
+  print_flash_throughput("Read", num_chunks * FLASH_TEST_CHUNK_SIZE, flash_us);
   cli_print_line("Test complete!");
+  /* the test pattern overwrote both file systems, the raw partition still reports the sectors after its cursor as
+   * erased */
+  format_storage();
+  osMutexRelease(flash_mutex);
+}
+
+static void cli_cmd_storage_bench(const char *cmd_name, char *args) {
+  if (args != NULL && strcmp(args, "history") == 0) {
+    if (storage_bench_print_history() != LFS_ERR_OK) {
+      cli_print_line("No benchmark results saved yet");
+    }
+    return;
+  }
+  if (global_recorder_status == REC_WRITE_TO_FLASH) {
+    cli_print_line("The recorder is currently active, stop it first!");
+    return;
+  }
+  /* keeps the stack of the CLI task small */
+  static storage_bench_results_t results;
+  cli_print_line("\nRunning the storage benchmark, this takes a few seconds...");
+  if (!storage_bench_run(&results)) {
+    cli_print_line("Some tests failed or could not run");
+  }
+  storage_bench_print(&results);
+  if (storage_bench_save(&results, code_version) != LFS_ERR_OK) {
+    cli_print_line("Saving the results failed");
+  } else {
+    cli_print_linef("Results appended to %s, compare with 'storage_bench history'", STORAGE_BENCH_FILE);
+  }
 }
 
 /**  Helper function definitions **/
@@ -673,9 +806,56 @@ static void cli_set_var(const cli_value_t *var, const uint32_t value) {
   }
 }
 
+/* Formats LittleFS and the raw partition, all flights are gone afterwards */
+static void format_storage() {
+  cli_print_line("Trying LFS format");
+  osMutexAcquire(flash_mutex, osWaitForever);
+  lfs_format(&lfs, &lfs_cfg);
+  /* an old file system spanning the whole flash is gone as well */
+  lfs_legacy_layout = false;
+  /* the flights in the raw partition are gone together with their files */
+  raw_partition_format();
+  int err = lfs_mount(&lfs, &lfs_cfg);
+  if (err != 0) {
+    cli_print_linef("LFS mounting failed with error %d!", err);
+  } else {
+    cli_print_line("Mounting successful!");
+    /* create the flights directory */
+    lfs_mkdir(&lfs, "flights");
+    lfs_mkdir(&lfs, "stats");
+    flight_index_init();
+
+    strncpy(cwd, "/", sizeof(cwd));
+  }
+  osMutexRelease(flash_mutex);
+}
+
 static void fill_buf(uint8_t *buf, size_t buf_sz) {
   for (uint32_t i = 0; i < buf_sz / 2; ++i) {
     buf[i] = i * 2;
     buf[buf_sz - i - 1] = i * 2 + 1;
   }
 }
+
+static void print_flash_throughput(const char *step, uint32_t num_bytes, uint32_t duration_us) {
+  if (duration_us == 0) {
+    duration_us = 1;
+  }
+  cli_print_linef("%s: %lu KiB in %lu ms, %lu KiB/s", step, num_bytes / 1024, duration_us / 1000,
+                  (uint32_t)((uint64_t)num_bytes * 1000000 / 1024 / duration_us));
+}
+
+/* The pre-launch history is limited by the history buffer, tell the user when it is shorter than configured */
+static void print_history_limit(const cli_value_t *var) {
+  if (var->pdata != &global_cats_config.config.rec_history_duration &&
+      var->pdata != global_cats_config.config.rec_decimation[REC_PHASE_GROUND]) {
+    return;
+  }
+  const uint32_t requested = global_cats_config.config.rec_history_duration;
+  const uint32_t duration = rec_get_history_duration();
+  if (requested == 0 || requested > duration) {
+    cli_print_linefeed();
+    cli_printf("Pre-launch history: %lu ms, the history buffer holds %lu ms at the current ground decimation",
+               duration, rec_get_history_capacity());
+  }
+}
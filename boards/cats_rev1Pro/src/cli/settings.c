@@ -19,6 +19,8 @@
 
 #include "config/cats_config.h"
 #include "cli/settings.h"
+#include "cli/settings_schema.h"
+#include "cli/settings_hash.h"
 
 const char* const lookupTableBootState[] = {
     "CATS_INVALID", "CATS_IDLE", "CATS_CONFIG", "CATS_TIMER", "CATS_DROP", "CATS_FLIGHT",
@@ -44,60 +46,50 @@ const lookup_table_entry_t lookup_tables[] = {
 
 #undef LOOKUP_TABLE_ENTRY
 
-const cli_value_t value_table[] = {
-    {"boot_state", VAR_UINT32 | MODE_LOOKUP, .config.lookup = {TABLE_BOOTSTATE}, &global_cats_config.config.boot_state},
-
-    // Control
-    {"main_altitude", VAR_UINT16, .config.minmax_unsigned = {10, 65535},
-     &global_cats_config.config.control_settings.main_altitude},
-    {"acc_threshhold", VAR_UINT16, .config.minmax_unsigned = {1500, 8000},
-     &global_cats_config.config.control_settings.liftoff_acc_threshold},
-    {"mach_timer_duration", VAR_UINT16, .config.minmax_unsigned = {0, 60000},
-     &global_cats_config.config.control_settings.mach_timer_duration},
-
-    // Timers
-    {"timer1_start", VAR_UINT8 | MODE_LOOKUP, .config.lookup = {TABLE_EVENTS},
-     &global_cats_config.config.timers[0].start_event},
-    {"timer1_end", VAR_UINT8 | MODE_LOOKUP, .config.lookup = {TABLE_EVENTS},
-     &global_cats_config.config.timers[0].end_event},
-    {"timer1_duration", VAR_UINT32, .config.u32_max = 1200000, &global_cats_config.config.timers[0].duration},
-    {"timer2_start", VAR_UINT8 | MODE_LOOKUP, .config.lookup = {TABLE_EVENTS},
-     &global_cats_config.config.timers[1].start_event},
-    {"timer2_end", VAR_UINT8 | MODE_LOOKUP, .config.lookup = {TABLE_EVENTS},
-     &global_cats_config.config.timers[1].end_event},
-    {"timer2_duration", VAR_UINT32, .config.u32_max = 1200000, &global_cats_config.config.timers[1].duration},
-    {"timer3_start", VAR_UINT8 | MODE_LOOKUP, .config.lookup = {TABLE_EVENTS},
-     &global_cats_config.config.timers[2].start_event},
-    {"timer3_end", VAR_UINT8 | MODE_LOOKUP, .config.lookup = {TABLE_EVENTS},
-     &global_cats_config.config.timers[2].end_event},
-    {"timer3_duration", VAR_UINT32, .config.u32_max = 1200000, &global_cats_config.config.timers[2].duration},
-    {"timer4_start", VAR_UINT8 | MODE_LOOKUP, .config.lookup = {TABLE_EVENTS},
-     &global_cats_config.config.timers[3].start_event},
-    {"timer4_end", VAR_UINT8 | MODE_LOOKUP, .config.lookup = {TABLE_EVENTS},
-     &global_cats_config.config.timers[3].end_event},
-    {"timer4_duration", VAR_UINT32, .config.u32_max = 1200000, &global_cats_config.config.timers[3].duration},
-
-    // Events
-    {"ev_moving", VAR_INT16 | MODE_ARRAY, .config.array.length = 16, global_cats_config.config.action_array[EV_MOVING]},
-    {"ev_ready", VAR_INT16 | MODE_ARRAY, .config.array.length = 16, global_cats_config.config.action_array[EV_READY]},
-    {"ev_liftoff", VAR_INT16 | MODE_ARRAY, .config.array.length = 16,
-     global_cats_config.config.action_array[EV_LIFTOFF]},
-    {"ev_burnout", VAR_INT16 | MODE_ARRAY, .config.array.length = 16, global_cats_config.config.action_array[EV_MAX_V]},
-    {"ev_apogee", VAR_INT16 | MODE_ARRAY, .config.array.length = 16, global_cats_config.config.action_array[EV_APOGEE]},
-    {"ev_lowalt", VAR_INT16 | MODE_ARRAY, .config.array.length = 16,
-     global_cats_config.config.action_array[EV_POST_APOGEE]},
-    {"ev_touchdown", VAR_INT16 | MODE_ARRAY, .config.array.length = 16,
-     global_cats_config.config.action_array[EV_TOUCHDOWN]},
-    {"ev_custom1", VAR_INT16 | MODE_ARRAY, .config.array.length = 16,
-     global_cats_config.config.action_array[EV_CUSTOM_1]},
-    {"ev_custom2", VAR_INT16 | MODE_ARRAY, .config.array.length = 16,
-     global_cats_config.config.action_array[EV_CUSTOM_2]},
-
-    // Servo position
-    {"servo1_init_pos", VAR_INT16, .config.minmax_unsigned = {0, 180},
-     &global_cats_config.config.initial_servo_position[0]},
-    {"servo2_init_pos", VAR_INT16, .config.minmax_unsigned = {0, 180},
-     &global_cats_config.config.initial_servo_position[1]},
-};
+/* Size of a value of the given type in bytes */
+#define VALUE_SIZE(type) \
+  (((type)&VALUE_TYPE_MASK) == VAR_UINT32 ? 4 : ((type)&VALUE_TYPE_MASK) >= VAR_UINT16 ? 2 : 1)
+#define MEMBER_SIZE(member) sizeof(((cats_config_t *)0)->member)
+
+#define SETTING_LOOKUP(name, type, table, member) \
+  {#name, (type) | MODE_LOOKUP, .config.lookup = {table}, &global_cats_config.config.member},
+#define SETTING_RANGE(name, type, min, max, member) \
+  {#name, type, .config.minmax_unsigned = {min, max}, &global_cats_config.config.member},
+#define SETTING_MAX(name, min, max, member) \
+  {#name, VAR_UINT32, .config.minmax_u32 = {min, max}, &global_cats_config.config.member},
+#define SETTING_ARRAY(name, type, member) \
+  {#name, (type) | MODE_ARRAY, .config.array.length = ARRAYLEN(global_cats_config.config.member), \
+   global_cats_config.config.member},
+
+/* Generated from cli/settings_schema.h */
+const cli_value_t value_table[] = {CLI_SETTINGS(SETTING_LOOKUP, SETTING_RANGE, SETTING_MAX, SETTING_ARRAY)};
+
+/* Every setting has to have the size of its value type, otherwise the CLI reads and writes the wrong bytes */
+#define CHECK_LOOKUP(name, type, table, member) \
+  _Static_assert(MEMBER_SIZE(member) == VALUE_SIZE(type), "Size of " #name " doesn't match cats_config_t");
+#define CHECK_RANGE(name, type, min, max, member) \
+  _Static_assert(MEMBER_SIZE(member) == VALUE_SIZE(type), "Size of " #name " doesn't match cats_config_t"); \
+  _Static_assert((min) <= (max), "Invalid range of " #name);
+#define CHECK_MAX(name, min, max, member) \
+  _Static_assert(MEMBER_SIZE(member) == VALUE_SIZE(VAR_UINT32), "Size of " #name " doesn't match cats_config_t"); \
+  _Static_assert((min) <= (max), "Invalid range of " #name);
+#define CHECK_ARRAY(name, type, member) \
+  _Static_assert(MEMBER_SIZE(member[0]) == VALUE_SIZE(type), "Size of " #name " doesn't match cats_config_t"); \
+  _Static_assert(ARRAYLEN(((cats_config_t *)0)->member) <= UINT8_MAX, "Array " #name " is too long");
+
+CLI_SETTINGS(CHECK_LOOKUP, CHECK_RANGE, CHECK_MAX, CHECK_ARRAY)
+
+/* The perfect hash in cli/settings_hash.h stores value_table indices. A setting which was added, renamed or moved since
+ * the hash was generated has no CLI_SETTINGS_INDEX_ macro or a different index, a removed one changes the count. */
+#define SETTING_INDEX(name, ...) SETTING_INDEX_##name,
+enum { CLI_SETTINGS(SETTING_INDEX, SETTING_INDEX, SETTING_INDEX, SETTING_INDEX) };
+#define CHECK_INDEX(name, ...) \
+  _Static_assert(SETTING_INDEX_##name == CLI_SETTINGS_INDEX_##name, "Settings changed, run tools/settings_gen");
+
+CLI_SETTINGS(CHECK_INDEX, CHECK_INDEX, CHECK_INDEX, CHECK_INDEX)
+
+_Static_assert(ARRAYLEN(value_table) == CLI_SETTINGS_COUNT, "Settings changed, run tools/settings_gen");
+
+const uint8_t settings_hash_slots[1U << CLI_SETTINGS_HASH_BITS] = CLI_SETTINGS_HASH_SLOTS;
 
 const uint16_t value_table_entry_count = ARRAYLEN(value_table);
@@ -64,6 +64,11 @@ typedef struct cli_minmax_unsigned_config {
   const uint16_t max;
 } cli_minmax_unsigned_config_t;
 
+typedef struct cli_minmax_u32_config {
+  const uint32_t min;
+  const uint32_t max;
+} cli_minmax_u32_config_t;
+
 typedef struct cli_lookup_table_config {
   const lookup_table_index_e table_index;
 } cli_lookup_table_config_t;
@@ -88,7 +93,7 @@ typedef union {
   cli_array_length_config_t array;               // used for MODE_ARRAY
   cli_string_length_config_t string;             // used for MODE_STRING
   uint8_t bitpos;                                // used for MODE_BITSET
-  uint32_t u32_max;                              // used for MODE_DIRECT with VAR_UINT32
+  cli_minmax_u32_config_t minmax_u32;            // used for MODE_DIRECT with VAR_UINT32
 } cli_value_config_t;
 
 typedef struct cli_value {
@@ -102,3 +107,6 @@ extern const lookup_table_entry_t lookup_tables[];
 extern const uint16_t value_table_entry_count;
 
 extern const cli_value_t value_table[];
+
+/* Perfect hash of the setting names, see cli/settings_schema.h */
+extern const uint8_t settings_hash_slots[];
@@ -0,0 +1,71 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Generated by tools/settings_gen from cli/settings_schema.h, do not edit.
+ */
+
+#pragma once
+
+#define CLI_SETTINGS_COUNT     33
+#define CLI_SETTINGS_HASH_SEED 0x000088D0U
+#define CLI_SETTINGS_HASH_BITS 6
+
+/* value_table index + 1 of every slot, 0 if the slot is empty */
+// clang-format off
+#define CLI_SETTINGS_HASH_SLOTS \
+  {2, 8, 0, 0, 31, 7, 28, 0, 0, 0, 11, 0, 18, 0, 0, 4, \
+   0, 6, 0, 0, 33, 0, 16, 19, 9, 0, 0, 0, 0, 0, 30, 29, \
+   0, 0, 12, 27, 22, 0, 13, 17, 0, 0, 0, 32, 24, 0, 0, 0, \
+   0, 26, 1, 14, 23, 3, 15, 21, 25, 20, 10, 0, 0, 0, 0, 5}
+
+/* value_table index of every setting */
+#define CLI_SETTINGS_INDEX_boot_state 0
+#define CLI_SETTINGS_INDEX_main_altitude 1
+#define CLI_SETTINGS_INDEX_acc_threshhold 2
+#define CLI_SETTINGS_INDEX_mach_timer_duration 3
+#define CLI_SETTINGS_INDEX_timer1_start 4
+#define CLI_SETTINGS_INDEX_timer1_end 5
+#define CLI_SETTINGS_INDEX_timer1_duration 6
+#define CLI_SETTINGS_INDEX_timer2_start 7
+#define CLI_SETTINGS_INDEX_timer2_end 8
+#define CLI_SETTINGS_INDEX_timer2_duration 9
+#define CLI_SETTINGS_INDEX_timer3_start 10
+#define CLI_SETTINGS_INDEX_timer3_end 11
+#define CLI_SETTINGS_INDEX_timer3_duration 12
+#define CLI_SETTINGS_INDEX_timer4_start 13
+#define CLI_SETTINGS_INDEX_timer4_end 14
+#define CLI_SETTINGS_INDEX_timer4_duration 15
+#define CLI_SETTINGS_INDEX_ev_moving 16
+#define CLI_SETTINGS_INDEX_ev_ready 17
+#define CLI_SETTINGS_INDEX_ev_liftoff 18
+#define CLI_SETTINGS_INDEX_ev_burnout 19
+#define CLI_SETTINGS_INDEX_ev_apogee 20
+#define CLI_SETTINGS_INDEX_ev_lowalt 21
+#define CLI_SETTINGS_INDEX_ev_touchdown 22
+#define CLI_SETTINGS_INDEX_ev_custom1 23
+#define CLI_SETTINGS_INDEX_ev_custom2 24
+#define CLI_SETTINGS_INDEX_servo1_init_pos 25
+#define CLI_SETTINGS_INDEX_servo2_init_pos 26
+#define CLI_SETTINGS_INDEX_rec_history_duration 27
+#define CLI_SETTINGS_INDEX_rec_retention_size 28
+#define CLI_SETTINGS_INDEX_rec_sync_window 29
+#define CLI_SETTINGS_INDEX_rec_dec_ground 30
+#define CLI_SETTINGS_INDEX_rec_dec_ascent 31
+#define CLI_SETTINGS_INDEX_rec_dec_descent 32
+// clang-format on
@@ -0,0 +1,100 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Declarative list of the CLI settings, the only place where a setting of cats_config_t is made available to the CLI.
+ *
+ * It is turned into value_table in cli/settings.c, where the size of every member is checked against its value type,
+ * and tools/settings_gen builds the perfect hash for the name lookup from it (cli/settings_hash.h). The file only
+ * contains macros and the hash function so that it can be included without any firmware headers.
+ *
+ * CLI_SETTINGS(L, R, M, A) calls for each setting, in the order of value_table:
+ *   L(name, type, table, member)    a value shown as an entry of a lookup table (MODE_LOOKUP)
+ *   R(name, type, min, max, member) a value limited to [min, max]
+ *   M(name, min, max, member)       a VAR_UINT32 value limited to [min, max]
+ *   A(name, type, member)           an array, the length is taken from the member (MODE_ARRAY)
+ * where name is the setting name as an identifier, the CLI shows it stringized, and member is the path of the field
+ * inside cats_config_t.
+ *
+ * Adding, removing, renaming or moving a setting requires running tools/settings_gen to update cli/settings_hash.h;
+ * cli/settings.c checks the index of every name against it, so a stale hash doesn't compile.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+// clang-format off
+#define CLI_SETTINGS_TIMER(L, M, n)                                                                                    \
+  L(timer##n##_start, VAR_UINT8, TABLE_EVENTS, timers[n - 1].start_event)                                              \
+  L(timer##n##_end, VAR_UINT8, TABLE_EVENTS, timers[n - 1].end_event)                                                  \
+  M(timer##n##_duration, 0, 1200000, timers[n - 1].duration)
+
+#define CLI_SETTINGS(L, R, M, A)                                                                                       \
+  L(boot_state, VAR_UINT32, TABLE_BOOTSTATE, boot_state)                                                               \
+  /* Control */                                                                                                        \
+  R(main_altitude, VAR_UINT16, 10, 65535, control_settings.main_altitude)                                              \
+  R(acc_threshhold, VAR_UINT16, 1500, 8000, control_settings.liftoff_acc_threshold)                                    \
+  R(mach_timer_duration, VAR_UINT16, 0, 60000, control_settings.mach_timer_duration)                                   \
+  /* Timers */                                                                                                         \
+  CLI_SETTINGS_TIMER(L, M, 1)                                                                                          \
+  CLI_SETTINGS_TIMER(L, M, 2)                                                                                          \
+  CLI_SETTINGS_TIMER(L, M, 3)                                                                                          \
+  CLI_SETTINGS_TIMER(L, M, 4)                                                                                          \
+  /* Events */                                                                                                         \
+  A(ev_moving, VAR_INT16, action_array[EV_MOVING])                                                                     \
+  A(ev_ready, VAR_INT16, action_array[EV_READY])                                                                       \
+  A(ev_liftoff, VAR_INT16, action_array[EV_LIFTOFF])                                                                   \
+  A(ev_burnout, VAR_INT16, action_array[EV_MAX_V])                                                                     \
+  A(ev_apogee, VAR_INT16, action_array[EV_APOGEE])                                                                     \
+  A(ev_lowalt, VAR_INT16, action_array[EV_POST_APOGEE])                                                                \
+  A(ev_touchdown, VAR_INT16, action_array[EV_TOUCHDOWN])                                                               \
+  A(ev_custom1, VAR_INT16, action_array[EV_CUSTOM_1])                                                                  \
+  A(ev_custom2, VAR_INT16, action_array[EV_CUSTOM_2])                                                                  \
+  /* Servo position */                                                                                                 \
+  R(servo1_init_pos, VAR_INT16, 0, 180, initial_servo_position[0])                                                     \
+  R(servo2_init_pos, VAR_INT16, 0, 180, initial_servo_position[1])                                                     \
+  /* Recorder */                                                                                                       \
+  M(rec_history_duration, 0, 60000, rec_history_duration)                                                              \
+  M(rec_retention_size, 0, 16384, rec_retention_size)                                                                  \
+  M(rec_sync_window, 500, 60000, rec_sync_window)                                                                      \
+  A(rec_dec_ground, VAR_UINT8, rec_decimation[REC_PHASE_GROUND])                                                       \
+  A(rec_dec_ascent, VAR_UINT8, rec_decimation[REC_PHASE_ASCENT])                                                       \
+  A(rec_dec_descent, VAR_UINT8, rec_decimation[REC_PHASE_DESCENT])
+// clang-format on
+
+/**
+ * Case insensitive hash of a setting name (seeded FNV-1a with a final mix), the CLI compares the names without case.
+ *
+ * @param name - setting name, doesn't have to be zero terminated
+ * @param length - length of the name
+ * @param seed - CLI_SETTINGS_HASH_SEED
+ * @return hash; the upper CLI_SETTINGS_HASH_BITS bits select the slot
+ */
+static inline uint32_t cli_settings_hash(const char *name, uint32_t length, uint32_t seed) {
+  uint32_t hash = 2166136261U ^ seed;
+  for (uint32_t i = 0; i < length; ++i) {
+    const char c = name[i];
+    hash ^= (uint8_t)(c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c);
+    hash *= 16777619U;
+  }
+  hash ^= hash >> 16;
+  hash *= 0x7FEB352DU;
+  hash ^= hash >> 15;
+  return hash;
+}
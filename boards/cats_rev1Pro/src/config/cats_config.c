@@ -17,10 +17,30 @@
  */
 
 #include "config/cats_config.h"
+#include "config/config_store.h"
 #include "util/log.h"
+#include "util/crc32.h"
 #include "eeprom_emul.h"
 #include "util/actions.h"
 
+/* The config store takes the two pages right behind the EEPROM emulation, which is only read to take over the config
+ * of older firmware versions */
+#define CC_STORE_FIRST_PAGE (PAGE(END_EEPROM_ADDRESS) + 1U)
+
+static const uint8_t *cc_flash_map(uint32_t page);
+static bool cc_flash_erase(uint32_t page);
+static bool cc_flash_program(uint32_t page, uint32_t offset, const uint8_t *data, uint32_t len);
+static bool cc_migrate(uint16_t version, const uint8_t *data, uint16_t len);
+
+static const config_store_io_t cc_flash_io = {
+    .page_size = FLASH_PAGE_SIZE,
+    .map = cc_flash_map,
+    .erase = cc_flash_erase,
+    .program = cc_flash_program,
+};
+
+static config_store_t cc_store;
+
 const cats_config_u DEFAULT_CONFIG = {
     .config.boot_state = CATS_FLIGHT,
     .config.control_settings.main_altitude = 150,
@@ -45,64 +65,91 @@ const cats_config_u DEFAULT_CONFIG = {
     .config.action_array[EV_TOUCHDOWN][1] = REC_OFF,
     .config.initial_servo_position[0] = 0,
     .config.initial_servo_position[1] = 0,
+    .config.rec_history_duration = 0,
+    .config.rec_retention_size = 4096,
+    .config.rec_sync_window = 2000,
+    /* IMU, BARO, MAGNETO, ACCELEROMETER, FLIGHT_INFO, ORIENTATION_INFO, FILTERED_DATA_INFO, FLIGHT_STATE,
+     * COVARIANCE_INFO, SENSOR_INFO, EVENT_INFO, ERROR_INFO */
+    .config.rec_decimation[REC_PHASE_GROUND] = {1, 1, 10, 1, 1, 1, 1, 1, 1, 1, 1, 1},
+    .config.rec_decimation[REC_PHASE_ASCENT] = {1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1},
+    .config.rec_decimation[REC_PHASE_DESCENT] = {10, 2, 10, 10, 2, 10, 2, 1, 10, 1, 1, 1},
 };
 
 cats_config_u global_cats_config = {};
 
 /** cats config initialization **/
 
-void cc_init() {
-  HAL_FLASH_Unlock();
-  EE_Status ee_status = EE_Init(EE_FORCED_ERASE);
-  if ((ee_status & EE_STATUSMASK_CLEANUP) == EE_STATUSMASK_CLEANUP) EE_CleanUp();
-  osDelay(5);
-  HAL_FLASH_Lock();
-}
+void cc_init() { config_store_init(&cc_store, &cc_flash_io); }
 
 void cc_defaults() { memcpy(&global_cats_config, &DEFAULT_CONFIG, sizeof(global_cats_config)); }
 
 /** persistence functions **/
 
 void cc_load() {
-  for (int i = 0; i < sizeof(cats_config_t) / sizeof(uint32_t); i++) {
-    EE_ReadVariable32bits(i + 1, &global_cats_config.config_array[i]);
+  const uint8_t *data = NULL;
+  uint16_t version = 0;
+  uint16_t len = 0;
+  if (!config_store_load(&cc_store, &data, &version, &len)) {
+    if (cc_load_eeprom()) {
+      log_info("Config taken over from the EEPROM emulation");
+    } else {
+      log_warn("No config found, using the defaults");
+      cc_defaults();
+    }
+    /* the EEPROM emulation is only looked at once */
+    cc_save();
+    return;
+  }
+  if (version == CATS_CONFIG_VERSION && len == sizeof(cats_config_t)) {
+    memcpy(&global_cats_config, data, sizeof(cats_config_t));
+  } else if (!cc_migrate(version, data, len)) {
+    log_error("Config version %u is not supported, using the defaults", version);
+    cc_defaults();
   }
 }
 
-bool cc_format_save(){
+/* Older firmware stored every word of the config as a separate EEPROM emulation variable. EE_ReadVariable32bits()
+ * returns 0 for a variable which was never written, so only the words which were found are taken over: the fields an
+ * older firmware didn't know keep their defaults. Its cc_save() skipped the words which were 0, these are 0 in the
+ * defaults as well. */
+bool cc_load_eeprom() {
   HAL_FLASH_Unlock();
-  __HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_ALL_ERRORS);
-  EE_Status ee_status = EE_Format(EE_FORCED_ERASE);
+  EE_Status ee_status = EE_Init(EE_CONDITIONAL_ERASE);
   if ((ee_status & EE_STATUSMASK_CLEANUP) == EE_STATUSMASK_CLEANUP) EE_CleanUp();
-  return cc_save();
+  HAL_FLASH_Lock();
+  bool found = false;
+  if ((ee_status & EE_STATUSMASK_ERROR) == EE_OK) {
+    uint32_t first_word = 0;
+    found = EE_ReadVariable32bits(1, &first_word) == EE_OK;
+    if (found) {
+      cc_defaults();
+      for (uint32_t i = 0; i < sizeof(cats_config_t) / sizeof(uint32_t); i++) {
+        uint32_t word = 0;
+        if (EE_ReadVariable32bits(i + 1, &word) == EE_OK) {
+          global_cats_config.config_array[i] = word;
+        }
+      }
+    }
+  }
+  /* the EEPROM emulation configures the CRC peripheral for its own polynomial */
+  crc32_init();
+  return found;
+}
+
+bool cc_format_save() {
+  HAL_FLASH_Unlock();
+  __HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_ALL_ERRORS);
+  const bool formatted = config_store_format(&cc_store);
+  HAL_FLASH_Lock();
+  return formatted && cc_save();
 }
 
 bool cc_save() {
   HAL_FLASH_Unlock();
   __HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_ALL_ERRORS);
-  // loop through all elements of the config
-  for (int i = 0; i < sizeof(cats_config_t) / sizeof(uint32_t); i++) {
-    uint32_t tmp;
-    EE_ReadVariable32bits(i + 1, &tmp);
-    // Compare the value from ram to the value from flash
-    if (tmp != global_cats_config.config_array[i]) {
-      // If different override the value in flash
-      EE_Status ee_status;
-      int errors = 0;
-      do {
-        ee_status = EE_WriteVariable32bits(i + 1, global_cats_config.config_array[i]);
-        errors++;
-      } while((ee_status & EE_STATUSMASK_ERROR) == EE_STATUSMASK_ERROR && errors < 5);
-      if ((ee_status & EE_STATUSMASK_CLEANUP) == EE_STATUSMASK_CLEANUP) EE_CleanUp();
-      // If writing failed 5 times, stop and return an error
-      if (errors == 5) {
-        HAL_FLASH_Lock();
-        return false;
-      }
-    }
-  }
+  const bool saved = config_store_save(&cc_store, &global_cats_config, CATS_CONFIG_VERSION, sizeof(cats_config_t));
   HAL_FLASH_Lock();
-  return true;
+  return saved;
 }
 
 /**
@@ -149,3 +196,44 @@ void cc_print() {
                                             "CATS_TIMER",   "CATS_DROP", "CATS_FLIGHT"};
   log_info("Boot State: %s", BOOT_STATE_STRING[global_cats_config.config.boot_state]);
 }
+
+/** config store functions **/
+
+static const uint8_t *cc_flash_map(uint32_t page) {
+  return (const uint8_t *)(FLASH_BASE + (CC_STORE_FIRST_PAGE + page) * FLASH_PAGE_SIZE);
+}
+
+static bool cc_flash_erase(uint32_t page) {
+  FLASH_EraseInitTypeDef erase_init = {
+      .TypeErase = FLASH_TYPEERASE_PAGES, .Banks = FLASH_BANK_1, .Page = CC_STORE_FIRST_PAGE + page, .NbPages = 1};
+  uint32_t page_error = 0;
+  return HAL_FLASHEx_Erase(&erase_init, &page_error) == HAL_OK;
+}
+
+static bool cc_flash_program(uint32_t page, uint32_t offset, const uint8_t *data, uint32_t len) {
+  const uint32_t addr = FLASH_BASE + (CC_STORE_FIRST_PAGE + page) * FLASH_PAGE_SIZE + offset;
+  for (uint32_t i = 0; i < len; i += sizeof(uint64_t)) {
+    uint64_t double_word;
+    memcpy(&double_word, &data[i], sizeof(double_word));
+    if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_DOUBLEWORD, addr + i, double_word) != HAL_OK) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* Fields are only ever appended to cats_config_t: an older config is taken over as far as it goes and the new fields
+ * keep their defaults. A version which changes existing fields adds a case which converts them from the previous
+ * version and falls through to the next one. */
+static bool cc_migrate(uint16_t version, const uint8_t *data, uint16_t len) {
+  if (version == 0 || version > CATS_CONFIG_VERSION) {
+    return false;
+  }
+  cc_defaults();
+  memcpy(&global_cats_config, data, len < sizeof(cats_config_t) ? len : sizeof(cats_config_t));
+  switch (version) {
+    default:
+      break;
+  }
+  return true;
+}
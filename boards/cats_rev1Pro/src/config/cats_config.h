@@ -21,6 +21,12 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "util/types.h"
+#include "util/recorder.h"
+
+/* Exported defines */
+
+/* Schema version of cats_config_t, has to be increased whenever it changes; see cc_migrate() in cats_config.c */
+#define CATS_CONFIG_VERSION 1
 
 /* Exported types */
 
@@ -47,6 +53,20 @@ typedef struct {
   // Event action map
   int16_t action_array[NUM_EVENTS][16]; // 8 (16/2) actions for each event
   int16_t initial_servo_position[2];
+
+  /* Pre-launch history kept by the recorder in milliseconds; limited to what fits into the history buffer at the ground
+   * decimation (see rec_get_history_duration()), 0 keeps as much as fits */
+  uint32_t rec_history_duration;
+  /* Expected size of a flight in KiB; the oldest flights are deleted until this much is free for the next one, 0
+   * keeps all flights until the flash is full */
+  uint32_t rec_retention_size;
+  /* Longest time in ms a record may take until it is committed to the flash during the ascent; on the pad and under
+   * the parachutes a quarter of it, see tasks/task_recorder.c. At least 500 ms: a commit is due after half of the
+   * window, a smaller one commits nearly empty blocks every few ten ms on the pad. */
+  uint32_t rec_sync_window;
+  /* Only every n-th record is logged; per phase group and record type index, 0 and 1 log every record. Records in the
+   * event lane (flight state, events and errors) are never decimated. */
+  uint8_t rec_decimation[NUM_REC_PHASES][NUM_REC_TYPES];
 } cats_config_t;
 
 typedef union {
@@ -62,6 +82,8 @@ void cc_defaults();
 
 /** persistence functions **/
 void cc_load();
+/* Takes over the config of an older firmware from the EEPROM emulation, false if there is none; used by cc_load() */
+bool cc_load_eeprom();
 bool cc_save();
 bool cc_format_save();
 
@@ -0,0 +1,148 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "config/config_store.h"
+#include "util/crc32.h"
+
+#include <stddef.h>
+#include <string.h>
+
+_Static_assert(sizeof(config_store_header_t) % CONFIG_STORE_PROGRAM_SIZE == 0,
+               "The payload has to start at a double word boundary");
+_Static_assert(CONFIG_STORE_NUM_PAGES == 2, "Only A/B is supported");
+
+/** Private Function Declarations **/
+
+static bool is_header_valid(const config_store_t *store, uint32_t page);
+static bool is_data_valid(const config_store_t *store, uint32_t page);
+static bool is_newer(uint32_t seq, uint32_t other_seq);
+static uint32_t header_crc(const config_store_header_t *header);
+
+/** Exported Function Definitions **/
+
+void config_store_init(config_store_t *store, const config_store_io_t *io) {
+  store->io = io;
+  store->current = -1;
+  store->seq = 0;
+  const config_store_header_t *headers[CONFIG_STORE_NUM_PAGES] = {(const config_store_header_t *)io->map(0),
+                                                                  (const config_store_header_t *)io->map(1)};
+  const bool header_ok[CONFIG_STORE_NUM_PAGES] = {is_header_valid(store, 0), is_header_valid(store, 1)};
+  /* the payload of the older copy is only checked if the newer one is corrupted */
+  const uint32_t newer = header_ok[1] && (!header_ok[0] || is_newer(headers[1]->seq, headers[0]->seq)) ? 1 : 0;
+  const uint32_t order[CONFIG_STORE_NUM_PAGES] = {newer, 1 - newer};
+  for (uint32_t i = 0; i < CONFIG_STORE_NUM_PAGES; ++i) {
+    const uint32_t page = order[i];
+    if (header_ok[page] && is_data_valid(store, page)) {
+      store->current = (int32_t)page;
+      store->seq = headers[page]->seq;
+      return;
+    }
+  }
+}
+
+bool config_store_load(const config_store_t *store, const uint8_t **data, uint16_t *version, uint16_t *len) {
+  if (store->current < 0) {
+    return false;
+  }
+  const uint8_t *page = store->io->map((uint32_t)store->current);
+  const config_store_header_t *header = (const config_store_header_t *)page;
+  *data = page + sizeof(config_store_header_t);
+  *version = header->version;
+  *len = header->len;
+  return true;
+}
+
+bool config_store_save(config_store_t *store, const void *data, uint16_t version, uint16_t len) {
+  const config_store_io_t *io = store->io;
+  if (sizeof(config_store_header_t) + len > io->page_size) {
+    return false;
+  }
+  if (store->current >= 0) {
+    const config_store_header_t *current = (const config_store_header_t *)io->map((uint32_t)store->current);
+    /* spare the flash if nothing changed */
+    if (current->version == version && current->len == len &&
+        memcmp((const uint8_t *)current + sizeof(config_store_header_t), data, len) == 0) {
+      return true;
+    }
+  }
+
+  const uint32_t page = store->current == 0 ? 1 : 0;
+  if (!io->erase(page)) {
+    return false;
+  }
+
+  /* payload first; the header is only programmed once the payload is complete */
+  const uint32_t aligned_len = len / CONFIG_STORE_PROGRAM_SIZE * CONFIG_STORE_PROGRAM_SIZE;
+  if (aligned_len > 0 && !io->program(page, sizeof(config_store_header_t), data, aligned_len)) {
+    return false;
+  }
+  if (aligned_len < len) {
+    uint8_t tail[CONFIG_STORE_PROGRAM_SIZE];
+    memset(tail, 0xFF, sizeof(tail));
+    memcpy(tail, (const uint8_t *)data + aligned_len, len - aligned_len);
+    if (!io->program(page, sizeof(config_store_header_t) + aligned_len, tail, sizeof(tail))) {
+      return false;
+    }
+  }
+
+  config_store_header_t header = {.magic = CONFIG_STORE_MAGIC,
+                                  .seq = store->current >= 0 ? store->seq + 1 : 0,
+                                  .version = version,
+                                  .len = len,
+                                  .data_crc = crc32_compute(data, len),
+                                  .reserved = 0};
+  header.header_crc = header_crc(&header);
+  if (!io->program(page, 0, (const uint8_t *)&header, sizeof(header)) || !is_header_valid(store, page) ||
+      !is_data_valid(store, page)) {
+    return false;
+  }
+  store->current = (int32_t)page;
+  store->seq = header.seq;
+  return true;
+}
+
+bool config_store_format(config_store_t *store) {
+  bool ok = true;
+  for (uint32_t page = 0; page < CONFIG_STORE_NUM_PAGES; ++page) {
+    ok = store->io->erase(page) && ok;
+  }
+  store->current = -1;
+  store->seq = 0;
+  return ok;
+}
+
+/** Private Function Definitions **/
+
+static bool is_header_valid(const config_store_t *store, uint32_t page) {
+  const config_store_header_t *header = (const config_store_header_t *)store->io->map(page);
+  return header->magic == CONFIG_STORE_MAGIC && header->header_crc == header_crc(header) &&
+         sizeof(config_store_header_t) + header->len <= store->io->page_size;
+}
+
+static bool is_data_valid(const config_store_t *store, uint32_t page) {
+  const uint8_t *content = store->io->map(page);
+  const config_store_header_t *header = (const config_store_header_t *)content;
+  return crc32_compute(content + sizeof(config_store_header_t), header->len) == header->data_crc;
+}
+
+/* The sequence number may wrap around */
+static bool is_newer(uint32_t seq, uint32_t other_seq) { return (int32_t)(seq - other_seq) > 0; }
+
+static uint32_t header_crc(const config_store_header_t *header) {
+  return crc32_compute(header, offsetof(config_store_header_t, header_crc));
+}
@@ -0,0 +1,110 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Versioned storage of a configuration blob in two internal flash pages.
+ *
+ * Every save writes the whole blob with a header into the page which does not hold the newest copy, the other page
+ * keeps the previous copy until the next save (A/B). The payload is programmed before the header and the header
+ * carries its own CRC, so a save which is interrupted by a reset leaves a copy which fails the check and the previous
+ * one is loaded instead. Loading only checks the two headers and the CRC of the newer copy, the payload is read
+ * directly from the memory-mapped flash.
+ *
+ * The store only knows the schema version and the length of the payload, converting older versions is up to the
+ * caller (see config/cats_config.c). The flash is accessed through config_store_io_t so the same code runs on the
+ * host on top of a RAM page mock.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Exported Defines **/
+
+#define CONFIG_STORE_MAGIC     0xCA75C0F1U
+#define CONFIG_STORE_NUM_PAGES 2
+/* The flash is programmed in double words */
+#define CONFIG_STORE_PROGRAM_SIZE 8
+
+/** Exported Types **/
+
+typedef struct {
+  uint32_t magic;      /* CONFIG_STORE_MAGIC */
+  uint32_t seq;        /* increased with every save, the copy with the higher number is the newer one */
+  uint16_t version;    /* schema version of the payload */
+  uint16_t len;        /* number of payload bytes following the header */
+  uint32_t data_crc;   /* CRC32 of the payload */
+  uint32_t reserved;   /* 0 */
+  uint32_t header_crc; /* CRC32 of the header up to this field */
+} config_store_header_t;
+
+typedef struct {
+  uint32_t page_size;
+  /* content of a page, read directly */
+  const uint8_t *(*map)(uint32_t page);
+  bool (*erase)(uint32_t page);
+  /* len and offset are multiples of CONFIG_STORE_PROGRAM_SIZE */
+  bool (*program)(uint32_t page, uint32_t offset, const uint8_t *data, uint32_t len);
+} config_store_io_t;
+
+typedef struct {
+  const config_store_io_t *io;
+  int32_t current; /* page of the newest valid copy, -1 if there is none */
+  uint32_t seq;    /* sequence number of the newest valid copy */
+} config_store_t;
+
+/** Exported Functions **/
+
+/**
+ * Find the newest valid copy.
+ *
+ * @param store - store to initialize
+ * @param io - flash access
+ */
+void config_store_init(config_store_t *store, const config_store_io_t *io);
+
+/**
+ * Get the newest valid copy.
+ *
+ * @param store - store
+ * @param data[out] - payload, points into the flash and is valid until the next save
+ * @param version[out] - schema version of the payload
+ * @param len[out] - length of the payload in bytes
+ * @return false if there is no valid copy
+ */
+bool config_store_load(const config_store_t *store, const uint8_t **data, uint16_t *version, uint16_t *len);
+
+/**
+ * Write a new copy into the other page. Nothing is written if the newest copy is identical.
+ *
+ * @param store - store
+ * @param data - payload
+ * @param version - schema version of the payload
+ * @param len - length of the payload in bytes; has to fit into a page together with the header
+ * @return false if writing failed, the previous copy is still valid in this case
+ */
+bool config_store_save(config_store_t *store, const void *data, uint16_t version, uint16_t len);
+
+/**
+ * Erase both pages.
+ *
+ * @param store - store
+ * @return false if erasing failed
+ */
+bool config_store_format(config_store_t *store);
@@ -38,6 +38,14 @@
 #undef USE_ORIENTATION_KF
 #endif
 
+/* Run the altitude Kalman filter on the generic arm_math matrix functions instead of the fixed size kernels of
+ * control/kalman_kernels.h, e.g. for comparing the two */
+//#define KALMAN_USE_ARM_MATH
+
+/* Use precomputed steady state gains in the altitude Kalman filter once the full filter converged to them, see
+ * control/kalman_steady_state.h */
+//#define USE_KALMAN_STEADY_STATE
+
 #define USE_MEDIAN_FILTER
 #define MEDIAN_FILTER_SIZE 9
 
@@ -131,8 +131,20 @@ cats_timer_t ev_timers[NUM_TIMERS] = {};
 cats_timer_t mach_timer = {};
 
 /** Recorder Queue **/
-osMessageQueueId_t rec_queue;
+static uint8_t rec_lane_imu_buffer[REC_LANE_IMU_SIZE];
+static uint8_t rec_lane_baro_buffer[REC_LANE_BARO_SIZE];
+static uint8_t rec_lane_state_est_buffer[REC_LANE_STATE_EST_SIZE];
+static uint8_t rec_lane_event_buffer[REC_LANE_EVENT_SIZE];
+
+rec_ring_t rec_lanes[NUM_REC_LANES] = {
+    [REC_LANE_IMU] = {.data = rec_lane_imu_buffer, .size = REC_LANE_IMU_SIZE},
+    [REC_LANE_BARO] = {.data = rec_lane_baro_buffer, .size = REC_LANE_BARO_SIZE},
+    [REC_LANE_STATE_EST] = {.data = rec_lane_state_est_buffer, .size = REC_LANE_STATE_EST_SIZE},
+    [REC_LANE_EVENT] = {.data = rec_lane_event_buffer, .size = REC_LANE_EVENT_SIZE},
+};
 osMessageQueueId_t rec_cmd_queue;
+osMessageQueueId_t rec_buf_free_queue;
+osMessageQueueId_t rec_buf_full_queue;
 osMessageQueueId_t event_queue;
 
 /** Tracing Channels **/
@@ -86,8 +86,10 @@ extern cats_timer_t ev_timers[NUM_TIMERS];
 extern cats_timer_t mach_timer;
 
 /** Recorder Queue **/
-extern osMessageQueueId_t rec_queue;
+extern rec_ring_t rec_lanes[NUM_REC_LANES];
 extern osMessageQueueId_t rec_cmd_queue;
+extern osMessageQueueId_t rec_buf_free_queue;
+extern osMessageQueueId_t rec_buf_full_queue;
 extern osMessageQueueId_t event_queue;
 
 /** Tracing Channels **/
@@ -17,9 +17,17 @@
  */
 
 #include "control/kalman_filter.h"
+#include "control/kalman_kernels.h"
 #include "cmsis_os.h"
+#include <math.h>
 #include <string.h>
 
+/* After apogee the acceleration input is 0, the offset state takes up the drag of the parachutes */
+const float32_t kalman_process_noise[KALMAN_NUM_PHASES][4] = {
+    [KALMAN_PHASE_ASCENT] = {STD_NOISE_IMU, 0, 0, STD_NOISE_OFFSET},
+    [KALMAN_PHASE_DESCENT] = {0, 0, 0, STD_NOISE_OFFSET_DESCENT},
+};
+
 void init_filter_struct(kalman_filter_t *const filter) {
   arm_mat_init_f32(&filter->Ad, 3, 3, filter->Ad_data);
   arm_mat_init_f32(&filter->Ad_T, 3, 3, filter->Ad_T_data);
@@ -32,7 +40,7 @@ void init_filter_struct(kalman_filter_t *const filter) {
   arm_mat_init_f32(&filter->H_eliminated, 2, 3, filter->H_eliminated_data);
   arm_mat_init_f32(&filter->H_eliminated_T, 3, 2, filter->H_eliminated_T_data);
   arm_mat_init_f32(&filter->H_2_eliminated, 1, 3, filter->H_2_eliminated_data);
-  arm_mat_init_f32(&filter->H_2_eliminated_T, 1, 2, filter->H_2_eliminated_T_data);
+  arm_mat_init_f32(&filter->H_2_eliminated_T, 3, 1, filter->H_2_eliminated_T_data);
   arm_mat_init_f32(&filter->R_full, 3, 3, filter->R_full_data);
   arm_mat_init_f32(&filter->R_eliminated, 2, 2, filter->R_eliminated_data);
   arm_mat_init_f32(&filter->R_2_eliminated, 1, 1, filter->R_2_eliminated_data);
@@ -166,11 +174,14 @@ void initialize_matrices(kalman_filter_t *const filter) {
   memcpy(filter->H_full_T_data, H_full_T, sizeof(H_full_T));
   memcpy(filter->H_eliminated_data, H_eliminated, sizeof(H_eliminated));
   memcpy(filter->H_eliminated_T_data, H_eliminated_T, sizeof(H_eliminated_T));
+  memcpy(filter->H_2_eliminated_data, H_2_eliminated, sizeof(H_2_eliminated));
+  memcpy(filter->H_2_eliminated_T_data, H_2_eliminated_T, sizeof(H_2_eliminated_T));
   memcpy(filter->R_full_data, R_full, sizeof(R_full));
   memcpy(filter->R_eliminated_data, R_eliminated, sizeof(R_eliminated));
   memcpy(filter->R_2_eliminated_data, R_2_eliminated, sizeof(R_2_eliminated));
   memcpy(filter->K_eliminated_data, K_eliminated, sizeof(K_eliminated));
   memcpy(filter->K_full_data, K_full, sizeof(K_full));
+  memcpy(filter->K_2_eliminated_data, K_2_eliminated, sizeof(K_2_eliminated));
   memcpy(filter->x_bar_data, x_bar, sizeof(x_bar));
   memcpy(filter->x_hat_data, x_hat, sizeof(x_hat));
 }
@@ -185,36 +196,42 @@ void reset_kalman(kalman_filter_t *filter, float initial_pressure) {
   memcpy(filter->P_hat_data, P_dash, sizeof(P_dash));
   memcpy(filter->x_bar_data, x_dash, sizeof(x_dash));
   memcpy(filter->x_bar_data, x_dash, sizeof(x_dash));
+  kalman_set_phase(filter, KALMAN_PHASE_ASCENT);
 }
 
-/* This Function Implements the kalman Prediction as long as more than 0 IMU
- * work */
-void kalman_prediction(kalman_filter_t *filter, state_estimation_data_t *data, sensor_elimination_t *elimination,
-                       flight_fsm_e fsm_state) {
-  float u = 0;
-  float32_t holder[9];
-  arm_matrix_instance_f32 holder_mat;
-  arm_mat_init_f32(&holder_mat, 3, 3, holder);
+void kalman_set_phase(kalman_filter_t *filter, kalman_phase_e phase) {
+  memcpy(filter->Q_data, kalman_process_noise[phase], sizeof(filter->Q_data));
 
-  float32_t holder2[9];
-  arm_matrix_instance_f32 holder2_mat;
-  arm_mat_init_f32(&holder2_mat, 3, 3, holder2);
+  /* GdQGd_T = Gd*Q*Gd' */
+  float32_t Gd_T[6];
+  arm_matrix_instance_f32 Gd_T_mat;
+  arm_mat_init_f32(&Gd_T_mat, 2, 3, Gd_T);
+  arm_mat_trans_f32(&filter->Gd, &Gd_T_mat);
 
-  float32_t holder_data[3];
-  arm_matrix_instance_f32 holder_vec;
-  arm_mat_init_f32(&holder_vec, 3, 1, holder_data);
+  float32_t holder[6];
+  arm_matrix_instance_f32 holder_mat;
+  arm_mat_init_f32(&holder_mat, 3, 2, holder);
 
-  float32_t holder2_data[3];
-  arm_matrix_instance_f32 holder2_vec;
-  arm_mat_init_f32(&holder2_vec, 3, 1, holder2_data);
+  arm_mat_mult_f32(&filter->Gd, &filter->Q, &holder_mat);
+  arm_mat_mult_f32(&holder_mat, &Gd_T_mat, &filter->GdQGd_T);
 
-  /* Prediction Step */
+  filter->phase = phase;
+  filter->steady_state = false;
+}
 
-  /* Average Acceleration */
+void kalman_enable_steady_state(kalman_filter_t *filter, const kalman_gains_t *gains) {
+  filter->gains = gains;
+  filter->steady_state = false;
+}
+
+/* Average acceleration of the working accelerometers, false if there is none */
+static bool get_acceleration_input(const state_estimation_data_t *data, const sensor_elimination_t *elimination,
+                                   flight_fsm_e fsm_state, float *u) {
+  float acc = 0;
   int counter_acc = 0;
   /* check if we are in high acceleration mode */
   if (elimination->high_acc) {
-    u = data->acceleration[HIGH_G_ACC_INDEX];
+    acc = data->acceleration[HIGH_G_ACC_INDEX];
     counter_acc++;
   } else {
     /* Check if we have ruled out an accelerometer */
@@ -222,7 +239,7 @@ void kalman_prediction(kalman_filter_t *filter, state_estimation_data_t *data, s
     if (elimination->num_faulty_accel == (NUM_ACC - 1)) {
       for (int i = 0; i < NUM_ACC; i++) {
         if (elimination->faulty_accel[i] == 0) {
-          u += data->acceleration[i];
+          acc += data->acceleration[i];
           counter_acc++;
         }
       }
@@ -231,22 +248,57 @@ void kalman_prediction(kalman_filter_t *filter, state_estimation_data_t *data, s
     else {
       for (int i = 0; i < NUM_ACC; i++) {
         if ((elimination->faulty_accel[i] == 0) && (i != HIGH_G_ACC_INDEX)) {
-          u += data->acceleration[i];
+          acc += data->acceleration[i];
           counter_acc++;
         }
       }
     }
   }
-  if(counter_acc == 0){
-      return;
+  if (counter_acc == 0) {
+    return false;
   }
 
   if (fsm_state > APOGEE) {
-    u = 0;
+    *u = 0;
   } else {
-    u /= (float)(counter_acc);
+    *u = acc / (float)(counter_acc);
+  }
+  return true;
+}
+
+/* This Function Implements the kalman Prediction as long as more than 0 IMU
+ * work */
+void kalman_prediction(kalman_filter_t *filter, state_estimation_data_t *data, sensor_elimination_t *elimination,
+                       flight_fsm_e fsm_state) {
+  float u = 0;
+
+  /* Prediction Step */
+
+  /* Average Acceleration */
+  if (!get_acceleration_input(data, elimination, fsm_state, &u)) {
+    return;
   }
 
+#ifndef KALMAN_USE_ARM_MATH
+  kk_predict_state(filter->Ad_data, filter->Bd_data, filter->x_bar_data, (float32_t)(u), filter->x_hat_data);
+  kk_predict_cov(filter->Ad_data, filter->P_bar_data, filter->GdQGd_T_data, filter->P_hat_data);
+#else
+  float32_t holder[9];
+  arm_matrix_instance_f32 holder_mat;
+  arm_mat_init_f32(&holder_mat, 3, 3, holder);
+
+  float32_t holder2[9];
+  arm_matrix_instance_f32 holder2_mat;
+  arm_mat_init_f32(&holder2_mat, 3, 3, holder2);
+
+  float32_t holder_data[3];
+  arm_matrix_instance_f32 holder_vec;
+  arm_mat_init_f32(&holder_vec, 3, 1, holder_data);
+
+  float32_t holder2_data[3];
+  arm_matrix_instance_f32 holder2_vec;
+  arm_mat_init_f32(&holder2_vec, 3, 1, holder2_data);
+
   /* Calculate Prediction of the state: x_hat = A*x_bar + B*u */
   arm_mat_mult_f32(&filter->Ad, &filter->x_bar, &holder_vec);
   arm_mat_scale_f32(&filter->Bd, (float32_t)(u), &holder2_vec);
@@ -256,12 +308,34 @@ void kalman_prediction(kalman_filter_t *filter, state_estimation_data_t *data, s
   arm_mat_mult_f32(&filter->Ad, &filter->P_bar, &holder_mat);
   arm_mat_mult_f32(&holder_mat, &filter->Ad_T, &holder2_mat);
   arm_mat_add_f32(&holder2_mat, &filter->GdQGd_T, &filter->P_hat);
+#endif
 
   /* Prediction Step finished */
 }
 
+#ifndef KALMAN_USE_ARM_MATH
+/* If the innovation covariance of a kernel update is singular the outputs are not written, keep the prediction as the
+ * estimate in that case */
+static cats_error_e finish_kernel_update(bool updated, kalman_filter_t *filter) {
+  if (!updated) {
+    memcpy(filter->x_bar_data, filter->x_hat_data, sizeof(filter->x_bar_data));
+    memcpy(filter->P_bar_data, filter->P_hat_data, sizeof(filter->P_bar_data));
+    return CATS_ERR_FILTER;
+  }
+  return CATS_ERR_OK;
+}
+#endif
+
 /* This function implements the Kalman update when no Barometer is faulty */
 cats_error_e kalman_update_full(kalman_filter_t *filter, state_estimation_data_t *data) {
+#ifndef KALMAN_USE_ARM_MATH
+  const float32_t z[3] = {(float32_t)data->calculated_AGL[0], (float32_t)data->calculated_AGL[1],
+                          (float32_t)data->calculated_AGL[2]};
+  return finish_kernel_update(kk_update_3(filter->H_full_data, filter->R_full_data, filter->P_hat_data,
+                                          filter->x_hat_data, z, filter->K_full_data, filter->x_bar_data,
+                                          filter->P_bar_data),
+                              filter);
+#else
   float32_t holder[9];
   arm_matrix_instance_f32 holder_mat;
   arm_mat_init_f32(&holder_mat, 3, 3, holder);
@@ -325,11 +399,26 @@ cats_error_e kalman_update_full(kalman_filter_t *filter, state_estimation_data_t
   /* Finished Calculating P_bar */
 
   return status;
+#endif
 }
 
 /* This function implements the Kalman update when one Barometer is faulty */
 cats_error_e kalman_update_eliminated(kalman_filter_t *filter, state_estimation_data_t *data,
                                       sensor_elimination_t *elimination) {
+#ifndef KALMAN_USE_ARM_MATH
+  float32_t z[2] = {0, 0};
+  uint8_t counter = 0;
+  for (int i = 0; i < 3 && counter < 2; i++) {
+    if (elimination->faulty_baro[i] == 0) {
+      z[counter] = (float32_t)data->calculated_AGL[i];
+      counter++;
+    }
+  }
+  return finish_kernel_update(kk_update_2(filter->H_eliminated_data, filter->R_eliminated_data, filter->P_hat_data,
+                                          filter->x_hat_data, z, filter->K_eliminated_data, filter->x_bar_data,
+                                          filter->P_bar_data),
+                              filter);
+#else
   /* Placeholder Matrices */
 
   float32_t holder_0_3x3[9];
@@ -420,11 +509,24 @@ cats_error_e kalman_update_eliminated(kalman_filter_t *filter, state_estimation_
   arm_mat_mult_f32(&holder_1_3x3_mat, &filter->P_hat, &filter->P_bar);
 
   return status;
+#endif
 }
 
 /* This function implements the Kalman update when one Barometer is faulty */
 cats_error_e kalman_update_2_eliminated(kalman_filter_t *filter, state_estimation_data_t *data,
                                         sensor_elimination_t *elimination) {
+#ifndef KALMAN_USE_ARM_MATH
+  float32_t z = 0;
+  for (int i = 0; i < 3; i++) {
+    if (elimination->faulty_baro[i] == 0) {
+      z = (float32_t)data->calculated_AGL[i];
+    }
+  }
+  return finish_kernel_update(kk_update_1(filter->H_2_eliminated_data, filter->R_2_eliminated_data[0],
+                                          filter->P_hat_data, filter->x_hat_data, z, filter->K_2_eliminated_data,
+                                          filter->x_bar_data, filter->P_bar_data),
+                              filter);
+#else
   /* Placeholder Matrices */
 
   float32_t holder_0_3x3[9];
@@ -513,12 +615,95 @@ cats_error_e kalman_update_2_eliminated(kalman_filter_t *filter, state_estimatio
   arm_mat_mult_f32(&holder_1_3x3_mat, &filter->P_hat, &filter->P_bar);
 
   return status;
+#endif
+}
+
+/* Decide whether the cached gain is used in this step. After every reset or change of the configuration the full
+ * filter runs until check_gain_convergence() switches over. */
+static bool use_steady_state(kalman_filter_t *filter, uint32_t num_baros) {
+  if (filter->gains == NULL || num_baros == 0 || num_baros > NUM_PRESSURE) {
+    return false;
+  }
+  if (num_baros != filter->num_baros) {
+    filter->num_baros = num_baros;
+    filter->steady_state = false;
+  }
+  return filter->steady_state;
+}
+
+/* Switch to the cached gain once the gain and the covariance of the full update are both within
+ * KALMAN_STEADY_STATE_TOLERANCE of the steady state. The gain alone isn't enough: after a large change of Q it can
+ * overshoot and pass through the tolerance on its way to the steady state. The filter continues from the steady state
+ * covariance so that the full filter can take over again after the next change. */
+static void check_gain_convergence(kalman_filter_t *filter, uint32_t num_baros) {
+  if (filter->gains == NULL || num_baros == 0 || num_baros > NUM_PRESSURE ||
+      !filter->gains->valid[filter->phase][num_baros - 1]) {
+    return;
+  }
+  const float32_t *K = filter->K_full_data;
+  if (num_baros == 2) {
+    K = filter->K_eliminated_data;
+  } else if (num_baros == 1) {
+    K = filter->K_2_eliminated_data;
+  }
+  const float32_t *K_ref = filter->gains->K[filter->phase][num_baros - 1];
+  float32_t scale = 0;
+  float32_t diff = 0;
+  for (uint32_t i = 0; i < 3 * num_baros; i++) {
+    scale = fmaxf(scale, fabsf(K_ref[i]));
+    diff = fmaxf(diff, fabsf(K[i] - K_ref[i]));
+  }
+  const float32_t *P_ref = filter->gains->P_bar[filter->phase][num_baros - 1];
+  float32_t P_scale = 0;
+  float32_t P_diff = 0;
+  for (uint32_t i = 0; i < 9; i++) {
+    P_scale = fmaxf(P_scale, fabsf(P_ref[i]));
+    P_diff = fmaxf(P_diff, fabsf(filter->P_bar_data[i] - P_ref[i]));
+  }
+  if (diff <= KALMAN_STEADY_STATE_TOLERANCE * scale && P_diff <= KALMAN_STEADY_STATE_TOLERANCE * P_scale) {
+    memcpy(filter->P_bar_data, filter->gains->P_bar[filter->phase][num_baros - 1], sizeof(filter->P_bar_data));
+    filter->steady_state = true;
+  }
+}
+
+/* Prediction of the state and update with the cached gain, the covariances are left as they are */
+static cats_error_e kalman_steady_state_step(kalman_filter_t *filter, const state_estimation_data_t *data,
+                                             const sensor_elimination_t *elimination, flight_fsm_e fsm_state,
+                                             uint32_t num_baros) {
+  float u = 0;
+  if (get_acceleration_input(data, elimination, fsm_state, &u)) {
+    kk_predict_state(filter->Ad_data, filter->Bd_data, filter->x_bar_data, (float32_t)(u), filter->x_hat_data);
+  }
+
+  /* same order of the measurements as in the update functions */
+  float32_t z[NUM_PRESSURE];
+  uint32_t counter = 0;
+  for (int i = 0; i < NUM_PRESSURE && counter < num_baros; i++) {
+    if (elimination->faulty_baro[i] == 0) {
+      z[counter] = (float32_t)data->calculated_AGL[i];
+      counter++;
+    }
+  }
+
+  const float32_t *H = filter->H_full_data;
+  if (num_baros == 2) {
+    H = filter->H_eliminated_data;
+  } else if (num_baros == 1) {
+    H = filter->H_2_eliminated_data;
+  }
+  kk_correct(H, filter->gains->K[filter->phase][num_baros - 1], num_baros, filter->x_hat_data, z, filter->x_bar_data);
+  return CATS_ERR_OK;
 }
 
 cats_error_e kalman_step(kalman_filter_t *filter, state_estimation_data_t *data, sensor_elimination_t *elimination,
                          flight_fsm_e fsm_state) {
   cats_error_e status;
 
+  const uint32_t num_baros = NUM_PRESSURE - elimination->num_faulty_baros;
+  if (use_steady_state(filter, num_baros)) {
+    return kalman_steady_state_step(filter, data, elimination, fsm_state, num_baros);
+  }
+
   kalman_prediction(filter, data, elimination, fsm_state);
 
   switch (NUM_PRESSURE - elimination->num_faulty_baros) {
@@ -538,5 +723,8 @@ cats_error_e kalman_step(kalman_filter_t *filter, state_estimation_data_t *data,
       status = CATS_ERR_FILTER;
       break;
   }
+  if (status == CATS_ERR_OK) {
+    check_gain_convergence(filter, num_baros);
+  }
   return status;
 }
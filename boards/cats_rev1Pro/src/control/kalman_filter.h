@@ -25,6 +25,17 @@
 #define STD_NOISE_BARO   9.0f    // From data analysis: 2.6f
 #define STD_NOISE_IMU    0.004f  // From data analysis: 0.004f
 #define STD_NOISE_OFFSET 0.000001f
+/* Process noise of the offset after apogee, the acceleration is not used any more */
+#define STD_NOISE_OFFSET_DESCENT 10.0f
+
+/* The steady state gain is used once the gain and the covariance of the full filter are within this fraction of the
+ * steady state, relative to their largest element, see kalman_enable_steady_state. From a reset the full filter gets
+ * there after about 4400 to 5000 steps in the ascent phase and about 100 in the descent phase, see
+ * tools/kalman_bench/steady_state_bench. */
+#define KALMAN_STEADY_STATE_TOLERANCE 0.01f
+
+/* Q of each kalman_phase_e */
+extern const float32_t kalman_process_noise[KALMAN_NUM_PHASES][4];
 
 void init_filter_struct(kalman_filter_t *filter);
 
@@ -35,10 +46,21 @@ void kalman_prediction(kalman_filter_t *filter, state_estimation_data_t *data, s
 
 void reset_kalman(kalman_filter_t *filter, float initial_pressure);
 
+/* Switch the process noise to the one of the phase */
+void kalman_set_phase(kalman_filter_t *filter, kalman_phase_e phase);
+
+/* Use the cached gains instead of the full update once the gain of the full filter converged to them after the last
+ * reset or change of the configuration, the covariances are not updated any more in that case; NULL runs the full
+ * filter in every step */
+void kalman_enable_steady_state(kalman_filter_t *filter, const kalman_gains_t *gains);
+
 cats_error_e kalman_update_full(kalman_filter_t *filter, state_estimation_data_t *data);
 
 cats_error_e kalman_update_eliminated(kalman_filter_t *filter, state_estimation_data_t *data,
                                       sensor_elimination_t *elimination);
 
+cats_error_e kalman_update_2_eliminated(kalman_filter_t *filter, state_estimation_data_t *data,
+                                        sensor_elimination_t *elimination);
+
 cats_error_e kalman_step(kalman_filter_t *filter, state_estimation_data_t *data, sensor_elimination_t *elimination,
                          flight_fsm_e fsm_state);
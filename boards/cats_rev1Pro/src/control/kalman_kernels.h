@@ -0,0 +1,354 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Fixed size kernels for the altitude Kalman filter (control/kalman_filter.c).
+ *
+ * The filter only ever works on 3x3 covariances, 3x1 states and 1 to 3 baro measurements. For these sizes the generic
+ * arm_math functions spend most of their time on the dimension checks, the loop control and the holder matrices; the
+ * kernels below are fully unrolled and work directly on the row major data arrays of kalman_filter_t.
+ *
+ * The covariances P_hat and P_bar are symmetric. The kernels only read their upper triangle and only compute the upper
+ * triangle of the result, which is then mirrored, so P stays exactly symmetric. The innovation covariance is inverted
+ * in closed form (adjugate / determinant); like arm_mat_inverse_f32, only an exactly zero determinant is treated as
+ * singular. The update uses P_bar = P_hat - K * (H * P_hat), which is the same as (I - K * H) * P_hat.
+ *
+ * The prediction uses the same summation order as arm_math: x_hat and the upper triangle of P_hat are bit identical to
+ * the arm_math path for the same input. The update is not: arm_mat_inverse_f32 eliminates with Gauss-Jordan and the
+ * arm_math path forms (I - K * H) * P_hat, so the results round differently. tools/kalman_bench accepts a difference
+ * of 1e-5 relative to the largest element of x_bar, P_bar and K (about 80 float epsilons); its synthetic flight stays
+ * below 1e-6. Single small elements of P_bar and K lose most of their digits to cancellation on both paths and can
+ * differ by tens of ulp, which is why the bound isn't given in ulp.
+ */
+
+#pragma once
+
+#include "arm_math.h"
+
+#include <stdbool.h>
+
+/** Exported Functions **/
+
+/**
+ * State prediction x_hat = Ad * x_bar + Bd * u.
+ *
+ * @param Ad - 3x3 system matrix
+ * @param Bd - 3x1 input matrix
+ * @param x - 3x1 state x_bar
+ * @param u - input
+ * @param out[out] - 3x1 state x_hat
+ */
+static inline void kk_predict_state(const float32_t Ad[9], const float32_t Bd[3], const float32_t x[3], float32_t u,
+                                    float32_t out[3]) {
+  out[0] = (Ad[0] * x[0] + Ad[1] * x[1] + Ad[2] * x[2]) + Bd[0] * u;
+  out[1] = (Ad[3] * x[0] + Ad[4] * x[1] + Ad[5] * x[2]) + Bd[1] * u;
+  out[2] = (Ad[6] * x[0] + Ad[7] * x[1] + Ad[8] * x[2]) + Bd[2] * u;
+}
+
+/**
+ * Covariance prediction P_hat = Ad * P_bar * Ad' + GdQGd'.
+ *
+ * @param Ad - 3x3 system matrix
+ * @param P - symmetric 3x3 covariance P_bar, only the upper triangle is read
+ * @param GQG - symmetric 3x3 process noise, only the upper triangle is read
+ * @param out[out] - symmetric 3x3 covariance P_hat
+ */
+static inline void kk_predict_cov(const float32_t Ad[9], const float32_t P[9], const float32_t GQG[9],
+                                  float32_t out[9]) {
+  /* M = Ad * P */
+  const float32_t m00 = Ad[0] * P[0] + Ad[1] * P[1] + Ad[2] * P[2];
+  const float32_t m01 = Ad[0] * P[1] + Ad[1] * P[4] + Ad[2] * P[5];
+  const float32_t m02 = Ad[0] * P[2] + Ad[1] * P[5] + Ad[2] * P[8];
+  const float32_t m10 = Ad[3] * P[0] + Ad[4] * P[1] + Ad[5] * P[2];
+  const float32_t m11 = Ad[3] * P[1] + Ad[4] * P[4] + Ad[5] * P[5];
+  const float32_t m12 = Ad[3] * P[2] + Ad[4] * P[5] + Ad[5] * P[8];
+  const float32_t m20 = Ad[6] * P[0] + Ad[7] * P[1] + Ad[8] * P[2];
+  const float32_t m21 = Ad[6] * P[1] + Ad[7] * P[4] + Ad[8] * P[5];
+  const float32_t m22 = Ad[6] * P[2] + Ad[7] * P[5] + Ad[8] * P[8];
+
+  /* M * Ad' + GQG, upper triangle */
+  out[0] = (m00 * Ad[0] + m01 * Ad[1] + m02 * Ad[2]) + GQG[0];
+  out[1] = (m00 * Ad[3] + m01 * Ad[4] + m02 * Ad[5]) + GQG[1];
+  out[2] = (m00 * Ad[6] + m01 * Ad[7] + m02 * Ad[8]) + GQG[2];
+  out[4] = (m10 * Ad[3] + m11 * Ad[4] + m12 * Ad[5]) + GQG[4];
+  out[5] = (m10 * Ad[6] + m11 * Ad[7] + m12 * Ad[8]) + GQG[5];
+  out[8] = (m20 * Ad[6] + m21 * Ad[7] + m22 * Ad[8]) + GQG[8];
+  out[3] = out[1];
+  out[6] = out[2];
+  out[7] = out[5];
+}
+
+/**
+ * Closed form inverse of a symmetric 2x2 matrix.
+ *
+ * @param S - symmetric 2x2 matrix, only the upper triangle is read
+ * @param out[out] - symmetric 2x2 inverse
+ * @return false if the matrix is singular, out is not written in that case
+ */
+static inline bool kk_inverse_2x2_sym(const float32_t S[4], float32_t out[4]) {
+  const float32_t det = S[0] * S[3] - S[1] * S[1];
+  if (det == 0.0f) {
+    return false;
+  }
+  const float32_t inv_det = 1.0f / det;
+  out[0] = S[3] * inv_det;
+  out[1] = -S[1] * inv_det;
+  out[2] = out[1];
+  out[3] = S[0] * inv_det;
+  return true;
+}
+
+/**
+ * Closed form inverse of a symmetric 3x3 matrix.
+ *
+ * @param S - symmetric 3x3 matrix, only the upper triangle is read
+ * @param out[out] - symmetric 3x3 inverse
+ * @return false if the matrix is singular, out is not written in that case
+ */
+static inline bool kk_inverse_3x3_sym(const float32_t S[9], float32_t out[9]) {
+  /* cofactors, the matrix of the cofactors is symmetric as well */
+  const float32_t c00 = S[4] * S[8] - S[5] * S[5];
+  const float32_t c01 = S[2] * S[5] - S[1] * S[8];
+  const float32_t c02 = S[1] * S[5] - S[2] * S[4];
+  const float32_t c11 = S[0] * S[8] - S[2] * S[2];
+  const float32_t c12 = S[1] * S[2] - S[0] * S[5];
+  const float32_t c22 = S[0] * S[4] - S[1] * S[1];
+
+  const float32_t det = S[0] * c00 + S[1] * c01 + S[2] * c02;
+  if (det == 0.0f) {
+    return false;
+  }
+  const float32_t inv_det = 1.0f / det;
+  out[0] = c00 * inv_det;
+  out[1] = c01 * inv_det;
+  out[2] = c02 * inv_det;
+  out[4] = c11 * inv_det;
+  out[5] = c12 * inv_det;
+  out[8] = c22 * inv_det;
+  out[3] = out[1];
+  out[6] = out[2];
+  out[7] = out[5];
+  return true;
+}
+
+/**
+ * Measurement update with three measurements.
+ *
+ *   K = P_hat * H' * (H * P_hat * H' + R)^-1
+ *   x_bar = x_hat + K * (z - H * x_hat)
+ *   P_bar = P_hat - K * H * P_hat
+ *
+ * @param H - 3x3 measurement matrix
+ * @param R - symmetric 3x3 measurement noise
+ * @param P - symmetric 3x3 covariance P_hat
+ * @param x - 3x1 state x_hat
+ * @param z - 3x1 measurement
+ * @param K[out] - 3x3 gain
+ * @param x_out[out] - 3x1 state x_bar
+ * @param P_out[out] - symmetric 3x3 covariance P_bar
+ * @return false if the innovation covariance is singular, the outputs are not written in that case
+ */
+static inline bool kk_update_3(const float32_t H[9], const float32_t R[9], const float32_t P[9], const float32_t x[3],
+                               const float32_t z[3], float32_t K[9], float32_t x_out[3], float32_t P_out[9]) {
+  /* HP = H * P; P * H' is its transpose */
+  const float32_t hp00 = H[0] * P[0] + H[1] * P[1] + H[2] * P[2];
+  const float32_t hp01 = H[0] * P[1] + H[1] * P[4] + H[2] * P[5];
+  const float32_t hp02 = H[0] * P[2] + H[1] * P[5] + H[2] * P[8];
+  const float32_t hp10 = H[3] * P[0] + H[4] * P[1] + H[5] * P[2];
+  const float32_t hp11 = H[3] * P[1] + H[4] * P[4] + H[5] * P[5];
+  const float32_t hp12 = H[3] * P[2] + H[4] * P[5] + H[5] * P[8];
+  const float32_t hp20 = H[6] * P[0] + H[7] * P[1] + H[8] * P[2];
+  const float32_t hp21 = H[6] * P[1] + H[7] * P[4] + H[8] * P[5];
+  const float32_t hp22 = H[6] * P[2] + H[7] * P[5] + H[8] * P[8];
+
+  /* S = HP * H' + R, upper triangle */
+  float32_t S[9];
+  S[0] = (hp00 * H[0] + hp01 * H[1] + hp02 * H[2]) + R[0];
+  S[1] = (hp00 * H[3] + hp01 * H[4] + hp02 * H[5]) + R[1];
+  S[2] = (hp00 * H[6] + hp01 * H[7] + hp02 * H[8]) + R[2];
+  S[4] = (hp10 * H[3] + hp11 * H[4] + hp12 * H[5]) + R[4];
+  S[5] = (hp10 * H[6] + hp11 * H[7] + hp12 * H[8]) + R[5];
+  S[8] = (hp20 * H[6] + hp21 * H[7] + hp22 * H[8]) + R[8];
+
+  float32_t Si[9];
+  if (!kk_inverse_3x3_sym(S, Si)) {
+    return false;
+  }
+
+  /* K = HP' * S^-1 */
+  K[0] = hp00 * Si[0] + hp10 * Si[3] + hp20 * Si[6];
+  K[1] = hp00 * Si[1] + hp10 * Si[4] + hp20 * Si[7];
+  K[2] = hp00 * Si[2] + hp10 * Si[5] + hp20 * Si[8];
+  K[3] = hp01 * Si[0] + hp11 * Si[3] + hp21 * Si[6];
+  K[4] = hp01 * Si[1] + hp11 * Si[4] + hp21 * Si[7];
+  K[5] = hp01 * Si[2] + hp11 * Si[5] + hp21 * Si[8];
+  K[6] = hp02 * Si[0] + hp12 * Si[3] + hp22 * Si[6];
+  K[7] = hp02 * Si[1] + hp12 * Si[4] + hp22 * Si[7];
+  K[8] = hp02 * Si[2] + hp12 * Si[5] + hp22 * Si[8];
+
+  /* innovation y = z - H * x */
+  const float32_t y0 = z[0] - (H[0] * x[0] + H[1] * x[1] + H[2] * x[2]);
+  const float32_t y1 = z[1] - (H[3] * x[0] + H[4] * x[1] + H[5] * x[2]);
+  const float32_t y2 = z[2] - (H[6] * x[0] + H[7] * x[1] + H[8] * x[2]);
+
+  x_out[0] = (K[0] * y0 + K[1] * y1 + K[2] * y2) + x[0];
+  x_out[1] = (K[3] * y0 + K[4] * y1 + K[5] * y2) + x[1];
+  x_out[2] = (K[6] * y0 + K[7] * y1 + K[8] * y2) + x[2];
+
+  /* P_bar = P - K * HP, upper triangle */
+  P_out[0] = P[0] - (K[0] * hp00 + K[1] * hp10 + K[2] * hp20);
+  P_out[1] = P[1] - (K[0] * hp01 + K[1] * hp11 + K[2] * hp21);
+  P_out[2] = P[2] - (K[0] * hp02 + K[1] * hp12 + K[2] * hp22);
+  P_out[4] = P[4] - (K[3] * hp01 + K[4] * hp11 + K[5] * hp21);
+  P_out[5] = P[5] - (K[3] * hp02 + K[4] * hp12 + K[5] * hp22);
+  P_out[8] = P[8] - (K[6] * hp02 + K[7] * hp12 + K[8] * hp22);
+  P_out[3] = P_out[1];
+  P_out[6] = P_out[2];
+  P_out[7] = P_out[5];
+  return true;
+}
+
+/**
+ * Measurement update with two measurements, see kk_update_3.
+ *
+ * @param H - 2x3 measurement matrix
+ * @param R - symmetric 2x2 measurement noise
+ * @param P - symmetric 3x3 covariance P_hat
+ * @param x - 3x1 state x_hat
+ * @param z - 2x1 measurement
+ * @param K[out] - 3x2 gain
+ * @param x_out[out] - 3x1 state x_bar
+ * @param P_out[out] - symmetric 3x3 covariance P_bar
+ * @return false if the innovation covariance is singular, the outputs are not written in that case
+ */
+static inline bool kk_update_2(const float32_t H[6], const float32_t R[4], const float32_t P[9], const float32_t x[3],
+                               const float32_t z[2], float32_t K[6], float32_t x_out[3], float32_t P_out[9]) {
+  const float32_t hp00 = H[0] * P[0] + H[1] * P[1] + H[2] * P[2];
+  const float32_t hp01 = H[0] * P[1] + H[1] * P[4] + H[2] * P[5];
+  const float32_t hp02 = H[0] * P[2] + H[1] * P[5] + H[2] * P[8];
+  const float32_t hp10 = H[3] * P[0] + H[4] * P[1] + H[5] * P[2];
+  const float32_t hp11 = H[3] * P[1] + H[4] * P[4] + H[5] * P[5];
+  const float32_t hp12 = H[3] * P[2] + H[4] * P[5] + H[5] * P[8];
+
+  float32_t S[4];
+  S[0] = (hp00 * H[0] + hp01 * H[1] + hp02 * H[2]) + R[0];
+  S[1] = (hp00 * H[3] + hp01 * H[4] + hp02 * H[5]) + R[1];
+  S[3] = (hp10 * H[3] + hp11 * H[4] + hp12 * H[5]) + R[3];
+
+  float32_t Si[4];
+  if (!kk_inverse_2x2_sym(S, Si)) {
+    return false;
+  }
+
+  K[0] = hp00 * Si[0] + hp10 * Si[2];
+  K[1] = hp00 * Si[1] + hp10 * Si[3];
+  K[2] = hp01 * Si[0] + hp11 * Si[2];
+  K[3] = hp01 * Si[1] + hp11 * Si[3];
+  K[4] = hp02 * Si[0] + hp12 * Si[2];
+  K[5] = hp02 * Si[1] + hp12 * Si[3];
+
+  const float32_t y0 = z[0] - (H[0] * x[0] + H[1] * x[1] + H[2] * x[2]);
+  const float32_t y1 = z[1] - (H[3] * x[0] + H[4] * x[1] + H[5] * x[2]);
+
+  x_out[0] = (K[0] * y0 + K[1] * y1) + x[0];
+  x_out[1] = (K[2] * y0 + K[3] * y1) + x[1];
+  x_out[2] = (K[4] * y0 + K[5] * y1) + x[2];
+
+  P_out[0] = P[0] - (K[0] * hp00 + K[1] * hp10);
+  P_out[1] = P[1] - (K[0] * hp01 + K[1] * hp11);
+  P_out[2] = P[2] - (K[0] * hp02 + K[1] * hp12);
+  P_out[4] = P[4] - (K[2] * hp01 + K[3] * hp11);
+  P_out[5] = P[5] - (K[2] * hp02 + K[3] * hp12);
+  P_out[8] = P[8] - (K[4] * hp02 + K[5] * hp12);
+  P_out[3] = P_out[1];
+  P_out[6] = P_out[2];
+  P_out[7] = P_out[5];
+  return true;
+}
+
+/**
+ * Measurement update with a single measurement, see kk_update_3.
+ *
+ * @param H - 1x3 measurement matrix
+ * @param R - measurement noise
+ * @param P - symmetric 3x3 covariance P_hat
+ * @param x - 3x1 state x_hat
+ * @param z - measurement
+ * @param K[out] - 3x1 gain
+ * @param x_out[out] - 3x1 state x_bar
+ * @param P_out[out] - symmetric 3x3 covariance P_bar
+ * @return false if the innovation variance is zero, the outputs are not written in that case
+ */
+static inline bool kk_update_1(const float32_t H[3], float32_t R, const float32_t P[9], const float32_t x[3],
+                               float32_t z, float32_t K[3], float32_t x_out[3], float32_t P_out[9]) {
+  const float32_t hp0 = H[0] * P[0] + H[1] * P[1] + H[2] * P[2];
+  const float32_t hp1 = H[0] * P[1] + H[1] * P[4] + H[2] * P[5];
+  const float32_t hp2 = H[0] * P[2] + H[1] * P[5] + H[2] * P[8];
+
+  const float32_t s = (hp0 * H[0] + hp1 * H[1] + hp2 * H[2]) + R;
+  if (s == 0.0f) {
+    return false;
+  }
+  const float32_t s_inv = 1.0f / s;
+
+  K[0] = hp0 * s_inv;
+  K[1] = hp1 * s_inv;
+  K[2] = hp2 * s_inv;
+
+  const float32_t y = z - (H[0] * x[0] + H[1] * x[1] + H[2] * x[2]);
+
+  x_out[0] = K[0] * y + x[0];
+  x_out[1] = K[1] * y + x[1];
+  x_out[2] = K[2] * y + x[2];
+
+  P_out[0] = P[0] - K[0] * hp0;
+  P_out[1] = P[1] - K[0] * hp1;
+  P_out[2] = P[2] - K[0] * hp2;
+  P_out[4] = P[4] - K[1] * hp1;
+  P_out[5] = P[5] - K[1] * hp2;
+  P_out[8] = P[8] - K[2] * hp2;
+  P_out[3] = P_out[1];
+  P_out[6] = P_out[2];
+  P_out[7] = P_out[5];
+  return true;
+}
+
+/**
+ * Measurement update with a fixed gain, e.g. the steady state gain: x_bar = x_hat + K * (z - H * x_hat).
+ *
+ * @param H - num x 3 measurement matrix
+ * @param K - 3 x num gain
+ * @param num - number of measurements, 1 to 3
+ * @param x - 3x1 state x_hat
+ * @param z - num x 1 measurement
+ * @param x_out[out] - 3x1 state x_bar
+ */
+static inline void kk_correct(const float32_t *H, const float32_t *K, uint32_t num, const float32_t x[3],
+                              const float32_t *z, float32_t x_out[3]) {
+  float32_t y[3] = {0, 0, 0};
+  for (uint32_t i = 0; i < num; i++) {
+    y[i] = z[i] - (H[3 * i] * x[0] + H[3 * i + 1] * x[1] + H[3 * i + 2] * x[2]);
+  }
+  for (uint32_t i = 0; i < 3; i++) {
+    float32_t sum = 0;
+    for (uint32_t j = 0; j < num; j++) {
+      sum += K[i * num + j] * y[j];
+    }
+    x_out[i] = sum + x[i];
+  }
+}
@@ -0,0 +1,291 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "control/kalman_steady_state.h"
+#include "control/kalman_filter.h"
+
+#include <math.h>
+#include <string.h>
+
+/** Private Constants **/
+
+#define SDA_MAX_ITERATIONS 64
+#define SDA_TOLERANCE      1e-12
+
+/** Private Function Declarations **/
+
+static bool solve_riccati(const double A[9], const double GQG[9], const double *H, const double *R, uint32_t num,
+                          double X[9]);
+static void mat_mult(const double *a, const double *b, double *out, uint32_t rows, uint32_t inner, uint32_t cols);
+static void mat_transpose(const double *a, double *out, uint32_t rows, uint32_t cols);
+static bool mat_inverse(const double *a, double *out, uint32_t n);
+static double mat_max_abs(const double *a, uint32_t len);
+
+/** Exported Function Definitions **/
+
+bool kalman_solve_steady_state(const kalman_filter_t *filter, kalman_gains_t *gains) {
+  const float32_t *H_data[NUM_PRESSURE] = {filter->H_2_eliminated_data, filter->H_eliminated_data,
+                                           filter->H_full_data};
+  const float32_t *R_data[NUM_PRESSURE] = {filter->R_2_eliminated_data, filter->R_eliminated_data,
+                                           filter->R_full_data};
+  bool all_valid = true;
+
+  double A[9];
+  for (uint32_t i = 0; i < 9; i++) {
+    A[i] = filter->Ad_data[i];
+  }
+  double G[6];
+  double G_T[6];
+  for (uint32_t i = 0; i < 6; i++) {
+    G[i] = filter->Gd_data[i];
+  }
+  mat_transpose(G, G_T, 3, 2);
+
+  memset(gains, 0, sizeof(*gains));
+  for (uint32_t phase = 0; phase < KALMAN_NUM_PHASES; phase++) {
+    /* GQG = Gd*Q*Gd' */
+    double Q[4];
+    for (uint32_t i = 0; i < 4; i++) {
+      Q[i] = kalman_process_noise[phase][i];
+    }
+    double GQ[6];
+    double GQG[9];
+    mat_mult(G, Q, GQ, 3, 2, 2);
+    mat_mult(GQ, G_T, GQG, 3, 2, 3);
+
+    for (uint32_t num = 1; num <= NUM_PRESSURE; num++) {
+      double H[9];
+      double R[9];
+      for (uint32_t i = 0; i < num * 3; i++) {
+        H[i] = H_data[num - 1][i];
+      }
+      for (uint32_t i = 0; i < num * num; i++) {
+        R[i] = R_data[num - 1][i];
+      }
+
+      double X[9];
+      if (!solve_riccati(A, GQG, H, R, num, X)) {
+        log_warn("Kalman steady state of phase %lu with %lu baros did not converge", (unsigned long)phase,
+                 (unsigned long)num);
+        all_valid = false;
+        continue;
+      }
+
+      /* K = X*H'*(H*X*H' + R)^-1, P_bar = X - K*H*X */
+      double H_T[9];
+      double HX[9];
+      double S[9];
+      double S_inv[9];
+      double K[9];
+      double KHX[9];
+      mat_transpose(H, H_T, num, 3);
+      mat_mult(H, X, HX, num, 3, 3);
+      mat_mult(HX, H_T, S, num, 3, num);
+      for (uint32_t i = 0; i < num * num; i++) {
+        S[i] += R[i];
+      }
+      if (!mat_inverse(S, S_inv, num)) {
+        all_valid = false;
+        continue;
+      }
+      double XH_T[9];
+      mat_mult(X, H_T, XH_T, 3, 3, num);
+      mat_mult(XH_T, S_inv, K, 3, num, num);
+      mat_mult(K, HX, KHX, 3, num, 3);
+
+      for (uint32_t i = 0; i < 3 * num; i++) {
+        gains->K[phase][num - 1][i] = (float32_t)K[i];
+      }
+      /* symmetric like the covariances of the full filter */
+      for (uint32_t i = 0; i < 3; i++) {
+        for (uint32_t j = i; j < 3; j++) {
+          const float32_t value = (float32_t)(X[i * 3 + j] - KHX[i * 3 + j]);
+          gains->P_bar[phase][num - 1][i * 3 + j] = value;
+          gains->P_bar[phase][num - 1][j * 3 + i] = value;
+        }
+      }
+      gains->valid[phase][num - 1] = true;
+    }
+  }
+  return all_valid;
+}
+
+/** Private Function Definitions **/
+
+/*
+ * Structure preserving doubling for X = Ad*X*Ad' - Ad*X*H'*(H*X*H' + R)^-1*H*X*Ad' + GQG. In the notation of the
+ * control form X = a'*X*(I + g*X)^-1*a + h it starts with a = Ad', g = H'*R^-1*H and h = GQG and iterates
+ *
+ *   a <- a*(I + g*h)^-1*a
+ *   g <- g + a*(I + g*h)^-1*g*a'
+ *   h <- h + a'*h*(I + g*h)^-1*a
+ *
+ * until h, which converges to X, doesn't change any more.
+ */
+static bool solve_riccati(const double A[9], const double GQG[9], const double *H, const double *R, uint32_t num,
+                          double X[9]) {
+  double a[9];
+  double g[9];
+  double h[9];
+  mat_transpose(A, a, 3, 3);
+  memcpy(h, GQG, sizeof(h));
+
+  double R_inv[9];
+  if (!mat_inverse(R, R_inv, num)) {
+    return false;
+  }
+  double H_T[9];
+  double H_TR_inv[9];
+  mat_transpose(H, H_T, num, 3);
+  mat_mult(H_T, R_inv, H_TR_inv, 3, num, num);
+  mat_mult(H_TR_inv, H, g, 3, num, 3);
+
+  for (uint32_t iteration = 0; iteration < SDA_MAX_ITERATIONS; iteration++) {
+    /* W = (I + g*h)^-1 */
+    double W[9];
+    double W_inv[9];
+    mat_mult(g, h, W, 3, 3, 3);
+    W[0] += 1.0;
+    W[4] += 1.0;
+    W[8] += 1.0;
+    if (!mat_inverse(W, W_inv, 3)) {
+      return false;
+    }
+
+    double a_T[9];
+    double W_a[9];
+    double W_g[9];
+    double tmp[9];
+    double a_next[9];
+    double g_next[9];
+    double h_next[9];
+    mat_transpose(a, a_T, 3, 3);
+    mat_mult(W_inv, a, W_a, 3, 3, 3);
+    mat_mult(W_inv, g, W_g, 3, 3, 3);
+
+    mat_mult(a, W_a, a_next, 3, 3, 3);
+
+    mat_mult(a, W_g, tmp, 3, 3, 3);
+    mat_mult(tmp, a_T, g_next, 3, 3, 3);
+
+    mat_mult(a_T, h, tmp, 3, 3, 3);
+    mat_mult(tmp, W_a, h_next, 3, 3, 3);
+
+    double change = 0;
+    for (uint32_t i = 0; i < 9; i++) {
+      g_next[i] += g[i];
+      h_next[i] += h[i];
+      change = fmax(change, fabs(h_next[i] - h[i]));
+    }
+    memcpy(a, a_next, sizeof(a));
+    memcpy(g, g_next, sizeof(g));
+    memcpy(h, h_next, sizeof(h));
+
+    if (!isfinite(change)) {
+      return false;
+    }
+    if (change <= SDA_TOLERANCE * mat_max_abs(h, 9)) {
+      /* the iteration only keeps X symmetric up to rounding */
+      for (uint32_t i = 0; i < 3; i++) {
+        for (uint32_t j = 0; j < 3; j++) {
+          X[i * 3 + j] = (h[i * 3 + j] + h[j * 3 + i]) / 2;
+        }
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+static void mat_mult(const double *a, const double *b, double *out, uint32_t rows, uint32_t inner, uint32_t cols) {
+  for (uint32_t i = 0; i < rows; i++) {
+    for (uint32_t j = 0; j < cols; j++) {
+      double sum = 0;
+      for (uint32_t k = 0; k < inner; k++) {
+        sum += a[i * inner + k] * b[k * cols + j];
+      }
+      out[i * cols + j] = sum;
+    }
+  }
+}
+
+static void mat_transpose(const double *a, double *out, uint32_t rows, uint32_t cols) {
+  for (uint32_t i = 0; i < rows; i++) {
+    for (uint32_t j = 0; j < cols; j++) {
+      out[j * rows + i] = a[i * cols + j];
+    }
+  }
+}
+
+/* Gauss-Jordan elimination with partial pivoting, n <= 3 */
+static bool mat_inverse(const double *a, double *out, uint32_t n) {
+  double work[9];
+  memcpy(work, a, n * n * sizeof(double));
+  for (uint32_t i = 0; i < n; i++) {
+    for (uint32_t j = 0; j < n; j++) {
+      out[i * n + j] = (i == j) ? 1.0 : 0.0;
+    }
+  }
+
+  for (uint32_t col = 0; col < n; col++) {
+    uint32_t pivot = col;
+    for (uint32_t row = col + 1; row < n; row++) {
+      if (fabs(work[row * n + col]) > fabs(work[pivot * n + col])) {
+        pivot = row;
+      }
+    }
+    if (work[pivot * n + col] == 0.0) {
+      return false;
+    }
+    if (pivot != col) {
+      for (uint32_t j = 0; j < n; j++) {
+        double tmp = work[col * n + j];
+        work[col * n + j] = work[pivot * n + j];
+        work[pivot * n + j] = tmp;
+        tmp = out[col * n + j];
+        out[col * n + j] = out[pivot * n + j];
+        out[pivot * n + j] = tmp;
+      }
+    }
+
+    const double scale = 1.0 / work[col * n + col];
+    for (uint32_t j = 0; j < n; j++) {
+      work[col * n + j] *= scale;
+      out[col * n + j] *= scale;
+    }
+    for (uint32_t row = 0; row < n; row++) {
+      if (row == col) {
+        continue;
+      }
+      const double factor = work[row * n + col];
+      for (uint32_t j = 0; j < n; j++) {
+        work[row * n + j] -= factor * work[col * n + j];
+        out[row * n + j] -= factor * out[col * n + j];
+      }
+    }
+  }
+  return true;
+}
+
+static double mat_max_abs(const double *a, uint32_t len) {
+  double max = 0;
+  for (uint32_t i = 0; i < len; i++) {
+    max = fmax(max, fabs(a[i]));
+  }
+  return max;
+}
@@ -0,0 +1,50 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Steady state gains of the altitude Kalman filter.
+ *
+ * The model of the filter (Ad, Gd, Q of the phase) and its measurement configurations are fixed, so its covariance and
+ * gain converge to a steady state which only depends on the phase and on the number of working baros: all baros have
+ * the same measurement row and noise, so every elimination pattern with the same number of baros has the same gain.
+ * The steady state is the solution of the discrete algebraic Riccati equation of the prediction covariance
+ *
+ *   P = Ad*P*Ad' - Ad*P*H'*(H*P*H' + R)^-1*H*P*Ad' + Gd*Q*Gd'
+ *
+ * which is solved at boot with the structure preserving doubling algorithm in double precision. Every iteration doubles
+ * the number of filter steps covered, so it converges in a few dozen iterations even though the offset state of the
+ * filter takes minutes to settle.
+ *
+ * The solutions are used by kalman_step once the filter runs with kalman_enable_steady_state, tools/kalman_bench
+ * compares them with the full filter.
+ */
+
+#pragma once
+
+#include "util/types.h"
+
+/** Exported Functions **/
+
+/**
+ * Solve the steady state of the filter for every phase and number of baros.
+ *
+ * @param filter - filter after initialize_matrices
+ * @param gains[out] - steady state gains and covariances; entries which didn't converge are marked as not valid
+ * @return true if all entries are valid
+ */
+bool kalman_solve_steady_state(const kalman_filter_t *filter, kalman_gains_t *gains);
@@ -18,6 +18,9 @@
 
 #include "drivers/w25q.h"
 #include "util/log.h"
+#include "cmsis_os.h"
+
+#include <string.h>
 
 extern QSPI_HandleTypeDef hqspi;
 
@@ -57,6 +60,37 @@ w25q_t w25q = {.id = W25QINVALID};
 // Chip erase waiting timeout
 #define W25Q_CHIP_ERASE_TIMEOUT_MAX 200000U
 
+/* Thread flags set from the QSPI interrupt when a DMA transfer or an auto-polling is finished */
+#define W25Q_FLAG_CPLT  0x01U
+#define W25Q_FLAG_ERROR 0x02U
+/* DMA transfer timeout in ticks; a page takes a few microseconds */
+#define W25Q_DMA_TIMEOUT 10U
+/* Smaller reads are done without DMA, setting it up takes longer than the transfer */
+#define W25Q_DMA_MIN_READ_SIZE 256U
+
+/* Time in ticks the chip may take to finish an operation; maximum of the datasheet plus some margin */
+#define W25Q_PROGRAM_TIMEOUT     10U
+#define W25Q_ERASE_TIMEOUT       500U
+#define W25Q_BLOCK_ERASE_TIMEOUT 2500U
+
+/* Cycles of inactivity after which the peripheral releases the chip select in memory-mapped mode, so the chip can go
+ * to standby */
+#define W25Q_MAPPED_TIMEOUT_PERIOD 100U
+
+/* Thread waiting for the current DMA transfer or auto-polling, NULL if there is none */
+static volatile osThreadId_t w25q_wait_thread = NULL;
+/* Timeout of the program or erase operation the chip is still busy with, 0 while it is idle */
+static uint32_t w25q_busy_timeout = 0;
+
+static HAL_StatusTypeDef w25q_command(QSPI_CommandTypeDef *s_command);
+static w25q_status_e w25q_send_write_enable(void);
+static w25q_status_e w25q_program_page(QSPI_CommandTypeDef *s_command, uint8_t *buf);
+static w25q_status_e w25q_transmit(uint8_t *buf);
+static w25q_status_e w25q_receive(uint8_t *buf, uint32_t num_bytes);
+static bool w25q_start_wait();
+static w25q_status_e w25q_wait_irq(uint32_t timeout);
+static void w25q_signal(uint32_t flag);
+
 // Write enable
 int8_t w25q_write_enable(void) {
   QSPI_CommandTypeDef s_command = {
@@ -68,11 +102,13 @@ int8_t w25q_write_enable(void) {
       .SIOOMode = QSPI_SIOO_INST_EVERY_CMD,
       .DataMode = QSPI_DATA_NONE,
       .DummyCycles = 0,
-      .Instruction = W25Q_CMD_WRITE_ENABLE,
   };
 
+  // The chip ignores the command while it is still busy with the previous program or erase operation
+  if (w25q_sync() != W25Q_OK) return W25Q_ERR_AUTOPOLLING;
+
   // Send write enable command
-  if (HAL_QSPI_Command(&hqspi, &s_command, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) return W25Q_ERR_WRITE_ENABLE;
+  if (w25q_send_write_enable() != W25Q_OK) return W25Q_ERR_WRITE_ENABLE;
   // Keep querying W25Q_CMD_READ_STATUS_REG1 register, read w25qxx in the status byte_ Status_ REG1_ Wel is compared
   // with 0x02 Read status register 1 bit 1 (read-only), WEL write enable flag bit. When the flag bit is 1, it means
   // that write operation can be performed
@@ -183,6 +219,8 @@ w25q_status_e w25q_init(void) {
 }
 
 // Polling to confirm whether the FLASH is idle (used to wait for the end of communication, etc.)
+// Once the scheduler is running the QSPI peripheral polls the chip on its own and the calling thread sleeps until the
+// status match interrupt wakes it up.
 int8_t w25q_auto_polling_mem_ready(void) {
   QSPI_CommandTypeDef s_command = {
       .InstructionMode = QSPI_INSTRUCTION_1_LINE,
@@ -209,13 +247,43 @@ int8_t w25q_auto_polling_mem_ready(void) {
       .Mask = W25Q_STATUS_REG1_BUSY,
   };
 
-  // Send polling wait command
-  if (HAL_QSPI_AutoPolling(&hqspi, &s_command, &s_config, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK)
+  const uint32_t timeout = w25q_busy_timeout > 0 ? w25q_busy_timeout : HAL_QPSI_TIMEOUT_DEFAULT_VALUE;
+  w25q_busy_timeout = 0;
+
+  if (!w25q_start_wait()) {
+    // Send polling wait command
+    if (HAL_QSPI_AutoPolling(&hqspi, &s_command, &s_config, timeout) != HAL_OK) return W25Q_ERR_AUTOPOLLING;
+    return W25Q_OK;  // Communication ended normally
+  }
+
+  if (HAL_QSPI_AutoPolling_IT(&hqspi, &s_command, &s_config) != HAL_OK) {
+    w25q_wait_thread = NULL;
     return W25Q_ERR_AUTOPOLLING;
+  }
+  if (w25q_wait_irq(timeout) != W25Q_OK) return W25Q_ERR_AUTOPOLLING;
 
   return W25Q_OK;  // Communication ended normally
 }
 
+w25q_status_e w25q_sync(void) {
+  if (w25q_busy_timeout == 0) {
+    return W25Q_OK;
+  }
+  return w25q_auto_polling_mem_ready();
+}
+
+bool w25q_is_busy(void) {
+  if (w25q_busy_timeout == 0) {
+    return false;
+  }
+  uint8_t status1 = 0;
+  if (w25q_read_status_reg(1, &status1) != W25Q_OK || (status1 & W25Q_STATUS_REG1_BUSY)) {
+    return true;
+  }
+  w25q_busy_timeout = 0;
+  return false;
+}
+
 // FLASH software reset
 w25q_status_e w25q_reset(void) {
   QSPI_CommandTypeDef s_command = {
@@ -231,7 +299,7 @@ w25q_status_e w25q_reset(void) {
   };
 
   // Send reset enable command
-  if (HAL_QSPI_Command(&hqspi, &s_command, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK)
+  if (w25q_command(&s_command) != HAL_OK)
     return W25Q_ERR_INIT;  // If the sending fails, an error message is returned
   // Use the automatic polling flag bit to wait for the end of communication
   if (w25q_auto_polling_mem_ready() != W25Q_OK) return W25Q_ERR_AUTOPOLLING;
@@ -239,7 +307,7 @@ w25q_status_e w25q_reset(void) {
   s_command.Instruction = W25Q_CMD_RESET_DEVICE;  // Reset device command
 
   // Send reset device command
-  if (HAL_QSPI_Command(&hqspi, &s_command, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK)
+  if (w25q_command(&s_command) != HAL_OK)
     return W25Q_ERR_INIT;  // If the sending fails, an error message is returned
 
   // Use the automatic polling flag bit to wait for the end of communication
@@ -247,7 +315,7 @@ w25q_status_e w25q_reset(void) {
 
   s_command.Instruction = W25Q_CMD_ENTER_4_BYTE_ADDRESS_MODE;
 
-  if (HAL_QSPI_Command(&hqspi, &s_command, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK)
+  if (w25q_command(&s_command) != HAL_OK)
     return W25Q_ERR_INIT;  // If the sending fails, an error message is returned
 
   // Use the automatic polling flag bit to wait for the end of communication
@@ -273,8 +341,10 @@ w25q_status_e w25q_read_id(uint32_t *w25q_id) {
 
   uint8_t qspi_receive_buff[3];  // Store data read by QSPI
 
+  if (w25q_sync() != W25Q_OK) return W25Q_ERR_AUTOPOLLING;
+
   // Send command
-  if (HAL_QSPI_Command(&hqspi, &s_command, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK)
+  if (w25q_command(&s_command) != HAL_OK)
     return W25Q_ERR_INIT;  // If the sending fails, an error message is returned
   // receive data
   if (HAL_QSPI_Receive(&hqspi, qspi_receive_buff, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK)
@@ -318,7 +388,7 @@ w25q_status_e w25q_read_status_reg(uint8_t status_reg_num, uint8_t *status_reg_v
       .Instruction = status_reg_cmd,
   };
 
-  if (HAL_QSPI_Command(&hqspi, &s_command, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) return W25Q_ERR_INIT;
+  if (w25q_command(&s_command) != HAL_OK) return W25Q_ERR_INIT;
 
   // receive data
   if (HAL_QSPI_Receive(&hqspi, status_reg_val, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) return W25Q_ERR_TRANSMIT;
@@ -346,18 +416,28 @@ w25q_status_e w25q_sector_erase(uint32_t sector_idx) {
   }
 
   // Issue erase command
-  if (HAL_QSPI_Command(&hqspi, &s_command, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
+  if (w25q_command(&s_command) != HAL_OK) {
     return W25Q_ERR_ERASE;  // Erase failed
   }
 
-  // Use the automatic polling flag bit to wait for the end of erasure
-  if (w25q_auto_polling_mem_ready() != W25Q_OK) {
-    return W25Q_ERR_AUTOPOLLING;
-  }
+  // The erasure finishes in the background, the next operation waits for it
+  w25q_busy_timeout = W25Q_ERASE_TIMEOUT;
   return W25Q_OK;
 }
 
 bool w25q_is_sector_empty(uint32_t sector_idx) {
+  const uint8_t *mapped = w25q_map(sector_idx * w25q.sector_size, w25q.sector_size);
+  if (mapped != NULL) {
+    // Word by word straight from the window; the sector is aligned
+    const uint32_t *words = (const uint32_t *)mapped;
+    for (uint32_t i = 0; i < w25q.sector_size / sizeof(uint32_t); ++i) {
+      if (words[i] != 0xFFFFFFFFU) {
+        return false;
+      }
+    }
+    return true;
+  }
+
   uint8_t buf[32] = {};
   uint32_t i;
   bool sector_empty = true;
@@ -395,14 +475,12 @@ w25q_status_e w25q_block_erase_32k(uint32_t block_idx) {
   }
 
   // Issue erase command
-  if (HAL_QSPI_Command(&hqspi, &s_command, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
+  if (w25q_command(&s_command) != HAL_OK) {
     return W25Q_ERR_ERASE;
   }
 
-  // Use the automatic polling flag bit to wait for the end of erasure
-  if (w25q_auto_polling_mem_ready() != W25Q_OK) {
-    return W25Q_ERR_AUTOPOLLING;
-  }
+  // The erasure finishes in the background, the next operation waits for it
+  w25q_busy_timeout = W25Q_BLOCK_ERASE_TIMEOUT;
   return W25Q_OK;
 }
 
@@ -426,14 +504,12 @@ w25q_status_e w25q_block_erase_64k(uint32_t block_idx) {
   }
 
   // Issue erase command
-  if (HAL_QSPI_Command(&hqspi, &s_command, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
+  if (w25q_command(&s_command) != HAL_OK) {
     return W25Q_ERR_ERASE;
   }
 
-  // Use the automatic polling flag bit to wait for the end of erasure
-  if (w25q_auto_polling_mem_ready() != W25Q_OK) {
-    return W25Q_ERR_AUTOPOLLING;
-  }
+  // The erasure finishes in the background, the next operation waits for it
+  w25q_busy_timeout = W25Q_BLOCK_ERASE_TIMEOUT;
   return W25Q_OK;
 }
 
@@ -456,27 +532,13 @@ w25q_status_e w25q_chip_erase(void) {
     return W25Q_ERR_WRITE_ENABLE;
   }
   // Issue erase command
-  if (HAL_QSPI_Command(&hqspi, &s_command, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
+  if (w25q_command(&s_command) != HAL_OK) {
     return W25Q_ERR_ERASE;
   }
 
-  // Keep querying W25Q_CMD_READ_STATUS_REG1 register, read w25qxx in the status byte_ Status_ REG1_ Busy keeps
-  // comparing with 0 Read status register 1 bit 0 (read-only), Busy flag bit, when erasing / writing data / writing
-  // command will be set to 1, idle or communication end to 0
-  QSPI_AutoPollingTypeDef s_config = {
-      .Match = 0,
-      .MatchMode = QSPI_MATCH_MODE_AND,
-      .Interval = 0x10,
-      .AutomaticStop = QSPI_AUTOMATIC_STOP_ENABLE,
-      .StatusBytesSize = 1,
-      .Mask = W25Q_STATUS_REG1_BUSY,
-  };
-
-  s_command.Instruction = W25Q_CMD_READ_STATUS_REG1;
-  s_command.DataMode = QSPI_DATA_1_LINE;
-  s_command.NbData = 1;
-
-  if (HAL_QSPI_AutoPolling(&hqspi, &s_command, &s_config, W25Q_CHIP_ERASE_TIMEOUT_MAX) != HAL_OK) {
+  // Wait for the end of the erasure, this takes minutes
+  w25q_busy_timeout = W25Q_CHIP_ERASE_TIMEOUT_MAX;
+  if (w25q_auto_polling_mem_ready() != W25Q_OK) {
     return W25Q_ERR_AUTOPOLLING;
   }
   return W25Q_OK;
@@ -500,64 +562,45 @@ w25q_status_e w25q_write_page(uint8_t *buf, uint32_t write_addr, uint16_t num_by
 
   };
 
-  if (w25q_write_enable() != W25Q_OK) {
-    return W25Q_ERR_WRITE_ENABLE;
-  }
-  // Write command
-  if (HAL_QSPI_Command(&hqspi, &s_command, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
-    return W25Q_ERR_TRANSMIT_CMD;
-  }
-  // Start data transfer
-  if (HAL_QSPI_Transmit(&hqspi, buf, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
-    return W25Q_ERR_TRANSMIT;
-  }
-  // Use the automatic polling flag bit to wait for the end of the write
-  if (w25q_auto_polling_mem_ready() != W25Q_OK) {
-    return W25Q_ERR_AUTOPOLLING;
-  }
-  return W25Q_OK;
+  return w25q_program_page(&s_command, buf);
 }
 
 w25q_status_e w25q_write_buffer(uint8_t *buf, uint32_t write_addr, uint32_t num_bytes_to_write) {
-  uint32_t end_addr, current_size, current_addr;
-  uint8_t *write_data;
-
-  // Calculates the remaining space on the current page
-  current_size = W25Q_PAGE_SIZE - (write_addr % W25Q_PAGE_SIZE);
-
-  // Determine whether the remaining space of the current page is enough to write all data
-  if (current_size > num_bytes_to_write) {
-    // If it is enough, the current length is obtained directly
-    current_size = num_bytes_to_write;
-  }
+  // The command is set up once, only the address and the length change from page to page
+  QSPI_CommandTypeDef s_command = {
+      .InstructionMode = QSPI_INSTRUCTION_1_LINE,
+      .AddressSize = QSPI_ADDRESS_32_BITS,
+      .AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE,
+      .DdrMode = QSPI_DDR_MODE_DISABLE,
+      .DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY,
+      .SIOOMode = QSPI_SIOO_INST_EVERY_CMD,
+      .AddressMode = QSPI_ADDRESS_1_LINE,
+      .DataMode = QSPI_DATA_4_LINES,
+      .DummyCycles = 0,
+      .Instruction = W25Q_CMD_QUAD_INPUT_PAGE_PROGRAM,
+  };
 
-  current_addr = write_addr;
-  end_addr = write_addr + num_bytes_to_write;
-  write_data = buf;
+  const uint32_t end_addr = write_addr + num_bytes_to_write;
+  uint32_t current_addr = write_addr;
+  uint8_t *write_data = buf;
 
-  w25q_status_e write_err = W25Q_OK;
-  do {
-    // Send write enable
-    if (w25q_write_enable() != W25Q_OK) {
-      return W25Q_ERR_WRITE_ENABLE;
-    }
+  while (current_addr < end_addr) {
+    // Up to the end of the current page; the chip wraps around within the page otherwise
+    const uint32_t page_end = (current_addr / W25Q_PAGE_SIZE + 1) * W25Q_PAGE_SIZE;
+    const uint32_t current_size = (page_end < end_addr ? page_end : end_addr) - current_addr;
+    s_command.Address = current_addr;
+    s_command.NbData = current_size;
 
-    // Write data by page
-    else if ((write_err = w25q_write_page(write_data, current_addr, current_size)) != W25Q_OK) {
+    // Waits for the previous page, which is programmed while this one is prepared
+    const w25q_status_e write_err = w25q_program_page(&s_command, write_data);
+    if (write_err != W25Q_OK) {
       return write_err;
     }
-    // Use the automatic polling flag bit to wait for the end of the write
-    else if (w25q_auto_polling_mem_ready() != W25Q_OK) {
-      return W25Q_ERR_AUTOPOLLING;
-    } else  // Write data by page successfully, prepare for the next data write
-    {
-      current_addr += current_size;  // Calculate the next write address
-      write_data += current_size;    // Gets the address of the data store to be written next time
-      // Calculate the length of the next write
-      current_size = ((current_addr + W25Q_PAGE_SIZE) > end_addr) ? (end_addr - current_addr) : W25Q_PAGE_SIZE;
-    }
-  } while (current_addr < end_addr);  // Judge whether all data are written
+    current_addr += current_size;
+    write_data += current_size;
+  }
 
+  // The last page is programmed in the background, the next operation waits for it
   return W25Q_OK;
 }
 
@@ -578,23 +621,189 @@ w25q_status_e w25q_read_buffer(uint8_t *buf, uint32_t read_addr, uint32_t num_by
       .Instruction = W25Q_CMD_FAST_READ_QUAD_IO,
   };
 
+  // Copy the data straight from the window, this saves setting up the command and the transfer
+  const uint8_t *mapped = w25q_map(read_addr, num_bytes_to_read);
+  if (mapped != NULL) {
+    memcpy(buf, mapped, num_bytes_to_read);
+    return W25Q_OK;
+  }
+
+  // Wait for the end of a program or erase operation which is still running
+  if (w25q_sync() != W25Q_OK) {
+    return W25Q_ERR_AUTOPOLLING;
+  }
+
   // Send read command
-  if (HAL_QSPI_Command(&hqspi, &s_command, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
+  if (w25q_command(&s_command) != HAL_OK) {
     return W25Q_ERR_TRANSMIT_CMD;
   }
 
   //	receive data
-  if (HAL_QSPI_Receive(&hqspi, buf, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
+  if (w25q_receive(buf, num_bytes_to_read) != W25Q_OK) {
     return W25Q_ERR_TRANSMIT;
   }
+  return W25Q_OK;
+}
 
-  // Use automatic polling flag bits to wait for the end of reception
-  if (w25q_auto_polling_mem_ready() != W25Q_OK) {
+const uint8_t *w25q_map(uint32_t addr, uint32_t len) {
+#ifdef W25Q_MEMORY_MAPPED
+  const uint32_t capacity = w25q.sector_count * w25q.sector_size;
+  if (len > capacity || addr > capacity - len) {
+    return NULL;
+  }
+  if (hqspi.State != HAL_QSPI_STATE_BUSY_MEM_MAPPED) {
+    QSPI_CommandTypeDef s_command = {
+        .InstructionMode = QSPI_INSTRUCTION_1_LINE,
+        .AddressSize = QSPI_ADDRESS_32_BITS,
+        .AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE,
+        .DdrMode = QSPI_DDR_MODE_DISABLE,
+        .DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY,
+        .SIOOMode = QSPI_SIOO_INST_EVERY_CMD,
+        .AddressMode = QSPI_ADDRESS_4_LINES,
+        .DataMode = QSPI_DATA_4_LINES,
+        .DummyCycles = 6,
+        .Instruction = W25Q_CMD_FAST_READ_QUAD_IO,
+    };
+    QSPI_MemoryMappedTypeDef s_mem_mapped_cfg = {
+        .TimeOutActivation = QSPI_TIMEOUT_COUNTER_ENABLE,
+        .TimeOutPeriod = W25Q_MAPPED_TIMEOUT_PERIOD,
+    };
+
+    // The chip can't be read while it is busy
+    if (w25q_sync() != W25Q_OK) {
+      return NULL;
+    }
+    if (HAL_QSPI_MemoryMapped(&hqspi, &s_command, &s_mem_mapped_cfg) != HAL_OK) {
+      return NULL;
+    }
+  }
+  return (const uint8_t *)(QSPI_BASE + addr);
+#else
+  return NULL;
+#endif
+}
+
+/* Send a command in indirect mode. All commands go through here so that the peripheral leaves memory-mapped mode
+ * first; this also invalidates the pointers returned by w25q_map(). */
+static HAL_StatusTypeDef w25q_command(QSPI_CommandTypeDef *s_command) {
+  if (hqspi.State == HAL_QSPI_STATE_BUSY_MEM_MAPPED && HAL_QSPI_Abort(&hqspi) != HAL_OK) {
+    return HAL_ERROR;
+  }
+  return HAL_QSPI_Command(&hqspi, s_command, HAL_QPSI_TIMEOUT_DEFAULT_VALUE);
+}
+
+/* Send the write enable command. The chip sets the write enable latch at the end of the command, so the program or
+ * erase command following it right away doesn't need to poll for it. */
+static w25q_status_e w25q_send_write_enable(void) {
+  QSPI_CommandTypeDef s_command = {
+      .InstructionMode = QSPI_INSTRUCTION_1_LINE,
+      .AddressMode = QSPI_ADDRESS_NONE,
+      .AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE,
+      .DdrMode = QSPI_DDR_MODE_DISABLE,
+      .DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY,
+      .SIOOMode = QSPI_SIOO_INST_EVERY_CMD,
+      .DataMode = QSPI_DATA_NONE,
+      .DummyCycles = 0,
+      .Instruction = W25Q_CMD_WRITE_ENABLE,
+  };
+
+  if (w25q_command(&s_command) != HAL_OK) {
+    return W25Q_ERR_WRITE_ENABLE;
+  }
+  return W25Q_OK;
+}
+
+/* Program one page: wait for the previous operation, write enable, program command and data. Returns without waiting
+ * for the end of the programming. */
+static w25q_status_e w25q_program_page(QSPI_CommandTypeDef *s_command, uint8_t *buf) {
+  if (w25q_sync() != W25Q_OK) {
     return W25Q_ERR_AUTOPOLLING;
   }
+  if (w25q_send_write_enable() != W25Q_OK) {
+    return W25Q_ERR_WRITE_ENABLE;
+  }
+  // Write command
+  if (w25q_command(s_command) != HAL_OK) {
+    return W25Q_ERR_TRANSMIT_CMD;
+  }
+  // Start data transfer
+  if (w25q_transmit(buf) != W25Q_OK) {
+    return W25Q_ERR_TRANSMIT;
+  }
+  // The page is programmed in the background, the next operation waits for it
+  w25q_busy_timeout = W25Q_PROGRAM_TIMEOUT;
+  return W25Q_OK;
+}
+
+/* Transmit the data phase of the current command. Once the scheduler is running the data is sent via DMA and the
+ * calling thread sleeps until the transfer complete interrupt wakes it up, so other tasks can run in the meantime. */
+static w25q_status_e w25q_transmit(uint8_t *buf) {
+  if (!w25q_start_wait()) {
+    if (HAL_QSPI_Transmit(&hqspi, buf, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
+      return W25Q_ERR_TRANSMIT;
+    }
+    return W25Q_OK;
+  }
+
+  if (HAL_QSPI_Transmit_DMA(&hqspi, buf) != HAL_OK) {
+    w25q_wait_thread = NULL;
+    return W25Q_ERR_TRANSMIT;
+  }
+  return w25q_wait_irq(W25Q_DMA_TIMEOUT);
+}
+
+/* Receive the data phase of the current command, like w25q_transmit() */
+static w25q_status_e w25q_receive(uint8_t *buf, uint32_t num_bytes) {
+  if (num_bytes < W25Q_DMA_MIN_READ_SIZE || !w25q_start_wait()) {
+    if (HAL_QSPI_Receive(&hqspi, buf, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
+      return W25Q_ERR_TRANSMIT;
+    }
+    return W25Q_OK;
+  }
+
+  if (HAL_QSPI_Receive_DMA(&hqspi, buf) != HAL_OK) {
+    w25q_wait_thread = NULL;
+    return W25Q_ERR_TRANSMIT;
+  }
+  return w25q_wait_irq(W25Q_DMA_TIMEOUT);
+}
+
+/* Register the calling thread for the completion interrupt; false if the scheduler isn't running yet and the
+ * operation has to be done blocking */
+static bool w25q_start_wait() {
+  if (osKernelGetState() != osKernelRunning) {
+    return false;
+  }
+  osThreadFlagsClear(W25Q_FLAG_CPLT | W25Q_FLAG_ERROR);
+  w25q_wait_thread = osThreadGetId();
+  return true;
+}
+
+/* Sleep until the interrupt signals the end of the operation started after w25q_start_wait() */
+static w25q_status_e w25q_wait_irq(uint32_t timeout) {
+  uint32_t flags = osThreadFlagsWait(W25Q_FLAG_CPLT | W25Q_FLAG_ERROR, osFlagsWaitAny, timeout);
+  w25q_wait_thread = NULL;
+  if ((flags & osFlagsError) || (flags & W25Q_FLAG_ERROR)) {
+    HAL_QSPI_Abort(&hqspi);
+    return W25Q_ERR_TRANSMIT;
+  }
   return W25Q_OK;
 }
 
+static void w25q_signal(uint32_t flag) {
+  if (w25q_wait_thread != NULL) {
+    osThreadFlagsSet(w25q_wait_thread, flag);
+  }
+}
+
+void HAL_QSPI_TxCpltCallback(QSPI_HandleTypeDef *qspi_handle) { w25q_signal(W25Q_FLAG_CPLT); }
+
+void HAL_QSPI_RxCpltCallback(QSPI_HandleTypeDef *qspi_handle) { w25q_signal(W25Q_FLAG_CPLT); }
+
+void HAL_QSPI_StatusMatchCallback(QSPI_HandleTypeDef *qspi_handle) { w25q_signal(W25Q_FLAG_CPLT); }
+
+void HAL_QSPI_ErrorCallback(QSPI_HandleTypeDef *qspi_handle) { w25q_signal(W25Q_FLAG_ERROR); }
+
 uint32_t w25q_sector_to_page(uint32_t sector_idx) { return (sector_idx * w25q.sector_size) / w25q.page_size; }
 
 uint32_t w25q_block_to_page(uint32_t block_idx) { return (block_idx * w25q.block_size) / w25q.page_size; }
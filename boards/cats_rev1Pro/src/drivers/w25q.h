@@ -19,6 +19,15 @@
 /*
  * Driver for Winbond W25Q chips.
  *
+ * Program and erase operations return as soon as the command and its data were transferred; the chip finishes them
+ * in the background while the caller prepares the next operation. Every operation which needs an idle chip waits for
+ * the previous one first, w25q_sync() waits explicitly. Once the scheduler is running, the data is transferred via
+ * DMA and the chip is polled by the QSPI peripheral, the calling thread sleeps until the interrupt wakes it up.
+ *
+ * With W25Q_MEMORY_MAPPED the flash can be read through the memory-mapped window of the QSPI peripheral, see
+ * w25q_map(). The peripheral stays in memory-mapped mode until the next command is sent, which switches it back to
+ * indirect mode.
+ *
  * Inspired by:
  *   - https://github.com/nimaltd/w25qxx
  *   - https://www.fatalerrors.org/a/stm32h7-peripheral-configuration-quick-reference-qspi-part.html
@@ -30,6 +39,9 @@
 #include "stm32l433xx.h"
 #include "main.h"
 
+/* Read the flash through the memory-mapped window instead of with indirect read commands */
+#define W25Q_MEMORY_MAPPED
+
 typedef enum {
   W25QINVALID = 0,
   W25Q10 = 1,
@@ -89,7 +101,7 @@ w25q_status_e w25q_reset(void);
 w25q_status_e w25q_read_id(uint32_t *device_id);
 
 /**
- * Erases a given 4K sector.
+ * Erases a given 4K sector. Returns without waiting for the end of the erasure.
  *
  * @param sector_idx - Index of the sector to be erased
  * @return W25Q_OK if successful, W25Q_ERR_* otherwise
@@ -97,7 +109,7 @@ w25q_status_e w25q_read_id(uint32_t *device_id);
 w25q_status_e w25q_sector_erase(uint32_t sector_idx);
 
 /**
- * Erases a given 32K block.
+ * Erases a given 32K block. Returns without waiting for the end of the erasure.
  *
  * @param block_idx - Address of the 32K block to be deleted
  * @return W25Q_OK if successful, W25Q_ERR_* otherwise
@@ -105,7 +117,7 @@ w25q_status_e w25q_sector_erase(uint32_t sector_idx);
 w25q_status_e w25q_block_erase_32k(uint32_t block_idx);
 
 /**
- * Erases a given 64K block.
+ * Erases a given 64K block. Returns without waiting for the end of the erasure.
  *
  * @param block_idx - Address of the 64K block to be deleted
  * @return W25Q_OK if successful, W25Q_ERR_* otherwise
@@ -120,7 +132,7 @@ w25q_status_e w25q_block_erase_64k(uint32_t block_idx);
 w25q_status_e w25q_chip_erase(void);
 
 /**
- * Write up to one page to the flash.
+ * Write up to one page to the flash. Returns without waiting for the end of the programming.
  *
  * @param buf - Data to be written
  * @param write_addr - Location on the flash chip in which to write the data
@@ -130,7 +142,8 @@ w25q_status_e w25q_chip_erase(void);
 w25q_status_e w25q_write_page(uint8_t *buf, uint32_t write_addr, uint16_t num_bytes_to_write);
 
 /**
- * Write up to flash capacity.
+ * Write up to flash capacity. The data is programmed page by page with one write enable and one wait for the previous
+ * page each; returns without waiting for the end of the programming of the last page.
  *
  * @param buf - Data to be written
  * @param write_addr - Location on the flash chip in which to write the data
@@ -158,6 +171,34 @@ w25q_status_e w25q_read_buffer(uint8_t *buf, uint32_t read_addr, uint32_t num_by
  */
 w25q_status_e w25q_read_status_reg(uint8_t status_reg_num, uint8_t *status_reg_val);
 
+/**
+ * Wait until the chip has finished the last program or erase operation.
+ *
+ * @return W25Q_OK if successful, W25Q_ERR_* otherwise
+ */
+w25q_status_e w25q_sync(void);
+
+/**
+ * Check whether the chip is still busy with the last program or erase operation, without waiting for it.
+ *
+ * @return true if the next program, erase or read operation would have to wait
+ */
+bool w25q_is_busy(void);
+
+/**
+ * Map a range of the flash into the address space. Waits for the chip to finish the last program or erase operation
+ * and switches the QSPI peripheral to memory-mapped mode if it isn't in it already.
+ *
+ * The pointer is only valid until the next function which sends a command to the flash is called, e.g. a program,
+ * erase or status read. Callers have to hold flash_mutex for as long as they access the data.
+ *
+ * @param addr - Location on the flash chip
+ * @param len - Number of bytes which will be accessed
+ * @return pointer to the data in the mapped window, NULL if W25Q_MEMORY_MAPPED isn't defined, the range is outside of
+ * the flash or the peripheral can't be switched
+ */
+const uint8_t *w25q_map(uint32_t addr, uint32_t len);
+
 uint32_t w25q_sector_to_page(uint32_t sector_num);
 
 uint32_t w25q_block_to_page(uint32_t block_num);
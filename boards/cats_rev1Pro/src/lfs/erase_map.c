@@ -0,0 +1,105 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "lfs/erase_map.h"
+#include "lfs/lfs_custom.h"
+
+#include <string.h>
+
+/** Private Variables **/
+
+static uint8_t erased_sectors[ERASE_MAP_MAX_SECTORS / 8] = {};
+
+/** Private Function Declarations **/
+
+static inline void set_erased(uint32_t sector_idx) {
+  if (sector_idx < ERASE_MAP_MAX_SECTORS) {
+    erased_sectors[sector_idx / 8] |= (uint8_t)(1U << (sector_idx % 8));
+  }
+}
+
+static inline void clear_erased(uint32_t sector_idx) {
+  if (sector_idx < ERASE_MAP_MAX_SECTORS) {
+    erased_sectors[sector_idx / 8] &= (uint8_t)~(1U << (sector_idx % 8));
+  }
+}
+
+/** Exported Function Definitions **/
+
+bool erase_map_is_erased(uint32_t sector_idx) {
+  osMutexAcquire(flash_mutex, osWaitForever);
+  const bool erased = sector_idx < ERASE_MAP_MAX_SECTORS && (erased_sectors[sector_idx / 8] & (1U << (sector_idx % 8)));
+  osMutexRelease(flash_mutex);
+  return erased;
+}
+
+w25q_status_e erase_map_erase_sector(uint32_t sector_idx) {
+  osMutexAcquire(flash_mutex, osWaitForever);
+  w25q_status_e status = W25Q_OK;
+  /* checking whether the sector is blank is a lot faster than erasing it */
+  if (!erase_map_is_erased(sector_idx) && !w25q_is_sector_empty(sector_idx)) {
+    status = w25q_sector_erase(sector_idx);
+  }
+  if (status == W25Q_OK) {
+    set_erased(sector_idx);
+  }
+  osMutexRelease(flash_mutex);
+  return status;
+}
+
+w25q_status_e erase_map_erase_block_64k(uint32_t block_idx) {
+  const uint32_t sectors_per_block = w25q.block_size / w25q.sector_size;
+  const uint32_t first_sector = block_idx * sectors_per_block;
+  osMutexAcquire(flash_mutex, osWaitForever);
+  bool erased = true;
+  for (uint32_t i = 0; i < sectors_per_block && erased; ++i) {
+    erased = erase_map_is_erased(first_sector + i);
+  }
+  w25q_status_e status = W25Q_OK;
+  if (!erased) {
+    status = w25q_block_erase_64k(block_idx);
+    if (status == W25Q_OK) {
+      for (uint32_t i = 0; i < sectors_per_block; ++i) {
+        set_erased(first_sector + i);
+      }
+    }
+  }
+  osMutexRelease(flash_mutex);
+  return status;
+}
+
+void erase_map_reset() {
+  osMutexAcquire(flash_mutex, osWaitForever);
+  memset(erased_sectors, 0, sizeof(erased_sectors));
+  osMutexRelease(flash_mutex);
+}
+
+w25q_status_e erase_map_write(const uint8_t *buf, uint32_t addr, uint32_t len) {
+  if (len == 0) {
+    return W25Q_OK;
+  }
+  osMutexAcquire(flash_mutex, osWaitForever);
+  /* even a failed write may have programmed some bits */
+  for (uint32_t sector_idx = addr / w25q.sector_size; sector_idx <= (addr + len - 1) / w25q.sector_size;
+       ++sector_idx) {
+    clear_erased(sector_idx);
+  }
+  const w25q_status_e status = w25q_write_buffer((uint8_t *)buf, addr, len);
+  osMutexRelease(flash_mutex);
+  return status;
+}
@@ -0,0 +1,79 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Erase state of the flash sectors.
+ *
+ * A set bit means that the whole sector is known to be erased. The bit is set when the sector is erased and cleared as
+ * soon as anything is programmed into it; sectors are assumed to be written after a reboot until they are erased
+ * again. The LittleFS erase callback skips sectors which are already erased, the raw partition erases ahead of the
+ * recording cursor in the background (see lfs/raw_partition.h).
+ *
+ * All functions take flash_mutex.
+ */
+
+#pragma once
+
+#include "drivers/w25q.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Exported Defines **/
+
+/* Sectors of a 256 Mbit flash; sectors beyond are never reported as erased */
+#define ERASE_MAP_MAX_SECTORS 8192
+
+/** Exported Functions **/
+
+/**
+ * @param sector_idx - index of the sector
+ * @return true if the sector is known to be erased
+ */
+bool erase_map_is_erased(uint32_t sector_idx);
+
+/**
+ * Erase a sector unless it is already erased or blank.
+ *
+ * @param sector_idx - index of the sector
+ * @return W25Q_OK if successful, W25Q_ERR_* otherwise
+ */
+w25q_status_e erase_map_erase_sector(uint32_t sector_idx);
+
+/**
+ * Erase a 64 KiB block unless all of its sectors are already erased.
+ *
+ * @param block_idx - index of the 64 KiB block
+ * @return W25Q_OK if successful, W25Q_ERR_* otherwise
+ */
+w25q_status_e erase_map_erase_block_64k(uint32_t block_idx);
+
+/**
+ * Forget the erase state of all sectors; has to be called after the flash was written without this module.
+ */
+void erase_map_reset();
+
+/**
+ * Program data and clear the erased state of the affected sectors.
+ *
+ * @param buf - data to write
+ * @param addr - flash address
+ * @param len - number of bytes
+ * @return W25Q_OK if successful, W25Q_ERR_* otherwise
+ */
+w25q_status_e erase_map_write(const uint8_t *buf, uint32_t addr, uint32_t len);
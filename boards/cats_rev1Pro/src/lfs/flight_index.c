@@ -0,0 +1,511 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "lfs/flight_index.h"
+#include "lfs/lfs_custom.h"
+#include "lfs/raw_partition.h"
+#include "drivers/w25q.h"
+#include "util/crc32.h"
+#include "util/log.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+/** Private Constants **/
+
+#define FLIGHT_INDEX_PATH     "flight_index"
+#define FLIGHT_INDEX_TMP_PATH "flight_index.tmp"
+
+/* The file is rewritten with the valid entries only once it holds this many */
+#define FLIGHT_INDEX_COMPACT_ENTRIES (2 * FLIGHT_INDEX_MAX_FLIGHTS)
+
+/** Private Types **/
+
+typedef struct {
+  uint16_t pos;    /* position of the entry in the file + 1, 0 if there is no such flight */
+  uint16_t sector; /* sector of the raw extent, 0 if the flight is stored in LittleFS */
+} flight_index_slot_t;
+
+typedef struct {
+  uint32_t newest;      /* the window covers the FLIGHT_INDEX_MAX_FLIGHTS flight numbers up to this one */
+  uint32_t num_entries; /* number of entries in the file, including the deletions */
+  /* indexed by flight number % FLIGHT_INDEX_MAX_FLIGHTS */
+  flight_index_slot_t slots[FLIGHT_INDEX_MAX_FLIGHTS];
+} flight_index_t;
+
+/** Private Variables **/
+
+static flight_index_t table = {};
+
+/** Private Function Declarations **/
+
+static inline flight_index_slot_t *get_slot(uint32_t flight_number) {
+  return &table.slots[flight_number % FLIGHT_INDEX_MAX_FLIGHTS];
+}
+static inline uint32_t window_start(uint32_t newest) {
+  return newest >= FLIGHT_INDEX_MAX_FLIGHTS ? newest - FLIGHT_INDEX_MAX_FLIGHTS + 1 : 1;
+}
+static bool is_indexed(uint32_t flight_number);
+static bool load();
+static bool create();
+static bool compact();
+static void apply_entry(const flight_index_entry_t *entry, uint32_t pos);
+static bool read_entry(uint32_t pos, flight_index_entry_t *entry);
+static bool append_entry(flight_index_entry_t *entry);
+static bool add_flight(uint32_t flight_number, const flight_stats_t *stats);
+static bool remove_flight(uint32_t flight_number);
+static bool flight_exists(uint32_t flight_number);
+static uint32_t find_flight_before(uint32_t flight_number);
+static bool read_stats(uint32_t flight_number, flight_stats_t *stats);
+static uint32_t update_raw_limit();
+static bool apply_retention(uint32_t required);
+
+/** Exported Function Definitions **/
+
+void flight_index_init() {
+  osMutexAcquire(flash_mutex, osWaitForever);
+  memset(&table, 0, sizeof(table));
+  const bool loaded = load();
+  if (!loaded) {
+    log_info("Creating the flight index");
+    if (!create()) {
+      log_error("Creating the flight index failed!");
+      osMutexRelease(flash_mutex);
+      return;
+    }
+  }
+
+  /* After an update from a firmware without the index all flights are added, otherwise only the ones which were
+   * recovered by raw_partition_init() */
+  const uint32_t last = flight_counter > table.newest ? flight_counter : table.newest;
+  const uint32_t first = loaded ? table.newest + 1 : window_start(last);
+  for (uint32_t flight_number = first; flight_number <= last; ++flight_number) {
+    if (flight_exists(flight_number)) {
+      flight_stats_t stats;
+      add_flight(flight_number, read_stats(flight_number, &stats) ? &stats : NULL);
+    }
+  }
+  if (!loaded && !lfs_legacy_layout) {
+    /* the older flights don't fit into the index and would be overwritten by the raw partition anyway */
+    uint32_t flight_number = 0;
+    while ((flight_number = find_flight_before(first)) != 0) {
+      log_warn("Deleting flight %lu, it is too old for the flight index", flight_number);
+      if (!remove_flight(flight_number)) {
+        break;
+      }
+    }
+  }
+
+  update_raw_limit();
+  osMutexRelease(flash_mutex);
+  log_info("Flight index: %lu flights, newest %lu", flight_index_get_count(), table.newest);
+}
+
+bool flight_index_add(uint32_t flight_number, const flight_stats_t *stats) {
+  osMutexAcquire(flash_mutex, osWaitForever);
+  bool ok = false;
+  if (flight_number <= table.newest) {
+    log_error("Flight %lu is older than the newest indexed flight %lu", flight_number, table.newest);
+  } else {
+    ok = add_flight(flight_number, stats);
+    update_raw_limit();
+  }
+  osMutexRelease(flash_mutex);
+  return ok;
+}
+
+bool flight_index_get(uint32_t flight_number, flight_index_entry_t *entry) {
+  osMutexAcquire(flash_mutex, osWaitForever);
+  const bool found = is_indexed(flight_number) && read_entry(get_slot(flight_number)->pos - 1U, entry) &&
+                     entry->flight_number == flight_number && (entry->flags & FLIGHT_INDEX_FLAG_VALID);
+  osMutexRelease(flash_mutex);
+  return found;
+}
+
+bool flight_index_remove(uint32_t flight_number) {
+  osMutexAcquire(flash_mutex, osWaitForever);
+  bool ok = false;
+  if (is_indexed(flight_number)) {
+    ok = remove_flight(flight_number);
+    update_raw_limit();
+  }
+  osMutexRelease(flash_mutex);
+  return ok;
+}
+
+void flight_index_remove_all() {
+  osMutexAcquire(flash_mutex, osWaitForever);
+  for (uint32_t flight_number = window_start(table.newest); flight_number <= table.newest; ++flight_number) {
+    if (is_indexed(flight_number)) {
+      remove_flight(flight_number);
+    }
+  }
+  compact();
+  update_raw_limit();
+  osMutexRelease(flash_mutex);
+}
+
+uint32_t flight_index_get_oldest() {
+  for (uint32_t flight_number = window_start(table.newest); flight_number <= table.newest; ++flight_number) {
+    if (is_indexed(flight_number)) {
+      return flight_number;
+    }
+  }
+  return 0;
+}
+
+uint32_t flight_index_get_newest() {
+  for (uint32_t flight_number = table.newest; flight_number >= window_start(table.newest); --flight_number) {
+    if (is_indexed(flight_number)) {
+      return flight_number;
+    }
+  }
+  return 0;
+}
+
+uint32_t flight_index_get_count() {
+  uint32_t count = 0;
+  for (uint32_t i = 0; i < FLIGHT_INDEX_MAX_FLIGHTS; ++i) {
+    if (table.slots[i].pos != 0) {
+      ++count;
+    }
+  }
+  return count;
+}
+
+bool flight_index_apply_retention(uint32_t required) {
+  osMutexAcquire(flash_mutex, osWaitForever);
+  const bool ok = apply_retention(required);
+  osMutexRelease(flash_mutex);
+  return ok;
+}
+
+/** Private Function Definitions **/
+
+static bool apply_retention(uint32_t required) {
+  uint32_t next_extent = update_raw_limit();
+  /* without the raw partition the flights are LittleFS files, deleting them doesn't make room in a partition */
+  if (required == 0 || raw_partition_get_cursor() == 0) {
+    return true;
+  }
+  bool wrapped = false;
+  while (raw_partition_get_free() < required) {
+    /* The space up to the end can't be extended, the extents at the start of the partition are the oldest ones */
+    if (next_extent == UINT32_MAX && !wrapped) {
+      wrapped = raw_partition_wrap();
+      if (!wrapped) {
+        break;
+      }
+      log_info("Raw partition wrapped around");
+    } else {
+      const uint32_t oldest = flight_index_get_oldest();
+      if (oldest == 0) {
+        break;
+      }
+      log_info("Deleting flight %lu to make room for the next one", oldest);
+      remove_flight(oldest);
+    }
+    next_extent = update_raw_limit();
+  }
+
+  const uint32_t free = raw_partition_get_free();
+  if (free < required) {
+    log_warn("Only %lu KiB are free for the next flight", free / 1024);
+    return false;
+  }
+  return true;
+}
+
+/* Slots are cleared when their flight number falls out of the window, a used slot always belongs to the flight
+ * number in the window which maps to it */
+static bool is_indexed(uint32_t flight_number) {
+  return flight_number != 0 && flight_number <= table.newest &&
+         table.newest - flight_number < FLIGHT_INDEX_MAX_FLIGHTS && get_slot(flight_number)->pos != 0;
+}
+
+/* Replay the entries of the index file */
+static bool load() {
+  lfs_file_t file;
+  if (lfs_file_open(&lfs, &file, FLIGHT_INDEX_PATH, LFS_O_RDONLY) != LFS_ERR_OK) {
+    return false;
+  }
+  flight_index_header_t header = {};
+  if (lfs_file_read(&lfs, &file, &header, sizeof(header)) != sizeof(header) || header.magic != FLIGHT_INDEX_MAGIC ||
+      header.version != FLIGHT_INDEX_VERSION || header.entry_size != sizeof(flight_index_entry_t)) {
+    lfs_file_close(&lfs, &file);
+    log_warn("Invalid flight index, rebuilding it");
+    return false;
+  }
+
+  flight_index_entry_t entry;
+  uint32_t pos = 0;
+  bool torn = false;
+  while (lfs_file_read(&lfs, &file, &entry, sizeof(entry)) == sizeof(entry)) {
+    if (entry.crc != crc32_compute(&entry, offsetof(flight_index_entry_t, crc))) {
+      /* only the last append can be interrupted */
+      torn = true;
+      break;
+    }
+    apply_entry(&entry, pos);
+    ++pos;
+  }
+  lfs_file_close(&lfs, &file);
+  table.num_entries = pos;
+
+  /* nothing can be appended behind a broken entry */
+  if (torn) {
+    compact();
+  }
+  return true;
+}
+
+static bool create() {
+  lfs_file_t file;
+  int err = lfs_file_open(&lfs, &file, FLIGHT_INDEX_PATH, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC);
+  if (err != LFS_ERR_OK) {
+    return false;
+  }
+  const flight_index_header_t header = {
+      .magic = FLIGHT_INDEX_MAGIC, .version = FLIGHT_INDEX_VERSION, .entry_size = sizeof(flight_index_entry_t)};
+  const lfs_ssize_t written = lfs_file_write(&lfs, &file, &header, sizeof(header));
+  err = lfs_file_close(&lfs, &file);
+  table.num_entries = 0;
+  return written == sizeof(header) && err == LFS_ERR_OK;
+}
+
+/* Rewrite the file with the valid entries in the order of their flight number; the file is replaced atomically */
+static bool compact() {
+  lfs_file_t file;
+  if (lfs_file_open(&lfs, &file, FLIGHT_INDEX_TMP_PATH, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC) != LFS_ERR_OK) {
+    return false;
+  }
+  const flight_index_header_t header = {
+      .magic = FLIGHT_INDEX_MAGIC, .version = FLIGHT_INDEX_VERSION, .entry_size = sizeof(flight_index_entry_t)};
+  bool ok = lfs_file_write(&lfs, &file, &header, sizeof(header)) == sizeof(header);
+  const uint32_t first = window_start(table.newest);
+  for (uint32_t flight_number = first; ok && flight_number <= table.newest; ++flight_number) {
+    flight_index_entry_t entry;
+    if (!is_indexed(flight_number)) {
+      continue;
+    }
+    if (flight_index_get(flight_number, &entry)) {
+      ok = lfs_file_write(&lfs, &file, &entry, sizeof(entry)) == sizeof(entry);
+    } else {
+      /* the entry is lost, so is the flight */
+      memset(get_slot(flight_number), 0, sizeof(flight_index_slot_t));
+    }
+  }
+  ok = lfs_file_close(&lfs, &file) == LFS_ERR_OK && ok;
+  ok = ok && lfs_rename(&lfs, FLIGHT_INDEX_TMP_PATH, FLIGHT_INDEX_PATH) == LFS_ERR_OK;
+  if (!ok) {
+    log_error("Compacting the flight index failed!");
+    return false;
+  }
+
+  /* the entries were written in the same order */
+  uint32_t pos = 0;
+  for (uint32_t flight_number = first; flight_number <= table.newest; ++flight_number) {
+    if (is_indexed(flight_number)) {
+      get_slot(flight_number)->pos = (uint16_t)++pos;
+    }
+  }
+  table.num_entries = pos;
+  return true;
+}
+
+static void apply_entry(const flight_index_entry_t *entry, uint32_t pos) {
+  const uint32_t flight_number = entry->flight_number;
+  if (!(entry->flags & FLIGHT_INDEX_FLAG_VALID)) {
+    if (is_indexed(flight_number)) {
+      memset(get_slot(flight_number), 0, sizeof(flight_index_slot_t));
+    }
+    return;
+  }
+  if (flight_number > table.newest) {
+    /* the slots of the flight numbers in between now belong to numbers which were never added */
+    const uint32_t gap = flight_number - table.newest - 1;
+    const uint32_t num_cleared = gap < FLIGHT_INDEX_MAX_FLIGHTS ? gap : FLIGHT_INDEX_MAX_FLIGHTS;
+    for (uint32_t i = 1; i <= num_cleared; ++i) {
+      memset(get_slot(table.newest + i), 0, sizeof(flight_index_slot_t));
+    }
+    table.newest = flight_number;
+  } else if (table.newest - flight_number >= FLIGHT_INDEX_MAX_FLIGHTS) {
+    return;
+  }
+  flight_index_slot_t *slot = get_slot(flight_number);
+  slot->pos = (uint16_t)(pos + 1);
+  slot->sector = (entry->flags & FLIGHT_INDEX_FLAG_RAW) ? (uint16_t)(entry->address / w25q.sector_size) : 0;
+}
+
+static bool read_entry(uint32_t pos, flight_index_entry_t *entry) {
+  lfs_file_t file;
+  if (lfs_file_open(&lfs, &file, FLIGHT_INDEX_PATH, LFS_O_RDONLY) != LFS_ERR_OK) {
+    return false;
+  }
+  const lfs_soff_t offset = (lfs_soff_t)(sizeof(flight_index_header_t) + pos * sizeof(*entry));
+  const bool ok = lfs_file_seek(&lfs, &file, offset, LFS_SEEK_SET) == offset &&
+                  lfs_file_read(&lfs, &file, entry, sizeof(*entry)) == sizeof(*entry) &&
+                  entry->crc == crc32_compute(entry, offsetof(flight_index_entry_t, crc));
+  lfs_file_close(&lfs, &file);
+  return ok;
+}
+
+/* Append an entry and apply it to the table */
+static bool append_entry(flight_index_entry_t *entry) {
+  entry->crc = crc32_compute(entry, offsetof(flight_index_entry_t, crc));
+  lfs_file_t file;
+  int err = lfs_file_open(&lfs, &file, FLIGHT_INDEX_PATH, LFS_O_WRONLY | LFS_O_APPEND);
+  if (err == LFS_ERR_OK) {
+    const lfs_ssize_t written = lfs_file_write(&lfs, &file, entry, sizeof(*entry));
+    err = lfs_file_close(&lfs, &file);
+    if (written != sizeof(*entry)) {
+      err = written < 0 ? (int)written : LFS_ERR_NOSPC;
+    }
+  }
+  if (err != LFS_ERR_OK) {
+    log_error("Writing the flight index failed: %d", err);
+    return false;
+  }
+  apply_entry(entry, table.num_entries);
+  ++table.num_entries;
+  if (table.num_entries >= FLIGHT_INDEX_COMPACT_ENTRIES) {
+    compact();
+  }
+  return true;
+}
+
+static bool add_flight(uint32_t flight_number, const flight_stats_t *stats) {
+  /* make room in the window */
+  const uint32_t first = window_start(table.newest);
+  for (uint32_t old = first; old <= table.newest && flight_number - old >= FLIGHT_INDEX_MAX_FLIGHTS; ++old) {
+    if (is_indexed(old)) {
+      log_warn("Deleting flight %lu, only the last %u flights are kept", old, FLIGHT_INDEX_MAX_FLIGHTS);
+      remove_flight(old);
+    }
+  }
+
+  flight_index_entry_t entry = {.flight_number = flight_number, .flags = FLIGHT_INDEX_FLAG_VALID};
+  flight_file_t ff;
+  if (flight_file_open(&ff, flight_number) != LFS_ERR_OK) {
+    log_error("Flight %lu can't be indexed, it doesn't exist", flight_number);
+    return false;
+  }
+  const lfs_ssize_t size = flight_file_size(&ff);
+  entry.size = size > 0 ? (uint32_t)size : 0;
+  if (ff.extent.magic == RAW_EXTENT_REF_MAGIC) {
+    entry.flags |= FLIGHT_INDEX_FLAG_RAW;
+    entry.address = ff.extent.address;
+  }
+  flight_file_close(&ff);
+
+  if (stats != NULL && stats->entered_states != 0) {
+    entry.flags |= FLIGHT_INDEX_FLAG_STATS;
+    entry.liftoff_ts = stats->liftoff_ts;
+    entry.max_height = stats->max_height.val;
+    entry.max_velocity = stats->max_velocity.val;
+    entry.max_acceleration = stats->max_acceleration.val;
+  }
+  return append_entry(&entry);
+}
+
+/* The files go first; if this is interrupted, the flight is still indexed and deleted again later */
+static bool remove_flight(uint32_t flight_number) {
+  char filename[MAX_FILENAME_SIZE] = {};
+  snprintf(filename, MAX_FILENAME_SIZE, "flights/flight_%05lu", flight_number);
+  int err = lfs_remove(&lfs, filename);
+  snprintf(filename, MAX_FILENAME_SIZE, "stats/stats_%05lu", flight_number);
+  const int stats_err = lfs_remove(&lfs, filename);
+  if ((err != LFS_ERR_OK && err != LFS_ERR_NOENT) || (stats_err != LFS_ERR_OK && stats_err != LFS_ERR_NOENT)) {
+    log_error("Deleting flight %lu failed: %d", flight_number, err != LFS_ERR_OK ? err : stats_err);
+    return false;
+  }
+  if (!is_indexed(flight_number)) {
+    return true;
+  }
+  flight_index_entry_t entry = {.flight_number = flight_number, .flags = 0};
+  return append_entry(&entry);
+}
+
+static bool flight_exists(uint32_t flight_number) {
+  char filename[MAX_FILENAME_SIZE] = {};
+  snprintf(filename, MAX_FILENAME_SIZE, "flights/flight_%05lu", flight_number);
+  struct lfs_info info;
+  return lfs_stat(&lfs, filename, &info) == LFS_ERR_OK && info.type == LFS_TYPE_REG;
+}
+
+/**
+ * Find a flight file with a number below `flight_number`.
+ *
+ * @param flight_number - number of the first flight which is not looked for
+ * @return flight number; 0 if there is none
+ */
+static uint32_t find_flight_before(uint32_t flight_number) {
+  lfs_dir_t dir;
+  if (lfs_dir_open(&lfs, &dir, "flights") != LFS_ERR_OK) {
+    return 0;
+  }
+  uint32_t found = 0;
+  struct lfs_info info;
+  while (found == 0 && lfs_dir_read(&lfs, &dir, &info) > 0) {
+    unsigned long number = 0;
+    if (info.type == LFS_TYPE_REG && sscanf(info.name, "flight_%lu", &number) == 1 && number > 0 &&
+        number < flight_number) {
+      found = number;
+    }
+  }
+  lfs_dir_close(&lfs, &dir);
+  return found;
+}
+
+static bool read_stats(uint32_t flight_number, flight_stats_t *stats) {
+  char filename[MAX_FILENAME_SIZE] = {};
+  snprintf(filename, MAX_FILENAME_SIZE, "stats/stats_%05lu", flight_number);
+  lfs_file_t file;
+  if (lfs_file_open(&lfs, &file, filename, LFS_O_RDONLY) != LFS_ERR_OK) {
+    return false;
+  }
+  flight_stats_file_header_t header = {};
+  const bool ok = lfs_file_read(&lfs, &file, &header, sizeof(header)) == sizeof(header) &&
+                  header.magic == FLIGHT_STATS_MAGIC && header.version == FLIGHT_STATS_VERSION &&
+                  header.flight_stats_size == sizeof(*stats) &&
+                  lfs_file_read(&lfs, &file, stats, sizeof(*stats)) == sizeof(*stats);
+  lfs_file_close(&lfs, &file);
+  return ok;
+}
+
+/**
+ * Limit the raw partition to the space in front of the next extent which is still in use.
+ *
+ * @return start of that extent; UINT32_MAX if there is none up to the end of the partition
+ */
+static uint32_t update_raw_limit() {
+  const uint32_t cursor = raw_partition_get_cursor();
+  if (cursor == 0) {
+    return UINT32_MAX;
+  }
+  uint32_t limit = UINT32_MAX;
+  for (uint32_t i = 0; i < FLIGHT_INDEX_MAX_FLIGHTS; ++i) {
+    const uint32_t extent = table.slots[i].sector * w25q.sector_size;
+    if (table.slots[i].pos != 0 && table.slots[i].sector != 0 && extent >= cursor && extent < limit) {
+      limit = extent;
+    }
+  }
+  raw_partition_set_limit(limit);
+  return limit;
+}
@@ -0,0 +1,138 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Index of the recorded flights.
+ *
+ * The file flight_index holds a flight_index_header_t followed by one flight_index_entry_t per change: adding a flight
+ * appends an entry with FLIGHT_INDEX_FLAG_VALID, deleting it appends one without. The file is only ever appended to
+ * and rewritten once it holds more than twice the maximum number of flights. At boot the entries are replayed into a
+ * table in RAM which maps every flight number to its entry, so a flight is found without walking the flights
+ * directory and reading its files.
+ *
+ * Only the last FLIGHT_INDEX_MAX_FLIGHTS flight numbers are kept, adding a flight deletes the flights which fall out
+ * of this window. On top of that flight_index_apply_retention() deletes the oldest flights until the raw partition has
+ * room for the next one. The raw partition is used as a ring (see lfs/raw_partition.h); the extents ahead of the
+ * write position belong to the oldest flights, so deleting them in order of their number frees contiguous space.
+ *
+ * The index has to be initialized after raw_partition_init() and again whenever LittleFS is formatted. The functions
+ * which read or change the file hold flash_mutex, so the recorder and the CLI can use the index at the same time.
+ */
+
+#pragma once
+
+#include "util/flight_stats.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Exported Defines **/
+
+#define FLIGHT_INDEX_MAGIC   0x58444943U /* "CIDX" */
+#define FLIGHT_INDEX_VERSION 1
+
+/* Has to be a power of two */
+#define FLIGHT_INDEX_MAX_FLIGHTS 128
+
+#define FLIGHT_INDEX_FLAG_VALID 0x0001U /* the flight exists; an entry without this flag deletes the flight */
+#define FLIGHT_INDEX_FLAG_RAW   0x0002U /* the flight log is stored in the raw partition */
+#define FLIGHT_INDEX_FLAG_STATS 0x0004U /* a liftoff was detected, the summary below is set */
+
+/** Exported Types **/
+
+typedef struct {
+  uint32_t magic;      /* FLIGHT_INDEX_MAGIC */
+  uint16_t version;    /* FLIGHT_INDEX_VERSION */
+  uint16_t entry_size; /* sizeof(flight_index_entry_t) */
+} flight_index_header_t;
+
+typedef struct {
+  uint32_t flight_number;
+  uint32_t flags;   /* FLIGHT_INDEX_FLAG_* */
+  uint32_t address; /* flash address of the first flight log byte if FLIGHT_INDEX_FLAG_RAW is set */
+  uint32_t size;    /* size of the flight log in bytes */
+  /* summary of the flight stats, see util/flight_stats.h */
+  timestamp_t liftoff_ts;
+  float max_height;
+  float max_velocity;
+  float max_acceleration;
+  uint32_t crc; /* CRC32 of the fields above */
+} flight_index_entry_t;
+
+/** Exported Functions **/
+
+/**
+ * Load the index; it is rebuilt from the flights directory if it doesn't exist yet. Flights which are not indexed,
+ * e.g. one recovered by raw_partition_init(), are added.
+ */
+void flight_index_init();
+
+/**
+ * Add a flight which was just recorded; flights which fall out of the index window are deleted.
+ *
+ * @param flight_number - number of the flight, has to be larger than the number of all indexed flights
+ * @param stats - flight statistics, NULL if there are none
+ * @return true if successful
+ */
+bool flight_index_add(uint32_t flight_number, const flight_stats_t *stats);
+
+/**
+ * Look up a flight in constant time.
+ *
+ * @param flight_number - number of the flight
+ * @param entry[out] - index entry
+ * @return true if the flight exists
+ */
+bool flight_index_get(uint32_t flight_number, flight_index_entry_t *entry);
+
+/**
+ * Delete a flight together with its stats file.
+ *
+ * @param flight_number - number of the flight
+ * @return true if successful
+ */
+bool flight_index_remove(uint32_t flight_number);
+
+/**
+ * Delete all flights.
+ */
+void flight_index_remove_all();
+
+/**
+ * @return number of the oldest flight, 0 if there is none
+ */
+uint32_t flight_index_get_oldest();
+
+/**
+ * @return number of the newest flight, 0 if there is none
+ */
+uint32_t flight_index_get_newest();
+
+/**
+ * @return number of indexed flights
+ */
+uint32_t flight_index_get_count();
+
+/**
+ * Delete the oldest flights until the raw partition has `required` contiguous bytes for the next flight. Moves the
+ * write position of the raw partition back to its start once the end is reached.
+ *
+ * @param required - expected size of the next flight in bytes; 0 disables the deletion
+ * @return true if the space is available
+ */
+bool flight_index_apply_retention(uint32_t required);
@@ -17,24 +17,39 @@
  */
 
 #include "lfs.h"
+#include "lfs/lfs_custom.h"
+#include "lfs/raw_partition.h"
+#include "lfs/erase_map.h"
 #include "drivers/w25q.h"
 #include "cli/cli.h"
 
+#include <stdio.h>
+
 static int w25q_lfs_read(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, void *buffer, lfs_size_t size);
 static int w25q_lfs_prog(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, const void *buffer,
                          lfs_size_t size);
 static int w25q_lfs_erase(const struct lfs_config *c, lfs_block_t block);
 static int w25q_lfs_sync(const struct lfs_config *c);
+static int w25q_lfs_lock(const struct lfs_config *c);
+static int w25q_lfs_unlock(const struct lfs_config *c);
+
+/* LittleFS is used by task_recorder, task_rec_writer and the CLI; every API call takes flash_mutex */
+#ifndef LFS_THREADSAFE
+#error "LittleFS has to be built with LFS_THREADSAFE"
+#endif
 
 #define LFS_CACHE_SIZE     512
 #define LFS_LOOKAHEAD_SIZE 512
 
+/* Before the raw partition existed LittleFS spanned the whole flash, 8k sectors of the 256 Mbit flash */
+#define LFS_LEGACY_BLOCK_COUNT 8192
+
 /* LFS Static Buffers */
 static uint8_t read_buffer[LFS_CACHE_SIZE] = {};
 static uint8_t prog_buffer[LFS_CACHE_SIZE] = {};
 static uint8_t lookahead_buffer[LFS_LOOKAHEAD_SIZE] = {};
 
-/* File System Handle  -- NOT THREAD-SAFE!!! */
+/* File System Handle, thread-safe through w25q_lfs_lock() */
 lfs_t lfs;
 const struct lfs_config lfs_cfg = {
     // block device operations
@@ -42,13 +57,15 @@ const struct lfs_config lfs_cfg = {
     .prog = w25q_lfs_prog,
     .erase = w25q_lfs_erase,
     .sync = w25q_lfs_sync,
+    .lock = w25q_lfs_lock,
+    .unlock = w25q_lfs_unlock,
 
     // block device configuration
     .read_size = 256,
     .prog_size = 256,
     .block_size = 4096,
-    // 8k pages for 256 Mbit flash
-    .block_count = 8192,
+    // the rest of the flash is the raw flight partition
+    .block_count = RAW_PARTITION_FIRST_SECTOR,
     .cache_size = LFS_CACHE_SIZE,
     .lookahead_size = LFS_LOOKAHEAD_SIZE,
     .block_cycles = 500,
@@ -56,11 +73,108 @@ const struct lfs_config lfs_cfg = {
     .prog_buffer = prog_buffer,
     .lookahead_buffer = lookahead_buffer};
 
+/* The old layout, only used to keep the flights of a flash which was written by an older firmware */
+static const struct lfs_config lfs_legacy_cfg = {
+    .read = w25q_lfs_read,
+    .prog = w25q_lfs_prog,
+    .erase = w25q_lfs_erase,
+    .sync = w25q_lfs_sync,
+    .lock = w25q_lfs_lock,
+    .unlock = w25q_lfs_unlock,
+    .read_size = 256,
+    .prog_size = 256,
+    .block_size = 4096,
+    .block_count = LFS_LEGACY_BLOCK_COUNT,
+    .cache_size = LFS_CACHE_SIZE,
+    .lookahead_size = LFS_LOOKAHEAD_SIZE,
+    .block_cycles = 500,
+    .read_buffer = read_buffer,
+    .prog_buffer = prog_buffer,
+    .lookahead_buffer = lookahead_buffer};
+
+bool lfs_legacy_layout = false;
+
 char cwd[256] = {};
 
 uint32_t flight_counter = 0;
 lfs_file_t fc_file;
 
+osMutexId_t flash_mutex;
+
+int save_flight_counter() {
+  /* fc_file is shared, the whole sequence has to be atomic */
+  osMutexAcquire(flash_mutex, osWaitForever);
+  int err = lfs_file_open(&lfs, &fc_file, "flight_counter", LFS_O_RDWR | LFS_O_CREAT);
+  if (err == 0) {
+    lfs_file_rewind(&lfs, &fc_file);
+    lfs_file_write(&lfs, &fc_file, &flight_counter, sizeof(flight_counter));
+    err = lfs_file_close(&lfs, &fc_file);
+  }
+  osMutexRelease(flash_mutex);
+  return err;
+}
+
+uint32_t lfs_get_free_space() {
+  /* the mounted layout, which is the old one until the flash was repartitioned */
+  const struct lfs_config *cfg = lfs.cfg;
+  const lfs_ssize_t used_blocks = lfs_fs_size(&lfs);
+  if (cfg == NULL || used_blocks < 0 || (lfs_size_t)used_blocks >= cfg->block_count) {
+    return 0;
+  }
+  return (cfg->block_count - (lfs_size_t)used_blocks) * cfg->block_size;
+}
+
+int lfs_mount_legacy() {
+  lfs_legacy_layout = false;
+  /* the old file system might use any sector, the raw partition must not be set up next to it */
+  if (w25q.sector_count < LFS_LEGACY_BLOCK_COUNT) {
+    return LFS_ERR_INVAL;
+  }
+  const int err = lfs_mount(&lfs, &lfs_legacy_cfg);
+  lfs_legacy_layout = err == 0;
+  return err;
+}
+
+bool lfs_has_recordings() {
+  static const char *const dirs[] = {"flights", "stats"};
+  for (uint32_t i = 0; i < sizeof(dirs) / sizeof(dirs[0]); ++i) {
+    lfs_dir_t dir;
+    if (lfs_dir_open(&lfs, &dir, dirs[i]) != 0) {
+      continue;
+    }
+    struct lfs_info info;
+    bool found = false;
+    while (!found && lfs_dir_read(&lfs, &dir, &info) > 0) {
+      found = info.type == LFS_TYPE_REG;
+    }
+    lfs_dir_close(&lfs, &dir);
+    if (found) {
+      return true;
+    }
+  }
+  return false;
+}
+
+int lfs_repartition() {
+  /* nothing else may use the file system in between */
+  osMutexAcquire(flash_mutex, osWaitForever);
+  lfs_unmount(&lfs);
+  lfs_legacy_layout = false;
+  int err = lfs_format(&lfs, &lfs_cfg);
+  if (err == 0) {
+    err = lfs_mount(&lfs, &lfs_cfg);
+  }
+  if (err == 0) {
+    raw_partition_format();
+    lfs_mkdir(&lfs, "flights");
+    lfs_mkdir(&lfs, "stats");
+    /* the flight numbers continue where the old layout stopped */
+    err = save_flight_counter();
+  }
+  osMutexRelease(flash_mutex);
+  return err;
+}
+
 int lfs_ls(const char *path) {
   lfs_dir_t dir;
   int err = lfs_dir_open(&lfs, &dir, path);
@@ -92,6 +206,15 @@ int lfs_ls(const char *path) {
     }
 
     static const char *prefixes[] = {"", "K", "M", "G"};
+    if (info.type == LFS_TYPE_REG && info.size == sizeof(raw_extent_ref_t)) {
+      /* show the size of flights which are stored in the raw partition */
+      char file_path[sizeof(cwd) + LFS_NAME_MAX + 2];
+      raw_extent_ref_t ref;
+      snprintf(file_path, sizeof(file_path), "%s/%s", path, info.name);
+      if (raw_partition_read_ref(file_path, &ref)) {
+        info.size = ref.length;
+      }
+    }
     if (info.type == LFS_TYPE_REG) {
       for (int i = sizeof(prefixes) / sizeof(prefixes[0]) - 1; i >= 0; i--) {
         if (info.size >= (1 << 10 * i) - 1) {
@@ -115,7 +238,10 @@ int lfs_ls(const char *path) {
 }
 
 static int w25q_lfs_read(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, void *buffer, lfs_size_t size) {
-  if (w25q_read_buffer((uint8_t *)buffer, block * (w25q.sector_size) + off, size) == W25Q_OK) {
+  osMutexAcquire(flash_mutex, osWaitForever);
+  const w25q_status_e status = w25q_read_buffer((uint8_t *)buffer, block * (w25q.sector_size) + off, size);
+  osMutexRelease(flash_mutex);
+  if (status == W25Q_OK) {
     return 0;
   }
   return LFS_ERR_CORRUPT;
@@ -124,7 +250,7 @@ static int w25q_lfs_prog(const struct lfs_config *c, lfs_block_t block, lfs_off_
                          lfs_size_t size) {
   static uint32_t sync_counter = 0;
   static uint32_t sync_counter_err = 0;
-  if (w25q_write_buffer((uint8_t *)buffer, block * (w25q.sector_size) + off, size) == W25Q_OK) {
+  if (erase_map_write((const uint8_t *)buffer, block * (w25q.sector_size) + off, size) == W25Q_OK) {
     if (sync_counter % 32 == 0) {
       /* Flash the LED at certain intervals */
       HAL_GPIO_TogglePin(LED1_GPIO_Port, LED1_Pin);
@@ -140,9 +266,24 @@ static int w25q_lfs_prog(const struct lfs_config *c, lfs_block_t block, lfs_off_
   return LFS_ERR_CORRUPT;
 }
 static int w25q_lfs_erase(const struct lfs_config *c, lfs_block_t block) {
-  if (w25q_sector_erase(block) == W25Q_OK) {
+  /* blocks which were erased ahead of time are not erased again */
+  if (erase_map_erase_sector(block) == W25Q_OK) {
     return 0;
   }
   return LFS_ERR_CORRUPT;
 }
-static int w25q_lfs_sync(const struct lfs_config *c) { return 0; }
\ No newline at end of file
+static int w25q_lfs_sync(const struct lfs_config *c) {
+  /* the last program or erase operation might still be running */
+  osMutexAcquire(flash_mutex, osWaitForever);
+  const w25q_status_e status = w25q_sync();
+  osMutexRelease(flash_mutex);
+  return status == W25Q_OK ? 0 : LFS_ERR_IO;
+}
+/* flash_mutex is recursive, the block device callbacks take it again */
+static int w25q_lfs_lock(const struct lfs_config *c) {
+  return osMutexAcquire(flash_mutex, osWaitForever) == osOK ? 0 : LFS_ERR_IO;
+}
+static int w25q_lfs_unlock(const struct lfs_config *c) {
+  osMutexRelease(flash_mutex);
+  return 0;
+}
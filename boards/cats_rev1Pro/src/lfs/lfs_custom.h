@@ -19,21 +19,61 @@
 #pragma once
 
 #include "lfs.h"
+#include "cmsis_os.h"
 
 /* TODO: Wrap lfs functions where you always pass this lfs variable instead of making it visible globally */
 extern lfs_t lfs;
 extern const struct lfs_config lfs_cfg;
 
+/* Set while LittleFS still spans the whole flash like before the raw partition existed, see lfs_mount_legacy() */
+extern bool lfs_legacy_layout;
+
 extern lfs_file_t fc_file;
 
 extern char cwd[256];
 
 extern uint32_t flight_counter;
 
+/* Serializes every LittleFS API call (LFS_THREADSAFE) and the flash accesses of the raw flight partition
+ * (lfs/raw_partition.h); recursive */
+extern osMutexId_t flash_mutex;
+
 /**
  * List the contents of the directory
  *
  * @param path - path to the directory
  * @return 0 if no error
  */
-int lfs_ls(const char *path);
\ No newline at end of file
+int lfs_ls(const char *path);
+/**
+ * Store flight_counter in the flight_counter file
+ *
+ * @return 0 if no error
+ */
+int save_flight_counter();
+/**
+ * Get the free space of the file system. This walks the whole file system and takes a while on a full flash.
+ *
+ * @return free space in bytes; 0 on error
+ */
+uint32_t lfs_get_free_space();
+/**
+ * Mount a file system which was created before the raw partition existed and spans the whole flash. Its flights are
+ * kept and new flights go to LittleFS files until lfs_repartition() is called, e.g. by erase_recordings().
+ *
+ * @return 0 if mounted, sets lfs_legacy_layout
+ */
+int lfs_mount_legacy();
+/**
+ * Check whether a flight log or a stats file is stored in LittleFS.
+ *
+ * @return true if there is at least one file in the flights or stats directory
+ */
+bool lfs_has_recordings();
+/**
+ * Format LittleFS in front of the raw partition and format the raw partition. All files are lost, the flight counter
+ * is kept. The flight index has to be initialized again afterwards.
+ *
+ * @return 0 if no error
+ */
+int lfs_repartition();
@@ -0,0 +1,515 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "lfs/raw_partition.h"
+#include "lfs/lfs_custom.h"
+#include "lfs/erase_map.h"
+#include "lfs/flight_index.h"
+#include "drivers/w25q.h"
+#include "util/crc32.h"
+#include "util/log.h"
+#include "util/log_format.h"
+#include "util/recorder.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+/** Private Constants **/
+
+/* The header takes a whole block so that the flight log blocks never cross a page boundary */
+#define RAW_EXTENT_HEADER_SIZE LOG_BLOCK_SIZE
+
+/** Private Types **/
+
+typedef struct {
+  bool valid;           /* the partition table matches this firmware */
+  uint32_t generation;  /* generation of the partition table */
+  uint32_t start;       /* address of the first extent */
+  uint32_t end;         /* end of the flash */
+  uint32_t limit;       /* start of the next extent which is still in use after the cursor, otherwise the end */
+  uint32_t cursor;      /* write position of the open extent, otherwise the start of the next one */
+  uint32_t erased_till; /* the flash is erased from the cursor up to here */
+  bool open;
+  uint32_t extent_addr; /* address of the open extent */
+  uint32_t flight_number;
+} raw_partition_t;
+
+/** Private Variables **/
+
+/* Protected by flash_mutex */
+static raw_partition_t raw = {};
+
+/** Private Function Declarations **/
+
+static inline uint32_t align_to_sector(uint32_t addr) {
+  return (addr + w25q.sector_size - 1) / w25q.sector_size * w25q.sector_size;
+}
+static bool flash_available();
+static bool read_extent_header(uint32_t addr, raw_extent_header_t *header);
+static bool is_extent_closed(uint32_t addr, const raw_extent_header_t *header);
+static uint32_t find_extent_end(uint32_t addr);
+static bool close_extent(uint32_t addr, uint32_t length);
+static bool register_extent(uint32_t flight_number, uint32_t addr, uint32_t length);
+static bool erase_next_sector();
+static bool erase_next_block();
+static bool ensure_erased(uint32_t until);
+
+/** Exported Function Definitions **/
+
+bool raw_partition_check_layout() {
+  raw.valid = false;
+  if (!flash_available()) {
+    return false;
+  }
+  raw_partition_table_t table = {};
+  osMutexAcquire(flash_mutex, osWaitForever);
+  const w25q_status_e status =
+      w25q_read_buffer((uint8_t *)&table, RAW_PARTITION_FIRST_SECTOR * w25q.sector_size, sizeof(table));
+  osMutexRelease(flash_mutex);
+  if (status != W25Q_OK || table.magic != RAW_PARTITION_MAGIC ||
+      table.crc != crc32_compute(&table, offsetof(raw_partition_table_t, crc)) ||
+      table.version != RAW_PARTITION_VERSION || table.first_sector != RAW_PARTITION_FIRST_SECTOR) {
+    return false;
+  }
+  raw.valid = true;
+  raw.generation = table.generation;
+  raw.start = (RAW_PARTITION_FIRST_SECTOR + 1) * w25q.sector_size;
+  raw.end = w25q.sector_count * w25q.sector_size;
+  raw.limit = raw.end;
+  raw.cursor = raw.start;
+  raw.erased_till = raw.start;
+  raw.open = false;
+  return true;
+}
+
+bool raw_partition_format() {
+  /* the sectors of the partition still belong to the old file system, see lfs_mount_legacy() */
+  if (lfs_legacy_layout) {
+    log_error("The flash still has the old layout, the raw partition can't be formatted!");
+    return false;
+  }
+  osMutexAcquire(flash_mutex, osWaitForever);
+  /* extents of the previous generation are ignored even if their headers are still on the flash */
+  const uint32_t generation = raw_partition_check_layout() ? raw.generation + 1 : 1;
+  raw.valid = false;
+  if (!flash_available()) {
+    osMutexRelease(flash_mutex);
+    return false;
+  }
+  raw_partition_table_t table = {.magic = RAW_PARTITION_MAGIC,
+                                 .version = RAW_PARTITION_VERSION,
+                                 .first_sector = RAW_PARTITION_FIRST_SECTOR,
+                                 .generation = generation,
+                                 .crc = 0};
+  table.crc = crc32_compute(&table, offsetof(raw_partition_table_t, crc));
+
+  const bool ok =
+      erase_map_erase_sector(RAW_PARTITION_FIRST_SECTOR) == W25Q_OK &&
+      erase_map_write((const uint8_t *)&table, RAW_PARTITION_FIRST_SECTOR * w25q.sector_size, sizeof(table)) ==
+          W25Q_OK &&
+      raw_partition_check_layout();
+  osMutexRelease(flash_mutex);
+  if (!ok) {
+    log_error("Formatting the raw partition failed!");
+  }
+  return ok;
+}
+
+void raw_partition_init() {
+  if (!raw.valid) {
+    return;
+  }
+  uint32_t addr = raw.start;
+  uint32_t num_extents = 0;
+  uint32_t last_flight_number = 0;
+  raw_extent_header_t header;
+  /* Once the partition wrapped around, the newer extents at its start are followed by older ones */
+  while (addr < raw.end && read_extent_header(addr, &header) && header.flight_number > last_flight_number) {
+    if (!is_extent_closed(addr, &header)) {
+      header.length = find_extent_end(addr);
+      log_warn("Recording of flight %lu was interrupted, recovered %lu bytes", header.flight_number, header.length);
+      register_extent(header.flight_number, addr, header.length);
+      close_extent(addr, header.length);
+    }
+    /* the flight number of an interrupted recording was never stored */
+    if (header.flight_number > flight_counter) {
+      flight_counter = header.flight_number;
+      save_flight_counter();
+    }
+    ++num_extents;
+    last_flight_number = header.flight_number;
+    addr = align_to_sector(addr + RAW_EXTENT_HEADER_SIZE + header.length);
+  }
+  raw.cursor = addr < raw.end ? addr : raw.end;
+  raw.erased_till = raw.cursor;
+  log_info("Raw partition: %lu flights, %lu KiB free", num_extents, raw_partition_get_free() / 1024);
+}
+
+bool raw_partition_open(uint32_t flight_number) {
+  osMutexAcquire(flash_mutex, osWaitForever);
+  if (!raw.valid || raw.open) {
+    osMutexRelease(flash_mutex);
+    return false;
+  }
+  const uint32_t addr = align_to_sector(raw.cursor);
+  if (addr + RAW_EXTENT_HEADER_SIZE + LOG_BLOCK_SIZE > raw.limit) {
+    osMutexRelease(flash_mutex);
+    log_error("The raw partition is full!");
+    return false;
+  }
+  raw.cursor = addr;
+  if (!ensure_erased(addr + RAW_EXTENT_HEADER_SIZE + LOG_BLOCK_SIZE)) {
+    osMutexRelease(flash_mutex);
+    return false;
+  }
+
+  raw_extent_header_t header = {
+      .magic = RAW_EXTENT_MAGIC, .generation = raw.generation, .flight_number = flight_number, .crc = 0};
+  header.crc = crc32_compute(&header, offsetof(raw_extent_header_t, crc));
+  /* the length stays erased until the extent is closed */
+  const w25q_status_e status = erase_map_write((const uint8_t *)&header, addr, offsetof(raw_extent_header_t, length));
+  /* the header area can't be used again, even if the write failed */
+  raw.cursor = addr + RAW_EXTENT_HEADER_SIZE;
+  if (status == W25Q_OK) {
+    raw.open = true;
+    raw.extent_addr = addr;
+    raw.flight_number = flight_number;
+  }
+  osMutexRelease(flash_mutex);
+  if (status != W25Q_OK) {
+    log_error("Writing the extent header failed: %d", status);
+    return false;
+  }
+  return true;
+}
+
+bool raw_partition_append(const uint8_t *data, uint32_t len) {
+  osMutexAcquire(flash_mutex, osWaitForever);
+  bool ok = raw.open && raw.cursor + len <= raw.limit;
+  /* the erased block after the data marks the end of the extent if the recording is interrupted */
+  if (ok && ensure_erased(raw.cursor + len + LOG_BLOCK_SIZE)) {
+    ok = erase_map_write(data, raw.cursor, len) == W25Q_OK;
+    /* a failed write may still have programmed some bits, don't write there again */
+    raw.cursor += len;
+  } else {
+    ok = false;
+  }
+  osMutexRelease(flash_mutex);
+  return ok;
+}
+
+bool raw_partition_close() {
+  osMutexAcquire(flash_mutex, osWaitForever);
+  if (!raw.open) {
+    osMutexRelease(flash_mutex);
+    return false;
+  }
+  raw.open = false;
+  const uint32_t length = raw.cursor - raw.extent_addr - RAW_EXTENT_HEADER_SIZE;
+  raw.cursor = align_to_sector(raw.cursor);
+  /* The file is created first; if the recorder is interrupted before the extent is closed, the extent is recovered
+   * at the next boot and the file is overwritten */
+  const bool ok = register_extent(raw.flight_number, raw.extent_addr, length) &&
+                  close_extent(raw.extent_addr, length) && w25q_sync() == W25Q_OK;
+  osMutexRelease(flash_mutex);
+  return ok;
+}
+
+bool raw_partition_erase_ahead(uint32_t headroom) {
+  osMutexAcquire(flash_mutex, osWaitForever);
+  bool done = false;
+  if (raw.valid) {
+    const uint32_t target = raw.limit - raw.cursor > headroom ? raw.cursor + headroom : raw.limit;
+    /* the erasures run in the background, only start the next one when the previous is done */
+    if (raw.erased_till < target && !w25q_is_busy()) {
+      /* a 64 KiB block erases about four times faster than its sectors one by one */
+      if (raw.erased_till % w25q.block_size == 0 && target - raw.erased_till >= w25q.block_size) {
+        erase_next_block();
+      } else {
+        erase_next_sector();
+      }
+    }
+    done = raw.erased_till >= target;
+  }
+  osMutexRelease(flash_mutex);
+  return done;
+}
+
+uint32_t raw_partition_get_free() {
+  osMutexAcquire(flash_mutex, osWaitForever);
+  const uint32_t free = raw.valid && raw.limit > raw.cursor ? raw.limit - raw.cursor : 0;
+  osMutexRelease(flash_mutex);
+  return free;
+}
+
+uint32_t raw_partition_get_erased() {
+  osMutexAcquire(flash_mutex, osWaitForever);
+  const uint32_t erased = raw.valid && raw.erased_till > raw.cursor ? raw.erased_till - raw.cursor : 0;
+  osMutexRelease(flash_mutex);
+  return erased;
+}
+
+uint32_t raw_partition_get_cursor() {
+  osMutexAcquire(flash_mutex, osWaitForever);
+  const uint32_t cursor = raw.valid ? raw.cursor : 0;
+  osMutexRelease(flash_mutex);
+  return cursor;
+}
+
+uint32_t raw_partition_get_scratch(uint32_t size) {
+  osMutexAcquire(flash_mutex, osWaitForever);
+  uint32_t addr = 0;
+  if (raw.valid && !raw.open) {
+    const uint32_t start = (raw.cursor + w25q.block_size - 1) / w25q.block_size * w25q.block_size;
+    if (start <= raw.limit && raw.limit - start >= size) {
+      addr = start;
+      /* the caller doesn't leave the space erased */
+      raw.erased_till = raw.cursor;
+    }
+  }
+  osMutexRelease(flash_mutex);
+  return addr;
+}
+
+void raw_partition_set_limit(uint32_t limit) {
+  osMutexAcquire(flash_mutex, osWaitForever);
+  raw.limit = limit < raw.end ? limit : raw.end;
+  osMutexRelease(flash_mutex);
+}
+
+bool raw_partition_wrap() {
+  osMutexAcquire(flash_mutex, osWaitForever);
+  const bool ok = raw.valid && !raw.open;
+  if (ok) {
+    raw.cursor = raw.start;
+    raw.erased_till = raw.start;
+    /* nothing may be overwritten until the caller knows which extents are still in use */
+    raw.limit = raw.start;
+  }
+  osMutexRelease(flash_mutex);
+  return ok;
+}
+
+bool raw_partition_read_ref(const char *path, raw_extent_ref_t *ref) {
+  lfs_file_t file;
+  if (lfs_file_open(&lfs, &file, path, LFS_O_RDONLY) != LFS_ERR_OK) {
+    return false;
+  }
+  const bool is_ref = lfs_file_size(&lfs, &file) == sizeof(*ref) &&
+                      lfs_file_read(&lfs, &file, ref, sizeof(*ref)) == sizeof(*ref) &&
+                      ref->magic == RAW_EXTENT_REF_MAGIC;
+  lfs_file_close(&lfs, &file);
+  return is_ref;
+}
+
+int flight_file_open(flight_file_t *ff, uint32_t number) {
+  char filename[MAX_FILENAME_SIZE] = {};
+  snprintf(filename, MAX_FILENAME_SIZE, "flights/flight_%05lu", number);
+
+  memset(&ff->extent, 0, sizeof(ff->extent));
+  ff->pos = 0;
+  flight_index_entry_t entry;
+  if (flight_index_get(number, &entry) && (entry.flags & FLIGHT_INDEX_FLAG_RAW)) {
+    ff->extent.magic = RAW_EXTENT_REF_MAGIC;
+    ff->extent.address = entry.address;
+    ff->extent.length = entry.size;
+  }
+  if (ff->extent.magic == RAW_EXTENT_REF_MAGIC || raw_partition_read_ref(filename, &ff->extent)) {
+    if (ff->extent.address < (RAW_PARTITION_FIRST_SECTOR + 1) * w25q.sector_size ||
+        ff->extent.address + ff->extent.length > w25q.sector_count * w25q.sector_size) {
+      return LFS_ERR_CORRUPT;
+    }
+    return LFS_ERR_OK;
+  }
+  /* the flight log is stored in the file itself */
+  memset(&ff->extent, 0, sizeof(ff->extent));
+  return lfs_file_open(&lfs, &ff->file, filename, LFS_O_RDONLY);
+}
+
+lfs_ssize_t flight_file_read(flight_file_t *ff, void *buf, uint32_t len) {
+  if (ff->extent.magic != RAW_EXTENT_REF_MAGIC) {
+    return lfs_file_read(&lfs, &ff->file, buf, len);
+  }
+  if (ff->pos >= ff->extent.length) {
+    return 0;
+  }
+  if (len > ff->extent.length - ff->pos) {
+    len = ff->extent.length - ff->pos;
+  }
+  osMutexAcquire(flash_mutex, osWaitForever);
+  const w25q_status_e status = w25q_read_buffer((uint8_t *)buf, ff->extent.address + ff->pos, len);
+  osMutexRelease(flash_mutex);
+  if (status != W25Q_OK) {
+    return LFS_ERR_IO;
+  }
+  ff->pos += len;
+  return (lfs_ssize_t)len;
+}
+
+lfs_ssize_t flight_file_read_ptr(flight_file_t *ff, void *buf, uint32_t len, const uint8_t **data) {
+  if (ff->extent.magic == RAW_EXTENT_REF_MAGIC) {
+    const uint32_t remaining = ff->pos < ff->extent.length ? ff->extent.length - ff->pos : 0;
+    if (len > remaining) {
+      len = remaining;
+    }
+    /* the caller holds the mutex, this only keeps the function safe to call on its own */
+    osMutexAcquire(flash_mutex, osWaitForever);
+    const uint8_t *mapped = w25q_map(ff->extent.address + ff->pos, len);
+    osMutexRelease(flash_mutex);
+    if (mapped != NULL) {
+      ff->pos += len;
+      *data = mapped;
+      return (lfs_ssize_t)len;
+    }
+  }
+  *data = (const uint8_t *)buf;
+  return flight_file_read(ff, buf, len);
+}
+
+int flight_file_seek(flight_file_t *ff, uint32_t pos) {
+  if (ff->extent.magic != RAW_EXTENT_REF_MAGIC) {
+    const lfs_soff_t res = lfs_file_seek(&lfs, &ff->file, (lfs_soff_t)pos, LFS_SEEK_SET);
+    return res < 0 ? (int)res : LFS_ERR_OK;
+  }
+  ff->pos = pos < ff->extent.length ? pos : ff->extent.length;
+  return LFS_ERR_OK;
+}
+
+lfs_ssize_t flight_file_size(flight_file_t *ff) {
+  if (ff->extent.magic != RAW_EXTENT_REF_MAGIC) {
+    return lfs_file_size(&lfs, &ff->file);
+  }
+  return (lfs_ssize_t)ff->extent.length;
+}
+
+void flight_file_close(flight_file_t *ff) {
+  if (ff->extent.magic != RAW_EXTENT_REF_MAGIC) {
+    lfs_file_close(&lfs, &ff->file);
+  }
+}
+
+/** Private Function Definitions **/
+
+/* The partition needs at least the partition table and one more sector */
+static bool flash_available() { return w25q.sector_size > 0 && w25q.sector_count > RAW_PARTITION_FIRST_SECTOR + 1; }
+
+/**
+ * Read the header of the extent starting at addr.
+ *
+ * @param addr - start of the extent
+ * @param header[out] - extent header
+ * @return true if there is an extent of the current generation
+ */
+static bool read_extent_header(uint32_t addr, raw_extent_header_t *header) {
+  osMutexAcquire(flash_mutex, osWaitForever);
+  const w25q_status_e status = w25q_read_buffer((uint8_t *)header, addr, sizeof(*header));
+  osMutexRelease(flash_mutex);
+  return status == W25Q_OK && header->magic == RAW_EXTENT_MAGIC && header->generation == raw.generation &&
+         header->crc == crc32_compute(header, offsetof(raw_extent_header_t, crc));
+}
+
+static bool is_extent_closed(uint32_t addr, const raw_extent_header_t *header) {
+  return header->length == ~header->length_inv && header->length <= raw.end - addr - RAW_EXTENT_HEADER_SIZE;
+}
+
+/* The recorder keeps the block after the end of the data erased, the first block without a sync word ends the
+ * extent */
+static uint32_t find_extent_end(uint32_t addr) {
+  const uint32_t data_start = addr + RAW_EXTENT_HEADER_SIZE;
+  uint32_t pos = data_start;
+  while (pos + LOG_BLOCK_SIZE <= raw.end) {
+    uint32_t sync = 0;
+    osMutexAcquire(flash_mutex, osWaitForever);
+    const w25q_status_e status = w25q_read_buffer((uint8_t *)&sync, pos, sizeof(sync));
+    osMutexRelease(flash_mutex);
+    if (status != W25Q_OK || sync == 0xFFFFFFFFU) {
+      break;
+    }
+    pos += LOG_BLOCK_SIZE;
+  }
+  return pos - data_start;
+}
+
+/* Program the length into the still erased length fields of the extent header */
+static bool close_extent(uint32_t addr, uint32_t length) {
+  const uint32_t fields[2] = {length, ~length};
+  const w25q_status_e status =
+      erase_map_write((const uint8_t *)fields, addr + offsetof(raw_extent_header_t, length), sizeof(fields));
+  if (status != W25Q_OK) {
+    log_error("Closing the extent at 0x%lx failed: %d", addr, status);
+    return false;
+  }
+  return true;
+}
+
+/* Create flights/flight_XXXXX pointing to the extent */
+static bool register_extent(uint32_t flight_number, uint32_t addr, uint32_t length) {
+  char filename[MAX_FILENAME_SIZE] = {};
+  snprintf(filename, MAX_FILENAME_SIZE, "flights/flight_%05lu", flight_number);
+  const raw_extent_ref_t ref = {
+      .magic = RAW_EXTENT_REF_MAGIC, .address = addr + RAW_EXTENT_HEADER_SIZE, .length = length};
+
+  lfs_file_t file;
+  int err = lfs_file_open(&lfs, &file, filename, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC);
+  if (err == LFS_ERR_OK) {
+    const lfs_ssize_t written = lfs_file_write(&lfs, &file, &ref, sizeof(ref));
+    err = lfs_file_close(&lfs, &file);
+    if (written != sizeof(ref)) {
+      err = written < 0 ? (int)written : LFS_ERR_NOSPC;
+    }
+  }
+  if (err != LFS_ERR_OK) {
+    log_error("Registering flight %lu failed: %d", flight_number, err);
+    return false;
+  }
+  return true;
+}
+
+static bool erase_next_sector() {
+  const uint32_t sector_idx = raw.erased_till / w25q.sector_size;
+  if (erase_map_erase_sector(sector_idx) != W25Q_OK) {
+    log_error("Erasing sector %lu failed!", sector_idx);
+    return false;
+  }
+  raw.erased_till += w25q.sector_size;
+  return true;
+}
+
+static bool erase_next_block() {
+  const uint32_t block_idx = raw.erased_till / w25q.block_size;
+  if (erase_map_erase_block_64k(block_idx) != W25Q_OK) {
+    log_error("Erasing block %lu failed!", block_idx);
+    return false;
+  }
+  raw.erased_till += w25q.block_size;
+  return true;
+}
+
+/* Erase the sectors up to `until` which are not erased yet; single sectors keep the blocking time short in flight */
+static bool ensure_erased(uint32_t until) {
+  if (until > raw.limit) {
+    until = raw.limit;
+  }
+  while (raw.erased_till < until) {
+    if (!erase_next_sector()) {
+      return false;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,258 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Raw flight partition.
+ *
+ * LittleFS only covers the first RAW_PARTITION_FIRST_SECTOR sectors of the flash. The rest is a raw partition to
+ * which the recorder appends the flight log blocks (see util/log_format.h) without any file system commits in flight:
+ *
+ *   - sector RAW_PARTITION_FIRST_SECTOR holds the partition table (raw_partition_table_t)
+ *   - every flight is stored in an extent which starts at a sector boundary after it. The first LOG_BLOCK_SIZE bytes
+ *     of an extent hold the raw_extent_header_t, the flight log blocks follow right after.
+ *
+ * The extent header is programmed when the recording starts and its length field when the recording is closed; both
+ * go into erased flash so nothing has to be erased or rewritten. The recorder always keeps the block after the end of
+ * the open extent erased. If the recording was interrupted, raw_partition_init() finds the end of the extent by
+ * looking for that block and closes the extent at the next boot.
+ *
+ * A closed extent is registered in LittleFS as flights/flight_XXXXX. Instead of the flight log this file only
+ * contains a raw_extent_ref_t, the flight_file_* functions read a flight no matter where it is stored.
+ *
+ * The partition is used as a ring: once the end is reached, raw_partition_wrap() continues at the start and the new
+ * extents overwrite the oldest ones. Which extents are still in use is only known to the flight index
+ * (lfs/flight_index.h), it limits the space of the next extents with raw_partition_set_limit(). raw_partition_init()
+ * follows the extents from the start of the partition as long as their flight numbers increase.
+ */
+
+#pragma once
+
+#include "lfs.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Exported Defines **/
+
+/* LittleFS gets the first 4 MiB of the flash */
+#define RAW_PARTITION_FIRST_SECTOR 1024
+
+#define RAW_PARTITION_MAGIC  0x50544143U /* "CATP" */
+#define RAW_EXTENT_MAGIC     0x58544143U /* "CATX" */
+#define RAW_EXTENT_REF_MAGIC 0x46524143U /* "CARF" */
+
+#define RAW_PARTITION_VERSION 1
+
+/* Value of raw_extent_header_t.length while the extent is open */
+#define RAW_EXTENT_OPEN 0xFFFFFFFFU
+
+/** Exported Types **/
+
+typedef struct {
+  uint32_t magic;        /* RAW_PARTITION_MAGIC */
+  uint32_t version;      /* RAW_PARTITION_VERSION */
+  uint32_t first_sector; /* RAW_PARTITION_FIRST_SECTOR of the firmware which created the partition */
+  uint32_t generation;   /* incremented by every format, extents of older generations are ignored */
+  uint32_t crc;          /* CRC32 of the fields above */
+} raw_partition_table_t;
+
+typedef struct {
+  uint32_t magic; /* RAW_EXTENT_MAGIC */
+  uint32_t generation;
+  uint32_t flight_number;
+  uint32_t crc;        /* CRC32 of the fields above */
+  uint32_t length;     /* number of flight log bytes after the header; RAW_EXTENT_OPEN until the extent is closed */
+  uint32_t length_inv; /* ~length, detects an interrupted write of the length */
+} raw_extent_header_t;
+
+/* Content of flights/flight_XXXXX for a flight stored in the raw partition */
+typedef struct {
+  uint32_t magic;   /* RAW_EXTENT_REF_MAGIC */
+  uint32_t address; /* flash address of the first flight log byte */
+  uint32_t length;  /* number of flight log bytes */
+} raw_extent_ref_t;
+
+/* A flight stored either in the raw partition or in a LittleFS file */
+typedef struct {
+  lfs_file_t file;
+  raw_extent_ref_t extent; /* extent.magic is 0 if the flight log is stored in the file itself */
+  uint32_t pos;
+} flight_file_t;
+
+/** Exported Functions **/
+
+/**
+ * Check whether the flash layout was created by this firmware. If not, LittleFS is either an old one on the whole
+ * flash (see lfs_mount_legacy()) or it has to be formatted and the raw partition has to be formatted with
+ * raw_partition_format() afterwards.
+ *
+ * @return true if the partition table is valid
+ */
+bool raw_partition_check_layout();
+
+/**
+ * Write a new partition table; all extents are dropped. Refused while LittleFS still has the old layout.
+ *
+ * @return true if successful
+ */
+bool raw_partition_format();
+
+/**
+ * Find the end of the used space and close an extent whose recording was interrupted. LittleFS has to be mounted and
+ * the flights directory has to exist.
+ */
+void raw_partition_init();
+
+/**
+ * Start a new extent at the next sector boundary.
+ *
+ * @param flight_number - number of the flight which is recorded into the extent
+ * @return true if successful; false if the partition is not available or full
+ */
+bool raw_partition_open(uint32_t flight_number);
+
+/**
+ * Append data to the open extent. Sectors which were not erased ahead of time are erased first.
+ *
+ * @param data - data to append
+ * @param len - number of bytes
+ * @return true if successful; false if the extent is not open, the partition is full or the flash write failed
+ */
+bool raw_partition_append(const uint8_t *data, uint32_t len);
+
+/**
+ * Close the open extent and register it in LittleFS as flights/flight_XXXXX.
+ *
+ * @return true if successful
+ */
+bool raw_partition_close();
+
+/**
+ * Erase the next 64 KiB block or sector after the already erased area if less than `headroom` bytes are erased ahead
+ * of the write position. Starts at most one erasure per call and none while the previous one is still running, so the
+ * caller doesn't block.
+ *
+ * @param headroom - number of bytes which should be erased ahead
+ * @return true if the headroom is available
+ */
+bool raw_partition_erase_ahead(uint32_t headroom);
+
+/**
+ * @return number of contiguous bytes which are still free for the next extent
+ */
+uint32_t raw_partition_get_free();
+
+/**
+ * @return number of bytes which are erased ahead of the write position
+ */
+uint32_t raw_partition_get_erased();
+
+/**
+ * @return address at which the next extent starts, 0 if the partition is not available
+ */
+uint32_t raw_partition_get_cursor();
+
+/**
+ * Hand out free space ahead of the cursor to code which programs and erases the flash directly, e.g. the storage
+ * benchmark. The space is not reserved, it is overwritten by the next extent; the erase ahead starts over.
+ *
+ * @param size - number of bytes needed
+ * @return 64 KiB aligned address of the space; 0 if there is not enough free space or an extent is open
+ */
+uint32_t raw_partition_get_scratch(uint32_t size);
+
+/**
+ * Limit the space of the next extents. An extent starts at the sector which holds its first flight log byte.
+ *
+ * @param limit - start of the next extent after the cursor which is still in use; the flash from the cursor up to
+ * there may be overwritten. Values beyond the end of the partition are clamped.
+ */
+void raw_partition_set_limit(uint32_t limit);
+
+/**
+ * Continue with the next extent at the start of the partition; only possible while no extent is open. Nothing can be
+ * written until raw_partition_set_limit() is called.
+ *
+ * @return true if successful
+ */
+bool raw_partition_wrap();
+
+/**
+ * Read the extent reference from a LittleFS file.
+ *
+ * @param path - path of the file
+ * @param ref[out] - extent reference
+ * @return true if the file refers to a raw extent
+ */
+bool raw_partition_read_ref(const char *path, raw_extent_ref_t *ref);
+
+/**
+ * Open a flight for reading.
+ *
+ * @param ff - flight file
+ * @param number - flight number
+ * @return LFS_ERR_OK if successful, LFS_ERR_* otherwise; the flight file doesn't have to be closed on error
+ */
+int flight_file_open(flight_file_t *ff, uint32_t number);
+
+/**
+ * Read from the current position of the flight.
+ *
+ * @param ff - flight file
+ * @param buf[out] - buffer
+ * @param len - number of bytes to read
+ * @return number of bytes read, LFS_ERR_* on error
+ */
+lfs_ssize_t flight_file_read(flight_file_t *ff, void *buf, uint32_t len);
+
+/**
+ * Read from the current position of the flight without copying the data if possible. Flights in the raw partition are
+ * accessed through the memory-mapped flash window (see w25q_map()), all others are read into buf.
+ *
+ * A pointer into the window is only valid as long as no other flash operation runs, the caller has to hold
+ * flash_mutex from this call until it is done with the data.
+ *
+ * @param ff - flight file
+ * @param buf - buffer used if the data can't be mapped
+ * @param len - number of bytes to read
+ * @param data[out] - the data, either in the flash window or in buf
+ * @return number of bytes read, LFS_ERR_* on error
+ */
+lfs_ssize_t flight_file_read_ptr(flight_file_t *ff, void *buf, uint32_t len, const uint8_t **data);
+
+/**
+ * Change the read position of the flight.
+ *
+ * @param ff - flight file
+ * @param pos - offset from the start of the flight log
+ * @return LFS_ERR_OK if successful, LFS_ERR_* otherwise
+ */
+int flight_file_seek(flight_file_t *ff, uint32_t pos);
+
+/**
+ * @param ff - flight file
+ * @return size of the flight log in bytes, LFS_ERR_* on error
+ */
+lfs_ssize_t flight_file_size(flight_file_t *ff);
+
+/**
+ * Close the flight.
+ *
+ * @param ff - flight file
+ */
+void flight_file_close(flight_file_t *ff);
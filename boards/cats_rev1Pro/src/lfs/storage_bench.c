@@ -0,0 +1,326 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "lfs/storage_bench.h"
+#include "lfs/lfs_custom.h"
+#include "lfs/raw_partition.h"
+#include "lfs/erase_map.h"
+#include "drivers/w25q.h"
+#include "util/cycle_counter.h"
+#include "util/log.h"
+#include "util/log_format.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/** Private Constants **/
+
+/* The raw flash tests erase the area with 64 KiB erases, program and read it completely and erase it again with
+ * sector and 32 KiB erases */
+#define STORAGE_BENCH_RAW_SIZE          (256 * 1024)
+#define STORAGE_BENCH_NUM_SECTOR_ERASES 16
+#define STORAGE_BENCH_NUM_32K_ERASES    4
+
+/* The LittleFS tests write a file like the recorder does: LOG_BLOCK_SIZE writes with a sync every
+ * STORAGE_BENCH_SYNC_INTERVAL bytes */
+#define STORAGE_BENCH_LFS_SIZE      (256 * 1024)
+#define STORAGE_BENCH_SYNC_INTERVAL (16 * LOG_BLOCK_SIZE)
+#define STORAGE_BENCH_TMP_FILE      "storage_bench.tmp"
+
+/* Latencies below 2^STORAGE_BENCH_SUB_BITS us have their own bucket, above every octave is split into
+ * 2^STORAGE_BENCH_SUB_BITS buckets */
+#define STORAGE_BENCH_SUB_BITS    2
+#define STORAGE_BENCH_NUM_BUCKETS ((32 - STORAGE_BENCH_SUB_BITS + 1) << STORAGE_BENCH_SUB_BITS)
+
+static const char *const storage_bench_names[NUM_STORAGE_BENCH_TESTS] = {
+    "erase_64k", "program", "read", "erase_4k", "erase_32k", "lfs_write", "lfs_sync", "lfs_read",
+};
+
+/** Private Variables **/
+
+/* Histogram of the test which is currently running */
+static uint16_t bench_buckets[STORAGE_BENCH_NUM_BUCKETS] = {};
+static uint8_t bench_buf[LOG_BLOCK_SIZE] = {};
+
+/** Private Function Declarations **/
+
+static bool run_raw_tests(storage_bench_results_t *results);
+static bool run_lfs_tests(storage_bench_results_t *results);
+static storage_bench_result_t *begin_test(storage_bench_results_t *results, storage_bench_test_e test);
+static void add_sample(storage_bench_result_t *result, uint32_t start_cycles, uint32_t bytes);
+static void add_sample_us(storage_bench_result_t *result, uint32_t us, uint32_t bytes);
+static void end_test(storage_bench_result_t *result);
+static uint32_t get_bucket(uint32_t us);
+static uint32_t get_bucket_limit(uint32_t bucket);
+static uint32_t get_percentile(const storage_bench_result_t *result, uint32_t percent);
+
+/** Exported Function Definitions **/
+
+bool storage_bench_run(storage_bench_results_t *results) {
+  memset(results, 0, sizeof(*results));
+  for (uint32_t i = 0; i < sizeof(bench_buf); ++i) {
+    bench_buf[i] = (uint8_t)(i * 7 + 3);
+  }
+  const bool raw_ok = run_raw_tests(results);
+  const bool lfs_ok = run_lfs_tests(results);
+  return raw_ok && lfs_ok;
+}
+
+void storage_bench_print(const storage_bench_results_t *results) {
+  log_raw("Test          Count     Bytes    MB/s   p50 [us]   p99 [us]   max [us]");
+  for (uint32_t i = 0; i < NUM_STORAGE_BENCH_TESTS; ++i) {
+    const storage_bench_result_t *result = &results->tests[i];
+    if (result->count == 0) {
+      log_raw("%-10s  not run", storage_bench_names[i]);
+      continue;
+    }
+    /* bytes per us are MB/s */
+    const double throughput = result->total_us > 0 ? (double)result->bytes / (double)result->total_us : 0.0;
+    log_raw("%-10s %8lu %9lu %7.2f %10lu %10lu %10lu", storage_bench_names[i], result->count, result->bytes,
+            throughput, result->p50_us, result->p99_us, result->max_us);
+  }
+}
+
+int storage_bench_format(const storage_bench_results_t *results, storage_bench_test_e test, const char *version,
+                         char *buf, uint32_t size) {
+  const storage_bench_result_t *result = &results->tests[test];
+  return snprintf(buf, size, "%s,%s,%lu,%lu,%lu,%lu,%lu,%lu\n", version, storage_bench_names[test],
+                  (unsigned long)result->count, (unsigned long)result->bytes, (unsigned long)result->total_us,
+                  (unsigned long)result->p50_us, (unsigned long)result->p99_us, (unsigned long)result->max_us);
+}
+
+int storage_bench_save(const storage_bench_results_t *results, const char *version) {
+  lfs_file_t file;
+  int err = lfs_file_open(&lfs, &file, STORAGE_BENCH_FILE, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_APPEND);
+  if (err != LFS_ERR_OK) {
+    return err;
+  }
+  char line[96];
+  for (uint32_t i = 0; i < NUM_STORAGE_BENCH_TESTS && err >= 0; ++i) {
+    if (results->tests[i].count > 0) {
+      const int len = storage_bench_format(results, (storage_bench_test_e)i, version, line, sizeof(line));
+      err = lfs_file_write(&lfs, &file, line, (lfs_size_t)len);
+    }
+  }
+  const int close_err = lfs_file_close(&lfs, &file);
+  return err < 0 ? err : close_err;
+}
+
+int storage_bench_print_history() {
+  lfs_file_t file;
+  const int err = lfs_file_open(&lfs, &file, STORAGE_BENCH_FILE, LFS_O_RDONLY);
+  if (err != LFS_ERR_OK) {
+    return err;
+  }
+  log_raw("version,test,count,bytes,total_us,p50_us,p99_us,max_us");
+  char line[96];
+  uint32_t len = 0;
+  char c = 0;
+  while (lfs_file_read(&lfs, &file, &c, 1) == 1) {
+    if (c == '\n' || len == sizeof(line) - 1) {
+      line[len] = '\0';
+      log_raw("%s", line);
+      len = 0;
+    } else {
+      line[len++] = c;
+    }
+  }
+  return lfs_file_close(&lfs, &file);
+}
+
+/** Private Function Definitions **/
+
+static bool run_raw_tests(storage_bench_results_t *results) {
+  const uint32_t start = raw_partition_get_scratch(STORAGE_BENCH_RAW_SIZE);
+  if (start == 0) {
+    log_raw("Not enough free space in the raw partition, skipping the flash tests");
+    return false;
+  }
+  const uint32_t end = start + STORAGE_BENCH_RAW_SIZE;
+  bool ok = true;
+
+  /* nobody else may use the flash in between, e.g. to erase ahead */
+  osMutexAcquire(flash_mutex, osWaitForever);
+
+  storage_bench_result_t *result = begin_test(results, STORAGE_BENCH_BLOCK_ERASE_64K);
+  for (uint32_t addr = start; ok && addr < end; addr += w25q.block_size) {
+    const uint32_t start_cycles = cycle_counter_get();
+    ok = w25q_block_erase_64k(addr / w25q.block_size) == W25Q_OK && w25q_sync() == W25Q_OK;
+    add_sample(result, start_cycles, w25q.block_size);
+  }
+  end_test(result);
+
+  result = begin_test(results, STORAGE_BENCH_PAGE_PROGRAM);
+  for (uint32_t addr = start; ok && addr < end; addr += w25q.page_size) {
+    const uint32_t start_cycles = cycle_counter_get();
+    ok = w25q_write_page(bench_buf, addr, w25q.page_size) == W25Q_OK && w25q_sync() == W25Q_OK;
+    add_sample(result, start_cycles, w25q.page_size);
+  }
+  end_test(result);
+
+  result = begin_test(results, STORAGE_BENCH_READ);
+  for (uint32_t addr = start; ok && addr < end; addr += sizeof(bench_buf)) {
+    const uint32_t start_cycles = cycle_counter_get();
+    ok = w25q_read_buffer(bench_buf, addr, sizeof(bench_buf)) == W25Q_OK;
+    add_sample(result, start_cycles, sizeof(bench_buf));
+  }
+  end_test(result);
+
+  result = begin_test(results, STORAGE_BENCH_SECTOR_ERASE);
+  for (uint32_t i = 0; ok && i < STORAGE_BENCH_NUM_SECTOR_ERASES; ++i) {
+    const uint32_t start_cycles = cycle_counter_get();
+    ok = w25q_sector_erase(start / w25q.sector_size + i) == W25Q_OK && w25q_sync() == W25Q_OK;
+    add_sample(result, start_cycles, w25q.sector_size);
+  }
+  end_test(result);
+
+  /* the driver addresses the 32 KiB erase in 64 KiB blocks, it erases the first half of the block */
+  result = begin_test(results, STORAGE_BENCH_BLOCK_ERASE_32K);
+  for (uint32_t i = 0; ok && i < STORAGE_BENCH_NUM_32K_ERASES; ++i) {
+    const uint32_t start_cycles = cycle_counter_get();
+    ok = w25q_block_erase_32k(start / w25q.block_size + i) == W25Q_OK && w25q_sync() == W25Q_OK;
+    add_sample(result, start_cycles, w25q.block_size / 2);
+  }
+  end_test(result);
+
+  /* the erase map doesn't know about any of this */
+  erase_map_reset();
+  osMutexRelease(flash_mutex);
+
+  if (!ok) {
+    log_raw("A flash operation failed");
+  }
+  return ok;
+}
+
+static bool run_lfs_tests(storage_bench_results_t *results) {
+  /* LittleFS needs some blocks for the metadata and the copy on write */
+  if (lfs_get_free_space() < 2 * STORAGE_BENCH_LFS_SIZE) {
+    log_raw("Not enough free space in LittleFS, skipping the file system tests");
+    return false;
+  }
+  lfs_file_t file;
+  if (lfs_file_open(&lfs, &file, STORAGE_BENCH_TMP_FILE, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC) != LFS_ERR_OK) {
+    return false;
+  }
+  bool ok = true;
+
+  storage_bench_result_t *write_result = begin_test(results, STORAGE_BENCH_LFS_WRITE);
+  /* the syncs have their own histogram, their latencies are kept until the writes are done */
+  uint32_t sync_us[STORAGE_BENCH_LFS_SIZE / STORAGE_BENCH_SYNC_INTERVAL];
+  uint32_t num_syncs = 0;
+  for (uint32_t written = 0; ok && written < STORAGE_BENCH_LFS_SIZE; written += sizeof(bench_buf)) {
+    uint32_t start_cycles = cycle_counter_get();
+    ok = lfs_file_write(&lfs, &file, bench_buf, sizeof(bench_buf)) == sizeof(bench_buf);
+    add_sample(write_result, start_cycles, sizeof(bench_buf));
+    if (ok && (written + sizeof(bench_buf)) % STORAGE_BENCH_SYNC_INTERVAL == 0) {
+      start_cycles = cycle_counter_get();
+      ok = lfs_file_sync(&lfs, &file) == LFS_ERR_OK;
+      sync_us[num_syncs++] = cycle_counter_to_us(cycle_counter_get() - start_cycles);
+    }
+  }
+  end_test(write_result);
+  ok = lfs_file_close(&lfs, &file) == LFS_ERR_OK && ok;
+
+  storage_bench_result_t *sync_result = begin_test(results, STORAGE_BENCH_LFS_SYNC);
+  for (uint32_t i = 0; i < num_syncs; ++i) {
+    add_sample_us(sync_result, sync_us[i], STORAGE_BENCH_SYNC_INTERVAL);
+  }
+  end_test(sync_result);
+
+  if (ok && lfs_file_open(&lfs, &file, STORAGE_BENCH_TMP_FILE, LFS_O_RDONLY) == LFS_ERR_OK) {
+    storage_bench_result_t *read_result = begin_test(results, STORAGE_BENCH_LFS_READ);
+    for (uint32_t read = 0; ok && read < STORAGE_BENCH_LFS_SIZE; read += sizeof(bench_buf)) {
+      const uint32_t start_cycles = cycle_counter_get();
+      ok = lfs_file_read(&lfs, &file, bench_buf, sizeof(bench_buf)) == sizeof(bench_buf);
+      add_sample(read_result, start_cycles, sizeof(bench_buf));
+    }
+    end_test(read_result);
+    lfs_file_close(&lfs, &file);
+  }
+  lfs_remove(&lfs, STORAGE_BENCH_TMP_FILE);
+
+  if (!ok) {
+    log_raw("A file system operation failed");
+  }
+  return ok;
+}
+
+static storage_bench_result_t *begin_test(storage_bench_results_t *results, storage_bench_test_e test) {
+  memset(bench_buckets, 0, sizeof(bench_buckets));
+  return &results->tests[test];
+}
+
+static void add_sample(storage_bench_result_t *result, uint32_t start_cycles, uint32_t bytes) {
+  add_sample_us(result, cycle_counter_to_us(cycle_counter_get() - start_cycles), bytes);
+}
+
+static void add_sample_us(storage_bench_result_t *result, uint32_t us, uint32_t bytes) {
+  const uint32_t bucket = get_bucket(us);
+  if (bench_buckets[bucket] < UINT16_MAX) {
+    ++bench_buckets[bucket];
+  }
+  ++result->count;
+  result->bytes += bytes;
+  result->total_us += us;
+  if (us > result->max_us) {
+    result->max_us = us;
+  }
+}
+
+static void end_test(storage_bench_result_t *result) {
+  result->p50_us = get_percentile(result, 50);
+  result->p99_us = get_percentile(result, 99);
+}
+
+static uint32_t get_bucket(uint32_t us) {
+  if (us < (1U << STORAGE_BENCH_SUB_BITS)) {
+    return us;
+  }
+  /* position of the highest set bit selects the octave, the next STORAGE_BENCH_SUB_BITS bits the bucket inside it */
+  const uint32_t exponent = 31U - (uint32_t)__builtin_clz(us);
+  const uint32_t sub_mask = (1U << STORAGE_BENCH_SUB_BITS) - 1;
+  return ((exponent - STORAGE_BENCH_SUB_BITS + 1) << STORAGE_BENCH_SUB_BITS) |
+         ((us >> (exponent - STORAGE_BENCH_SUB_BITS)) & sub_mask);
+}
+
+static uint32_t get_bucket_limit(uint32_t bucket) {
+  if (bucket < (1U << STORAGE_BENCH_SUB_BITS)) {
+    return bucket;
+  }
+  const uint32_t shift = (bucket >> STORAGE_BENCH_SUB_BITS) - 1;
+  const uint32_t mantissa = (1U << STORAGE_BENCH_SUB_BITS) | (bucket & ((1U << STORAGE_BENCH_SUB_BITS) - 1));
+  return (uint32_t)((((uint64_t)mantissa + 1) << shift) - 1);
+}
+
+/* Upper limit of the bucket which contains the percentile, i.e. at most 25% above the exact value */
+static uint32_t get_percentile(const storage_bench_result_t *result, uint32_t percent) {
+  if (result->count == 0) {
+    return 0;
+  }
+  const uint32_t rank = (result->count * percent + 99) / 100;
+  uint32_t seen = 0;
+  for (uint32_t bucket = 0; bucket < STORAGE_BENCH_NUM_BUCKETS; ++bucket) {
+    seen += bench_buckets[bucket];
+    if (seen >= rank) {
+      const uint32_t limit = get_bucket_limit(bucket);
+      return limit < result->max_us ? limit : result->max_us;
+    }
+  }
+  return result->max_us;
+}
@@ -0,0 +1,112 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Storage benchmark: latency and throughput of the flash driver (page program, 4/32/64 KiB erase, quad read) and of
+ * LittleFS (sequential write, sync and read with the block size of the recorder).
+ *
+ * Every operation is timed with the cycle counter (util/cycle_counter.h) including the wait for the chip, i.e. the
+ * program and erase times are the busy times of the flash. The latencies go into a histogram with four buckets per
+ * octave, so the percentiles are exact below 8 us and at most 25 % too high above. The raw flash tests run in free
+ * space of the raw partition (lfs/raw_partition.h), the LittleFS tests on a temporary file; no flight is touched.
+ *
+ * The results can be appended to STORAGE_BENCH_FILE together with the firmware version so that runs of different
+ * versions can be compared. The same code runs on the host on top of the flash emulation, see tools/flash_emu.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Exported Defines **/
+
+#define STORAGE_BENCH_FILE "storage_bench.csv"
+
+/** Exported Types **/
+
+typedef enum {
+  STORAGE_BENCH_BLOCK_ERASE_64K = 0,
+  STORAGE_BENCH_PAGE_PROGRAM,
+  STORAGE_BENCH_READ,
+  STORAGE_BENCH_SECTOR_ERASE,
+  STORAGE_BENCH_BLOCK_ERASE_32K,
+  STORAGE_BENCH_LFS_WRITE,
+  STORAGE_BENCH_LFS_SYNC,
+  STORAGE_BENCH_LFS_READ,
+  NUM_STORAGE_BENCH_TESTS
+} storage_bench_test_e;
+
+typedef struct {
+  uint32_t count;    /* number of operations */
+  uint32_t bytes;    /* bytes programmed, erased, read or written by all operations */
+  uint32_t total_us; /* sum of all latencies */
+  uint32_t p50_us;
+  uint32_t p99_us;
+  uint32_t max_us;
+} storage_bench_result_t;
+
+typedef struct {
+  storage_bench_result_t tests[NUM_STORAGE_BENCH_TESTS];
+} storage_bench_results_t;
+
+/** Exported Functions **/
+
+/**
+ * Run all benchmarks. LittleFS has to be mounted and the recorder must not write to the flash.
+ *
+ * @param results[out] - results of all tests; tests which could not run have a count of 0
+ * @return false if one of the tests failed or there was not enough free space for it
+ */
+bool storage_bench_run(storage_bench_results_t *results);
+
+/**
+ * Print the results as a table.
+ *
+ * @param results - results of storage_bench_run()
+ */
+void storage_bench_print(const storage_bench_results_t *results);
+
+/**
+ * Format the result of one test as a CSV line: version, test, count, bytes, total, p50, p99 and max; all times in us.
+ *
+ * @param results - results of storage_bench_run()
+ * @param test - test to format
+ * @param version - firmware version
+ * @param buf[out] - output buffer
+ * @param size - size of the output buffer
+ * @return length of the line like snprintf
+ */
+int storage_bench_format(const storage_bench_results_t *results, storage_bench_test_e test, const char *version,
+                         char *buf, uint32_t size);
+
+/**
+ * Append the results to STORAGE_BENCH_FILE.
+ *
+ * @param results - results of storage_bench_run()
+ * @param version - firmware version
+ * @return LFS_ERR_OK if successful
+ */
+int storage_bench_save(const storage_bench_results_t *results, const char *version);
+
+/**
+ * Print all results stored in STORAGE_BENCH_FILE.
+ *
+ * @return LFS_ERR_OK if successful
+ */
+int storage_bench_print_history();
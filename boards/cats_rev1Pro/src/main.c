@@ -27,6 +27,7 @@
 #include "util/types.h"
 #include "util/log.h"
 #include "util/recorder.h"
+#include "lfs/lfs_custom.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -51,6 +52,7 @@ DMA_HandleTypeDef hdma_adc1;
 CAN_HandleTypeDef hcan1;
 
 QSPI_HandleTypeDef hqspi;
+DMA_HandleTypeDef hdma_quadspi;
 
 RTC_HandleTypeDef hrtc;
 
@@ -171,6 +173,13 @@ int main(void) {
   };
   print_mutex = osMutexNew(&print_mutex_attr);
 #endif
+  const osMutexAttr_t flash_mutex_attr = {
+      "flash_mutex",                          // human readable mutex name
+      osMutexRecursive | osMutexPrioInherit,  // attr_bits
+      NULL,                                   // memory for control block
+      0U                                      // size for control block
+  };
+  flash_mutex = osMutexNew(&flash_mutex_attr);
   /* USER CODE END RTOS_MUTEX */
 
   /* USER CODE BEGIN RTOS_SEMAPHORES */
@@ -663,6 +672,9 @@ static void MX_DMA_Init(void) {
   /* DMA1_Channel1_IRQn interrupt configuration */
   HAL_NVIC_SetPriority(DMA1_Channel1_IRQn, 5, 0);
   HAL_NVIC_EnableIRQ(DMA1_Channel1_IRQn);
+  /* DMA1_Channel5_IRQn interrupt configuration */
+  HAL_NVIC_SetPriority(DMA1_Channel5_IRQn, 5, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Channel5_IRQn);
 }
 
 /**
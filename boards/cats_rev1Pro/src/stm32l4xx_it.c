@@ -59,6 +59,8 @@
 extern PCD_HandleTypeDef hpcd_USB_FS;
 extern TIM_HandleTypeDef htim1;
 extern DMA_HandleTypeDef hdma_adc1;
+extern DMA_HandleTypeDef hdma_quadspi;
+extern QSPI_HandleTypeDef hqspi;
 
 /* USER CODE BEGIN EV */
 
@@ -177,6 +179,19 @@ void DMA1_Channel1_IRQHandler(void) {
   /* USER CODE END DMA1_Channel1_IRQn 1 */
 }
 
+/**
+ * @brief This function handles DMA1 channel5 global interrupt.
+ */
+void DMA1_Channel5_IRQHandler(void) {
+  /* USER CODE BEGIN DMA1_Channel5_IRQn 0 */
+
+  /* USER CODE END DMA1_Channel5_IRQn 0 */
+  HAL_DMA_IRQHandler(&hdma_quadspi);
+  /* USER CODE BEGIN DMA1_Channel5_IRQn 1 */
+
+  /* USER CODE END DMA1_Channel5_IRQn 1 */
+}
+
 /**
  * @brief This function handles USB event interrupt through EXTI line 17.
  */
@@ -190,6 +205,19 @@ void USB_IRQHandler(void) {
   /* USER CODE END USB_IRQn 1 */
 }
 
+/**
+ * @brief This function handles QUADSPI global interrupt.
+ */
+void QUADSPI_IRQHandler(void) {
+  /* USER CODE BEGIN QUADSPI_IRQn 0 */
+
+  /* USER CODE END QUADSPI_IRQn 0 */
+  HAL_QSPI_IRQHandler(&hqspi);
+  /* USER CODE BEGIN QUADSPI_IRQn 1 */
+
+  /* USER CODE END QUADSPI_IRQn 1 */
+}
+
 /* USER CODE BEGIN 1 */
 
 /* USER CODE END 1 */
@@ -39,7 +39,11 @@
 #include "tasks/task_health_monitor.h"
 #include "lfs.h"
 #include "lfs/lfs_custom.h"
+#include "lfs/raw_partition.h"
+#include "lfs/flight_index.h"
 #include "util/fifo.h"
+#include "util/crc32.h"
+#include "util/cycle_counter.h"
 #include "main.h"
 #include "cmsis_os.h"
 
@@ -64,13 +68,19 @@ SET_TASK_PARAMS(task_baro_read, 256)
 SET_TASK_PARAMS(task_imu_read, 256)
 
 // SET_TASK_PARAMS(task_receiver, 256)
+#ifdef USE_KALMAN_STEADY_STATE
+/* kalman_solve_steady_state needs about 2 KiB of stack at the start of the task */
+SET_TASK_PARAMS(task_state_est, 1800)
+#else
 SET_TASK_PARAMS(task_state_est, 1300)
+#endif
 SET_TASK_PARAMS(task_health_monitor, 256)
 
 SET_TASK_PARAMS(task_flight_fsm, 512)
 // SET_TASK_PARAMS(task_drop_test_fsm, 512)
 SET_TASK_PARAMS(task_peripherals, 256)
-SET_TASK_PARAMS(task_recorder, 1592)
+SET_TASK_PARAMS(task_recorder, 1024)
+SET_TASK_PARAMS(task_rec_writer, 1024)
 SET_TASK_PARAMS(task_usb_communicator, 512)
 
 /** Private Constants **/
@@ -115,6 +125,8 @@ _Noreturn void task_init(__attribute__((unused)) void *argument) {
    * In the given example, BARO and FLIGHT_STATE ARE MISSING */
   //    uint32_t selected_entry_types = IMU | FLIGHT_INFO | COVARIANCE_INFO | SENSOR_INFO;
   //    cc_set_recorder_mask(selected_entry_types);
+  /* used to protect the config, the flight log blocks and the raw partition headers */
+  crc32_init();
   cc_init();
 
   // cc_defaults();
@@ -136,6 +148,9 @@ _Noreturn void task_init(__attribute__((unused)) void *argument) {
 
   osDelay(100);
 
+  /* used for the recorder telemetry */
+  cycle_counter_init();
+
   init_lfs();
 
   adc_init();
@@ -195,8 +210,21 @@ static void init_devices() {
 }
 
 static void init_lfs() {
-  /* mount the filesystem */
-  int err = lfs_mount(&lfs, &lfs_cfg);
+  /* LittleFS only covers the part of the flash in front of the raw partition, a flash which was set up with a
+   * different layout has to be formatted */
+  const bool layout_valid = raw_partition_check_layout();
+  int err = LFS_ERR_INVAL;
+  if (layout_valid) {
+    err = lfs_mount(&lfs, &lfs_cfg);
+  } else {
+    log_raw("No valid flash layout found!");
+    /* a flash written by a firmware without the raw partition keeps its file system and flights until they are
+     * erased, see below */
+    err = lfs_mount_legacy();
+    if (err == 0) {
+      log_raw("LFS with the old flash layout found");
+    }
+  }
   if (err == 0) {
     log_raw("LFS mounted successfully!");
   } else {
@@ -209,6 +237,7 @@ static void init_lfs() {
     if (err2 != 0) {
       log_raw("LFS mounting failed again with error %d!", err2);
     }
+    raw_partition_format();
   }
 
   lfs_file_open(&lfs, &fc_file, "flight_counter", LFS_O_RDWR | LFS_O_CREAT);
@@ -228,6 +257,24 @@ static void init_lfs() {
   lfs_mkdir(&lfs, "flights");
   lfs_mkdir(&lfs, "stats");
 
+  /* Nothing is lost by moving an old file system without any recordings to the new layout right away. Otherwise the
+   * flights stay where they are and new ones are written to LittleFS until the user erases the recordings. */
+  if (lfs_legacy_layout) {
+    if (lfs_has_recordings()) {
+      log_raw("The flights are stored with the old flash layout, download them and run rec_erase to switch to the "
+              "raw flight partition");
+    } else if (lfs_repartition() != 0) {
+      log_raw("Switching to the new flash layout failed!");
+    } else {
+      log_raw("Switched to the new flash layout");
+    }
+  }
+
+  /* close a flight whose recording was interrupted */
+  raw_partition_init();
+  flight_index_init();
+  flight_index_apply_retention(global_cats_config.config.rec_retention_size * 1024);
+
   strncpy(cwd, "/", sizeof(cwd));
 }
 
@@ -244,16 +291,15 @@ static void init_tasks() {
       flash_channel = xTraceRegisterString("Flash Channel");
 #endif
       /* creation of task_recorder */
-      // TODO: Check rec_queue for validity here
-      rec_queue = osMessageQueueNew(REC_QUEUE_SIZE, sizeof(rec_elem_t), NULL);
       rec_cmd_queue = osMessageQueueNew(REC_CMD_QUEUE_SIZE, sizeof(rec_cmd_type_e), NULL);
+      rec_buf_free_queue = osMessageQueueNew(REC_NUM_BUFFERS, sizeof(uint8_t), NULL);
+      rec_buf_full_queue = osMessageQueueNew(REC_NUM_BUFFERS, sizeof(rec_buf_desc_t), NULL);
       event_queue = osMessageQueueNew(EVENT_QUEUE_SIZE, sizeof(cats_event_e), NULL);
-#if (configUSE_TRACE_FACILITY == 1)
-      vTraceSetQueueName(rec_queue, "Recorder Queue");
-#endif
-
       osThreadNew(task_recorder, NULL, &task_recorder_attributes);
 
+      /* creation of task_rec_writer */
+      osThreadNew(task_rec_writer, NULL, &task_rec_writer_attributes);
+
       /* creation of task_baro_read */
       osThreadNew(task_baro_read, NULL, &task_baro_read_attributes);
 
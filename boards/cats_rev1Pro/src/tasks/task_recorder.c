@@ -21,38 +21,136 @@
 #include "util/log.h"
 #include "util/types.h"
 #include "lfs/lfs_custom.h"
+#include "lfs/raw_partition.h"
+#include "lfs/flight_index.h"
 #include "util/recorder.h"
+#include "util/rec_tier.h"
+#include "util/flight_stats.h"
+#include "util/crc32.h"
+#include "util/cycle_counter.h"
+#include "util/error_handler.h"
 #include "config/cats_config.h"
+#include "config/globals.h"
 
+#include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
 
 /** Private Constants **/
 
-#define REC_BUFFER_LEN 256
+/* While there is nothing to write, task_rec_writer erases the raw partition ahead of the recording; every
+ * REC_ERASE_INTERVAL ms it starts the next 64 KiB block once the previous one is done */
+#define REC_ERASE_INTERVAL 10
+
+/* lfs_fs_size walks the whole file system; while a flight is written to LFS the free space is only measured every
+ * REC_SPACE_CHECK_INTERVAL bytes and estimated from the bytes written in between */
+#define REC_SPACE_CHECK_INTERVAL (64 * LOG_BLOCK_SIZE)
+
+#ifdef REC_USE_CODEC
+#define REC_DATA_BLOCK_FLAGS LOG_BLOCK_FLAG_ENCODED
+#else
+#define REC_DATA_BLOCK_FLAGS 0
+#endif
+
+/* A record is on the flash at most rec_sync_window ms after it was taken: task_recorder hands a block over once its
+ * first record is older than half of the window and task_rec_writer commits the flight file once the oldest data in
+ * it waited for half of the window, see get_sync_deadline(). The window is shifted right per phase group; the ascent
+ * gets the full window so that the bandwidth goes to the data, on the pad and under the parachutes it is quartered. */
+static const uint8_t rec_sync_window_shift[NUM_REC_PHASES] = {2, 0, 2};
+/* A block with a record from the event lane is handed over and committed right away in every phase, but at most once
+ * every rec_event_sync_interval ms per phase group; a later event waits for the next slot or the deadline. The ascent
+ * packs liftoff, burnout and apogee into a few seconds and a commit there costs the most bandwidth. It isn't a setting:
+ * the flight events are few and the interval only bounds how often they can force a commit, unlike rec_sync_window
+ * it doesn't trade the latency of all records against bandwidth. */
+static const uint16_t rec_event_sync_interval[NUM_REC_PHASES] = {0, 100, 0};
+/* Lower bound of the deadline in ms, what the smallest rec_sync_window the CLI accepts (500 ms) gives on the pad; a
+ * config saved before the window had a minimum could otherwise turn into a flood of nearly empty blocks */
+#define REC_MIN_SYNC_DEADLINE 62
+
+/** Private Variables **/
+
+/* Every buffer holds one flight log block. Buffers are owned by task_recorder while they are filled and by
+ * task_rec_writer while they are written; the ownership is passed through rec_buf_full_queue and rec_buf_free_queue. */
+static uint8_t rec_buffers[REC_NUM_BUFFERS][LOG_BLOCK_SIZE] = {};
+static uint8_t rec_buffer_slot = 0;
+/* Number of payload bytes in the current block */
+static uint32_t rec_buffer_idx = 0;
+static uint32_t rec_block_seq = 0;
+/* Timestamp of the first record in the current block and whether it contains a record from the event lane */
+static uint32_t rec_block_start_tick = 0;
+static bool rec_block_has_event = false;
+/* When a block was last handed over because of an event */
+static uint32_t rec_last_event_sync_tick = 0;
+
+/* Set while a flight is being recorded; the flight goes to the raw partition unless it isn't available */
+static bool rec_use_raw_partition = false;
+
+/* Only touched by task_rec_writer while a flight is being recorded */
+static lfs_file_t current_flight_file;
+/* Some blocks were written to the flight file but not committed yet; the oldest data among them was taken at
+ * oldest_unsynced_tick */
+static bool flight_file_dirty = false;
+static uint32_t oldest_unsynced_tick = 0;
+/* Free space of LFS at the last measurement and the bytes written to the flight file since */
+static uint32_t lfs_free_space = 0;
+static uint32_t bytes_since_space_check = 0;
+
+/* Records collected before liftoff; only touched by task_recorder */
+static uint8_t rec_history_buffer[REC_HISTORY_SIZE] = {};
+static rec_ring_t rec_history = {.data = rec_history_buffer, .size = REC_HISTORY_SIZE};
+static timestamp_t rec_history_newest_ts = 0;
+/* rec_get_history_duration() when the queue started filling */
+static uint32_t rec_history_duration = 0;
+
+/* Timestamp of the last IMU record written per IMU ID, 0 before the first one; only touched by task_recorder */
+static timestamp_t rec_last_imu_ts[REC_ID_MASK + 1] = {};
+
+#ifdef REC_USE_CODEC
+static rec_codec_t rec_codec;
+#endif
 
 /** Private Function Declarations **/
 
-static inline uint_fast8_t get_rec_elem_size(const rec_elem_t *rec_elem);
-static inline void write_value(const rec_elem_t *rec_elem, uint8_t *rec_buffer, uint16_t *rec_buffer_idx,
-                               uint_fast8_t *rec_elem_size);
+static uint32_t get_oldest_record_size(rec_ring_t *ring);
+static uint32_t read_record(rec_ring_t *ring, rec_elem_t *rec_elem);
+static void make_room_in_history(uint32_t count);
+static void move_to_history(rec_ring_t *lane);
+static void evict_old_history();
+static void update_history_telemetry();
+static uint32_t write_lane(rec_ring_t *lane);
+static uint32_t append_records(rec_ring_t *lane, const uint8_t *span, uint32_t len);
+static inline uint8_t *get_payload() { return &rec_buffers[rec_buffer_slot][sizeof(log_block_header_t)]; }
+static void acquire_buffer();
+static void submit_buffer(uint16_t flags, bool sync);
+static void wait_for_writer();
+static void flush_lanes();
+static void update_latency(rec_latency_t *latency, uint32_t start_cycles);
+static void update_imu_gap(const uint8_t *record);
+static uint32_t get_sync_deadline();
+static void sync_flight_file();
+static void update_commit_delay(uint32_t start_tick);
+static uint32_t get_free_space();
+static void update_storage_tier(bool write_failed);
 
 static void create_stats_file();
 
 /** Exported Function Definitions **/
 
 _Noreturn void task_recorder(__attribute__((unused)) void *argument) {
-  uint8_t rec_buffer[REC_BUFFER_LEN] = {};
-
-  uint16_t rec_buffer_idx = 0;
-  uint_fast8_t curr_log_elem_size = 0;
-
   log_debug("Recorder Task Started...\n");
 
-  uint16_t bytes_remaining = 0;
-  uint32_t max_elem_count = 0;
+#ifdef REC_USE_CODEC
+  rec_codec_init(&rec_codec, rec_layouts);
+#endif
+
+  /* hand out all buffers; the recorder always holds one of them */
+  for (uint8_t i = 0; i < REC_NUM_BUFFERS; ++i) {
+    osMessageQueuePut(rec_buf_free_queue, &i, 0U, osWaitForever);
+  }
+  acquire_buffer();
 
-  lfs_file_t current_flight_file;
   char current_flight_filename[MAX_FILENAME_SIZE] = {};
+  uint32_t write_start_tick = 0;
 
   while (1) {
     rec_cmd_type_e curr_rec_cmd = REC_CMD_INVALID;
@@ -67,179 +165,651 @@ _Noreturn void task_recorder(__attribute__((unused)) void *argument) {
         log_error("Invalid command value!");
         break;
       case REC_CMD_FILL_Q: {
-        rec_elem_t dummy_log_elem;
-        uint32_t cmd_check_counter = 0;
         log_info("Started filling pre recording queue");
+        rec_ring_flush(&rec_history);
+        rec_history_newest_ts = 0;
+        /* a longer history than the buffer holds at the ground rates would silently be cut short */
+        rec_history_duration = rec_get_history_duration();
+        if (global_cats_config.config.rec_history_duration > rec_history_duration) {
+          log_warn("Pre-launch history limited to %lu ms by the history buffer", rec_history_duration);
+        }
+        global_rec_telemetry.history_duration = rec_history_duration;
         while (1) {
-          uint32_t curr_elem_count = osMessageQueueGetCount(rec_queue);
-          if (curr_elem_count > REC_QUEUE_PRE_THRUSTING_LIMIT) {
-            /* If the number of elements goes over REC_QUEUE_PRE_THRUSTING_LIMIT we start to empty it. When thrusting is
-             * detected we will have around REC_QUEUE_PRE_THRUSTING_LIMIT elements in the queue and in the next loop
-             * iteration we will start to write the elements to the flash. */
-            osMessageQueueGet(rec_queue, &dummy_log_elem, 0, 10);
-            // osMessageQueueGet(rec_queue, &dummy_log_elem, 0, 10);
-            // osMessageQueueGet(rec_queue, &dummy_log_elem, 0, 10);
-          } else {
-            /* Check for a new command */
-            if (osMessageQueueGetCount(rec_cmd_queue) > 0) {
-              /* breaks out of the inner while loop */
-              break;
-            }
-            osDelay(1);
+          /* Keep the lanes empty and only hold the last rec_history_duration ms in the pre-launch history. When
+           * thrusting is detected the history is written to the flash first, followed by the live records. */
+          for (uint32_t i = 0; i < NUM_REC_LANES; ++i) {
+            move_to_history(&rec_lanes[i]);
           }
-
-          ++cmd_check_counter;
+          evict_old_history();
+          update_history_telemetry();
           /* Check for a new command */
-          if (((cmd_check_counter % 16) == 0) && (osMessageQueueGetCount(rec_cmd_queue) > 0)) {
+          if (osMessageQueueGetCount(rec_cmd_queue) > 0) {
             /* breaks out of the inner while loop */
             break;
           }
+          osDelay(1);
         }
       } break;
       case REC_CMD_FILL_Q_STOP:
-        osMessageQueueReset(rec_queue);
+        flush_lanes();
+        rec_ring_flush(&rec_history);
         break;
       case REC_CMD_WRITE: {
         /* increment number of flights */
         ++flight_counter;
-        lfs_file_open(&lfs, &fc_file, "flight_counter", LFS_O_RDWR | LFS_O_CREAT);
-        lfs_file_rewind(&lfs, &fc_file);
-        lfs_file_write(&lfs, &fc_file, &flight_counter, sizeof(flight_counter));
-        lfs_file_close(&lfs, &fc_file);
-
-        /* reset flight stats */
-        reset_global_flight_stats();
-
-        /* open a new file */
-        snprintf(current_flight_filename, MAX_FILENAME_SIZE, "flights/flight_%05lu", flight_counter);
-        lfs_file_open(&lfs, &current_flight_file, current_flight_filename, LFS_O_WRONLY | LFS_O_CREAT);
-        rec_elem_t curr_log_elem;
-        uint32_t sync_counter = 0;
+
+        /* the flight stats are reset at liftoff, see util/flight_stats.h */
+        memset(&global_rec_telemetry, 0, sizeof(global_rec_telemetry));
+        memset(rec_last_imu_ts, 0, sizeof(rec_last_imu_ts));
+        global_rec_telemetry.history_duration = rec_history_duration;
+        update_history_telemetry();
+
+        /* Open a new extent in the raw partition, the flight counter is only stored after the flight; task_rec_writer
+         * is idle at this point */
+        rec_use_raw_partition = raw_partition_open(flight_counter);
+        if (!rec_use_raw_partition) {
+          log_warn("Raw partition not available, writing the flight to LFS");
+          save_flight_counter();
+          snprintf(current_flight_filename, MAX_FILENAME_SIZE, "flights/flight_%05lu", flight_counter);
+          lfs_file_open(&lfs, &current_flight_file, current_flight_filename, LFS_O_WRONLY | LFS_O_CREAT);
+        }
+        flight_file_dirty = false;
+        if (!rec_use_raw_partition) {
+          lfs_free_space = lfs_get_free_space();
+          bytes_since_space_check = 0;
+        }
+        /* the flash might already be close to full, this also goes into the header block */
+        update_storage_tier(false);
+        write_start_tick = osKernelGetTickCount();
+        /* every file starts with the header block, see util/log_format.h */
+        rec_block_seq = 0;
+        rec_buffer_idx = fill_log_header(get_payload(), flight_counter);
+        submit_buffer(LOG_BLOCK_FLAG_HEADER, false);
         log_info("Started writing to flash");
+        /* everything in the history is older than what is in the lanes, write it out in bulk */
+        write_lane(&rec_history);
         while (1) {
-          /* TODO: check if this should be < or <= */
-          while (rec_buffer_idx < REC_BUFFER_LEN) {
-            // uint32_t curr_elem_count = osMessageQueueGetCount(rec_queue);
-            // if (max_elem_count < curr_elem_count) {
-            //  max_elem_count = curr_elem_count;
-            //  log_warn("max_queued_elems: %lu", max_elem_count);
-            //}
-
-            if (osMessageQueueGet(rec_queue, &curr_log_elem, NULL, osWaitForever) == osOK) {
-              // trace_print(flash_channel, "write_value start");
-              write_value(&curr_log_elem, rec_buffer, &rec_buffer_idx, &curr_log_elem_size);
-              // trace_print(flash_channel, "write_value end");
-            } else {
-              log_error("Something wrong with the recording queue!");
+          uint32_t bytes_read = 0;
+          for (uint32_t i = 0; i < NUM_REC_LANES; ++i) {
+            if (i == REC_LANE_EVENT) {
+              continue;
             }
-          }
-          // log_info("lfw start");
-          // trace_print(flash_channel, "lfw start");
-          int32_t sz = lfs_file_write(&lfs, &current_flight_file, rec_buffer, (lfs_size_t)REC_BUFFER_LEN);
-          // trace_printf(flash_channel, "lfw end, written %ld", sz);
-          ++sync_counter;
-          /* Check for a new command */
-          if ((sync_counter % 32) == 0) {
-            lfs_file_sync(&lfs, &current_flight_file);
-          }
-          // log_info("lfw synced");
-          // log_info("written to file: %ld", sz);
-
-          /* reset log buffer index */
-          if (rec_buffer_idx > REC_BUFFER_LEN) {
-            bytes_remaining = rec_buffer_idx - REC_BUFFER_LEN;
-            rec_buffer_idx = bytes_remaining;
-          } else {
-            rec_buffer_idx = 0;
+            /* The events go first and again before every bulk lane; serializing a bulk lane can block until the
+             * writer frees a buffer */
+            const uint32_t event_bytes = write_lane(&rec_lanes[REC_LANE_EVENT]);
+            rec_block_has_event |= event_bytes > 0 && rec_buffer_idx > 0;
+            bytes_read += event_bytes;
+            bytes_read += write_lane(&rec_lanes[i]);
           }
 
-          if (rec_buffer_idx > 0) {
-            memcpy(rec_buffer, (uint8_t *)(&curr_log_elem) + curr_log_elem_size - bytes_remaining, bytes_remaining);
+          /* Don't keep the records in RAM for longer than the sync policy allows */
+          const rec_phase_e phase = get_rec_phase(global_flight_state.flight_state);
+          const uint32_t now = osKernelGetTickCount();
+          const bool event_sync =
+              rec_block_has_event && now - rec_last_event_sync_tick >= rec_event_sync_interval[phase];
+          if (rec_buffer_idx > 0 && (event_sync || now - rec_block_start_tick >= get_sync_deadline())) {
+            if (rec_block_has_event) {
+              rec_last_event_sync_tick = now;
+            }
+            submit_buffer(REC_DATA_BLOCK_FLAGS, true);
           }
+
           /* Check for a new command */
           if (osMessageQueueGetCount(rec_cmd_queue) > 0) {
             /* breaks out of the inner while loop */
             break;
           }
+
+          /* All lanes are empty, wait for the producers */
+          if (bytes_read == 0) {
+            osDelay(1);
+          }
         }
       } break;
       case REC_CMD_WRITE_STOP: {
         log_info("Stopped writing to flash");
-        /* close the current file */
-        lfs_file_close(&lfs, &current_flight_file);
+        /* hand over the partially filled block and wait until everything is on the flash */
+        submit_buffer(REC_DATA_BLOCK_FLAGS, true);
+        wait_for_writer();
 
-        /* reset recording buffer index and queue */
-        rec_buffer_idx = 0;
-        osMessageQueueReset(rec_queue);
+        const rec_telemetry_t *telemetry = &global_rec_telemetry;
+        const uint32_t duration_ms = osKernelGetTickCount() - write_start_tick;
+        uint32_t busy_us = telemetry->write_latency.total;
+        for (uint32_t i = 0; i < NUM_REC_PHASES; ++i) {
+          busy_us += telemetry->sync_latency[i].total;
+        }
+        if (duration_ms > 0 && busy_us > 0) {
+          log_info("Wrote %lu bytes in %lu ms: %lu B/s sustained, %lu B/s while writing", telemetry->bytes_written,
+                   duration_ms, (uint32_t)((uint64_t)telemetry->bytes_written * 1000 / duration_ms),
+                   (uint32_t)((uint64_t)telemetry->bytes_written * 1000000 / busy_us));
+        }
+
+        for (uint32_t i = 0; i < NUM_REC_LANES; ++i) {
+          const rec_lane_stats_t *lane_stats = &telemetry->lanes[i];
+          if (lane_stats->dropped > 0 || lane_stats->shed > 0) {
+            log_warn("Lane %lu: %lu records dropped, %lu shed, high water %u of %lu bytes", i, lane_stats->dropped,
+                     lane_stats->shed, lane_stats->high_water, rec_lanes[i].size);
+          }
+        }
+
+        /* close the current flight */
+        if (rec_use_raw_partition) {
+          /* the counter goes first, the extent is registered under this number */
+          save_flight_counter();
+          if (!raw_partition_close()) {
+            log_error("Closing the flight failed, it is recovered at the next boot");
+          }
+          rec_use_raw_partition = false;
+        } else {
+          lfs_file_close(&lfs, &current_flight_file);
+        }
+
+        /* reset the recorder lanes */
+        flush_lanes();
 
         /* create flight stats file */
         create_stats_file();
+
+        /* make room for the next flight right away so that it can be erased ahead on the pad */
+        flight_index_add(flight_counter, &global_flight_stats);
+        flight_index_apply_retention(global_cats_config.config.rec_retention_size * 1024);
       } break;
       default:
         log_error("Unknown command value: %u", curr_rec_cmd);
         break;
     }
   }
-  /* TODO: check if there is enough space left on the flash */
+}
+
+_Noreturn void task_rec_writer(__attribute__((unused)) void *argument) {
+  log_debug("Recorder Writer Task Started...\n");
+
+  while (1) {
+    rec_buf_desc_t rec_buf = {};
+    const osStatus_t status = osMessageQueueGet(rec_buf_full_queue, &rec_buf, NULL, REC_ERASE_INTERVAL);
+    if (status == osErrorTimeout) {
+      /* Prepare the flash for the next flight while waiting on the pad so that the recording doesn't have to wait for
+       * sector erases */
+      if (global_recorder_status == REC_FILL_QUEUE) {
+        raw_partition_erase_ahead(REC_PREERASE_SIZE);
+      }
+      continue;
+    }
+    if (status != osOK) {
+      log_error("Something wrong with the recorder buffer queue");
+      continue;
+    }
+
+    rec_telemetry_t *telemetry = &global_rec_telemetry;
+    const uint32_t start_cycles = cycle_counter_get();
+    if (rec_use_raw_partition) {
+      /* plain page programs, nothing has to be committed */
+      const bool written = raw_partition_append(rec_buffers[rec_buf.slot], rec_buf.len);
+      update_latency(&telemetry->write_latency, start_cycles);
+      if (written) {
+        telemetry->bytes_written += rec_buf.len;
+        ++telemetry->blocks_written;
+        update_commit_delay(rec_buf.start_tick);
+      } else {
+        log_error("Writing to the raw partition failed");
+      }
+      update_storage_tier(!written);
+    } else {
+      // trace_print(flash_channel, "lfw start");
+      int32_t sz = lfs_file_write(&lfs, &current_flight_file, rec_buffers[rec_buf.slot], (lfs_size_t)rec_buf.len);
+      // trace_printf(flash_channel, "lfw end, written %ld", sz);
+      update_latency(&telemetry->write_latency, start_cycles);
+      if (sz < 0) {
+        log_error("Writing to the flight file failed: %ld", sz);
+      } else {
+        bytes_since_space_check += (uint32_t)sz;
+        telemetry->bytes_written += (uint32_t)sz;
+        ++telemetry->blocks_written;
+        if (!flight_file_dirty && rec_buf.start_tick != 0) {
+          flight_file_dirty = true;
+          oldest_unsynced_tick = rec_buf.start_tick;
+        }
+      }
+      update_storage_tier(sz < 0);
+      if (flight_file_dirty &&
+          (rec_buf.sync || osKernelGetTickCount() - oldest_unsynced_tick >= get_sync_deadline())) {
+        sync_flight_file();
+      }
+    }
+
+    osMessageQueuePut(rec_buf_free_queue, &rec_buf.slot, 0U, osWaitForever);
+  }
 }
 
 /** Private Function Definitions **/
 
-static uint_fast8_t get_rec_elem_size(const rec_elem_t *const rec_elem) {
-  uint_fast8_t rec_elem_size = sizeof(rec_elem->rec_type);
-  switch (get_record_type_without_id(rec_elem->rec_type)) {
-    case IMU:
-      rec_elem_size += sizeof(rec_elem->u.imu);
-      break;
-    case BARO:
-      rec_elem_size += sizeof(rec_elem->u.baro);
-      break;
-    case MAGNETO:
-      rec_elem_size += sizeof(rec_elem->u.magneto_info);
-      break;
-    case ACCELEROMETER:
-      rec_elem_size += sizeof(rec_elem->u.accel_data);
-      break;
-    case FLIGHT_INFO:
-      rec_elem_size += sizeof(rec_elem->u.flight_info);
-      break;
-    case ORIENTATION_INFO:
-      rec_elem_size += sizeof(rec_elem->u.orientation_info);
-      break;
-    case FILTERED_DATA_INFO:
-      rec_elem_size += sizeof(rec_elem->u.filtered_data_info);
-      break;
-    case FLIGHT_STATE:
-      rec_elem_size += sizeof(rec_elem->u.flight_state);
-      break;
-    case COVARIANCE_INFO:
-      rec_elem_size += sizeof(rec_elem->u.covariance_info);
-      break;
-    case SENSOR_INFO:
-      rec_elem_size += sizeof(rec_elem->u.sensor_info);
+/**
+ * Get the packed size of the record at the start of a span.
+ *
+ * @param record - start of the record
+ * @param len - number of bytes in the span
+ * @return packed size of the record; 0 if the record doesn't end within the span or its type is unknown
+ */
+static inline uint32_t get_span_record_size(const uint8_t *record, uint32_t len) {
+  rec_entry_type_e rec_type;
+  if (len < sizeof(rec_type)) {
+    return 0;
+  }
+  memcpy(&rec_type, record, sizeof(rec_type));
+  const uint32_t elem_size = get_rec_elem_size(rec_type);
+  return elem_size <= len ? elem_size : 0;
+}
+
+/* Timestamp of a packed record, the records in the rings are not aligned; every record struct starts with it */
+static inline timestamp_t get_record_ts(const uint8_t *record) {
+  timestamp_t ts;
+  memcpy(&ts, &record[offsetof(rec_elem_t, u)], sizeof(ts));
+  return ts;
+}
+
+/**
+ * Get the packed size of the oldest record of the ring without consuming it.
+ *
+ * @param ring - ring to read from
+ * @return packed size of the record; 0 if the ring is empty or corrupted, in which case it is flushed
+ */
+static uint32_t get_oldest_record_size(rec_ring_t *ring) {
+  const uint32_t length = rec_ring_get_length(ring);
+  if (length == 0) {
+    return 0;
+  }
+  rec_entry_type_e rec_type = 0;
+  if (length >= sizeof(rec_type)) {
+    rec_ring_copy(ring, &rec_type, sizeof(rec_type));
+  }
+  const uint32_t elem_size = get_rec_elem_size(rec_type);
+  if (elem_size == 0 || elem_size > length) {
+    /* Should never happen, the ring can't be parsed anymore */
+    log_fatal("Impossible recorder entry type!");
+    rec_ring_flush(ring);
+    return 0;
+  }
+  return elem_size;
+}
+
+/**
+ * Read and consume the oldest record of the ring. Only used for the records which wrap around the end of the ring,
+ * all others are processed in place, see write_lane().
+ *
+ * @param ring - ring to read from
+ * @param rec_elem[out] - the record
+ * @return packed size of the record; 0 if the ring is empty or corrupted, in which case it is flushed
+ */
+static uint32_t read_record(rec_ring_t *ring, rec_elem_t *rec_elem) {
+  const uint32_t elem_size = get_oldest_record_size(ring);
+  if (elem_size > 0) {
+    /* the packed record has the same layout as rec_elem_t */
+    rec_ring_copy(ring, rec_elem, elem_size);
+    rec_ring_consume(ring, elem_size);
+  }
+  return elem_size;
+}
+
+/**
+ * Drop the oldest records of the pre-launch history until there is room for `count` bytes.
+ *
+ * @param count - number of bytes which have to fit
+ */
+static void make_room_in_history(uint32_t count) {
+  while (rec_ring_get_free(&rec_history) < count) {
+    const uint32_t elem_size = get_oldest_record_size(&rec_history);
+    if (elem_size == 0) {
       break;
-    case EVENT_INFO:
-      rec_elem_size += sizeof(rec_elem->u.event_info);
+    }
+    rec_ring_consume(&rec_history, elem_size);
+  }
+}
+
+/**
+ * Move all records of the lane into the pre-launch history. If the history is full its oldest records are dropped.
+ * The records are moved in contiguous runs, only a record which wraps around the end of the lane is copied on its own.
+ *
+ * @param lane - lane to empty
+ */
+static void move_to_history(rec_ring_t *lane) {
+  while (rec_ring_get_length(lane) > 0) {
+    const uint8_t *span = NULL;
+    const uint32_t span_len = rec_ring_peek(lane, &span);
+    uint32_t run = 0;
+    uint32_t elem_size = 0;
+    while ((elem_size = get_span_record_size(&span[run], span_len - run)) > 0) {
+      const timestamp_t ts = get_record_ts(&span[run]);
+      if (ts > rec_history_newest_ts) {
+        rec_history_newest_ts = ts;
+      }
+      run += elem_size;
+    }
+    if (run > 0) {
+      make_room_in_history(run);
+      rec_ring_write(&rec_history, span, run);
+      rec_ring_consume(lane, run);
+      continue;
+    }
+    /* the next record wraps around the end of the lane */
+    rec_elem_t rec_elem;
+    elem_size = read_record(lane, &rec_elem);
+    if (elem_size == 0) {
       break;
-    case ERROR_INFO:
-      rec_elem_size += sizeof(rec_elem->u.error_info);
+    }
+    make_room_in_history(elem_size);
+    rec_ring_write(&rec_history, &rec_elem, elem_size);
+    if (rec_elem.u.imu.ts > rec_history_newest_ts) {
+      rec_history_newest_ts = rec_elem.u.imu.ts;
+    }
+  }
+}
+
+/* Drop the records which are older than rec_history_duration. The lanes are merged into the history one after the
+ * other so it is only roughly sorted by time, which is good enough for the eviction. */
+static void evict_old_history() {
+  const uint32_t duration = rec_history_duration;
+  struct {
+    rec_entry_type_e rec_type;
+    timestamp_t ts;
+  } oldest;
+  while (rec_ring_get_length(&rec_history) >= sizeof(oldest)) {
+    rec_ring_copy(&rec_history, &oldest, sizeof(oldest));
+    if (rec_history_newest_ts - oldest.ts <= duration) {
       break;
-    default:
-      log_fatal("Impossible recorder entry type!");
+    }
+    const uint32_t elem_size = get_oldest_record_size(&rec_history);
+    if (elem_size == 0) {
       break;
+    }
+    rec_ring_consume(&rec_history, elem_size);
+  }
+}
+
+/* Store how far back the pre-launch history reaches */
+static void update_history_telemetry() {
+  struct {
+    rec_entry_type_e rec_type;
+    timestamp_t ts;
+  } oldest;
+  uint32_t kept = 0;
+  if (rec_ring_get_length(&rec_history) >= sizeof(oldest)) {
+    rec_ring_copy(&rec_history, &oldest, sizeof(oldest));
+    kept = rec_history_newest_ts > oldest.ts ? rec_history_newest_ts - oldest.ts : 0;
+  }
+  global_rec_telemetry.history_kept = kept;
+}
+
+/**
+ * Serialize everything that is currently stored in the lane into the recorder buffers. The whole content is taken in
+ * one go so that a record which wraps around the end of the lane is not interleaved with records from other lanes.
+ * The records are serialized straight from the lane; only a record which wraps around the end is copied first.
+ *
+ * @param lane - lane to serialize
+ * @return number of bytes read from the lane
+ */
+static uint32_t write_lane(rec_ring_t *lane) {
+  /* The producer only publishes whole records, therefore this is always a record boundary */
+  const uint32_t length = rec_ring_get_length(lane);
+  uint32_t remaining = length;
+  while (remaining > 0) {
+    const uint8_t *span = NULL;
+    uint32_t span_len = rec_ring_peek(lane, &span);
+    if (span_len > remaining) {
+      span_len = remaining;
+    }
+    uint32_t taken = append_records(lane, span, span_len);
+    if (taken == 0) {
+      /* the next record wraps around the end of the lane */
+      rec_elem_t rec_elem;
+      taken = read_record(lane, &rec_elem);
+      if (taken == 0) {
+        break;
+      }
+      append_records(NULL, (const uint8_t *)&rec_elem, taken);
+    }
+    remaining -= taken;
   }
-  return rec_elem_size;
+  return length;
 }
 
-static inline void write_value(const rec_elem_t *const rec_elem, uint8_t *const rec_buffer, uint16_t *rec_buffer_idx,
-                               uint_fast8_t *const rec_elem_size) {
-  *rec_elem_size = get_rec_elem_size(rec_elem);
-  if (*rec_buffer_idx + *rec_elem_size > REC_BUFFER_LEN) {
-    memcpy(&(rec_buffer[*rec_buffer_idx]), rec_elem, (REC_BUFFER_LEN - *rec_buffer_idx));
+/**
+ * Append the whole records at the start of a span to the current block. Records never span two blocks, if a record
+ * doesn't fit anymore the block is submitted and the record goes into the next one. Without the codec the records are
+ * copied in one run per block.
+ *
+ * @param lane - lane the span belongs to, the records are consumed as soon as they are in a block so that the producer
+ *               doesn't have to wait for a submitted block; NULL if the span is a copy
+ * @param span - packed records
+ * @param len - number of bytes in the span
+ * @return number of bytes appended; 0 if the first record doesn't end within the span
+ */
+static uint32_t append_records(rec_ring_t *lane, const uint8_t *span, uint32_t len) {
+  uint32_t idx = 0;
+  uint32_t run_start = 0;
+  uint32_t elem_size = 0;
+  while ((elem_size = get_span_record_size(&span[idx], len - idx)) > 0) {
+    const uint8_t *record = &span[idx];
+    update_imu_gap(record);
+#ifdef REC_USE_CODEC
+    rec_entry_type_e rec_type;
+    memcpy(&rec_type, record, sizeof(rec_type));
+    const uint32_t type_idx = get_rec_type_index(rec_type);
+    const uint8_t id = get_id_from_record_type(rec_type);
+    const uint8_t *elem = &record[offsetof(rec_elem_t, u)];
+    if (rec_buffer_idx + REC_CODEC_MAX_ENC_SIZE <= LOG_BLOCK_PAYLOAD_SIZE) {
+      /* the record fits in any case, encode it right into the block */
+      if (rec_buffer_idx == 0) {
+        rec_block_start_tick = get_record_ts(record);
+      }
+      rec_buffer_idx += rec_codec_encode(&rec_codec, type_idx, id, elem, &get_payload()[rec_buffer_idx]);
+    } else {
+      uint8_t encoded[REC_CODEC_MAX_ENC_SIZE];
+      uint32_t encoded_size = rec_codec_encode(&rec_codec, type_idx, id, elem, encoded);
+      if (rec_buffer_idx + encoded_size > LOG_BLOCK_PAYLOAD_SIZE) {
+        if (lane != NULL) {
+          rec_ring_consume(lane, idx - run_start);
+          run_start = idx;
+        }
+        /* the codec history is reset with the new block, the record has to be encoded again */
+        submit_buffer(REC_DATA_BLOCK_FLAGS, false);
+        encoded_size = rec_codec_encode(&rec_codec, type_idx, id, elem, encoded);
+        rec_block_start_tick = get_record_ts(record);
+      }
+      memcpy(&get_payload()[rec_buffer_idx], encoded, encoded_size);
+      rec_buffer_idx += encoded_size;
+    }
+#else
+    if (rec_buffer_idx + (idx - run_start) + elem_size > LOG_BLOCK_PAYLOAD_SIZE) {
+      /* the packed records have the same layout as in the lane */
+      memcpy(&get_payload()[rec_buffer_idx], &span[run_start], idx - run_start);
+      rec_buffer_idx += idx - run_start;
+      if (lane != NULL) {
+        rec_ring_consume(lane, idx - run_start);
+      }
+      run_start = idx;
+      submit_buffer(REC_DATA_BLOCK_FLAGS, false);
+    }
+    if (rec_buffer_idx == 0 && idx == run_start) {
+      rec_block_start_tick = get_record_ts(record);
+    }
+#endif
+    idx += elem_size;
+  }
+#ifndef REC_USE_CODEC
+  memcpy(&get_payload()[rec_buffer_idx], &span[run_start], idx - run_start);
+  rec_buffer_idx += idx - run_start;
+#endif
+  if (lane != NULL) {
+    rec_ring_consume(lane, idx - run_start);
+  }
+  return idx;
+}
+
+/* Take the next empty buffer, blocks while task_rec_writer is busy with all others */
+static void acquire_buffer() {
+  const uint32_t start_cycles = cycle_counter_get();
+  osMessageQueueGet(rec_buf_free_queue, &rec_buffer_slot, NULL, osWaitForever);
+  const uint32_t wait_us = cycle_counter_to_us(cycle_counter_get() - start_cycles);
+  if (wait_us > global_rec_telemetry.max_buffer_wait) {
+    global_rec_telemetry.max_buffer_wait = wait_us;
+  }
+  rec_buffer_idx = 0;
+  rec_block_start_tick = 0;
+  rec_block_has_event = false;
+#ifdef REC_USE_CODEC
+  /* every block can be decoded on its own */
+  rec_codec_reset(&rec_codec);
+#endif
+}
+
+/**
+ * Complete the current block and hand it over to task_rec_writer, then continue with the next one.
+ *
+ * @param flags - LOG_BLOCK_FLAG_* of the block
+ * @param sync - commit the flight file right after the block was written
+ */
+static void submit_buffer(uint16_t flags, bool sync) {
+  if (rec_buffer_idx == 0) {
+    return;
+  }
+  uint8_t *block = rec_buffers[rec_buffer_slot];
+  /* the storage tier tells the reader which records were left out on purpose */
+  flags |= (uint16_t)((global_rec_telemetry.storage_tier << LOG_BLOCK_TIER_SHIFT) & LOG_BLOCK_TIER_MASK);
+  log_block_header_t header = {
+      .sync = LOG_BLOCK_SYNC, .crc = 0, .seq = rec_block_seq++, .len = (uint16_t)rec_buffer_idx, .flags = flags};
+  memcpy(block, &header, sizeof(header));
+  memset(&block[sizeof(header) + rec_buffer_idx], 0, LOG_BLOCK_PAYLOAD_SIZE - rec_buffer_idx);
+  header.crc = crc32_compute(&block[LOG_BLOCK_CRC_OFFSET], LOG_BLOCK_SIZE - LOG_BLOCK_CRC_OFFSET);
+  memcpy(block, &header, sizeof(header));
+
+  rec_buf_desc_t rec_buf = {
+      .slot = rec_buffer_slot, .sync = sync, .len = LOG_BLOCK_SIZE, .start_tick = rec_block_start_tick};
+  osMessageQueuePut(rec_buf_full_queue, &rec_buf, 0U, osWaitForever);
+  const uint32_t pending = osMessageQueueGetCount(rec_buf_full_queue);
+  if (pending > global_rec_telemetry.max_pending_blocks) {
+    global_rec_telemetry.max_pending_blocks = pending;
+  }
+  acquire_buffer();
+}
+
+/* Wait until task_rec_writer has written all submitted buffers */
+static void wait_for_writer() {
+  while (osMessageQueueGetCount(rec_buf_free_queue) < REC_NUM_BUFFERS - 1) {
+    osDelay(1);
+  }
+}
+
+static void flush_lanes() {
+  for (uint32_t i = 0; i < NUM_REC_LANES; ++i) {
+    rec_ring_flush(&rec_lanes[i]);
+  }
+}
+
+/**
+ * Add the duration of an operation to its statistics.
+ *
+ * @param latency - statistics of the operation
+ * @param start_cycles - value of the cycle counter when the operation started
+ */
+static void update_latency(rec_latency_t *latency, uint32_t start_cycles) {
+  const uint32_t duration_us = cycle_counter_to_us(cycle_counter_get() - start_cycles);
+  if (latency->count == 0 || duration_us < latency->min) {
+    latency->min = duration_us;
+  }
+  if (duration_us > latency->max) {
+    latency->max = duration_us;
+  }
+  latency->total += duration_us;
+  ++latency->count;
+}
+
+/* Track the longest gap between consecutive IMU records which make it into the flight log; this includes the
+ * decimation, the load shedding and dropped records */
+static void update_imu_gap(const uint8_t *record) {
+  rec_entry_type_e rec_type;
+  memcpy(&rec_type, record, sizeof(rec_type));
+  if (get_record_type_without_id(rec_type) != IMU) {
+    return;
+  }
+  const timestamp_t ts = get_record_ts(record);
+  timestamp_t *last_ts = &rec_last_imu_ts[get_id_from_record_type(rec_type)];
+  if (*last_ts != 0 && ts > *last_ts) {
+    const uint32_t gap = ts - *last_ts;
+    if (gap > global_rec_telemetry.max_imu_gap) {
+      global_rec_telemetry.max_imu_gap = gap;
+    }
+  }
+  *last_ts = ts;
+}
+
+/* Half of the sync window of the current phase group in ms */
+static uint32_t get_sync_deadline() {
+  const rec_phase_e phase = get_rec_phase(global_flight_state.flight_state);
+  const uint32_t deadline = (global_cats_config.config.rec_sync_window >> rec_sync_window_shift[phase]) / 2;
+  return deadline > REC_MIN_SYNC_DEADLINE ? deadline : REC_MIN_SYNC_DEADLINE;
+}
+
+/* Commit the flight file and account the cost to the current phase group */
+static void sync_flight_file() {
+  rec_telemetry_t *telemetry = &global_rec_telemetry;
+  const rec_phase_e phase = get_rec_phase(global_flight_state.flight_state);
+  const uint32_t start_cycles = cycle_counter_get();
+  const int err = lfs_file_sync(&lfs, &current_flight_file);
+  update_latency(&telemetry->sync_latency[phase], start_cycles);
+  if (err < 0) {
+    log_error("Syncing the flight file failed: %d", err);
+    return;
+  }
+  update_commit_delay(oldest_unsynced_tick);
+  flight_file_dirty = false;
+}
+
+/**
+ * Track the longest time it took until a record was committed to the flash.
+ *
+ * @param start_tick - timestamp of the oldest record which was just committed; 0 if unknown
+ */
+static void update_commit_delay(uint32_t start_tick) {
+  const uint32_t now = osKernelGetTickCount();
+  if (start_tick != 0 && now > start_tick && now - start_tick > global_rec_telemetry.max_commit_delay) {
+    global_rec_telemetry.max_commit_delay = now - start_tick;
+  }
+}
+
+/**
+ * Get the space left for the current flight.
+ *
+ * @return free space in bytes
+ */
+static uint32_t get_free_space() {
+  if (rec_use_raw_partition) {
+    return raw_partition_get_free();
+  }
+  if (bytes_since_space_check >= REC_SPACE_CHECK_INTERVAL) {
+    lfs_free_space = lfs_get_free_space();
+    bytes_since_space_check = 0;
+  }
+  return lfs_free_space > bytes_since_space_check ? lfs_free_space - bytes_since_space_check : 0;
+}
+
+/**
+ * Move the recorder to the storage tier for the space left, see util/rec_tier.h. The tier never goes down during a
+ * flight.
+ *
+ * @param write_failed - the last block could not be written, i.e. the flash is full
+ */
+static void update_storage_tier(bool write_failed) {
+  const rec_storage_tier_e tier = write_failed ? REC_TIER_CRITICAL : rec_tier_from_free_space(get_free_space());
+  if (tier <= global_rec_telemetry.storage_tier) {
+    return;
+  }
+  global_rec_telemetry.storage_tier = tier;
+  if (tier == REC_TIER_CRITICAL) {
+    log_error("Flash full, only the events are recorded from now on");
+    add_error(CATS_ERR_LOG_FULL);
   } else {
-    memcpy(&(rec_buffer[*rec_buffer_idx]), rec_elem, *rec_elem_size);
+    log_warn("Flash running full, switching to storage tier %u", tier);
   }
-  *rec_buffer_idx += *rec_elem_size;
 }
 
 static void create_stats_file() {
@@ -249,8 +819,14 @@ static void create_stats_file() {
   snprintf(current_stats_filename, MAX_FILENAME_SIZE, "stats/stats_%05lu", flight_counter);
   lfs_file_open(&lfs, &current_stats_file, current_stats_filename, LFS_O_WRONLY | LFS_O_CREAT);
 
-  /* This will as long as there are no pointers in the global_flight_stats struct */
+  /* This works as long as there are no pointers in the stats structs */
+  const flight_stats_file_header_t header = {.magic = FLIGHT_STATS_MAGIC,
+                                             .version = FLIGHT_STATS_VERSION,
+                                             .flight_stats_size = sizeof(global_flight_stats),
+                                             .telemetry_size = sizeof(global_rec_telemetry)};
+  lfs_file_write(&lfs, &current_stats_file, &header, sizeof(header));
   lfs_file_write(&lfs, &current_stats_file, &global_flight_stats, sizeof(global_flight_stats));
+  lfs_file_write(&lfs, &current_stats_file, &global_rec_telemetry, sizeof(global_rec_telemetry));
 
   lfs_file_close(&lfs, &current_stats_file);
 }
@@ -19,3 +19,5 @@
 #pragma once
 
 void task_recorder(void *argument);
+
+void task_rec_writer(void *argument);
@@ -18,6 +18,7 @@
 
 #include "tasks/task_state_est.h"
 #include "control/kalman_filter.h"
+#include "control/kalman_steady_state.h"
 #include "control/orientation_filter.h"
 #include "control/sensor_elimination.h"
 #include "control/calibration.h"
@@ -82,6 +83,13 @@ _Noreturn void task_state_est(__attribute__((unused)) void *argument) {
 
   init_filter_struct(&filter);
   initialize_matrices(&filter);
+#ifdef USE_KALMAN_STEADY_STATE
+  static kalman_gains_t kalman_gains;
+  if (!kalman_solve_steady_state(&filter, &kalman_gains)) {
+    log_warn("Kalman steady state incomplete, the full filter runs in the missing configurations");
+  }
+  kalman_enable_steady_state(&filter, &kalman_gains);
+#endif
   /* For Logging */
   float raw_accel;
   float raw_altitude_AGL;
@@ -121,8 +129,7 @@ _Noreturn void task_state_est(__attribute__((unused)) void *argument) {
     }
     /* Remove Accel Data when we enter apogee for the KF */
     if ((new_fsm_enum == APOGEE) && (new_fsm_enum != old_fsm_enum)) {
-      float32_t Q_dash[4] = {0, 0, 0, 10.0f};
-      memcpy(filter.Q_data, Q_dash, sizeof(Q_dash));
+      kalman_set_phase(&filter, KALMAN_PHASE_DESCENT);
     }
 
     /* Get Sensor Readings already transformed in the right coordinate Frame */
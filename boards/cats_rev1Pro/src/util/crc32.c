@@ -0,0 +1,127 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "util/crc32.h"
+
+#if defined(STM32L433xx)
+#include "cmsis_os.h"
+#include "stm32l4xx_ll_bus.h"
+#include "stm32l4xx_ll_crc.h"
+#else
+#include <stdbool.h>
+#endif
+
+#include <string.h>
+
+#if defined(STM32L433xx)
+
+/** Exported Function Definitions **/
+
+void crc32_init() {
+  LL_AHB1_GRP1_EnableClock(LL_AHB1_GRP1_PERIPH_CRC);
+  LL_CRC_SetPolynomialSize(CRC, LL_CRC_POLYLENGTH_32B);
+  LL_CRC_SetPolynomialCoef(CRC, LL_CRC_DEFAULT_CRC32_POLY);
+  LL_CRC_SetInitialData(CRC, LL_CRC_DEFAULT_CRC_INITVALUE);
+  /* The reflected CRC32 processes the LSB of every byte first */
+  LL_CRC_SetInputDataReverseMode(CRC, LL_CRC_INDATA_REVERSE_BYTE);
+  LL_CRC_SetOutputDataReverseMode(CRC, LL_CRC_OUTDATA_REVERSE_BIT);
+}
+
+uint32_t crc32_compute(const void *data, uint32_t len) {
+  const uint8_t *bytes = (const uint8_t *)data;
+  /* The peripheral is shared between the recorder and the CLI, a block is only a few microseconds */
+  const int32_t lock = osKernelLock();
+  LL_CRC_ResetCRCCalculationUnit(CRC);
+  while (len >= sizeof(uint32_t)) {
+    uint32_t word;
+    memcpy(&word, bytes, sizeof(word));
+    /* the peripheral takes the first byte from the most significant bits */
+    LL_CRC_FeedData32(CRC, __REV(word));
+    bytes += sizeof(word);
+    len -= sizeof(word);
+  }
+  while (len > 0) {
+    LL_CRC_FeedData8(CRC, *bytes);
+    ++bytes;
+    --len;
+  }
+  const uint32_t crc = ~LL_CRC_ReadData32(CRC);
+  osKernelRestoreLock(lock);
+  return crc;
+}
+
+#else
+
+/** Private Constants **/
+
+/* Bytes processed per table lookup round */
+#define CRC32_SLICES 8
+
+/** Private Variables **/
+
+/* Slicing-by-8 tables, the host tools check a lot of blocks: crc32_table[k][b] is the CRC of byte b followed by k
+ * zero bytes */
+static uint32_t crc32_table[CRC32_SLICES][256];
+static bool crc32_table_ready = false;
+
+/** Exported Function Definitions **/
+
+void crc32_init() {
+  for (uint32_t i = 0; i < 256; ++i) {
+    uint32_t crc = i;
+    for (uint32_t j = 0; j < 8; ++j) {
+      crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320U : crc >> 1;
+    }
+    crc32_table[0][i] = crc;
+  }
+  for (uint32_t i = 0; i < 256; ++i) {
+    for (uint32_t j = 1; j < CRC32_SLICES; ++j) {
+      crc32_table[j][i] = crc32_table[0][crc32_table[j - 1][i] & 0xFF] ^ (crc32_table[j - 1][i] >> 8);
+    }
+  }
+  crc32_table_ready = true;
+}
+
+uint32_t crc32_compute(const void *data, uint32_t len) {
+  if (!crc32_table_ready) {
+    crc32_init();
+  }
+  const uint8_t *bytes = (const uint8_t *)data;
+  uint32_t crc = 0xFFFFFFFFU;
+  while (len >= 2 * sizeof(uint32_t)) {
+    uint32_t lo;
+    uint32_t hi;
+    /* little endian host */
+    memcpy(&lo, bytes, sizeof(lo));
+    memcpy(&hi, &bytes[sizeof(lo)], sizeof(hi));
+    lo ^= crc;
+    crc = crc32_table[7][lo & 0xFF] ^ crc32_table[6][(lo >> 8) & 0xFF] ^ crc32_table[5][(lo >> 16) & 0xFF] ^
+          crc32_table[4][lo >> 24] ^ crc32_table[3][hi & 0xFF] ^ crc32_table[2][(hi >> 8) & 0xFF] ^
+          crc32_table[1][(hi >> 16) & 0xFF] ^ crc32_table[0][hi >> 24];
+    bytes += 2 * sizeof(uint32_t);
+    len -= 2 * sizeof(uint32_t);
+  }
+  while (len > 0) {
+    crc = crc32_table[0][(crc ^ *bytes) & 0xFF] ^ (crc >> 8);
+    ++bytes;
+    --len;
+  }
+  return ~crc;
+}
+
+#endif
@@ -0,0 +1,43 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * CRC32 as used by zlib and IEEE 802.3 (reflected polynomial 0xEDB88320, initial value and final XOR 0xFFFFFFFF).
+ *
+ * On the target the CRC peripheral is used, the table-driven fallback is built for the host tools.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/** Exported Functions **/
+
+/**
+ * Enable and configure the CRC peripheral on the target, build the lookup table on the host.
+ */
+void crc32_init();
+
+/**
+ * Compute the CRC32 of a buffer.
+ *
+ * @param data - data to compute the CRC of
+ * @param len - number of bytes
+ * @return CRC32 of the data
+ */
+uint32_t crc32_compute(const void *data, uint32_t len);
@@ -0,0 +1,58 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Cycle counter of the Cortex-M4 (DWT->CYCCNT) for timing measurements with sub microsecond resolution. The counter
+ * wraps after 2^32 cycles, i.e. after about 53 s at 80 MHz, which is plenty for measuring single operations.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#if defined(__ARM_ARCH)
+#include "stm32l4xx.h"
+#else
+/* Host builds provide the counter and the clock themselves, e.g. the flash emulation in tools/flash_emu */
+extern uint32_t SystemCoreClock;
+#endif
+
+/** Exported Functions **/
+
+#if defined(__ARM_ARCH)
+/** Enable the cycle counter. **/
+static inline void cycle_counter_init() {
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CYCCNT = 0;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+/** Current value of the cycle counter. **/
+static inline uint32_t cycle_counter_get() { return DWT->CYCCNT; }
+#else
+void cycle_counter_init();
+uint32_t cycle_counter_get();
+#endif
+
+/**
+ * Convert a number of cycles to microseconds.
+ *
+ * @param cycles - difference between two cycle_counter_get() values
+ * @return duration in us
+ */
+static inline uint32_t cycle_counter_to_us(uint32_t cycles) { return cycles / (SystemCoreClock / 1000000U); }
@@ -0,0 +1,204 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "util/flight_stats.h"
+#include "config/cats_config.h"
+
+#include <math.h>
+#include <string.h>
+
+/** Private Constants **/
+
+static const float GRAVITY = 9.81f;
+/* Scale of the raw accelerations in m/s^2 per LSB, see task_state_est */
+static const float IMU_ACC_SCALE = GRAVITY / 1024.0f;
+static const float ACCEL_ACC_SCALE = 7.6640625f;
+
+/** Exported Variables **/
+
+flight_stats_t global_flight_stats = {};
+
+/** Private Variables **/
+
+/* Set by task_flight_fsm between liftoff and touchdown */
+static volatile bool flight_active = false;
+static volatile flight_fsm_e current_state = INVALID;
+/* Latest output of the state estimation, needed for the values at the state transitions */
+static volatile float current_height = 0;
+static volatile float current_velocity = 0;
+
+/** Private Function Declarations **/
+
+static void update_state(const flight_state_t *flight_state);
+static void update_flight_info(const flight_info_t *flight_info);
+static void update_max(timed_value_t *max, timestamp_t ts, float value);
+static void accumulate(stats_accumulator_t *acc, float value);
+static void start_flight(timestamp_t liftoff_ts);
+
+static inline float acc_magnitude(float x, float y, float z) { return sqrtf(x * x + y * y + z * z); }
+
+/** Exported Function Definitions **/
+
+void flight_stats_update(rec_entry_type_e rec_type_with_id, const void *rec_value) {
+  const rec_entry_type_e rec_type = get_record_type_without_id(rec_type_with_id);
+  if (rec_type == FLIGHT_STATE) {
+    update_state((const flight_state_t *)rec_value);
+    return;
+  }
+  if (!flight_active) {
+    return;
+  }
+
+  const uint8_t id = get_id_from_record_type(rec_type_with_id);
+  switch (rec_type) {
+    case FLIGHT_INFO:
+      update_flight_info((const flight_info_t *)rec_value);
+      break;
+    case BARO:
+      if (id < NUM_BARO) {
+        const baro_data_t *baro = (const baro_data_t *)rec_value;
+        accumulate(&global_flight_stats.pressure[id], (float)baro->pressure);
+        /* the barometers measure in 0.01 deg C */
+        accumulate(&global_flight_stats.temperature[id], (float)baro->temperature / 100.0f);
+      }
+      break;
+    case IMU:
+      if (id < NUM_IMU) {
+        const imu_data_t *imu = (const imu_data_t *)rec_value;
+        accumulate(&global_flight_stats.acceleration[id],
+                   acc_magnitude(imu->acc_x, imu->acc_y, imu->acc_z) * IMU_ACC_SCALE);
+      }
+      break;
+    case ACCELEROMETER:
+      if (id < NUM_ACCELEROMETER) {
+        const accel_data_t *accel = (const accel_data_t *)rec_value;
+        accumulate(&global_flight_stats.acceleration[NUM_IMU + id],
+                   acc_magnitude(accel->acc_x, accel->acc_y, accel->acc_z) * ACCEL_ACC_SCALE);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+float stats_accumulator_stddev(const stats_accumulator_t *acc) {
+  if (acc->count < 2) {
+    return 0;
+  }
+  return sqrtf(acc->m2 / (float)(acc->count - 1));
+}
+
+/** Private Function Definitions **/
+
+static void update_state(const flight_state_t *flight_state) {
+  /* the drop test FSM records its own states */
+  if (global_cats_config.config.boot_state != CATS_FLIGHT) {
+    return;
+  }
+  const flight_fsm_e new_state = flight_state->flight_or_drop_state.flight_state;
+  if (new_state >= NUM_FLIGHT_STATES) {
+    return;
+  }
+  if (new_state == THRUSTING_1 && !flight_active) {
+    start_flight(flight_state->ts);
+  }
+  if (!flight_active) {
+    return;
+  }
+
+  flight_stats_t *stats = &global_flight_stats;
+  const timestamp_t ts = flight_state->ts - stats->liftoff_ts;
+  const flight_fsm_e old_state = current_state;
+  if (stats->entered_states & (1U << old_state)) {
+    stats->state_duration[old_state] += ts - stats->state_entry[old_state];
+  }
+  stats->entered_states |= 1U << new_state;
+  stats->state_entry[new_state] = ts;
+
+  if ((old_state == THRUSTING_1 || old_state == THRUSTING_2) && new_state != THRUSTING_2) {
+    stats->burnout.ts = ts;
+    stats->burnout.val = current_velocity;
+  }
+  if (new_state == APOGEE) {
+    stats->apogee.ts = ts;
+    stats->apogee.val = current_height;
+  }
+
+  current_state = new_state;
+  if (new_state == TOUCHDOWN) {
+    flight_active = false;
+  }
+}
+
+static void update_flight_info(const flight_info_t *flight_info) {
+  flight_stats_t *stats = &global_flight_stats;
+  const timestamp_t ts = flight_info->ts - stats->liftoff_ts;
+  current_height = flight_info->height;
+  current_velocity = flight_info->velocity;
+
+  update_max(&stats->max_height, ts, flight_info->height);
+  update_max(&stats->max_velocity, ts, flight_info->velocity);
+  update_max(&stats->max_acceleration, ts, flight_info->acceleration);
+
+  if (current_state == DROGUE) {
+    accumulate(&stats->descent_rate[DESCENT_DROGUE], -flight_info->velocity);
+  } else if (current_state == MAIN) {
+    accumulate(&stats->descent_rate[DESCENT_MAIN], -flight_info->velocity);
+  }
+}
+
+static void update_max(timed_value_t *max, timestamp_t ts, float value) {
+  if (value > max->val) {
+    max->ts = ts;
+    max->val = value;
+  }
+}
+
+static void accumulate(stats_accumulator_t *acc, float value) {
+  ++acc->count;
+  if (acc->count == 1) {
+    acc->min = value;
+    acc->max = value;
+    acc->mean = value;
+    acc->m2 = 0;
+    return;
+  }
+  if (value < acc->min) {
+    acc->min = value;
+  }
+  if (value > acc->max) {
+    acc->max = value;
+  }
+  const float delta = value - acc->mean;
+  acc->mean += delta / (float)acc->count;
+  acc->m2 += delta * (value - acc->mean);
+}
+
+/* The other tasks only update the statistics while a flight is active, so nobody else touches them here */
+static void start_flight(timestamp_t liftoff_ts) {
+  flight_stats_t *stats = &global_flight_stats;
+  int32_t lock = osKernelLock();
+  memset(stats, 0, sizeof(flight_stats_t));
+  stats->liftoff_ts = liftoff_ts;
+  stats->max_height.val = -INFINITY;
+  stats->max_velocity.val = -INFINITY;
+  stats->max_acceleration.val = -INFINITY;
+  current_state = READY;
+  flight_active = true;
+  osKernelRestoreLock(lock);
+}
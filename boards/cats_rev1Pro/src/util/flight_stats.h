@@ -0,0 +1,107 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Flight statistics which are updated incrementally with every sample passed to record(), so that the summary of a
+ * flight is available right after the flight without parsing the flight log.
+ *
+ * The collection starts when the flight FSM enters THRUSTING_1 and ends at TOUCHDOWN; all times are relative to the
+ * liftoff. Every part of the statistics has a single writer: the state transitions are updated by task_flight_fsm, the
+ * flight values by task_state_est and the sensor statistics by task_baro_read and task_imu_read.
+ */
+
+#pragma once
+
+#include "util/recorder.h"
+#include "config/control_config.h"
+
+/** Exported Defines **/
+
+#define FLIGHT_STATS_MAGIC 0x53544143U /* "CATS" */
+/* Has to be increased whenever flight_stats_t or rec_telemetry_t change */
+#define FLIGHT_STATS_VERSION 4
+
+#define NUM_FLIGHT_STATES (TOUCHDOWN + 1)
+
+/** Exported Types **/
+
+/* Running statistics of a value; the mean and the variance are updated with Welford's algorithm */
+typedef struct {
+  uint32_t count;
+  float min;
+  float max;
+  float mean;
+  float m2; /* sum of the squared differences from the mean, variance = m2 / (count - 1) */
+} stats_accumulator_t;
+
+typedef struct {
+  timestamp_t ts; /* ms since liftoff */
+  float val;
+} timed_value_t;
+
+typedef enum { DESCENT_DROGUE = 0, DESCENT_MAIN, NUM_DESCENT_PHASES } descent_phase_e;
+
+typedef struct {
+  timestamp_t liftoff_ts;  /* tick count at liftoff */
+  uint32_t entered_states; /* bit mask of the entered flight states; 0 if no liftoff was detected */
+  /* ms since liftoff at which each flight state was entered and how long it lasted, indexed by flight_fsm_e */
+  uint32_t state_entry[NUM_FLIGHT_STATES];
+  uint32_t state_duration[NUM_FLIGHT_STATES];
+
+  timed_value_t max_height;
+  timed_value_t max_velocity;
+  timed_value_t max_acceleration;
+  timed_value_t apogee;  /* height at which the FSM detected the apogee */
+  timed_value_t burnout; /* velocity at the end of the last thrust phase */
+
+  stats_accumulator_t descent_rate[NUM_DESCENT_PHASES]; /* m/s, positive while descending */
+  stats_accumulator_t pressure[NUM_BARO];               /* Pa */
+  stats_accumulator_t temperature[NUM_BARO];            /* deg C */
+  stats_accumulator_t acceleration[NUM_ACC];            /* magnitude in m/s^2, IMUs then accelerometers */
+} flight_stats_t;
+
+/* Start of a stats file, followed by flight_stats_t and rec_telemetry_t */
+typedef struct {
+  uint32_t magic;   /* FLIGHT_STATS_MAGIC */
+  uint16_t version; /* FLIGHT_STATS_VERSION */
+  uint16_t flight_stats_size;
+  uint16_t telemetry_size;
+  uint16_t reserved;
+} flight_stats_file_header_t;
+
+/** Exported Variables **/
+
+extern flight_stats_t global_flight_stats;
+
+/** Exported Functions **/
+
+/**
+ * Update the flight statistics with a sample; O(1) for every record type.
+ *
+ * @param rec_type_with_id - record type with ID
+ * @param rec_value - record struct
+ */
+void flight_stats_update(rec_entry_type_e rec_type_with_id, const void *rec_value);
+
+/**
+ * Get the standard deviation of the accumulated values.
+ *
+ * @param acc - accumulator
+ * @return sample standard deviation; 0 for less than two values
+ */
+float stats_accumulator_stddev(const stats_accumulator_t *acc);
@@ -0,0 +1,313 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "util/flight_transfer.h"
+#include "util/crc32.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/** Private Constants **/
+
+/* Wait time for acknowledgements while the window is full */
+#define XFER_POLL_INTERVAL 2
+
+/* The host only sends frames without payload */
+#define XFER_RX_BUFFER_SIZE (4 * XFER_FRAME_OVERHEAD)
+
+/** Private Function Declarations **/
+
+static bool find_magic(const uint8_t *buf, uint32_t len, uint32_t *pos);
+static xfer_error_e send_loop(const xfer_io_t *io, const xfer_info_t *info, uint8_t *frames[2], xfer_stats_t *stats);
+static void finish_transfer(const xfer_io_t *io, uint32_t file_size, uint8_t *frames[2], uint32_t frame_idx,
+                            xfer_parser_t *parser, xfer_stats_t *stats);
+
+/** Exported Function Definitions **/
+
+uint32_t xfer_finish_frame(uint8_t *frame, uint8_t type, uint32_t seq, uint32_t offset, uint16_t len) {
+  const xfer_frame_header_t header = {
+      .magic = XFER_MAGIC, .type = type, .version = XFER_VERSION, .len = len, .seq = seq, .offset = offset};
+  memcpy(frame, &header, sizeof(header));
+  const uint32_t crc_offset = sizeof(header) + len;
+  const uint32_t crc = crc32_compute(frame, crc_offset);
+  memcpy(&frame[crc_offset], &crc, sizeof(crc));
+  return crc_offset + sizeof(crc);
+}
+
+void xfer_parser_init(xfer_parser_t *parser, uint8_t *buf, uint32_t size) {
+  memset(parser, 0, sizeof(*parser));
+  parser->buf = buf;
+  parser->size = size;
+}
+
+uint32_t xfer_parser_space(xfer_parser_t *parser, uint8_t **buf) {
+  *buf = &parser->buf[parser->used];
+  return parser->size - parser->used;
+}
+
+void xfer_parser_commit(xfer_parser_t *parser, uint32_t len) { parser->used += len; }
+
+bool xfer_parser_next(xfer_parser_t *parser, xfer_frame_header_t *header, const uint8_t **payload) {
+  /* drop the frame which was returned by the previous call */
+  if (parser->frame_len > 0) {
+    parser->used -= parser->frame_len;
+    memmove(parser->buf, &parser->buf[parser->frame_len], parser->used);
+    parser->frame_len = 0;
+  }
+
+  while (parser->used > 0) {
+    uint32_t pos = 0;
+    if (!find_magic(parser->buf, parser->used, &pos)) {
+      /* keep the bytes which could be the beginning of the magic */
+      pos = parser->used > sizeof(uint32_t) - 1 ? parser->used - (sizeof(uint32_t) - 1) : 0;
+    }
+    if (pos > 0) {
+      parser->skipped_bytes += pos;
+      parser->used -= pos;
+      memmove(parser->buf, &parser->buf[pos], parser->used);
+    }
+    if (parser->used < sizeof(xfer_frame_header_t)) {
+      return false;
+    }
+
+    memcpy(header, parser->buf, sizeof(*header));
+    const uint32_t frame_len = header->len + XFER_FRAME_OVERHEAD;
+    if (frame_len <= parser->size) {
+      if (parser->used < frame_len) {
+        return false;
+      }
+      uint32_t crc = 0;
+      memcpy(&crc, &parser->buf[frame_len - sizeof(crc)], sizeof(crc));
+      if (crc == crc32_compute(parser->buf, frame_len - sizeof(crc))) {
+        *payload = &parser->buf[sizeof(*header)];
+        parser->frame_len = frame_len;
+        return true;
+      }
+      ++parser->bad_frames;
+    }
+    /* not a valid frame, look for the next magic */
+    parser->skipped_bytes += 1;
+    parser->used -= 1;
+    memmove(parser->buf, &parser->buf[1], parser->used);
+  }
+  return false;
+}
+
+bool xfer_send_frame(const xfer_io_t *io, uint8_t *buf, uint8_t type, uint32_t offset, const void *payload,
+                     uint16_t len) {
+  if (len > 0) {
+    memcpy(&buf[sizeof(xfer_frame_header_t)], payload, len);
+  }
+  const uint32_t frame_len = xfer_finish_frame(buf, type, 0, offset, len);
+  return io->send(io->ctx, buf, frame_len);
+}
+
+xfer_error_e xfer_send_file(const xfer_io_t *io, uint32_t flight_number, uint32_t file_size, uint32_t offset,
+                            xfer_stats_t *stats) {
+  xfer_stats_t local_stats;
+  if (stats == NULL) {
+    stats = &local_stats;
+  }
+  memset(stats, 0, sizeof(*stats));
+
+  /* While one frame is being sent the next one is read from the flash */
+  uint8_t *frames[2] = {malloc(XFER_MAX_FRAME_SIZE), malloc(XFER_MAX_FRAME_SIZE)};
+  xfer_error_e result = XFER_ERR_NO_MEMORY;
+  if (frames[0] != NULL && frames[1] != NULL) {
+    if (offset > file_size) {
+      const xfer_error_t error = {.error = XFER_ERR_BAD_OFFSET};
+      xfer_send_frame(io, frames[0], XFER_FRAME_ERROR, offset, &error, sizeof(error));
+      result = XFER_ERR_BAD_OFFSET;
+    } else {
+      const xfer_info_t info = {.flight_number = flight_number,
+                                .file_size = file_size,
+                                .start_offset = offset,
+                                .chunk_size = XFER_CHUNK_SIZE,
+                                .window = XFER_WINDOW};
+      result = send_loop(io, &info, frames, stats);
+    }
+    /* the interface might still be sending the last frame */
+    io->send(io->ctx, NULL, 0);
+  }
+  free(frames[0]);
+  free(frames[1]);
+  return result;
+}
+
+/** Private Function Definitions **/
+
+static bool find_magic(const uint8_t *buf, uint32_t len, uint32_t *pos) {
+  const uint8_t first = (uint8_t)(XFER_MAGIC & 0xFF);
+  for (uint32_t i = 0; i + sizeof(uint32_t) <= len; ++i) {
+    if (buf[i] == first) {
+      uint32_t magic = 0;
+      memcpy(&magic, &buf[i], sizeof(magic));
+      if (magic == XFER_MAGIC) {
+        *pos = i;
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+/**
+ * Send the file until it was acknowledged completely or the transfer failed.
+ *
+ * @param io - access to the file and the interface
+ * @param info - payload of the info frame
+ * @param frames - two frame buffers which are used alternately
+ * @param stats - transfer statistics
+ * @return XFER_OK if the host received the whole file
+ */
+static xfer_error_e send_loop(const xfer_io_t *io, const xfer_info_t *info, uint8_t *frames[2], xfer_stats_t *stats) {
+  uint8_t rx_buf[XFER_RX_BUFFER_SIZE];
+  xfer_parser_t parser;
+  xfer_parser_init(&parser, rx_buf, sizeof(rx_buf));
+
+  const uint32_t file_size = info->file_size;
+  uint32_t frame_idx = 0;
+  uint32_t seq = 0;
+  bool info_pending = true;
+  bool acked_once = false;
+  uint32_t acked = info->start_offset;
+  uint32_t next = info->start_offset;
+  /* end of the data sent so far, everything sent again below it is counted as resent */
+  uint32_t sent_max = info->start_offset;
+  uint32_t retries = 0;
+  uint32_t last_progress = io->get_time(io->ctx);
+
+  while (true) {
+    if (info_pending) {
+      if (!xfer_send_frame(io, frames[frame_idx], XFER_FRAME_INFO, info->start_offset, info, sizeof(*info))) {
+        return XFER_ERR_SEND;
+      }
+      frame_idx ^= 1;
+      ++stats->frames_sent;
+      info_pending = false;
+    }
+
+    /* only wait for the host if nothing can be sent */
+    const bool window_open = next < file_size && next - acked < XFER_WINDOW * XFER_CHUNK_SIZE;
+    uint8_t *space = NULL;
+    const uint32_t space_len = xfer_parser_space(&parser, &space);
+    const uint32_t timeout = (window_open || acked == file_size) ? 0 : XFER_POLL_INTERVAL;
+    xfer_parser_commit(&parser, io->receive(io->ctx, space, space_len, timeout));
+
+    xfer_frame_header_t header;
+    const uint8_t *payload = NULL;
+    while (xfer_parser_next(&parser, &header, &payload)) {
+      if (header.type == XFER_FRAME_ABORT) {
+        return XFER_ERR_ABORTED;
+      }
+      if ((header.type != XFER_FRAME_ACK && header.type != XFER_FRAME_NAK) || header.offset < acked ||
+          header.offset > next) {
+        /* an old acknowledgement or something which doesn't belong to this transfer */
+        continue;
+      }
+      if (header.offset > acked || header.type == XFER_FRAME_NAK) {
+        retries = 0;
+        last_progress = io->get_time(io->ctx);
+      }
+      acked = header.offset;
+      acked_once = true;
+      if (header.type == XFER_FRAME_NAK) {
+        ++stats->naks;
+        next = acked;
+      }
+    }
+
+    if (acked == file_size) {
+      finish_transfer(io, file_size, frames, frame_idx, &parser, stats);
+      return XFER_OK;
+    }
+
+    if (next < file_size && next - acked < XFER_WINDOW * XFER_CHUNK_SIZE) {
+      uint8_t *frame = frames[frame_idx];
+      const uint32_t chunk = file_size - next < XFER_CHUNK_SIZE ? file_size - next : XFER_CHUNK_SIZE;
+      if (io->read(io->ctx, next, &frame[sizeof(xfer_frame_header_t)], chunk) != (int32_t)chunk) {
+        const xfer_error_t error = {.error = XFER_ERR_READ};
+        xfer_send_frame(io, frames[frame_idx ^ 1], XFER_FRAME_ERROR, next, &error, sizeof(error));
+        return XFER_ERR_READ;
+      }
+      if (!io->send(io->ctx, frame, xfer_finish_frame(frame, XFER_FRAME_DATA, seq++, next, (uint16_t)chunk))) {
+        return XFER_ERR_SEND;
+      }
+      frame_idx ^= 1;
+      ++stats->frames_sent;
+      if (next < sent_max) {
+        stats->bytes_resent += chunk;
+      }
+      next += chunk;
+      if (next > sent_max) {
+        sent_max = next;
+      }
+      continue;
+    }
+
+    if (io->get_time(io->ctx) - last_progress > XFER_ACK_TIMEOUT) {
+      ++stats->timeouts;
+      if (++retries > XFER_MAX_RETRIES) {
+        const xfer_error_t error = {.error = XFER_ERR_TIMEOUT};
+        xfer_send_frame(io, frames[frame_idx], XFER_FRAME_ERROR, acked, &error, sizeof(error));
+        return XFER_ERR_TIMEOUT;
+      }
+      /* go back to the acknowledged offset; the info frame might have been lost as well */
+      info_pending = !acked_once;
+      next = acked;
+      last_progress = io->get_time(io->ctx);
+    }
+  }
+}
+
+/**
+ * Send the end frame. It can get lost like any other frame; the host then keeps asking for the end of the file, which
+ * is answered with another end frame until the host is quiet for XFER_ACK_TIMEOUT ms.
+ *
+ * @param io - access to the interface
+ * @param file_size - size of the file
+ * @param frames - two frame buffers which are used alternately
+ * @param frame_idx - index of the frame buffer to use next
+ * @param parser - parser of the received frames
+ * @param stats - transfer statistics
+ */
+static void finish_transfer(const xfer_io_t *io, uint32_t file_size, uint8_t *frames[2], uint32_t frame_idx,
+                            xfer_parser_t *parser, xfer_stats_t *stats) {
+  bool end_pending = true;
+  uint32_t last_request = io->get_time(io->ctx);
+  while (io->get_time(io->ctx) - last_request < XFER_ACK_TIMEOUT) {
+    if (end_pending) {
+      xfer_send_frame(io, frames[frame_idx], XFER_FRAME_END, file_size, NULL, 0);
+      frame_idx ^= 1;
+      ++stats->frames_sent;
+      end_pending = false;
+    }
+    uint8_t *space = NULL;
+    const uint32_t space_len = xfer_parser_space(parser, &space);
+    xfer_parser_commit(parser, io->receive(io->ctx, space, space_len, XFER_POLL_INTERVAL));
+
+    xfer_frame_header_t header;
+    const uint8_t *payload = NULL;
+    while (xfer_parser_next(parser, &header, &payload)) {
+      if (header.type == XFER_FRAME_NAK && header.offset == file_size) {
+        end_pending = true;
+        last_request = io->get_time(io->ctx);
+      }
+    }
+  }
+}
@@ -0,0 +1,222 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Binary flight download over the USB CDC interface.
+ *
+ * `flight_dump <flight_number> [offset]` switches the CLI into binary mode until the transfer is over. Both directions
+ * use the same frame format:
+ *
+ *   xfer_frame_header_t, `len` payload bytes, CRC32 (see util/crc32.h) of the header and the payload
+ *
+ * The board starts with an XFER_FRAME_INFO frame and then sends the file in XFER_FRAME_DATA frames of up to
+ * XFER_CHUNK_SIZE bytes, each tagged with its file offset. The host acknowledges the data with XFER_FRAME_ACK frames
+ * whose offset is the end of the data received without gaps. The board keeps at most XFER_WINDOW chunks
+ * unacknowledged; if the host reports a gap with XFER_FRAME_NAK or stays silent for XFER_ACK_TIMEOUT ms, the board
+ * goes back to the acknowledged offset. Once the whole file is acknowledged the board sends XFER_FRAME_END and repeats
+ * it for every NAK at the end of the file until the host is quiet; an XFER_FRAME_ERROR frame ends the transfer early.
+ * The host can cancel the transfer with XFER_FRAME_ABORT and resume it later by starting at the size of the partially
+ * received file.
+ *
+ * The host skips everything in the stream which is not a frame with a valid CRC, e.g. the echo of the CLI.
+ *
+ * Only depends on the CRC so the host tools can use it as well. All values are little endian.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Exported Defines **/
+
+#define XFER_MAGIC   0x44544143U /* "CATD" */
+#define XFER_VERSION 1
+
+/* Payload size of a data frame */
+#define XFER_CHUNK_SIZE 1024
+/* Number of unacknowledged data frames */
+#define XFER_WINDOW 8
+
+/* The board goes back to the acknowledged offset if no acknowledgement arrives for this long */
+#define XFER_ACK_TIMEOUT 500
+/* Number of timeouts in a row after which the board gives up */
+#define XFER_MAX_RETRIES 6
+
+#define XFER_FRAME_OVERHEAD (sizeof(xfer_frame_header_t) + sizeof(uint32_t))
+#define XFER_MAX_FRAME_SIZE (XFER_CHUNK_SIZE + XFER_FRAME_OVERHEAD)
+
+/** Exported Types **/
+
+typedef enum {
+  /* board -> host */
+  XFER_FRAME_INFO = 1,
+  XFER_FRAME_DATA,
+  XFER_FRAME_END,
+  XFER_FRAME_ERROR,
+  /* host -> board */
+  XFER_FRAME_ACK = 0x10,
+  XFER_FRAME_NAK,
+  XFER_FRAME_ABORT,
+} xfer_frame_type_e;
+
+typedef enum {
+  XFER_OK = 0,
+  XFER_ERR_NOT_FOUND,  /* the flight doesn't exist */
+  XFER_ERR_BUSY,       /* the recorder is active */
+  XFER_ERR_NO_MEMORY,  /* the frame buffers can't be allocated */
+  XFER_ERR_READ,       /* reading the file failed */
+  XFER_ERR_SEND,       /* the interface didn't accept a frame */
+  XFER_ERR_TIMEOUT,    /* the other side stopped responding */
+  XFER_ERR_ABORTED,    /* the host cancelled the transfer */
+  XFER_ERR_BAD_OFFSET, /* the start offset is past the end of the file */
+  XFER_ERR_PROTOCOL,   /* unexpected frame */
+} xfer_error_e;
+
+typedef struct {
+  uint32_t magic; /* XFER_MAGIC */
+  uint8_t type;   /* xfer_frame_type_e */
+  uint8_t version;
+  uint16_t len;    /* number of payload bytes */
+  uint32_t seq;    /* frame counter of the sender, only used for diagnostics */
+  uint32_t offset; /* DATA: file offset of the payload; ACK, NAK: offset up to which the file was received */
+} xfer_frame_header_t;
+
+/* Payload of XFER_FRAME_INFO */
+typedef struct {
+  uint32_t flight_number;
+  uint32_t file_size;
+  uint32_t start_offset;
+  uint16_t chunk_size;
+  uint16_t window;
+} xfer_info_t;
+
+/* Payload of XFER_FRAME_ERROR */
+typedef struct {
+  uint32_t error; /* xfer_error_e */
+} xfer_error_t;
+
+/* Byte stream access of the sender */
+typedef struct {
+  /* read up to `len` bytes of the file at `offset`; returns the number of bytes read, negative on error */
+  int32_t (*read)(void *ctx, uint32_t offset, uint8_t *buf, uint32_t len);
+  /* start sending a frame; the buffer has to stay untouched until the next call returns. A call with len 0 only
+   * waits until the last frame was sent. */
+  bool (*send)(void *ctx, const uint8_t *buf, uint32_t len);
+  /* copy up to `len` received bytes to buf, waits at most `timeout` ms if nothing was received */
+  uint32_t (*receive)(void *ctx, uint8_t *buf, uint32_t len, uint32_t timeout);
+  /* time in ms */
+  uint32_t (*get_time)(void *ctx);
+  void *ctx;
+} xfer_io_t;
+
+typedef struct {
+  uint32_t frames_sent;
+  uint32_t bytes_resent; /* payload bytes which had to be sent again */
+  uint32_t timeouts;
+  uint32_t naks;
+} xfer_stats_t;
+
+/* Extracts the frames from a byte stream */
+typedef struct {
+  uint8_t *buf;
+  uint32_t size;
+  uint32_t used;
+  uint32_t frame_len;     /* size of the frame returned last, removed by the next xfer_parser_next() */
+  uint32_t skipped_bytes; /* bytes which didn't belong to a valid frame */
+  uint32_t bad_frames;    /* frames with a wrong CRC */
+} xfer_parser_t;
+
+/** Exported Functions **/
+
+/**
+ * Fill in the header and the CRC of a frame whose payload is already at frame + sizeof(xfer_frame_header_t).
+ *
+ * @param frame - frame buffer; has to hold len + XFER_FRAME_OVERHEAD bytes
+ * @param type - xfer_frame_type_e
+ * @param seq - frame counter
+ * @param offset - file offset
+ * @param len - payload size
+ * @return size of the frame
+ */
+uint32_t xfer_finish_frame(uint8_t *frame, uint8_t type, uint32_t seq, uint32_t offset, uint16_t len);
+
+/**
+ * Initialize a frame parser.
+ *
+ * @param parser - parser to initialize
+ * @param buf - receive buffer; has to hold at least one frame of the largest expected size
+ * @param size - size of the receive buffer
+ */
+void xfer_parser_init(xfer_parser_t *parser, uint8_t *buf, uint32_t size);
+
+/**
+ * Get the space for new bytes. The caller copies up to the returned number of bytes to *buf and commits them with
+ * xfer_parser_commit().
+ *
+ * @param parser - frame parser
+ * @param buf[out] - start of the free space
+ * @return number of free bytes
+ */
+uint32_t xfer_parser_space(xfer_parser_t *parser, uint8_t **buf);
+
+/**
+ * Commit the bytes which were written to the free space.
+ *
+ * @param parser - frame parser
+ * @param len - number of bytes
+ */
+void xfer_parser_commit(xfer_parser_t *parser, uint32_t len);
+
+/**
+ * Get the next valid frame from the received bytes. The frame stays valid until the next call.
+ *
+ * @param parser - frame parser
+ * @param header[out] - header of the frame
+ * @param payload[out] - payload of the frame
+ * @return true if a frame was found
+ */
+bool xfer_parser_next(xfer_parser_t *parser, xfer_frame_header_t *header, const uint8_t **payload);
+
+/**
+ * Send a file with the transfer protocol. Returns when the whole file was acknowledged or the transfer failed; the
+ * frame buffers are allocated on the heap for the duration of the transfer.
+ *
+ * @param io - access to the file and the interface
+ * @param flight_number - flight number for the info frame
+ * @param file_size - size of the file
+ * @param offset - offset at which the transfer starts
+ * @param stats[out] - transfer statistics; can be NULL
+ * @return XFER_OK if the host received the whole file
+ */
+xfer_error_e xfer_send_file(const xfer_io_t *io, uint32_t flight_number, uint32_t file_size, uint32_t offset,
+                            xfer_stats_t *stats);
+
+/**
+ * Send a single frame without payload or with a small payload, e.g. an acknowledgement or an error.
+ *
+ * @param io - interface; only send() is used
+ * @param buf - frame buffer; has to hold len + XFER_FRAME_OVERHEAD bytes
+ * @param type - xfer_frame_type_e
+ * @param offset - file offset
+ * @param payload - payload; can be NULL if len is 0
+ * @param len - payload size
+ * @return true if the frame was sent
+ */
+bool xfer_send_frame(const xfer_io_t *io, uint8_t *buf, uint8_t type, uint32_t offset, const void *payload,
+                     uint16_t len);
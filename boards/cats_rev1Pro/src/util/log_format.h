@@ -0,0 +1,93 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * On-flash format of the flight logs. Only depends on stdint so it can be shared with host tools.
+ *
+ * A flight file is a sequence of LOG_BLOCK_SIZE byte blocks, block n starts at offset n * LOG_BLOCK_SIZE. Every block
+ * starts with a log_block_header_t followed by `len` payload bytes; the rest of the block is zero padded. The CRC32
+ * (IEEE 802.3, as used by zlib) covers everything after the crc field up to the end of the block.
+ *
+ * Block 0 has LOG_BLOCK_FLAG_HEADER set and contains the file header:
+ *   - log_file_header_t
+ *   - the layout table: for each of the num_types record types its struct size, number of fields and num_fields
+ *     (kind, offset) byte pairs, see util/rec_codec.h
+ *   - the decimation table: num_phases x num_types bytes
+ *
+ * All other blocks contain whole records, a record never spans two blocks. With LOG_BLOCK_FLAG_ENCODED the records
+ * are encoded with the record codec whose history is reset at the start of every block, otherwise they are stored
+ * as 4 byte record type followed by the record struct. Every block can therefore be decoded on its own and a
+ * corrupted block only loses the records inside of it.
+ *
+ * The LOG_BLOCK_TIER bits of the flags hold the storage tier of the recorder when the block was written (see
+ * util/rec_tier.h); a tier above 0 means that some record types were left out because the flash ran full.
+ *
+ * All values are little endian.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/** Exported Defines **/
+
+#define LOG_BLOCK_SIZE 512
+#define LOG_BLOCK_SYNC 0xCA75B10CU
+
+#define LOG_FILE_MAGIC      "CATL"
+#define LOG_FILE_MAGIC_SIZE 4
+
+/* Version of the container */
+#define LOG_FORMAT_VERSION 1
+/* Version of the record structs; has to be increased whenever one of them changes */
+#define LOG_SCHEMA_VERSION 1
+
+#define LOG_BLOCK_FLAG_HEADER  0x0001U
+#define LOG_BLOCK_FLAG_ENCODED 0x0002U
+#define LOG_BLOCK_TIER_MASK    0x0700U
+#define LOG_BLOCK_TIER_SHIFT   8
+
+#define LOG_MAX_TYPES 16
+
+/** Exported Types **/
+
+typedef struct {
+  uint32_t sync;  /* LOG_BLOCK_SYNC */
+  uint32_t crc;   /* CRC32 of the block starting at seq */
+  uint32_t seq;   /* block sequence number, the header block is 0 */
+  uint16_t len;   /* number of payload bytes */
+  uint16_t flags; /* LOG_BLOCK_FLAG_* and the storage tier */
+} log_block_header_t;
+
+#define LOG_BLOCK_PAYLOAD_SIZE (LOG_BLOCK_SIZE - sizeof(log_block_header_t))
+/* The CRC covers the block starting right after the crc field */
+#define LOG_BLOCK_CRC_OFFSET (2 * sizeof(uint32_t))
+
+typedef struct {
+  char magic[LOG_FILE_MAGIC_SIZE]; /* LOG_FILE_MAGIC */
+  uint16_t format_version;         /* LOG_FORMAT_VERSION */
+  uint16_t schema_version;         /* LOG_SCHEMA_VERSION */
+  char board[16];                  /* board revision, zero terminated */
+  char code_version[16];           /* firmware version, zero terminated */
+  uint32_t flight_counter;
+  uint8_t num_types;
+  uint8_t num_phases;
+  uint16_t layout_table_size; /* size of the layout table following this struct in bytes */
+  /* nominal sample rate of each record type in Hz, 0 if event driven */
+  uint16_t sample_rates[LOG_MAX_TYPES];
+} log_file_header_t;
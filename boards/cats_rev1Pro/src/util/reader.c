@@ -22,55 +22,85 @@
 #include "util/reader.h"
 #include "util/recorder.h"
 #include "util/log.h"
+#include "util/crc32.h"
+#include "util/flight_transfer.h"
+#include "util/rec_schema.h"
+#include "util/rec_tier.h"
+#include "util/flight_stats.h"
 #include "config/globals.h"
 #include "lfs/lfs_custom.h"
+#include "lfs/raw_partition.h"
+#include "lfs/flight_index.h"
 #include "control/data_processing.h"
+#include "usbd_cdc_if.h"
 
-void dump_recording(uint16_t number) {
-  if (global_recorder_status == REC_WRITE_TO_FLASH) {
-    log_raw("The recorder is currently active, stop it first!");
-    return;
-  }
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
 
-  char *string_buffer1 = calloc(400, sizeof(char));
-  char *string_buffer2 = calloc(400, sizeof(char));
-  uint8_t *read_buf = (uint8_t *)calloc(256, sizeof(uint8_t));
+/** Private Function Declarations **/
 
-  char filename[MAX_FILENAME_SIZE] = {};
-  snprintf(filename, MAX_FILENAME_SIZE, "flights/flight_%05d", number);
+static void print_rec_elem(rec_entry_type_e rec_type, const rec_elem_u *rec_elem);
+static void print_flight_stats(const flight_stats_t *stats);
+static void print_accumulator(const char *name, uint32_t id, const stats_accumulator_t *acc);
+static void parse_raw_recording(flight_file_t *file);
+static void parse_log_blocks(flight_file_t *file, uint32_t file_size);
+static bool parse_log_block(rec_codec_t *codec, const uint8_t *block, uint32_t idx, uint32_t *expected_seq,
+                            uint32_t *num_bad_blocks, uint32_t *tier);
+static bool check_log_header(const uint8_t *payload, uint32_t len);
+static void parse_log_payload(rec_codec_t *codec, const uint8_t *payload, uint32_t len, uint16_t flags);
 
-  log_raw("Dumping file: %s", filename);
+static int32_t xfer_read(void *ctx, uint32_t offset, uint8_t *buf, uint32_t len);
+static bool xfer_send(void *ctx, const uint8_t *buf, uint32_t len);
+static uint32_t xfer_receive(void *ctx, uint8_t *buf, uint32_t len, uint32_t timeout);
+static uint32_t xfer_get_time(void *ctx);
 
-  lfs_file_t curr_file;
-  if (lfs_file_open(&lfs, &curr_file, filename, LFS_O_RDONLY) == LFS_ERR_OK) {
-    int file_size = lfs_file_size(&lfs, &curr_file);
-    for (lfs_size_t i = 0; i < file_size; i += 256) {
-      lfs_size_t chunk = lfs_min(256, file_size - i);
+/** Exported Function Definitions **/
 
-      lfs_file_read(&lfs, &curr_file, read_buf, chunk);
+void dump_recording(uint16_t number, uint32_t offset) {
+  const xfer_io_t io = {.read = xfer_read, .send = xfer_send, .receive = xfer_receive, .get_time = xfer_get_time};
+  /* stands in for the frame buffers when an error is reported before the transfer starts */
+  uint8_t error_frame[sizeof(xfer_error_t) + XFER_FRAME_OVERHEAD];
 
-      int write_idx = 0;
-      for (uint32_t j = 0; j < 128; ++j) {
-        write_idx += sprintf(string_buffer1 + write_idx, "%02x ", read_buf[j]);
-      }
-      log_rawr("%s", string_buffer1);
-      write_idx = 0;
-      for (uint32_t j = 128; j < 256; ++j) {
-        write_idx += sprintf(string_buffer2 + write_idx, "%02x ", read_buf[j]);
-      }
-      log_rawr("%s\n", string_buffer2);
+  if (global_recorder_status == REC_WRITE_TO_FLASH) {
+    const xfer_error_t error = {.error = XFER_ERR_BUSY};
+    xfer_send_frame(&io, error_frame, XFER_FRAME_ERROR, offset, &error, sizeof(error));
+    xfer_send(NULL, NULL, 0);
+    log_raw("The recorder is currently active, stop it first!");
+    return;
+  }
 
-      memset(string_buffer1, 0, 400);
-      memset(string_buffer2, 0, 400);
-    }
-  } else {
+  flight_file_t curr_file;
+  if (flight_file_open(&curr_file, number) != LFS_ERR_OK) {
+    const xfer_error_t error = {.error = XFER_ERR_NOT_FOUND};
+    xfer_send_frame(&io, error_frame, XFER_FRAME_ERROR, offset, &error, sizeof(error));
+    xfer_send(NULL, NULL, 0);
     log_error("Flight %d not found!", number);
+    return;
   }
 
-  lfs_file_close(&lfs, &curr_file);
+  xfer_io_t file_io = io;
+  file_io.ctx = &curr_file;
+  const lfs_ssize_t file_size = flight_file_size(&curr_file);
+  xfer_stats_t stats = {};
+  xfer_error_e result = XFER_ERR_READ;
+  if (file_size >= 0) {
+#ifdef CATS_DEBUG
+    /* Log messages would end up in the middle of the frames; they are dropped while the mutex is held */
+    osMutexAcquire(print_mutex, osWaitForever);
+#endif
+    result = xfer_send_file(&file_io, number, (uint32_t)file_size, offset, &stats);
+#ifdef CATS_DEBUG
+    osMutexRelease(print_mutex);
+#endif
+  }
+  flight_file_close(&curr_file);
+
+  /* Late acknowledgements must not end up in the CLI */
+  fifo_flush(&usb_input_fifo);
 
-  free(string_buffer1);
-  free(string_buffer2);
+  log_raw("Flight %d: transfer %s, %lu frames, %lu bytes resent, %lu timeouts", number,
+          result == XFER_OK ? "complete" : "failed", stats.frames_sent, stats.bytes_resent, stats.timeouts);
 }
 
 void parse_recording(uint16_t number) {
@@ -84,110 +114,27 @@ void parse_recording(uint16_t number) {
 
   log_raw("Reading file: %s", filename);
 
-  lfs_file_t curr_file;
-  if (lfs_file_open(&lfs, &curr_file, filename, LFS_O_RDONLY) == LFS_ERR_OK) {
-    rec_elem_t rec_elem;
-    lfs_ssize_t file_size = lfs_file_size(&lfs, &curr_file);
+  flight_file_t curr_file;
+  if (flight_file_open(&curr_file, number) == LFS_ERR_OK) {
+    lfs_ssize_t file_size = flight_file_size(&curr_file);
     if (file_size < 0) {
       log_raw("Invalid file size %ld!", file_size);
+      flight_file_close(&curr_file);
       return;
     }
-    rec_entry_type_e rec_type;
-    while (lfs_file_read(&lfs, &curr_file, (uint8_t *)&rec_type, 4) > 0) {
-      switch (get_record_type_without_id(rec_type)) {
-        case IMU: {
-          size_t elem_sz = sizeof(rec_elem.u.imu);
-          lfs_file_read(&lfs, &curr_file, (uint8_t *)&rec_elem.u.imu, elem_sz);
-          log_raw("%lu|IMU%hu|%d|%d|%d|%d|%d|%d", rec_elem.u.imu.ts, get_id_from_record_type(rec_type),
-                  rec_elem.u.imu.acc_x, rec_elem.u.imu.acc_y, rec_elem.u.imu.acc_z, rec_elem.u.imu.gyro_x,
-                  rec_elem.u.imu.gyro_y, rec_elem.u.imu.gyro_z);
-        } break;
-        case BARO: {
-          size_t elem_sz = sizeof(rec_elem.u.baro);
-          lfs_file_read(&lfs, &curr_file, (uint8_t *)&rec_elem.u.imu, elem_sz);
-          log_raw("%lu|BARO%hu|%lu|%lu", rec_elem.u.baro.ts, get_id_from_record_type(rec_type),
-                  rec_elem.u.baro.pressure, rec_elem.u.baro.temperature);
-        } break;
-        case MAGNETO: {
-          size_t elem_sz = sizeof(rec_elem.u.magneto_info);
-          lfs_file_read(&lfs, &curr_file, (uint8_t *)&rec_elem.u.imu, elem_sz);
-          log_raw("%lu|MAGNETO|%f|%f|%f", rec_elem.u.magneto_info.ts, (double)rec_elem.u.magneto_info.magneto_x,
-                  (double)rec_elem.u.magneto_info.magneto_y, (double)rec_elem.u.magneto_info.magneto_z);
-        } break;
-        case ACCELEROMETER: {
-          size_t elem_sz = sizeof(rec_elem.u.accel_data);
-          lfs_file_read(&lfs, &curr_file, (uint8_t *)&rec_elem.u.imu, elem_sz);
-          log_raw("%lu|ACC|%d|%d|%d", rec_elem.u.accel_data.ts, rec_elem.u.accel_data.acc_x,
-                  rec_elem.u.accel_data.acc_y, rec_elem.u.accel_data.acc_z);
-        } break;
-        case FLIGHT_INFO: {
-          size_t elem_sz = sizeof(rec_elem.u.flight_info);
-          lfs_file_read(&lfs, &curr_file, (uint8_t *)&rec_elem.u.imu, elem_sz);
-          log_raw("%lu|FLIGHT_INFO|%f|%f|%f", rec_elem.u.flight_info.ts, (double)rec_elem.u.flight_info.acceleration,
-                  (double)rec_elem.u.flight_info.height, (double)rec_elem.u.flight_info.velocity);
-        } break;
-        case ORIENTATION_INFO: {
-          size_t elem_sz = sizeof(rec_elem.u.orientation_info);
-          lfs_file_read(&lfs, &curr_file, (uint8_t *)&rec_elem.u.imu, elem_sz);
-          log_raw("%lu|ORIENTATION_INFO|%d|%d|%d|%d|%d|%d|%d|%d", rec_elem.u.orientation_info.ts,
-                  rec_elem.u.orientation_info.raw_orientation[0], rec_elem.u.orientation_info.raw_orientation[1],
-                  rec_elem.u.orientation_info.raw_orientation[2], rec_elem.u.orientation_info.raw_orientation[3],
-                  rec_elem.u.orientation_info.estimated_orientation[0],
-                  rec_elem.u.orientation_info.estimated_orientation[1],
-                  rec_elem.u.orientation_info.estimated_orientation[2],
-                  rec_elem.u.orientation_info.estimated_orientation[3]);
-        } break;
-        case FILTERED_DATA_INFO: {
-          size_t elem_sz = sizeof(rec_elem.u.filtered_data_info);
-          lfs_file_read(&lfs, &curr_file, (uint8_t *)&rec_elem.u.imu, elem_sz);
-          log_raw("%lu|FILTERED_DATA_INFO|%f|%f|%f|%f", rec_elem.u.filtered_data_info.ts,
-                  (double)rec_elem.u.filtered_data_info.measured_altitude_AGL,
-                  (double)rec_elem.u.filtered_data_info.measured_acceleration,
-                  (double)rec_elem.u.filtered_data_info.filtered_altitude_AGL,
-                  (double)rec_elem.u.filtered_data_info.filtered_acceleration);
-        } break;
-        case FLIGHT_STATE: {
-          size_t elem_sz = sizeof(rec_elem.u.flight_state);
-          lfs_file_read(&lfs, &curr_file, (uint8_t *)&rec_elem.u.imu, elem_sz);
-          log_raw("%lu|FLIGHT_STATE|%u", rec_elem.u.flight_state.ts,
-                  rec_elem.u.flight_state.flight_or_drop_state.flight_state);
-        } break;
-        case COVARIANCE_INFO: {
-          size_t elem_sz = sizeof(rec_elem.u.covariance_info);
-          lfs_file_read(&lfs, &curr_file, (uint8_t *)&rec_elem.u.imu, elem_sz);
-          log_raw("%lu|COVARIANCE_INFO|%f|%f", rec_elem.u.covariance_info.ts,
-                  (double)rec_elem.u.covariance_info.height_cov, (double)rec_elem.u.covariance_info.velocity_cov);
-        } break;
-        case SENSOR_INFO: {
-          size_t elem_sz = sizeof(rec_elem.u.sensor_info);
-          lfs_file_read(&lfs, &curr_file, (uint8_t *)&rec_elem.u.imu, elem_sz);
-          log_raw("%lu|SENSOR_INFO|%u|%u|%u|%u|%u|%u", rec_elem.u.sensor_info.ts, rec_elem.u.sensor_info.faulty_imu[0],
-                  rec_elem.u.sensor_info.faulty_imu[1], rec_elem.u.sensor_info.faulty_imu[2],
-                  rec_elem.u.sensor_info.faulty_baro[0], rec_elem.u.sensor_info.faulty_baro[1],
-                  rec_elem.u.sensor_info.faulty_baro[2]);
-        } break;
-        case EVENT_INFO: {
-          size_t elem_sz = sizeof(rec_elem.u.event_info);
-          lfs_file_read(&lfs, &curr_file, (uint8_t *)&rec_elem.u.imu, elem_sz);
-          log_raw("%lu|EVENT_INFO|%d|%u", rec_elem.u.event_info.ts, rec_elem.u.event_info.event,
-                  rec_elem.u.event_info.action_idx);
-        } break;
-        case ERROR_INFO: {
-          size_t elem_sz = sizeof(rec_elem.u.error_info);
-          lfs_file_read(&lfs, &curr_file, (uint8_t *)&rec_elem.u.imu, elem_sz);
-          log_raw("%lu|ERROR_INFO|%d", rec_elem.u.error_info.ts, rec_elem.u.error_info.error);
-        } break;
-        default:
-          log_raw("Impossible recorder entry type!");
-          break;
-      }
+    /* Files recorded before the block format was introduced start directly with a record type */
+    uint32_t sync = 0;
+    flight_file_read(&curr_file, &sync, sizeof(sync));
+    flight_file_seek(&curr_file, 0);
+    if (sync == LOG_BLOCK_SYNC) {
+      parse_log_blocks(&curr_file, (uint32_t)file_size);
+    } else {
+      parse_raw_recording(&curr_file);
     }
-    lfs_file_close(&lfs, &curr_file);
+    flight_file_close(&curr_file);
   } else {
     log_raw("Flight %d not found!", number);
   }
-
-  lfs_file_close(&lfs, &curr_file);
 }
 
 void parse_stats(uint16_t number) {
@@ -204,23 +151,24 @@ void parse_stats(uint16_t number) {
   lfs_file_t curr_file;
 
   if (lfs_file_open(&lfs, &curr_file, filename, LFS_O_RDONLY) == LFS_ERR_OK) {
-    flight_stats_t local_flight_stats = {};
-    if (lfs_file_read(&lfs, &curr_file, &local_flight_stats, sizeof(flight_stats_t)) > 0) {
-      log_raw("Flight Stats %d", number);
-      log_raw("========================");
-      log_raw("  Height");
-      log_raw("    Time Since Bootup: %lu", local_flight_stats.max_height.ts);
-      log_raw("    Max. Height [m]: %f", (double)local_flight_stats.max_height.val);
-      log_raw("========================");
-      log_raw("  Velocity");
-      log_raw("    Time Since Bootup: %lu", local_flight_stats.max_velocity.ts);
-      log_raw("    Max. Velocity [m/s]: %f", (double)local_flight_stats.max_velocity.val);
-      log_raw("========================");
-      log_raw("  Acceleration");
-      log_raw("    Time Since Bootup: %lu", local_flight_stats.max_acceleration.ts);
-      log_raw("    Max. Acceleration [m/s^2]: %f", (double)local_flight_stats.max_acceleration.val);
-    } else {
+    flight_stats_file_header_t header = {};
+    /* the structs are big, don't put them on the CLI task stack */
+    static flight_stats_t local_flight_stats;
+    static rec_telemetry_t local_telemetry;
+    if (lfs_file_read(&lfs, &curr_file, &header, sizeof(header)) != sizeof(header)) {
       log_raw("Error while reading Stats %d", number);
+    } else if (header.magic != FLIGHT_STATS_MAGIC || header.version != FLIGHT_STATS_VERSION ||
+               header.flight_stats_size != sizeof(flight_stats_t) || header.telemetry_size != sizeof(rec_telemetry_t)) {
+      /* also the case for the stats files of older firmware which have no header */
+      log_raw("Stats %d were written by an incompatible firmware version", number);
+    } else if (lfs_file_read(&lfs, &curr_file, &local_flight_stats, sizeof(local_flight_stats)) !=
+                   sizeof(local_flight_stats) ||
+               lfs_file_read(&lfs, &curr_file, &local_telemetry, sizeof(local_telemetry)) != sizeof(local_telemetry)) {
+      log_raw("Error while reading Stats %d", number);
+    } else {
+      log_raw("Flight Stats %d", number);
+      print_flight_stats(&local_flight_stats);
+      print_rec_telemetry(&local_telemetry);
     }
   } else {
     log_raw("Stats %d not found!", number);
@@ -229,5 +177,420 @@ void parse_stats(uint16_t number) {
   lfs_file_close(&lfs, &curr_file);
 }
 
-void erase_recordings() { /* remove everything from /flights */
+void print_rec_telemetry(const rec_telemetry_t *telemetry) {
+  log_raw("========================");
+  log_raw("  Recorder Lanes");
+  static const char *const lane_names[NUM_REC_LANES] = {"IMU", "BARO", "STATE_EST", "EVENT"};
+  for (uint32_t i = 0; i < NUM_REC_LANES; ++i) {
+    const rec_lane_stats_t *lane = &telemetry->lanes[i];
+    log_raw("    %-9s dropped: %lu, shed: %lu (max. 1/%u), high water: %u of %lu B", lane_names[i], lane->dropped,
+            lane->shed, 1U << lane->max_shed_level, lane->high_water, rec_lanes[i].size);
+  }
+
+#define REC_TYPE_NAME(name, type, fields) #name,
+  static const char *const type_names[NUM_REC_TYPES] = {REC_TYPES(REC_TYPE_NAME)};
+#undef REC_TYPE_NAME
+  log_raw("========================");
+  log_raw("  Recorder Types");
+  for (uint32_t i = 0; i < NUM_REC_TYPES; ++i) {
+    if (telemetry->enqueued[i] > 0 || telemetry->dropped[i] > 0 || telemetry->skipped[i] > 0) {
+      log_raw("    %-18s enqueued: %lu, dropped: %lu, skipped: %lu", type_names[i], telemetry->enqueued[i],
+              telemetry->dropped[i], telemetry->skipped[i]);
+    }
+  }
+  log_raw("========================");
+  log_raw("  Recorder Writer");
+  log_raw("    Written: %lu blocks, %lu B", telemetry->blocks_written, telemetry->bytes_written);
+  log_raw("    Max. pending blocks: %lu of %u", telemetry->max_pending_blocks, REC_NUM_BUFFERS);
+  log_raw("    Max. wait for a free buffer [us]: %lu", telemetry->max_buffer_wait);
+  const rec_latency_t *write = &telemetry->write_latency;
+  log_raw("    Write latency [us]: min %lu, avg %lu, max %lu (%lu writes)", write->min,
+          write->count > 0 ? write->total / write->count : 0, write->max, write->count);
+  static const char *const phase_names[NUM_REC_PHASES] = {"ground", "ascent", "descent"};
+  for (uint32_t i = 0; i < NUM_REC_PHASES; ++i) {
+    const rec_latency_t *sync = &telemetry->sync_latency[i];
+    if (sync->count > 0) {
+      log_raw("    Sync latency %-7s [us]: min %lu, avg %lu, max %lu (%lu syncs)", phase_names[i], sync->min,
+              sync->total / sync->count, sync->max, sync->count);
+    }
+  }
+  log_raw("    Max. commit delay [ms]: %lu", telemetry->max_commit_delay);
+  log_raw("    Max. IMU gap [ms]: %lu", telemetry->max_imu_gap);
+  log_raw("    Pre-launch history [ms]: %lu of %lu", telemetry->history_kept, telemetry->history_duration);
+  log_raw("    Storage tier: %lu of %u", telemetry->storage_tier, NUM_REC_TIERS - 1);
+}
+
+void erase_recordings() {
+  /* removes the flights and their stats files */
+  flight_index_remove_all();
+  /* The old file system goes together with the recordings, including the flights which were too old for the index;
+   * the flash is moved to the new layout */
+  if (lfs_legacy_layout) {
+    if (lfs_repartition() != 0) {
+      log_raw("Switching to the new flash layout failed, run lfs_format!");
+    }
+    flight_index_init();
+    return;
+  }
+  /* the next flight starts at the beginning of the raw partition again */
+  raw_partition_format();
+}
+
+/** Private Function Definitions **/
+
+static void print_flight_stats(const flight_stats_t *stats) {
+  if (stats->entered_states == 0) {
+    log_raw("  No liftoff detected");
+    return;
+  }
+  log_raw("========================");
+  log_raw("  Flight States [ms since liftoff]");
+  for (uint32_t i = THRUSTING_1; i < NUM_FLIGHT_STATES; ++i) {
+    if (stats->entered_states & (1U << i)) {
+      log_raw("    %-11s entered: %lu, duration: %lu", flight_fsm_map[i], stats->state_entry[i],
+              stats->state_duration[i]);
+    }
+  }
+  log_raw("========================");
+  log_raw("  Flight [ms since liftoff]");
+  log_raw("    Max. Height [m]: %f at %lu", (double)stats->max_height.val, stats->max_height.ts);
+  log_raw("    Max. Velocity [m/s]: %f at %lu", (double)stats->max_velocity.val, stats->max_velocity.ts);
+  log_raw("    Max. Acceleration [m/s^2]: %f at %lu", (double)stats->max_acceleration.val,
+          stats->max_acceleration.ts);
+  log_raw("    Burnout Velocity [m/s]: %f at %lu", (double)stats->burnout.val, stats->burnout.ts);
+  log_raw("    Apogee [m]: %f at %lu", (double)stats->apogee.val, stats->apogee.ts);
+  static const char *const descent_names[NUM_DESCENT_PHASES] = {"Drogue", "Main"};
+  for (uint32_t i = 0; i < NUM_DESCENT_PHASES; ++i) {
+    const stats_accumulator_t *rate = &stats->descent_rate[i];
+    if (rate->count > 0) {
+      log_raw("    %s Descent Rate [m/s]: avg %f, peak %f", descent_names[i], (double)rate->mean, (double)rate->max);
+    }
+  }
+  log_raw("========================");
+  log_raw("  Sensors");
+  for (uint32_t i = 0; i < NUM_BARO; ++i) {
+    print_accumulator("Pressure [Pa]", i, &stats->pressure[i]);
+  }
+  for (uint32_t i = 0; i < NUM_BARO; ++i) {
+    print_accumulator("Temperature [C]", i, &stats->temperature[i]);
+  }
+  for (uint32_t i = 0; i < NUM_ACC; ++i) {
+    print_accumulator("Acceleration [m/s^2]", i, &stats->acceleration[i]);
+  }
+}
+
+static void print_accumulator(const char *name, uint32_t id, const stats_accumulator_t *acc) {
+  if (acc->count == 0) {
+    return;
+  }
+  log_raw("    %s %lu: min %f, max %f, mean %f, stddev %f", name, id, (double)acc->min, (double)acc->max,
+          (double)acc->mean, (double)stats_accumulator_stddev(acc));
+}
+
+static void print_rec_elem(rec_entry_type_e rec_type, const rec_elem_u *rec_elem) {
+  switch (get_record_type_without_id(rec_type)) {
+    case IMU: {
+      log_raw("%lu|IMU%hu|%d|%d|%d|%d|%d|%d", rec_elem->imu.ts, get_id_from_record_type(rec_type),
+              rec_elem->imu.acc_x, rec_elem->imu.acc_y, rec_elem->imu.acc_z, rec_elem->imu.gyro_x,
+              rec_elem->imu.gyro_y, rec_elem->imu.gyro_z);
+    } break;
+    case BARO: {
+      log_raw("%lu|BARO%hu|%lu|%lu", rec_elem->baro.ts, get_id_from_record_type(rec_type),
+              rec_elem->baro.pressure, rec_elem->baro.temperature);
+    } break;
+    case MAGNETO: {
+      log_raw("%lu|MAGNETO|%f|%f|%f", rec_elem->magneto_info.ts, (double)rec_elem->magneto_info.magneto_x,
+              (double)rec_elem->magneto_info.magneto_y, (double)rec_elem->magneto_info.magneto_z);
+    } break;
+    case ACCELEROMETER: {
+      log_raw("%lu|ACC|%d|%d|%d", rec_elem->accel_data.ts, rec_elem->accel_data.acc_x,
+              rec_elem->accel_data.acc_y, rec_elem->accel_data.acc_z);
+    } break;
+    case FLIGHT_INFO: {
+      log_raw("%lu|FLIGHT_INFO|%f|%f|%f", rec_elem->flight_info.ts, (double)rec_elem->flight_info.acceleration,
+              (double)rec_elem->flight_info.height, (double)rec_elem->flight_info.velocity);
+    } break;
+    case ORIENTATION_INFO: {
+      log_raw("%lu|ORIENTATION_INFO|%d|%d|%d|%d|%d|%d|%d|%d", rec_elem->orientation_info.ts,
+              rec_elem->orientation_info.raw_orientation[0], rec_elem->orientation_info.raw_orientation[1],
+              rec_elem->orientation_info.raw_orientation[2], rec_elem->orientation_info.raw_orientation[3],
+              rec_elem->orientation_info.estimated_orientation[0],
+              rec_elem->orientation_info.estimated_orientation[1],
+              rec_elem->orientation_info.estimated_orientation[2],
+              rec_elem->orientation_info.estimated_orientation[3]);
+    } break;
+    case FILTERED_DATA_INFO: {
+      log_raw("%lu|FILTERED_DATA_INFO|%f|%f|%f|%f", rec_elem->filtered_data_info.ts,
+              (double)rec_elem->filtered_data_info.measured_altitude_AGL,
+              (double)rec_elem->filtered_data_info.measured_acceleration,
+              (double)rec_elem->filtered_data_info.filtered_altitude_AGL,
+              (double)rec_elem->filtered_data_info.filtered_acceleration);
+    } break;
+    case FLIGHT_STATE: {
+      log_raw("%lu|FLIGHT_STATE|%u", rec_elem->flight_state.ts,
+              rec_elem->flight_state.flight_or_drop_state.flight_state);
+    } break;
+    case COVARIANCE_INFO: {
+      log_raw("%lu|COVARIANCE_INFO|%f|%f", rec_elem->covariance_info.ts,
+              (double)rec_elem->covariance_info.height_cov, (double)rec_elem->covariance_info.velocity_cov);
+    } break;
+    case SENSOR_INFO: {
+      log_raw("%lu|SENSOR_INFO|%u|%u|%u|%u|%u|%u", rec_elem->sensor_info.ts, rec_elem->sensor_info.faulty_imu[0],
+              rec_elem->sensor_info.faulty_imu[1], rec_elem->sensor_info.faulty_imu[2],
+              rec_elem->sensor_info.faulty_baro[0], rec_elem->sensor_info.faulty_baro[1],
+              rec_elem->sensor_info.faulty_baro[2]);
+    } break;
+    case EVENT_INFO: {
+      log_raw("%lu|EVENT_INFO|%d|%u", rec_elem->event_info.ts, rec_elem->event_info.event,
+              rec_elem->event_info.action_idx);
+    } break;
+    case ERROR_INFO: {
+      log_raw("%lu|ERROR_INFO|%d", rec_elem->error_info.ts, rec_elem->error_info.error);
+    } break;
+    default:
+      log_raw("Impossible recorder entry type!");
+      break;
+  }
 }
+
+/* Raw flight files are a sequence of record types each followed by the record struct */
+static void parse_raw_recording(flight_file_t *file) {
+  rec_elem_t rec_elem;
+  while (flight_file_read(file, (uint8_t *)&rec_elem.rec_type, sizeof(rec_elem.rec_type)) > 0) {
+    const uint32_t elem_size = get_rec_elem_size(rec_elem.rec_type);
+    if (elem_size == 0) {
+      log_raw("Impossible recorder entry type!");
+      break;
+    }
+    flight_file_read(file, (uint8_t *)&rec_elem.u, elem_size - sizeof(rec_elem.rec_type));
+    print_rec_elem(rec_elem.rec_type, &rec_elem.u);
+  }
+}
+
+/**
+ * Parse a flight log, see util/log_format.h. Every block is checked on its own, a corrupted block is reported and
+ * skipped and the parsing continues with the next one.
+ *
+ * @param file - flight file
+ * @param file_size - size of the file in bytes
+ */
+static void parse_log_blocks(flight_file_t *file, uint32_t file_size) {
+  rec_codec_t *codec = calloc(1, sizeof(rec_codec_t));
+  uint8_t *block = (uint8_t *)calloc(LOG_BLOCK_SIZE, sizeof(uint8_t));
+  if (codec == NULL || block == NULL) {
+    log_raw("Not enough memory to decode the recording!");
+    free(codec);
+    free(block);
+    return;
+  }
+  rec_codec_init(codec, rec_layouts);
+
+  const uint32_t num_blocks = file_size / LOG_BLOCK_SIZE;
+  uint32_t expected_seq = 0;
+  uint32_t num_bad_blocks = 0;
+  uint32_t tier = REC_TIER_FULL;
+  for (uint32_t i = 0; i < num_blocks; ++i) {
+    /* blocks are at fixed offsets, a broken block doesn't affect where the next one starts */
+    flight_file_seek(file, i * LOG_BLOCK_SIZE);
+    /* the flash is only locked while the block is read, it is parsed and printed from the copy */
+    osMutexAcquire(flash_mutex, osWaitForever);
+    const uint8_t *block_data = NULL;
+    const lfs_ssize_t read = flight_file_read_ptr(file, block, LOG_BLOCK_SIZE, &block_data);
+    if (read == LOG_BLOCK_SIZE && block_data != block) {
+      memcpy(block, block_data, LOG_BLOCK_SIZE);
+    }
+    osMutexRelease(flash_mutex);
+    if (read != LOG_BLOCK_SIZE) {
+      log_raw("Reading block %lu failed!", i);
+      break;
+    }
+    const bool parse_next = parse_log_block(codec, block, i, &expected_seq, &num_bad_blocks, &tier);
+    if (!parse_next) {
+      break;
+    }
+  }
+
+  if (file_size % LOG_BLOCK_SIZE != 0) {
+    log_raw("The last block is incomplete!");
+  }
+  if (num_bad_blocks > 0) {
+    log_raw("Skipped %lu corrupted blocks out of %lu", num_bad_blocks, num_blocks);
+  }
+
+  free(codec);
+  free(block);
+}
+
+/**
+ * Check and parse a single block of a flight log.
+ *
+ * @param codec - decoder
+ * @param block - LOG_BLOCK_SIZE bytes
+ * @param idx - index of the block in the file
+ * @param expected_seq[in,out] - sequence number the block should have
+ * @param num_bad_blocks[in,out] - number of corrupted blocks
+ * @param tier[in,out] - storage tier of the previous block, see util/rec_tier.h
+ * @return false if the parsing has to stop
+ */
+static bool parse_log_block(rec_codec_t *codec, const uint8_t *block, uint32_t idx, uint32_t *expected_seq,
+                            uint32_t *num_bad_blocks, uint32_t *tier) {
+  log_block_header_t header;
+  memcpy(&header, block, sizeof(header));
+  if (header.sync != LOG_BLOCK_SYNC || header.len > LOG_BLOCK_PAYLOAD_SIZE ||
+      header.crc != crc32_compute(&block[LOG_BLOCK_CRC_OFFSET], LOG_BLOCK_SIZE - LOG_BLOCK_CRC_OFFSET)) {
+    log_raw("Block %lu is corrupted, skipping it!", idx);
+    ++(*num_bad_blocks);
+    return true;
+  }
+  if (header.seq < *expected_seq) {
+    /* the records of a repeated block were already printed, a block from further back is printed where it is */
+    if (header.seq + 1 == *expected_seq) {
+      log_raw("Block %lu repeats block %lu, skipping it!", idx, header.seq);
+      return true;
+    }
+    log_raw("Block %lu is out of order, expected block %lu but got block %lu!", idx, *expected_seq, header.seq);
+  } else {
+    if (header.seq > *expected_seq) {
+      log_raw("Blocks %lu to %lu are missing!", *expected_seq, header.seq - 1);
+    }
+    *expected_seq = header.seq + 1;
+  }
+  const uint32_t block_tier = (header.flags & LOG_BLOCK_TIER_MASK) >> LOG_BLOCK_TIER_SHIFT;
+  if (block_tier != *tier) {
+    log_raw("Storage tier %lu from block %lu on, the flash ran full", block_tier, idx);
+    *tier = block_tier;
+  }
+
+  const uint8_t *payload = &block[sizeof(header)];
+  if (header.flags & LOG_BLOCK_FLAG_HEADER) {
+    return check_log_header(payload, header.len);
+  }
+  parse_log_payload(codec, payload, header.len, header.flags);
+  return true;
+}
+
+/**
+ * Print the information from the header block and check that the records can be decoded by this firmware.
+ *
+ * @param payload - payload of the header block
+ * @param len - payload size
+ * @return true if the records can be decoded
+ */
+static bool check_log_header(const uint8_t *payload, uint32_t len) {
+  log_file_header_t header;
+  if (len < sizeof(header)) {
+    log_raw("Invalid log header!");
+    return false;
+  }
+  memcpy(&header, payload, sizeof(header));
+  header.board[sizeof(header.board) - 1] = '\0';
+  header.code_version[sizeof(header.code_version) - 1] = '\0';
+  if (memcmp(header.magic, LOG_FILE_MAGIC, LOG_FILE_MAGIC_SIZE) != 0) {
+    log_raw("Invalid log header!");
+    return false;
+  }
+  log_raw("Flight %lu recorded by %s, firmware %s, format %u, schema %u", header.flight_counter, header.board,
+          header.code_version, header.format_version, header.schema_version);
+
+  /* The layout table allows the host tools to decode older schemas; here the record structs have to match */
+  uint8_t *own_header = (uint8_t *)calloc(LOG_BLOCK_PAYLOAD_SIZE, sizeof(uint8_t));
+  bool layout_matches = false;
+  if (own_header != NULL) {
+    fill_log_header(own_header, header.flight_counter);
+    layout_matches = header.layout_table_size + sizeof(header) <= len &&
+                     memcmp(&own_header[sizeof(header)], &payload[sizeof(header)], header.layout_table_size) == 0;
+    free(own_header);
+  }
+  if (header.format_version != LOG_FORMAT_VERSION || header.schema_version != LOG_SCHEMA_VERSION ||
+      header.num_types != NUM_REC_TYPES || !layout_matches) {
+    log_raw("The recording was made with a different record format, use the host tools to decode it!");
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Print all records of a data block.
+ *
+ * @param codec - decoder, it is reset for every block
+ * @param payload - payload of the block
+ * @param len - payload size
+ * @param flags - LOG_BLOCK_FLAG_* of the block
+ */
+static void parse_log_payload(rec_codec_t *codec, const uint8_t *payload, uint32_t len, uint16_t flags) {
+  uint32_t idx = 0;
+  if (flags & LOG_BLOCK_FLAG_ENCODED) {
+    rec_codec_reset(codec);
+    while (idx < len) {
+      rec_elem_u rec_elem;
+      uint32_t type_idx = 0;
+      uint8_t id = 0;
+      const int32_t used = rec_codec_decode(codec, &payload[idx], len - idx, &type_idx, &id, &rec_elem);
+      if (used <= 0) {
+        log_raw("Corrupted record, skipping the rest of the block!");
+        return;
+      }
+      idx += (uint32_t)used;
+      print_rec_elem(add_id_to_record_type((rec_entry_type_e)(1U << (type_idx + 4)), id), &rec_elem);
+    }
+  } else {
+    while (idx + sizeof(rec_entry_type_e) <= len) {
+      rec_elem_t rec_elem;
+      memcpy(&rec_elem.rec_type, &payload[idx], sizeof(rec_elem.rec_type));
+      const uint32_t elem_size = get_rec_elem_size(rec_elem.rec_type);
+      if (elem_size == 0 || idx + elem_size > len) {
+        log_raw("Corrupted record, skipping the rest of the block!");
+        return;
+      }
+      memcpy(&rec_elem, &payload[idx], elem_size);
+      idx += elem_size;
+      print_rec_elem(rec_elem.rec_type, &rec_elem.u);
+    }
+  }
+}
+
+/** Flight transfer interface, see util/flight_transfer.h **/
+
+static int32_t xfer_read(void *ctx, uint32_t offset, uint8_t *buf, uint32_t len) {
+  flight_file_t *file = (flight_file_t *)ctx;
+  if (flight_file_seek(file, offset) < 0) {
+    return -1;
+  }
+  return flight_file_read(file, buf, len);
+}
+
+static bool xfer_send(void *ctx, const uint8_t *buf, uint32_t len) {
+  /* A frame takes about 1 ms at full speed, the timeout only triggers if the host stopped reading */
+  static const uint32_t tx_timeout = 100;
+  if (CDC_Wait_Transmit_FS(tx_timeout) != USBD_OK) {
+    return false;
+  }
+  if (len == 0) {
+    return true;
+  }
+  /* The health monitor might have started sending the CLI output in the meantime */
+  uint8_t status;
+  while ((status = CDC_Transmit_FS((uint8_t *)buf, (uint16_t)len)) == USBD_BUSY) {
+    if (CDC_Wait_Transmit_FS(tx_timeout) != USBD_OK) {
+      return false;
+    }
+  }
+  return status == USBD_OK;
+}
+
+static uint32_t xfer_receive(void *ctx, uint8_t *buf, uint32_t len, uint32_t timeout) {
+  const uint32_t start = osKernelGetTickCount();
+  while (fifo_get_length(&usb_input_fifo) == 0 && osKernelGetTickCount() - start < timeout) {
+    osDelay(1);
+  }
+  const uint32_t available = fifo_get_length(&usb_input_fifo);
+  if (len > available) {
+    len = available;
+  }
+  if (len == 0 || !fifo_read_bytes(&usb_input_fifo, buf, len)) {
+    return 0;
+  }
+  return len;
+}
+
+static uint32_t xfer_get_time(void *ctx) { return osKernelGetTickCount(); }
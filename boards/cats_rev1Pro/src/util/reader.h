@@ -19,10 +19,24 @@
 #pragma once
 
 #include "util/types.h"
+#include "util/recorder.h"
 #include "cmsis_os.h"
 
-void dump_recording(uint16_t number);
+/**
+ * Send a flight over USB with the binary transfer protocol, see util/flight_transfer.h.
+ *
+ * @param number - flight number
+ * @param offset - offset at which the transfer starts, allows to resume an interrupted download
+ */
+void dump_recording(uint16_t number, uint32_t offset);
 void parse_recording(uint16_t number);
 void erase_recordings();
 
 void parse_stats(uint16_t number);
+
+/**
+ * Print the recorder telemetry of a flight.
+ *
+ * @param telemetry - recorder telemetry
+ */
+void print_rec_telemetry(const rec_telemetry_t *telemetry);
@@ -0,0 +1,201 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "util/rec_codec.h"
+
+#include <string.h>
+
+/** Private Function Declarations **/
+
+static uint32_t field_width(uint8_t kind);
+static uint32_t load_field(const uint8_t *src, uint32_t width);
+static void store_field(uint8_t *dst, uint32_t width, uint32_t value);
+static int32_t sign_extend(uint32_t value, uint32_t width);
+
+static inline uint32_t zigzag_encode(int32_t value) { return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31); }
+static inline int32_t zigzag_decode(uint32_t value) { return (int32_t)(value >> 1) ^ -(int32_t)(value & 1); }
+
+static uint32_t varint_encode(uint32_t value, uint8_t *out);
+static int32_t varint_decode(const uint8_t *in, uint32_t len, uint32_t *value);
+
+/** Exported Function Definitions **/
+
+void rec_codec_init(rec_codec_t *codec, const rec_layout_t *layouts) {
+  codec->layouts = layouts;
+  rec_codec_reset(codec);
+}
+
+void rec_codec_reset(rec_codec_t *codec) { memset(codec->prev, 0, sizeof(codec->prev)); }
+
+uint32_t rec_codec_encode(rec_codec_t *codec, uint32_t type_idx, uint8_t id, const void *elem, uint8_t *out) {
+  if (type_idx >= REC_CODEC_NUM_TYPES) {
+    return 0;
+  }
+  const rec_layout_t *layout = &codec->layouts[type_idx];
+  uint8_t *prev = codec->prev[type_idx][id % REC_CODEC_NUM_IDS];
+  const uint8_t *curr = (const uint8_t *)elem;
+
+  uint32_t idx = 0;
+  out[idx++] = (uint8_t)((type_idx << 4) | (id & 0x0F));
+
+  for (uint32_t i = 0; i < layout->num_fields; ++i) {
+    const rec_field_t *field = &layout->fields[i];
+    const uint32_t width = field_width(field->kind);
+    const uint32_t new_val = load_field(&curr[field->offset], width);
+    const uint32_t old_val = load_field(&prev[field->offset], width);
+    if (field->kind == REC_FIELD_F32) {
+      idx += varint_encode(new_val ^ old_val, &out[idx]);
+    } else {
+      idx += varint_encode(zigzag_encode(sign_extend(new_val - old_val, width)), &out[idx]);
+    }
+  }
+
+  memcpy(prev, curr, layout->size);
+  return idx;
+}
+
+int32_t rec_codec_decode(rec_codec_t *codec, const uint8_t *in, uint32_t len, uint32_t *type_idx, uint8_t *id,
+                         void *elem) {
+  if (len == 0) {
+    return 0;
+  }
+  const uint32_t tag_type_idx = in[0] >> 4;
+  if (tag_type_idx >= REC_CODEC_NUM_TYPES) {
+    return -1;
+  }
+  const uint8_t tag_id = in[0] & 0x0F;
+  const rec_layout_t *layout = &codec->layouts[tag_type_idx];
+  /* Decode in place, the history is only valid again after a reset if the record turns out to be incomplete */
+  uint8_t *prev = codec->prev[tag_type_idx][tag_id % REC_CODEC_NUM_IDS];
+
+  uint32_t idx = 1;
+  for (uint32_t i = 0; i < layout->num_fields; ++i) {
+    const rec_field_t *field = &layout->fields[i];
+    const uint32_t width = field_width(field->kind);
+    uint32_t coded = 0;
+    const int32_t used = varint_decode(&in[idx], len - idx, &coded);
+    if (used <= 0) {
+      return used;
+    }
+    idx += (uint32_t)used;
+    const uint32_t old_val = load_field(&prev[field->offset], width);
+    if (field->kind == REC_FIELD_F32) {
+      store_field(&prev[field->offset], width, old_val ^ coded);
+    } else {
+      store_field(&prev[field->offset], width, old_val + (uint32_t)zigzag_decode(coded));
+    }
+  }
+
+  memcpy(elem, prev, layout->size);
+  *type_idx = tag_type_idx;
+  *id = tag_id;
+  return (int32_t)idx;
+}
+
+/** Private Function Definitions **/
+
+static uint32_t field_width(uint8_t kind) {
+  switch (kind) {
+    case REC_FIELD_U8:
+    case REC_FIELD_I8:
+      return 1;
+    case REC_FIELD_U16:
+    case REC_FIELD_I16:
+      return 2;
+    default:
+      return 4;
+  }
+}
+
+/* The copies have a constant size so that they compile to single loads and stores instead of memcpy calls; little
+ * endian target and host */
+static uint32_t load_field(const uint8_t *src, uint32_t width) {
+  switch (width) {
+    case 1:
+      return src[0];
+    case 2: {
+      uint16_t value;
+      memcpy(&value, src, sizeof(value));
+      return value;
+    }
+    default: {
+      uint32_t value;
+      memcpy(&value, src, sizeof(value));
+      return value;
+    }
+  }
+}
+
+static void store_field(uint8_t *dst, uint32_t width, uint32_t value) {
+  switch (width) {
+    case 1:
+      dst[0] = (uint8_t)value;
+      break;
+    case 2: {
+      const uint16_t half = (uint16_t)value;
+      memcpy(dst, &half, sizeof(half));
+    } break;
+    default:
+      memcpy(dst, &value, sizeof(value));
+      break;
+  }
+}
+
+/* Interpret the lower `width` bytes of the difference as a signed value so that a small step stays small even if the
+ * field wraps around */
+static int32_t sign_extend(uint32_t value, uint32_t width) {
+  switch (width) {
+    case 1:
+      return (int8_t)value;
+    case 2:
+      return (int16_t)value;
+    default:
+      return (int32_t)value;
+  }
+}
+
+static uint32_t varint_encode(uint32_t value, uint8_t *out) {
+  uint32_t idx = 0;
+  while (value >= 0x80) {
+    out[idx++] = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  out[idx++] = (uint8_t)value;
+  return idx;
+}
+
+static int32_t varint_decode(const uint8_t *in, uint32_t len, uint32_t *value) {
+  /* most deltas fit into a single byte */
+  if (len > 0 && in[0] < 0x80) {
+    *value = in[0];
+    return 1;
+  }
+  uint32_t result = 0;
+  for (uint32_t i = 0; i < 5; ++i) {
+    if (i >= len) {
+      return 0;
+    }
+    result |= (uint32_t)(in[i] & 0x7F) << (7 * i);
+    if ((in[i] & 0x80) == 0) {
+      *value = result;
+      return (int32_t)(i + 1);
+    }
+  }
+  /* more than 5 bytes can't be a 32 bit value */
+  return -1;
+}
@@ -0,0 +1,120 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Compressed encoding of recorder elements.
+ *
+ * Every record is encoded as a 1 byte tag (type index in the upper, ID in the lower nibble) followed by one varint per
+ * field of the record struct. The fields are described by a layout table so the codec itself does not depend on the
+ * recorder types and can be built for the host as well:
+ *   - integer fields (including the timestamp) store the zig-zag encoded difference to the previous record of the
+ *     same type and ID,
+ *   - float fields store the XOR with the previous value; slowly changing values share the sign, exponent and upper
+ *     mantissa bits which makes the XOR result small.
+ *
+ * The encoder and the decoder keep the previous value of each (type, ID) pair and have to be reset at the same point
+ * of the stream, i.e. at the start of every flight log block (see util/log_format.h).
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/** Exported Defines **/
+
+#define REC_CODEC_NUM_TYPES 12
+/* Number of IDs per type for which a separate history is kept; other IDs share it (ID % REC_CODEC_NUM_IDS) */
+#define REC_CODEC_NUM_IDS 4
+#define REC_CODEC_MAX_FIELDS 9
+#define REC_CODEC_MAX_ELEM_SIZE 20
+
+/* Worst case size of an encoded record: tag + 5 varint bytes per field */
+#define REC_CODEC_MAX_ENC_SIZE (1 + 5 * REC_CODEC_MAX_FIELDS)
+
+/** Exported Types **/
+
+typedef enum {
+  REC_FIELD_U8 = 0,
+  REC_FIELD_I8,
+  REC_FIELD_U16,
+  REC_FIELD_I16,
+  REC_FIELD_U32,
+  REC_FIELD_I32,
+  REC_FIELD_F32,
+} rec_field_kind_e;
+
+typedef struct {
+  uint8_t kind; /* rec_field_kind_e */
+  uint8_t offset;
+} rec_field_t;
+
+typedef struct {
+  uint8_t size; /* size of the record struct in bytes */
+  uint8_t num_fields;
+  rec_field_t fields[REC_CODEC_MAX_FIELDS];
+} rec_layout_t;
+
+typedef struct {
+  const rec_layout_t *layouts; /* REC_CODEC_NUM_TYPES entries, indexed by the record type index */
+  uint8_t prev[REC_CODEC_NUM_TYPES][REC_CODEC_NUM_IDS][REC_CODEC_MAX_ELEM_SIZE];
+} rec_codec_t;
+
+/** Exported Functions **/
+
+/**
+ * Initialize the codec and reset its history.
+ *
+ * @param codec - codec to initialize
+ * @param layouts - layout table with REC_CODEC_NUM_TYPES entries
+ */
+void rec_codec_init(rec_codec_t *codec, const rec_layout_t *layouts);
+
+/**
+ * Reset the history, the next record of each type is encoded relative to zero.
+ *
+ * @param codec - codec to reset
+ */
+void rec_codec_reset(rec_codec_t *codec);
+
+/**
+ * Encode a single record.
+ *
+ * @param codec - encoder
+ * @param type_idx - record type index
+ * @param id - record ID
+ * @param elem - record struct
+ * @param out - output buffer; has to hold at least REC_CODEC_MAX_ENC_SIZE bytes
+ * @return number of bytes written to out; 0 if the type index is invalid
+ */
+uint32_t rec_codec_encode(rec_codec_t *codec, uint32_t type_idx, uint8_t id, const void *elem, uint8_t *out);
+
+/**
+ * Decode a single record.
+ *
+ * @param codec - decoder
+ * @param in - encoded data
+ * @param len - number of bytes available in the input
+ * @param type_idx[out] - record type index
+ * @param id[out] - record ID
+ * @param elem[out] - record struct; has to hold at least REC_CODEC_MAX_ELEM_SIZE bytes
+ * @return number of bytes consumed; 0 if the input ends in the middle of the record, -1 if the data is invalid. In both
+ * error cases the history has to be reset before decoding further records.
+ */
+int32_t rec_codec_decode(rec_codec_t *codec, const uint8_t *in, uint32_t len, uint32_t *type_idx, uint8_t *id,
+                         void *elem);
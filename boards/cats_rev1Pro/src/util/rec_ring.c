@@ -0,0 +1,88 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "util/rec_ring.h"
+
+#include <string.h>
+
+/* Make sure the data accesses are not reordered around the index update. On a single core Cortex-M4 a compiler
+ * barrier would be sufficient, the DMB keeps this correct on other targets as well. */
+#if defined(__ARM_ARCH)
+#define REC_RING_BARRIER() __asm volatile("dmb" ::: "memory")
+#else
+#define REC_RING_BARRIER() __sync_synchronize()
+#endif
+
+void rec_ring_init(rec_ring_t *ring, uint8_t *pdata, uint32_t size) {
+  ring->data = pdata;
+  ring->size = size;
+  ring->head = 0;
+  ring->tail = 0;
+}
+
+bool rec_ring_write(rec_ring_t *ring, const void *data, uint32_t count) {
+  const uint32_t head = ring->head;
+  if (ring->size - (head - ring->tail) < count) {
+    return false;
+  }
+  const uint32_t idx = head & (ring->size - 1);
+  const uint32_t back = ring->size - idx;
+  if (count > back) {
+    memcpy(&ring->data[idx], data, back);
+    memcpy(&ring->data[0], (const uint8_t *)data + back, count - back);
+  } else {
+    memcpy(&ring->data[idx], data, count);
+  }
+  /* publish the data only after it was written */
+  REC_RING_BARRIER();
+  ring->head = head + count;
+  return true;
+}
+
+uint32_t rec_ring_peek(const rec_ring_t *ring, const uint8_t **data) {
+  const uint32_t tail = ring->tail;
+  const uint32_t used = ring->head - tail;
+  REC_RING_BARRIER();
+  const uint32_t idx = tail & (ring->size - 1);
+  const uint32_t back = ring->size - idx;
+  *data = &ring->data[idx];
+  return used > back ? back : used;
+}
+
+void rec_ring_copy(const rec_ring_t *ring, void *data, uint32_t count) {
+  REC_RING_BARRIER();
+  const uint32_t idx = ring->tail & (ring->size - 1);
+  const uint32_t back = ring->size - idx;
+  if (count > back) {
+    memcpy(data, &ring->data[idx], back);
+    memcpy((uint8_t *)data + back, &ring->data[0], count - back);
+  } else {
+    memcpy(data, &ring->data[idx], count);
+  }
+}
+
+void rec_ring_consume(rec_ring_t *ring, uint32_t count) {
+  /* the bytes have to be read before the producer is allowed to overwrite them */
+  REC_RING_BARRIER();
+  ring->tail += count;
+}
+
+void rec_ring_flush(rec_ring_t *ring) {
+  REC_RING_BARRIER();
+  ring->tail = ring->head;
+}
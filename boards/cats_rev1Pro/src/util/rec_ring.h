@@ -0,0 +1,96 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Lock-free single-producer/single-consumer byte ring used by the recorder.
+ *
+ * The producer only ever writes `head` and the consumer only ever writes `tail`. Both indices are free running and
+ * are masked with (size - 1) when accessing the buffer, therefore the size has to be a power of two. A write either
+ * stores all bytes or nothing, so as long as the producer writes whole records the consumer only ever sees whole
+ * records.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct {
+  uint8_t *data;
+  uint32_t size;
+  volatile uint32_t head;
+  volatile uint32_t tail;
+} rec_ring_t;
+
+/**
+ * Initialize the ring.
+ *
+ * @param ring - ring to initialize
+ * @param pdata - backing buffer
+ * @param size - size of the backing buffer; has to be a power of two
+ */
+void rec_ring_init(rec_ring_t *ring, uint8_t *pdata, uint32_t size);
+
+/**
+ * Producer side: append `count` bytes to the ring.
+ *
+ * @param ring - ring to write to
+ * @param data - bytes to write
+ * @param count - number of bytes to write
+ * @return true if all bytes were written, false if there was not enough space (nothing is written in that case)
+ */
+bool rec_ring_write(rec_ring_t *ring, const void *data, uint32_t count);
+
+/**
+ * Consumer side: get the longest contiguous span of readable bytes without copying.
+ *
+ * @param ring - ring to read from
+ * @param data[out] - start of the readable span
+ * @return number of bytes in the span; can be less than rec_ring_get_length() if the data wraps around
+ */
+uint32_t rec_ring_peek(const rec_ring_t *ring, const uint8_t **data);
+
+/**
+ * Consumer side: copy `count` bytes starting at the current read position without consuming them.
+ *
+ * @param ring - ring to read from
+ * @param data - destination buffer
+ * @param count - number of bytes to copy; has to be <= rec_ring_get_length()
+ */
+void rec_ring_copy(const rec_ring_t *ring, void *data, uint32_t count);
+
+/**
+ * Consumer side: release `count` bytes that were read via rec_ring_peek() or rec_ring_copy().
+ *
+ * @param ring - ring to read from
+ * @param count - number of bytes to release
+ */
+void rec_ring_consume(rec_ring_t *ring, uint32_t count);
+
+/**
+ * Consumer side: drop everything which is currently stored in the ring.
+ *
+ * @param ring - ring to flush
+ */
+void rec_ring_flush(rec_ring_t *ring);
+
+/** Number of bytes which can currently be read. **/
+static inline uint32_t rec_ring_get_length(const rec_ring_t *ring) { return ring->head - ring->tail; }
+
+/** Number of bytes which can currently be written. **/
+static inline uint32_t rec_ring_get_free(const rec_ring_t *ring) { return ring->size - (ring->head - ring->tail); }
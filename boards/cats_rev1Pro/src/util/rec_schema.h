@@ -0,0 +1,99 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Field list of every record type, in the order of rec_entry_type_e.
+ *
+ * The record structs in util/types.h and util/recorder.h define the data, this list only names their members. It is
+ * turned into the codec layout table in util/recorder.c, where every entry is checked against the real struct with
+ * offsetof, and the host tools use it to name the decoded columns. The file only contains macros so that it can be
+ * included without any firmware headers.
+ *
+ * REC_TYPES(T) calls T(name, struct, fields) for each record type; fields(F, E) calls F(struct, member, kind) for each
+ * plain field and E(struct, member) for each enum field whose size depends on the compiler settings.
+ */
+
+#pragma once
+
+// clang-format off
+#define REC_FIELDS_IMU(F, E)                                                                                           \
+  F(imu_data_t, ts, REC_FIELD_U32) F(imu_data_t, gyro_x, REC_FIELD_I16) F(imu_data_t, gyro_y, REC_FIELD_I16)           \
+  F(imu_data_t, gyro_z, REC_FIELD_I16) F(imu_data_t, acc_x, REC_FIELD_I16) F(imu_data_t, acc_y, REC_FIELD_I16)         \
+  F(imu_data_t, acc_z, REC_FIELD_I16)
+
+#define REC_FIELDS_BARO(F, E)                                                                                          \
+  F(baro_data_t, ts, REC_FIELD_U32) F(baro_data_t, pressure, REC_FIELD_I32) F(baro_data_t, temperature, REC_FIELD_I32)
+
+#define REC_FIELDS_MAGNETO(F, E)                                                                                       \
+  F(magneto_data_t, ts, REC_FIELD_U32) F(magneto_data_t, magneto_x, REC_FIELD_F32)                                     \
+  F(magneto_data_t, magneto_y, REC_FIELD_F32) F(magneto_data_t, magneto_z, REC_FIELD_F32)
+
+#define REC_FIELDS_ACCELEROMETER(F, E)                                                                                 \
+  F(accel_data_t, ts, REC_FIELD_U32) F(accel_data_t, acc_x, REC_FIELD_I8) F(accel_data_t, acc_y, REC_FIELD_I8)         \
+  F(accel_data_t, acc_z, REC_FIELD_I8)
+
+#define REC_FIELDS_FLIGHT_INFO(F, E)                                                                                   \
+  F(flight_info_t, ts, REC_FIELD_U32) F(flight_info_t, height, REC_FIELD_F32)                                          \
+  F(flight_info_t, velocity, REC_FIELD_F32) F(flight_info_t, acceleration, REC_FIELD_F32)
+
+#define REC_FIELDS_ORIENTATION_INFO(F, E)                                                                              \
+  F(orientation_info_t, ts, REC_FIELD_U32)                                                                             \
+  F(orientation_info_t, estimated_orientation[0], REC_FIELD_I16)                                                       \
+  F(orientation_info_t, estimated_orientation[1], REC_FIELD_I16)                                                       \
+  F(orientation_info_t, estimated_orientation[2], REC_FIELD_I16)                                                       \
+  F(orientation_info_t, estimated_orientation[3], REC_FIELD_I16)                                                       \
+  F(orientation_info_t, raw_orientation[0], REC_FIELD_I16) F(orientation_info_t, raw_orientation[1], REC_FIELD_I16)    \
+  F(orientation_info_t, raw_orientation[2], REC_FIELD_I16) F(orientation_info_t, raw_orientation[3], REC_FIELD_I16)
+
+#define REC_FIELDS_FILTERED_DATA_INFO(F, E)                                                                            \
+  F(filtered_data_info_t, ts, REC_FIELD_U32) F(filtered_data_info_t, measured_altitude_AGL, REC_FIELD_F32)             \
+  F(filtered_data_info_t, measured_acceleration, REC_FIELD_F32)                                                        \
+  F(filtered_data_info_t, filtered_altitude_AGL, REC_FIELD_F32)                                                        \
+  F(filtered_data_info_t, filtered_acceleration, REC_FIELD_F32)
+
+#define REC_FIELDS_FLIGHT_STATE(F, E) F(flight_state_t, ts, REC_FIELD_U32) E(flight_state_t, flight_or_drop_state)
+
+#define REC_FIELDS_COVARIANCE_INFO(F, E)                                                                               \
+  F(covariance_info_t, ts, REC_FIELD_U32) F(covariance_info_t, height_cov, REC_FIELD_F32)                              \
+  F(covariance_info_t, velocity_cov, REC_FIELD_F32)
+
+#define REC_FIELDS_SENSOR_INFO(F, E)                                                                                   \
+  F(sensor_info_t, ts, REC_FIELD_U32) F(sensor_info_t, faulty_imu[0], REC_FIELD_U8)                                    \
+  F(sensor_info_t, faulty_imu[1], REC_FIELD_U8) F(sensor_info_t, faulty_imu[2], REC_FIELD_U8)                          \
+  F(sensor_info_t, faulty_baro[0], REC_FIELD_U8) F(sensor_info_t, faulty_baro[1], REC_FIELD_U8)                        \
+  F(sensor_info_t, faulty_baro[2], REC_FIELD_U8)
+
+#define REC_FIELDS_EVENT_INFO(F, E)                                                                                    \
+  F(event_info_t, ts, REC_FIELD_U32) E(event_info_t, event) F(event_info_t, action_idx, REC_FIELD_U8)
+
+#define REC_FIELDS_ERROR_INFO(F, E) F(error_info_t, ts, REC_FIELD_U32) E(error_info_t, error)
+
+#define REC_TYPES(T)                                                                                                   \
+  T(IMU, imu_data_t, REC_FIELDS_IMU)                                                                                   \
+  T(BARO, baro_data_t, REC_FIELDS_BARO)                                                                                \
+  T(MAGNETO, magneto_data_t, REC_FIELDS_MAGNETO)                                                                       \
+  T(ACCELEROMETER, accel_data_t, REC_FIELDS_ACCELEROMETER)                                                             \
+  T(FLIGHT_INFO, flight_info_t, REC_FIELDS_FLIGHT_INFO)                                                                \
+  T(ORIENTATION_INFO, orientation_info_t, REC_FIELDS_ORIENTATION_INFO)                                                 \
+  T(FILTERED_DATA_INFO, filtered_data_info_t, REC_FIELDS_FILTERED_DATA_INFO)                                           \
+  T(FLIGHT_STATE, flight_state_t, REC_FIELDS_FLIGHT_STATE)                                                             \
+  T(COVARIANCE_INFO, covariance_info_t, REC_FIELDS_COVARIANCE_INFO)                                                    \
+  T(SENSOR_INFO, sensor_info_t, REC_FIELDS_SENSOR_INFO)                                                                \
+  T(EVENT_INFO, event_info_t, REC_FIELDS_EVENT_INFO)                                                                   \
+  T(ERROR_INFO, error_info_t, REC_FIELDS_ERROR_INFO)
+// clang-format on
@@ -0,0 +1,84 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "util/rec_tier.h"
+
+/** Private Constants **/
+
+/* Free space below which each tier starts, indexed by the tier */
+static const uint32_t rec_tier_thresholds[NUM_REC_TIERS] = {
+    0,                                                       /* REC_TIER_FULL */
+    REC_TIER_NO_MAGNETO_DURATION * REC_NOMINAL_DATA_RATE,    /* REC_TIER_NO_MAGNETO */
+    REC_TIER_NO_COVARIANCE_DURATION * REC_NOMINAL_DATA_RATE, /* REC_TIER_NO_COVARIANCE */
+    REC_TIER_DECIMATED_DURATION * REC_NOMINAL_DATA_RATE,     /* REC_TIER_DECIMATED */
+    REC_TIER_CRITICAL_SPACE,                                 /* REC_TIER_CRITICAL */
+};
+
+/* First tier in which each record type is dropped, indexed by the record type index; NUM_REC_TIERS if never */
+static const uint8_t rec_tier_drop[NUM_REC_TYPES] = {
+    REC_TIER_CRITICAL,      /* IMU */
+    REC_TIER_CRITICAL,      /* BARO */
+    REC_TIER_NO_MAGNETO,    /* MAGNETO */
+    REC_TIER_CRITICAL,      /* ACCELEROMETER */
+    REC_TIER_CRITICAL,      /* FLIGHT_INFO */
+    REC_TIER_CRITICAL,      /* ORIENTATION_INFO */
+    REC_TIER_CRITICAL,      /* FILTERED_DATA_INFO */
+    NUM_REC_TIERS,          /* FLIGHT_STATE */
+    REC_TIER_NO_COVARIANCE, /* COVARIANCE_INFO */
+    NUM_REC_TIERS,          /* SENSOR_INFO */
+    NUM_REC_TIERS,          /* EVENT_INFO */
+    NUM_REC_TIERS,          /* ERROR_INFO */
+};
+
+/* First tier in which each record type is decimated by 2^REC_TIER_DECIMATION_SHIFT, indexed by the record type
+ * index; NUM_REC_TIERS if never */
+static const uint8_t rec_tier_decimate[NUM_REC_TYPES] = {
+    REC_TIER_DECIMATED, /* IMU */
+    NUM_REC_TIERS,      /* BARO */
+    NUM_REC_TIERS,      /* MAGNETO */
+    NUM_REC_TIERS,      /* ACCELEROMETER */
+    NUM_REC_TIERS,      /* FLIGHT_INFO */
+    NUM_REC_TIERS,      /* ORIENTATION_INFO */
+    NUM_REC_TIERS,      /* FILTERED_DATA_INFO */
+    NUM_REC_TIERS,      /* FLIGHT_STATE */
+    NUM_REC_TIERS,      /* COVARIANCE_INFO */
+    NUM_REC_TIERS,      /* SENSOR_INFO */
+    NUM_REC_TIERS,      /* EVENT_INFO */
+    NUM_REC_TIERS,      /* ERROR_INFO */
+};
+
+/** Exported Function Definitions **/
+
+rec_storage_tier_e rec_tier_from_free_space(uint32_t free_space) {
+  rec_storage_tier_e tier = REC_TIER_FULL;
+  while (tier < REC_TIER_CRITICAL && free_space < rec_tier_thresholds[tier + 1]) {
+    ++tier;
+  }
+  return tier;
+}
+
+bool rec_tier_keeps(uint32_t type_idx, rec_storage_tier_e tier, uint32_t *decimation_shift) {
+  *decimation_shift = 0;
+  if (type_idx >= NUM_REC_TYPES || tier >= rec_tier_drop[type_idx]) {
+    return false;
+  }
+  if (tier >= rec_tier_decimate[type_idx]) {
+    *decimation_shift = REC_TIER_DECIMATION_SHIFT;
+  }
+  return true;
+}
@@ -0,0 +1,80 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Graceful degradation of the flight log when the flash runs full during a flight.
+ *
+ * task_rec_writer checks the free space after every block and moves the recorder to a higher storage tier once it
+ * falls below the threshold of that tier. Every tier drops more of the bulk data so that the remaining space lasts
+ * until touchdown; the flight states, events, errors and sensor faults are recorded in every tier and the space
+ * below REC_TIER_CRITICAL_SPACE is reserved for them. The tier never goes down during a flight and is stored in the
+ * flags of every log block (see util/log_format.h) so the reader can tell where data is missing on purpose.
+ *
+ * Only depends on the recorder definitions so that it can be tested on the host, see tools/flash_emu.
+ */
+
+#pragma once
+
+#include "util/recorder.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Exported Defines **/
+
+/* Free space below which each tier starts, in seconds of recording at REC_NOMINAL_DATA_RATE */
+#define REC_TIER_NO_MAGNETO_DURATION    120
+#define REC_TIER_NO_COVARIANCE_DURATION 60
+#define REC_TIER_DECIMATED_DURATION     30
+/* Space reserved for the event lane */
+#define REC_TIER_CRITICAL_SPACE (32 * 1024)
+
+/* In REC_TIER_DECIMATED only every 2^REC_TIER_DECIMATION_SHIFT-th IMU record is kept */
+#define REC_TIER_DECIMATION_SHIFT 2
+
+/** Exported Types **/
+
+typedef enum {
+  REC_TIER_FULL = 0,      /* everything is recorded */
+  REC_TIER_NO_MAGNETO,    /* MAGNETO is dropped */
+  REC_TIER_NO_COVARIANCE, /* COVARIANCE_INFO is dropped as well */
+  REC_TIER_DECIMATED,     /* IMU is decimated further */
+  REC_TIER_CRITICAL,      /* only FLIGHT_STATE, SENSOR_INFO, EVENT_INFO and ERROR_INFO */
+  NUM_REC_TIERS
+} rec_storage_tier_e;
+
+/** Exported Functions **/
+
+/**
+ * Get the storage tier for the remaining space of the flight log.
+ *
+ * @param free_space - bytes which can still be written
+ * @return storage tier
+ */
+rec_storage_tier_e rec_tier_from_free_space(uint32_t free_space);
+
+/**
+ * Checks whether a record type is still recorded in the given storage tier.
+ *
+ * @param type_idx - record type index
+ * @param tier - current storage tier
+ * @param decimation_shift[out] - the sample rate of the type has to be divided by 2^decimation_shift in addition to
+ * the configured decimation
+ * @return true if the type is recorded
+ */
+bool rec_tier_keeps(uint32_t type_idx, rec_storage_tier_e tier, uint32_t *decimation_shift);
@@ -20,11 +20,73 @@
 #include "util/log.h"
 #include "config/globals.h"
 #include "config/cats_config.h"
+#include "util/rec_schema.h"
+#include "util/flight_stats.h"
+#include "util/rec_tier.h"
 
-#include <math.h>
+#include <stddef.h>
+#include <string.h>
 
-flight_stats_t global_flight_stats = {
-    .max_height.val = -INFINITY, .max_velocity.val = -INFINITY, .max_acceleration.val = -INFINITY};
+rec_telemetry_t global_rec_telemetry = {};
+
+extern inline uint32_t get_rec_type_index(rec_entry_type_e rec_type);
+extern inline uint32_t get_rec_elem_size(rec_entry_type_e rec_type);
+extern inline rec_phase_e get_rec_phase(flight_fsm_e flight_state);
+
+#define REC_FIELD(type, member, kind) {kind, offsetof(type, member)},
+/* Enums are stored with their native size, which depends on -fshort-enums */
+#define REC_ENUM_KIND(type, member) \
+  (sizeof(((type *)0)->member) == 1 ? REC_FIELD_U8 : sizeof(((type *)0)->member) == 2 ? REC_FIELD_U16 : REC_FIELD_I32)
+#define REC_ENUM_FIELD(type, member) REC_FIELD(type, member, REC_ENUM_KIND(type, member))
+#define REC_COUNT_FIELD(...) +1
+#define REC_LAYOUT(name, type, fields) \
+  {sizeof(type), 0 fields(REC_COUNT_FIELD, REC_COUNT_FIELD), {fields(REC_FIELD, REC_ENUM_FIELD)}},
+
+_Static_assert(NUM_REC_TYPES == REC_CODEC_NUM_TYPES, "Codec doesn't cover all record types");
+_Static_assert(sizeof(rec_elem_u) <= REC_CODEC_MAX_ELEM_SIZE, "Record struct is too big for the codec");
+_Static_assert(NUM_REC_TYPES <= LOG_MAX_TYPES, "Too many record types for the log header");
+_Static_assert(sizeof(log_file_header_t) + NUM_REC_TYPES * (2 + 2 * REC_CODEC_MAX_FIELDS) +
+                       NUM_REC_PHASES * NUM_REC_TYPES <=
+                   LOG_BLOCK_PAYLOAD_SIZE,
+               "Log header doesn't fit into the header block");
+_Static_assert(REC_CODEC_MAX_ENC_SIZE <= LOG_BLOCK_PAYLOAD_SIZE && REC_MAX_ELEM_SIZE <= LOG_BLOCK_PAYLOAD_SIZE,
+               "Record doesn't fit into a log block");
+
+#define REC_BOARD_NAME "cats_rev1Pro"
+
+/* Indexed by the record type index, see get_rec_type_index(); generated from util/rec_schema.h */
+const rec_layout_t rec_layouts[NUM_REC_TYPES] = {REC_TYPES(REC_LAYOUT)};
+
+/* Lane into which each record type is written, indexed by the record type index */
+static const rec_lane_e rec_lane_map[NUM_REC_TYPES] = {
+    REC_LANE_IMU,       REC_LANE_BARO,      REC_LANE_IMU,       REC_LANE_IMU,
+    REC_LANE_STATE_EST, REC_LANE_STATE_EST, REC_LANE_STATE_EST, REC_LANE_EVENT,
+    REC_LANE_STATE_EST, REC_LANE_STATE_EST, REC_LANE_EVENT,     REC_LANE_EVENT,
+};
+
+/* Nominal sample rate in Hz before decimation, indexed by the record type index; 0 for event driven records */
+static const uint16_t rec_sample_rates[NUM_REC_TYPES] = {
+    CONTROL_SAMPLING_FREQ, /* IMU */
+    CONTROL_SAMPLING_FREQ, /* BARO */
+    CONTROL_SAMPLING_FREQ, /* MAGNETO */
+    CONTROL_SAMPLING_FREQ, /* ACCELEROMETER */
+    CONTROL_SAMPLING_FREQ, /* FLIGHT_INFO */
+    CONTROL_SAMPLING_FREQ, /* ORIENTATION_INFO */
+    CONTROL_SAMPLING_FREQ, /* FILTERED_DATA_INFO */
+    0,                     /* FLIGHT_STATE */
+    CONTROL_SAMPLING_FREQ, /* COVARIANCE_INFO */
+    0,                     /* SENSOR_INFO */
+    0,                     /* EVENT_INFO */
+    0,                     /* ERROR_INFO */
+};
+
+/* Records of each type per sample, i.e. the number of sensors, indexed by the record type index */
+static const uint8_t rec_num_ids[NUM_REC_TYPES] = {
+    NUM_IMU, NUM_BARO, NUM_MAGNETO, NUM_ACCELEROMETER, 1, 1, 1, 1, 1, 1, 1, 1,
+};
+
+/* Decimation counters per record type and ID; each counter is only touched by the task producing these records */
+static uint8_t rec_decimation_counters[NUM_REC_TYPES][REC_ID_MASK + 1] = {};
 
 /**
  * Checks whether the given rec_type should be recorded.
@@ -36,76 +98,201 @@ static inline bool should_record(rec_entry_type_e rec_type) {
   return (global_cats_config.config.recorder_mask & rec_type) > 0;
 }
 
-/* TODO: See whether this is optimized in assembler. Here we copy the entire struct but the alternative is to pass a
- * pointer and this will cause too many indirect accesses. */
-static inline void collect_flight_info_stats(flight_info_t flight_info) {
-  if (global_recorder_status == REC_WRITE_TO_FLASH) {
-    /* TODO: We need to offset the timestamps in the flight stats struct by subtracting the timestamp at EV_LIFTOFF. */
-    if ((flight_info.height > global_flight_stats.max_height.val)) {
-      global_flight_stats.max_height.ts = flight_info.ts;
-      global_flight_stats.max_height.val = flight_info.height;
+/**
+ * Get the shed level of a lane from its fill level: 0 while at least half of the lane is free, then one level more
+ * every time the free space halves.
+ *
+ * @param lane - recorder lane
+ * @return shed level, the sample rate is divided by 2^level
+ */
+static inline uint32_t get_shed_level(rec_lane_e lane) {
+  const rec_ring_t *ring = &rec_lanes[lane];
+  const uint32_t free_space = rec_ring_get_free(ring);
+  uint32_t level = 0;
+  while (level < REC_SHED_MAX_LEVEL && free_space < (ring->size >> (level + 1))) {
+    ++level;
+  }
+  return level;
+}
+
+/**
+ * Checks whether the record passes the decimation configured for the current flight phase, the decimation of the
+ * storage tier and the load shedding of its lane.
+ *
+ * @param type_idx - record type index
+ * @param id - record ID
+ * @param tier_shift - additional decimation of the storage tier, see rec_tier_keeps()
+ * @param shed_level - shed level of the lane, see get_shed_level()
+ * @param shed[out] - true if the record is only skipped because of the load shedding
+ * @return true if the record should be kept
+ */
+static inline bool passes_decimation(uint32_t type_idx, uint8_t id, uint32_t tier_shift, uint32_t shed_level,
+                                     bool *shed) {
+  *shed = false;
+  if (rec_lane_map[type_idx] == REC_LANE_EVENT || rec_sample_rates[type_idx] == 0) {
+    return true;
+  }
+  const rec_phase_e phase = get_rec_phase(global_flight_state.flight_state);
+  uint32_t configured = global_cats_config.config.rec_decimation[phase][type_idx];
+  if (configured == 0) {
+    configured = 1;
+  }
+  configured <<= tier_shift;
+  uint32_t decimation = configured << shed_level;
+  if (decimation > UINT8_MAX) {
+    decimation = UINT8_MAX;
+  }
+  if (decimation <= 1) {
+    return true;
+  }
+  uint8_t *counter = &rec_decimation_counters[type_idx][id];
+  /* the decimation might have changed together with the phase or the load */
+  if (*counter >= decimation) {
+    *counter = 0;
+  }
+  const bool keep = *counter == 0;
+  /* without shedding every configured-th record would be kept */
+  *shed = !keep && *counter % configured == 0;
+  ++(*counter);
+  return keep;
+}
+
+/**
+ * Update the lane statistics and the recorder telemetry after a record was offered to its lane.
+ *
+ * @param type_idx - record type index
+ * @param lane - recorder lane
+ * @param shed_level - current shed level of the lane
+ * @param written - true if the record fit into the lane
+ */
+static inline void update_record_stats(uint32_t type_idx, rec_lane_e lane, uint32_t shed_level, bool written) {
+  rec_lane_stats_t *stats = &global_rec_telemetry.lanes[lane];
+  if (!written) {
+    ++stats->dropped;
+    ++global_rec_telemetry.dropped[type_idx];
+    return;
+  }
+  ++global_rec_telemetry.enqueued[type_idx];
+  const uint32_t length = rec_ring_get_length(&rec_lanes[lane]);
+  if (length > stats->high_water) {
+    stats->high_water = (uint16_t)length;
+  }
+  if (shed_level > stats->max_shed_level) {
+    stats->max_shed_level = (uint8_t)shed_level;
+  }
+}
+
+void record(rec_entry_type_e rec_type_with_id, const void *rec_value) {
+  rec_entry_type_e pure_rec_type = get_record_type_without_id(rec_type_with_id);
+  if (global_recorder_status >= REC_FILL_QUEUE) {
+    const uint32_t type_idx = get_rec_type_index(pure_rec_type);
+    if (type_idx >= NUM_REC_TYPES) {
+      log_fatal("Impossible recorder entry type %d!", pure_rec_type);
+      return;
     }
-    if (flight_info.velocity > global_flight_stats.max_velocity.val) {
-      global_flight_stats.max_velocity.ts = flight_info.ts;
-      global_flight_stats.max_velocity.val = flight_info.velocity;
+
+    /* The statistics are collected from every sample, only the recording is masked and decimated */
+    flight_stats_update(rec_type_with_id, rec_value);
+    if (!should_record(pure_rec_type)) {
+      return;
+    }
+
+    /* Once the flash runs full the bulk data is thinned out, see util/rec_tier.h */
+    uint32_t tier_shift = 0;
+    if (!rec_tier_keeps(type_idx, (rec_storage_tier_e)global_rec_telemetry.storage_tier, &tier_shift)) {
+      ++global_rec_telemetry.skipped[type_idx];
+      return;
     }
-    if (flight_info.acceleration > global_flight_stats.max_acceleration.val) {
-      global_flight_stats.max_acceleration.ts = flight_info.ts;
-      global_flight_stats.max_acceleration.val = flight_info.acceleration;
+
+    const rec_lane_e lane = rec_lane_map[type_idx];
+    const uint32_t shed_level = lane == REC_LANE_EVENT ? 0 : get_shed_level(lane);
+    bool shed = false;
+    if (!passes_decimation(type_idx, get_id_from_record_type(rec_type_with_id), tier_shift, shed_level, &shed)) {
+      if (shed) {
+        ++global_rec_telemetry.lanes[lane].shed;
+      }
+      return;
+    }
+
+    /* Pack the record to its real size: record type followed by the record struct */
+    uint8_t packed_elem[REC_MAX_ELEM_SIZE];
+    const uint32_t elem_size = sizeof(rec_type_with_id) + rec_layouts[type_idx].size;
+    memcpy(packed_elem, &rec_type_with_id, sizeof(rec_type_with_id));
+    memcpy(packed_elem + sizeof(rec_type_with_id), rec_value, rec_layouts[type_idx].size);
+
+    bool written;
+    if (lane == REC_LANE_EVENT) {
+      /* This lane has multiple producers, make sure they don't interleave; this covers the statistics as well */
+      int32_t lock = osKernelLock();
+      written = rec_ring_write(&rec_lanes[lane], packed_elem, elem_size);
+      update_record_stats(type_idx, lane, 0, written);
+      osKernelRestoreLock(lock);
+    } else {
+      written = rec_ring_write(&rec_lanes[lane], packed_elem, elem_size);
+      update_record_stats(type_idx, lane, shed_level, written);
+    }
+
+    if (!written) {
+      log_error("Inserting an element to the recorder lane %d failed!", lane);
     }
   }
 }
 
-void record(rec_entry_type_e rec_type_with_id, const void *rec_value) {
-  rec_entry_type_e pure_rec_type = get_record_type_without_id(rec_type_with_id);
-  if (global_recorder_status >= REC_FILL_QUEUE && should_record(pure_rec_type)) {
-    rec_elem_t e = {.rec_type = rec_type_with_id};
-    switch (pure_rec_type) {
-      case IMU:
-        e.u.imu = *((imu_data_t *)rec_value);
-        break;
-      case BARO:
-        e.u.baro = *((baro_data_t *)rec_value);
-        break;
-      case MAGNETO:
-        e.u.magneto_info = *((magneto_data_t *)rec_value);
-        break;
-      case ACCELEROMETER:
-        e.u.accel_data = *((accel_data_t *)rec_value);
-        break;
-      case FLIGHT_INFO:
-        e.u.flight_info = *((flight_info_t *)rec_value);
-        collect_flight_info_stats(e.u.flight_info);
-        break;
-      case ORIENTATION_INFO:
-        e.u.orientation_info = *((orientation_info_t *)rec_value);
-        break;
-      case FILTERED_DATA_INFO:
-        e.u.filtered_data_info = *((filtered_data_info_t *)rec_value);
-        break;
-      case FLIGHT_STATE:
-        e.u.flight_state = *((flight_state_t *)rec_value);
-        break;
-      case COVARIANCE_INFO:
-        e.u.covariance_info = *((covariance_info_t *)rec_value);
-        break;
-      case SENSOR_INFO:
-        e.u.sensor_info = *((sensor_info_t *)rec_value);
-        break;
-      case EVENT_INFO:
-        e.u.event_info = *((event_info_t *)rec_value);
-        break;
-      case ERROR_INFO:
-        e.u.error_info = *((error_info_t *)rec_value);
-        break;
-      default:
-        log_fatal("Impossible recorder entry type %d!", pure_rec_type);
-        break;
+uint32_t fill_log_header(uint8_t *payload, uint32_t flight_number) {
+  log_file_header_t header = {};
+  memcpy(header.magic, LOG_FILE_MAGIC, LOG_FILE_MAGIC_SIZE);
+  header.format_version = LOG_FORMAT_VERSION;
+  header.schema_version = LOG_SCHEMA_VERSION;
+  strncpy(header.board, REC_BOARD_NAME, sizeof(header.board) - 1);
+  strncpy(header.code_version, code_version, sizeof(header.code_version) - 1);
+  header.flight_counter = flight_number;
+  header.num_types = NUM_REC_TYPES;
+  header.num_phases = NUM_REC_PHASES;
+  for (uint32_t i = 0; i < NUM_REC_TYPES; ++i) {
+    header.sample_rates[i] = rec_sample_rates[i];
+  }
+
+  /* the layout table only contains the used fields */
+  uint32_t idx = sizeof(header);
+  for (uint32_t i = 0; i < NUM_REC_TYPES; ++i) {
+    const rec_layout_t *layout = &rec_layouts[i];
+    payload[idx++] = layout->size;
+    payload[idx++] = layout->num_fields;
+    for (uint32_t j = 0; j < layout->num_fields; ++j) {
+      payload[idx++] = layout->fields[j].kind;
+      payload[idx++] = layout->fields[j].offset;
     }
+  }
+  header.layout_table_size = (uint16_t)(idx - sizeof(header));
+  memcpy(payload, &header, sizeof(header));
 
-    osStatus_t ret = osMessageQueuePut(rec_queue, &e, 0U, 0U);
-    if (ret != osOK) {
-      log_error("Inserting an element to the recorder queue failed! Error: %d", ret);
+  memcpy(&payload[idx], global_cats_config.config.rec_decimation, sizeof(global_cats_config.config.rec_decimation));
+  idx += sizeof(global_cats_config.config.rec_decimation);
+  return idx;
+}
+
+uint32_t rec_get_history_capacity() {
+  /* packed bytes per second of the sampled records on the ground; event driven records are rare enough to ignore */
+  uint32_t data_rate = 0;
+  for (uint32_t i = 0; i < NUM_REC_TYPES; ++i) {
+    const rec_entry_type_e rec_type = (rec_entry_type_e)(1U << (i + 4));
+    if (rec_sample_rates[i] == 0 || !should_record(rec_type)) {
+      continue;
+    }
+    uint32_t decimation = global_cats_config.config.rec_decimation[REC_PHASE_GROUND][i];
+    if (decimation == 0) {
+      decimation = 1;
     }
+    data_rate += get_rec_elem_size(rec_type) * rec_num_ids[i] * rec_sample_rates[i] / decimation;
   }
+  if (data_rate == 0) {
+    return UINT32_MAX;
+  }
+  return (uint32_t)((uint64_t)REC_HISTORY_SIZE * 1000U / data_rate);
+}
+
+uint32_t rec_get_history_duration() {
+  const uint32_t capacity = rec_get_history_capacity();
+  const uint32_t duration = global_cats_config.config.rec_history_duration;
+  return duration == 0 || duration > capacity ? capacity : duration;
 }
@@ -20,6 +20,9 @@
 
 #include "util/types.h"
 #include "util/error_handler.h"
+#include "util/rec_ring.h"
+#include "util/rec_codec.h"
+#include "util/log_format.h"
 
 #include "cmsis_os.h"
 
@@ -30,24 +33,57 @@
 #endif
 //#define FLASH_READ_TEST
 
+/* Store the records in the flight log blocks compressed with the record codec (see util/rec_codec.h); the reader
+ * understands both formats */
+#define REC_USE_CODEC
+
+/* Sizes of the recorder lanes and of the pre-launch history in bytes; have to be powers of two. The records are
+ * stored packed to their real size, i.e. the 4 byte record type followed by the record struct. The lanes only have to
+ * bridge the time until the recorder task picks the records up, the pre-launch history is kept separately. */
 #if (configUSE_TRACE_FACILITY == 1)
-#define REC_QUEUE_SIZE 256
+#define REC_LANE_IMU_SIZE       1024
+#define REC_LANE_BARO_SIZE      512
+#define REC_LANE_STATE_EST_SIZE 1024
+#define REC_LANE_EVENT_SIZE     256
+#define REC_HISTORY_SIZE        4096
 #else
-#define REC_QUEUE_SIZE 512
+#define REC_LANE_IMU_SIZE       2048
+#define REC_LANE_BARO_SIZE      1024
+#define REC_LANE_STATE_EST_SIZE 2048
+#define REC_LANE_EVENT_SIZE     512
+#define REC_HISTORY_SIZE        8192
 #endif
 
 #define REC_CMD_QUEUE_SIZE 16
 
-#define MAX_FILENAME_SIZE 32
+/* Sampled records in a lane which is filled beyond half of its size are decimated further to shed load: one more
+ * halving of the rate every time the free space halves, up to REC_SHED_MAX_LEVEL. Event driven records and the event
+ * lane are never shed. */
+#define REC_SHED_MAX_LEVEL 3
+
+/* The recorder task serializes the lanes into one flight log block while task_rec_writer writes the other one to the
+ * flash, see util/log_format.h */
+#define REC_NUM_BUFFERS 2
 
-#define REC_QUEUE_PRE_THRUSTING_FILL_RATIO 0.75f
-#define REC_QUEUE_PRE_THRUSTING_LIMIT      (uint32_t)(REC_QUEUE_PRE_THRUSTING_FILL_RATIO * REC_QUEUE_SIZE)
+/* Rough amount of encoded flight log data per second with the default sample rates */
+#define REC_NOMINAL_DATA_RATE (10 * 1024)
+/* The raw partition is erased ahead for this many seconds of recording while waiting on the pad */
+#define REC_PREERASE_DURATION 300
+#define REC_PREERASE_SIZE     (REC_PREERASE_DURATION * REC_NOMINAL_DATA_RATE)
+
+#define MAX_FILENAME_SIZE 32
 
 /**
  * A bit mask that specifies where the IDs are located. The IDs occupy the first four bits of the rec_entry_type_e enum.
  */
 #define REC_ID_MASK 0x0000000F
 
+/** Number of record types in rec_entry_type_e, the type bits start right after the ID bits. **/
+#define NUM_REC_TYPES 12
+
+/** Largest record which can be stored in a lane: record type + biggest record struct **/
+#define REC_MAX_ELEM_SIZE (sizeof(rec_entry_type_e) + sizeof(rec_elem_u))
+
 /** Exported Types **/
 
 // clang-format off
@@ -152,37 +188,125 @@ typedef struct {
   rec_elem_u u;
 } rec_elem_t;
 
-/* Flight Statistics */
+/* Every producer task gets its own lane so that a lane always has exactly one writer. The only exception is
+ * REC_LANE_EVENT which is written by several tasks; its writers are serialized in record(). */
+typedef enum {
+  REC_LANE_IMU = 0,   /* IMU, MAGNETO, ACCELEROMETER - task_imu_read */
+  REC_LANE_BARO,      /* BARO - task_baro_read */
+  REC_LANE_STATE_EST, /* FLIGHT_INFO, ORIENTATION_INFO, FILTERED_DATA_INFO, COVARIANCE_INFO, SENSOR_INFO */
+  REC_LANE_EVENT,     /* FLIGHT_STATE, EVENT_INFO, ERROR_INFO */
+  NUM_REC_LANES
+} rec_lane_e;
+
+/* Flight phase groups with separate decimation and sync settings, see cats_config_t */
+typedef enum {
+  REC_PHASE_GROUND = 0, /* INVALID, MOVING, READY, TOUCHDOWN */
+  REC_PHASE_ASCENT,     /* THRUSTING_1 ... APOGEE */
+  REC_PHASE_DESCENT,    /* DROGUE, MAIN */
+  NUM_REC_PHASES
+} rec_phase_e;
 
+/* Load of a recorder lane during a flight */
+typedef struct {
+  uint32_t dropped;       /* records which didn't fit into the lane */
+  uint32_t shed;          /* records skipped to shed load */
+  uint16_t high_water;    /* highest number of bytes in the lane */
+  uint8_t max_shed_level; /* highest shed level, the rate was divided by up to 2^max_shed_level */
+  uint8_t reserved;
+} rec_lane_stats_t;
+
+/* Durations of an operation in us */
+typedef struct {
+  uint32_t count;
+  uint32_t min;
+  uint32_t max;
+  uint32_t total;
+} rec_latency_t;
+
+/* Health of the recorder during a flight, used to size the lanes and buffers. Every counter has a single writer (the
+ * event lane counters are only updated with the kernel locked) and is a plain 32 bit store, so readers never see torn
+ * values. */
 typedef struct {
-  struct {
-    timestamp_t ts;
-    float val;
-  } max_height;
-
-  struct {
-    timestamp_t ts;
-    float val;
-  } max_velocity;
-
-  struct {
-    timestamp_t ts;
-    float val;
-  } max_acceleration;
-} flight_stats_t;
+  /* updated by the producers in record() */
+  rec_lane_stats_t lanes[NUM_REC_LANES];
+  /* indexed by the record type index */
+  uint32_t enqueued[NUM_REC_TYPES];
+  uint32_t dropped[NUM_REC_TYPES];
+  uint32_t skipped[NUM_REC_TYPES]; /* not recorded because the flash ran full, see util/rec_tier.h */
+  /* updated by task_recorder */
+  uint32_t max_pending_blocks; /* highest number of blocks waiting for task_rec_writer */
+  uint32_t max_buffer_wait;    /* longest wait for a free buffer in us */
+  uint32_t max_imu_gap;        /* longest time between two consecutive records of the same IMU in ms */
+  uint32_t history_duration;   /* pre-launch history aimed for in ms, see rec_get_history_duration() */
+  uint32_t history_kept;       /* pre-launch history held at liftoff in ms (live while waiting on the pad) */
+  /* updated by task_rec_writer */
+  uint32_t blocks_written;
+  uint32_t bytes_written;
+  rec_latency_t write_latency;                /* per block, raw_partition_append or lfs_file_write */
+  rec_latency_t sync_latency[NUM_REC_PHASES]; /* lfs_file_sync, per phase group */
+  uint32_t max_commit_delay;                  /* longest time from taking a record until it was on the flash in ms */
+  uint32_t storage_tier;       /* rec_storage_tier_e, only goes up during a flight; read by the producers */
+} rec_telemetry_t;
+
+/* A filled recorder buffer handed from task_recorder to task_rec_writer */
+typedef struct {
+  uint8_t slot;
+  bool sync; /* commit the flight file right after this block */
+  uint16_t len;
+  uint32_t start_tick; /* when the first record of the block was taken */
+} rec_buf_desc_t;
 
 /** Exported Variables **/
-extern flight_stats_t global_flight_stats;
+
+/* Stored after the flight statistics in the stats file, see util/flight_stats.h */
+extern rec_telemetry_t global_rec_telemetry;
+
+/* Field layout of the record struct (without the record type) for each record type index */
+extern const rec_layout_t rec_layouts[NUM_REC_TYPES];
 
 /** Exported Functions **/
 
 void record(rec_entry_type_e rec_type_with_id, const void *rec_value);
 
-inline void reset_global_flight_stats() {
-  memset(&global_flight_stats, 0, sizeof(flight_stats_t));
-  global_flight_stats.max_height.val = -INFINITY;
-  global_flight_stats.max_velocity.val = -INFINITY;
-  global_flight_stats.max_acceleration.val = -INFINITY;
+/**
+ * Write the payload of the flight log header block: the file header followed by the layout and decimation tables.
+ *
+ * @param payload - payload of the header block; has to hold LOG_BLOCK_PAYLOAD_SIZE bytes
+ * @param flight_number - number of the flight stored in the file
+ * @return number of payload bytes written
+ */
+uint32_t fill_log_header(uint8_t *payload, uint32_t flight_number);
+
+/**
+ * Get how much of the pre-launch history fits into the history buffer with the recorder mask and the ground
+ * decimation of the current config, assuming every sampled record type arrives at its nominal rate.
+ *
+ * @return capacity of the history buffer in ms
+ */
+uint32_t rec_get_history_capacity();
+
+/**
+ * Get the pre-launch history which is actually kept: rec_history_duration clamped to rec_get_history_capacity(), the
+ * whole capacity if rec_history_duration is 0.
+ *
+ * @return duration of the pre-launch history in ms
+ */
+uint32_t rec_get_history_duration();
+
+/**
+ * Get the phase group of a flight state.
+ *
+ * @param flight_state - state of the flight FSM
+ * @return phase group
+ */
+inline rec_phase_e get_rec_phase(flight_fsm_e flight_state) {
+  if (flight_state >= THRUSTING_1 && flight_state <= APOGEE) {
+    return REC_PHASE_ASCENT;
+  }
+  if (flight_state == DROGUE || flight_state == MAIN) {
+    return REC_PHASE_DESCENT;
+  }
+  return REC_PHASE_GROUND;
 }
 
 /**
@@ -211,3 +335,25 @@ inline rec_entry_type_e add_id_to_record_type(rec_entry_type_e rec_type, uint8_t
  * @return ID of the record element without record type information
  */
 inline uint8_t get_id_from_record_type(rec_entry_type_e rec_type) { return rec_type & REC_ID_MASK; }
+
+/**
+ * Get the index of the record type, i.e. IMU -> 0, BARO -> 1, ..., ERROR_INFO -> NUM_REC_TYPES - 1.
+ *
+ * @param rec_type record type with or without ID
+ * @return index of the record type; >= NUM_REC_TYPES if the type is invalid
+ */
+inline uint32_t get_rec_type_index(rec_entry_type_e rec_type) {
+  const uint32_t pure_type = get_record_type_without_id(rec_type);
+  return pure_type == 0 ? NUM_REC_TYPES : (uint32_t)__builtin_ctz(pure_type) - 4;
+}
+
+/**
+ * Get the number of bytes a record occupies when packed, i.e. record type + record struct.
+ *
+ * @param rec_type record type with or without ID
+ * @return packed size of the record; 0 if the type is invalid
+ */
+inline uint32_t get_rec_elem_size(rec_entry_type_e rec_type) {
+  const uint32_t type_idx = get_rec_type_index(rec_type);
+  return type_idx < NUM_REC_TYPES ? sizeof(rec_entry_type_e) + rec_layouts[type_idx].size : 0;
+}
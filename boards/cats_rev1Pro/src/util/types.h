@@ -159,6 +159,21 @@ typedef struct {
   uint8_t set_main;
 } dt_telemetry_trigger_t;
 
+/* Process noise phases of the altitude Kalman filter */
+typedef enum {
+  KALMAN_PHASE_ASCENT = 0,
+  KALMAN_PHASE_DESCENT, /* after apogee, the accelerometers aren't used any more */
+  KALMAN_NUM_PHASES,
+} kalman_phase_e;
+
+/* Steady state of the altitude Kalman filter for each phase and number of working baros (index num_baros - 1), see
+ * control/kalman_steady_state.h */
+typedef struct {
+  float32_t K[KALMAN_NUM_PHASES][NUM_PRESSURE][9];     /* 3 x num_baros gain, row major */
+  float32_t P_bar[KALMAN_NUM_PHASES][NUM_PRESSURE][9]; /* covariance after the update */
+  bool valid[KALMAN_NUM_PHASES][NUM_PRESSURE];
+} kalman_gains_t;
+
 typedef struct {
   float32_t Ad_data[9];
   float32_t Ad_T_data[9];
@@ -206,6 +221,11 @@ typedef struct {
   arm_matrix_instance_f32 P_hat;
   float pressure_0;
   float t_sampl;
+  kalman_phase_e phase;
+  /* Steady state mode, NULL if the full filter runs in every step */
+  const kalman_gains_t *gains;
+  bool steady_state;  /* the cached gain is used, cleared by a reset or a change of the phase or the baros */
+  uint32_t num_baros; /* number of baros used in the last step */
 } kalman_filter_t;
 
 typedef struct {
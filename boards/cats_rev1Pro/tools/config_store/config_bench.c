@@ -0,0 +1,450 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Checks the A/B config store (src/config/config_store.h) on a RAM mock of two internal flash pages and compares the
+ * amount of flash read at boot with the EEPROM emulation it replaces.
+ *
+ * The checks cover the alternation of the pages, skipped saves of an unchanged config, a save interrupted after every
+ * possible double word, corrupted copies and the wrap around of the sequence number. The mock refuses to program a
+ * double word twice without erasing the page, like the STM32L4.
+ *
+ * The EEPROM emulation is modelled after lib/STM/EEPROM: EE_Init() reads all of its pages and every
+ * EE_ReadVariable32bits() scans the active page backwards from the last written element. The model does not count
+ * the page header reads and the CRC checks, so its numbers are a lower bound.
+ *
+ * cc_load_eeprom() of config/cats_config.c takes over an emulated EEPROM written like the first firmware with this
+ * store did it: only the fields up to initial_servo_position, and only the words which differed from what
+ * EE_ReadVariable32bits() returned, which is 0 for a missing variable. The fields appended since have to keep their
+ * defaults.
+ *
+ *   config_bench [-n <number of saves before the boot>] [-w <words changed per save>]
+ *
+ * Exits with a failure if one of the checks fails.
+ */
+
+#include "config/cats_config.h"
+#include "config/config_store.h"
+#include "util/crc32.h"
+#include "eeprom_emul.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/** Private Constants **/
+
+#define MOCK_PAGE_SIZE 2048
+
+/* lib/STM/EEPROM with NB_OF_VARIABLES 512, CYCLES_NUMBER 2 and GUARD_PAGES_NUMBER 2, EE_ELEMENT_SIZE is its own */
+#define EE_PAGE_HEADER_SIZE (4 * EE_ELEMENT_SIZE)
+#define EE_ELEMENTS_PER_PAGE ((MOCK_PAGE_SIZE - EE_PAGE_HEADER_SIZE) / EE_ELEMENT_SIZE)
+#define EE_PAGES_NUMBER     14
+
+#define CONFIG_WORDS (sizeof(cats_config_t) / sizeof(uint32_t))
+/* Words of the config before the recorder settings were appended */
+#define BASELINE_CONFIG_WORDS (offsetof(cats_config_t, rec_history_duration) / sizeof(uint32_t))
+
+/** Private Types **/
+
+typedef struct {
+  uint32_t erases;
+  uint32_t programmed; /* double words */
+  /* programming fails after this many double words, i.e. the power is cut; UINT32_MAX never */
+  uint32_t fail_after;
+} mock_stats_t;
+
+/** Private Variables **/
+
+static uint8_t mock_pages[CONFIG_STORE_NUM_PAGES][MOCK_PAGE_SIZE];
+static mock_stats_t mock_stats = {.fail_after = UINT32_MAX};
+static bool mock_violation = false;
+static uint32_t failed_checks = 0;
+
+/* Emulated EEPROM variables in the order they were written, virtual address and value */
+static uint16_t ee_mock_addresses[4 * CONFIG_WORDS];
+static uint32_t ee_mock_values[4 * CONFIG_WORDS];
+static uint32_t ee_mock_count = 0;
+
+/** Private Function Declarations **/
+
+static const uint8_t *mock_map(uint32_t page);
+static bool mock_erase(uint32_t page);
+static bool mock_program(uint32_t page, uint32_t offset, const uint8_t *data, uint32_t len);
+
+static void check(bool condition, const char *what);
+static void fill_config(uint32_t *words, uint32_t seed);
+static bool loads(const config_store_t *store, const uint32_t *words);
+
+static void check_alternation();
+static void check_interrupted_saves();
+static void check_corruption();
+static void check_seq_wrap();
+static void check_eeprom_takeover();
+static void ee_mock_save(const uint32_t *words, uint32_t num_words);
+static void compare_boot(uint32_t num_saves, uint32_t changed_words);
+static uint32_t ee_boot_reads(uint32_t num_saves, uint32_t changed_words);
+
+static const config_store_io_t mock_io = {
+    .page_size = MOCK_PAGE_SIZE,
+    .map = mock_map,
+    .erase = mock_erase,
+    .program = mock_program,
+};
+
+/** Stubs for the HAL and EEPROM emulation functions config/cats_config.c depends on **/
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void) { return HAL_OK; }
+
+HAL_StatusTypeDef HAL_FLASH_Lock(void) { return HAL_OK; }
+
+HAL_StatusTypeDef HAL_FLASHEx_Erase(__attribute__((unused)) FLASH_EraseInitTypeDef *pEraseInit,
+                                    __attribute__((unused)) uint32_t *PageError) {
+  return HAL_ERROR;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Program(__attribute__((unused)) uint32_t TypeProgram,
+                                    __attribute__((unused)) uint32_t Address, __attribute__((unused)) uint64_t Data) {
+  return HAL_ERROR;
+}
+
+EE_Status EE_Init(__attribute__((unused)) EE_Erase_type EraseType) { return EE_OK; }
+
+EE_Status EE_CleanUp(void) { return EE_OK; }
+
+/* Like lib/STM/EEPROM, the value is written even if the variable is missing */
+EE_Status EE_ReadVariable32bits(uint16_t VirtAddress, uint32_t *pData) {
+  for (uint32_t i = ee_mock_count; i > 0; --i) {
+    if (ee_mock_addresses[i - 1] == VirtAddress) {
+      *pData = ee_mock_values[i - 1];
+      return EE_OK;
+    }
+  }
+  *pData = 0;
+  return EE_NO_DATA;
+}
+
+void log_log(__attribute__((unused)) int level, __attribute__((unused)) const char *file,
+             __attribute__((unused)) int line, __attribute__((unused)) const char *format, ...) {}
+
+/** Exported Function Definitions **/
+
+int main(int argc, char **argv) {
+  uint32_t num_saves = 20;
+  uint32_t changed_words = 4;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:w:")) != -1) {
+    switch (opt) {
+      case 'n':
+        num_saves = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      case 'w':
+        changed_words = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      default:
+        fprintf(stderr,
+                "Usage: config_bench [-n <number of saves before the boot>] [-w <words changed per save>]\n"
+                "  -n  saves since the EEPROM emulation was formatted, default 20\n"
+                "  -w  config words changed by every save, default 4\n");
+        return EXIT_FAILURE;
+    }
+  }
+  if (changed_words == 0 || changed_words > CONFIG_WORDS) {
+    changed_words = CONFIG_WORDS;
+  }
+
+  crc32_init();
+  check_alternation();
+  check_interrupted_saves();
+  check_corruption();
+  check_seq_wrap();
+  check_eeprom_takeover();
+  check(!mock_violation, "no double word was programmed twice");
+  compare_boot(num_saves, changed_words);
+
+  printf("%s\n", failed_checks == 0 ? "PASSED" : "FAILED");
+  return failed_checks == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/** Private Function Definitions **/
+
+static const uint8_t *mock_map(uint32_t page) { return mock_pages[page]; }
+
+static bool mock_erase(uint32_t page) {
+  memset(mock_pages[page], 0xFF, MOCK_PAGE_SIZE);
+  ++mock_stats.erases;
+  return true;
+}
+
+static bool mock_program(uint32_t page, uint32_t offset, const uint8_t *data, uint32_t len) {
+  if (offset % CONFIG_STORE_PROGRAM_SIZE != 0 || len % CONFIG_STORE_PROGRAM_SIZE != 0 ||
+      offset + len > MOCK_PAGE_SIZE) {
+    mock_violation = true;
+    return false;
+  }
+  for (uint32_t i = 0; i < len; i += CONFIG_STORE_PROGRAM_SIZE) {
+    if (mock_stats.programmed >= mock_stats.fail_after) {
+      return false;
+    }
+    uint8_t *dst = &mock_pages[page][offset + i];
+    for (uint32_t j = 0; j < CONFIG_STORE_PROGRAM_SIZE; ++j) {
+      if (dst[j] != 0xFF) {
+        mock_violation = true;
+        return false;
+      }
+    }
+    memcpy(dst, &data[i], CONFIG_STORE_PROGRAM_SIZE);
+    ++mock_stats.programmed;
+  }
+  return true;
+}
+
+static void check(bool condition, const char *what) {
+  if (!condition) {
+    printf("Check failed: %s\n", what);
+    ++failed_checks;
+  }
+}
+
+static void fill_config(uint32_t *words, uint32_t seed) {
+  for (uint32_t i = 0; i < CONFIG_WORDS; ++i) {
+    words[i] = seed * 0x9E3779B9U + i;
+  }
+}
+
+static bool loads(const config_store_t *store, const uint32_t *words) {
+  const uint8_t *data = NULL;
+  uint16_t version = 0;
+  uint16_t len = 0;
+  return config_store_load(store, &data, &version, &len) && version == CATS_CONFIG_VERSION &&
+         len == sizeof(cats_config_t) && memcmp(data, words, len) == 0;
+}
+
+static void check_alternation() {
+  config_store_t store;
+  memset(mock_pages, 0xFF, sizeof(mock_pages));
+  config_store_init(&store, &mock_io);
+  const uint8_t *data = NULL;
+  uint16_t version = 0;
+  uint16_t len = 0;
+  check(!config_store_load(&store, &data, &version, &len), "erased pages hold no config");
+
+  uint32_t words[CONFIG_WORDS];
+  for (uint32_t i = 0; i < 5; ++i) {
+    fill_config(words, i);
+    check(config_store_save(&store, words, CATS_CONFIG_VERSION, sizeof(cats_config_t)), "save succeeds");
+    check(store.current == (int32_t)(i % 2), "saves alternate between the pages");
+    config_store_t reloaded;
+    config_store_init(&reloaded, &mock_io);
+    check(loads(&reloaded, words), "the newest copy is loaded");
+  }
+
+  const uint32_t erases = mock_stats.erases;
+  check(config_store_save(&store, words, CATS_CONFIG_VERSION, sizeof(cats_config_t)), "unchanged save succeeds");
+  check(mock_stats.erases == erases, "an unchanged config is not written again");
+
+  /* a payload which doesn't end on a double word boundary */
+  const uint8_t odd[13] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13};
+  check(config_store_save(&store, odd, 7, sizeof(odd)), "save of an odd length succeeds");
+  config_store_init(&store, &mock_io);
+  check(config_store_load(&store, &data, &version, &len) && version == 7 && len == sizeof(odd) &&
+            memcmp(data, odd, sizeof(odd)) == 0,
+        "odd length payload is loaded");
+
+  check(!config_store_save(&store, odd, 1, MOCK_PAGE_SIZE), "a payload bigger than a page is refused");
+  check(config_store_format(&store) && !config_store_load(&store, &data, &version, &len), "format removes all copies");
+}
+
+static void check_interrupted_saves() {
+  uint32_t old_words[CONFIG_WORDS];
+  uint32_t new_words[CONFIG_WORDS];
+  fill_config(old_words, 100);
+  fill_config(new_words, 200);
+  const uint32_t num_double_words =
+      (sizeof(config_store_header_t) + sizeof(cats_config_t) + CONFIG_STORE_PROGRAM_SIZE - 1) /
+      CONFIG_STORE_PROGRAM_SIZE;
+
+  uint32_t old_loaded = 0;
+  for (uint32_t cut = 0; cut <= num_double_words; ++cut) {
+    config_store_t store;
+    memset(mock_pages, 0xFF, sizeof(mock_pages));
+    config_store_init(&store, &mock_io);
+    /* two saves so that the interrupted one overwrites an older copy */
+    fill_config(new_words, 300 + cut);
+    config_store_save(&store, new_words, CATS_CONFIG_VERSION, sizeof(cats_config_t));
+    config_store_save(&store, old_words, CATS_CONFIG_VERSION, sizeof(cats_config_t));
+
+    fill_config(new_words, 200);
+    mock_stats.programmed = 0;
+    mock_stats.fail_after = cut;
+    const bool saved = config_store_save(&store, new_words, CATS_CONFIG_VERSION, sizeof(cats_config_t));
+    mock_stats.fail_after = UINT32_MAX;
+
+    config_store_t rebooted;
+    config_store_init(&rebooted, &mock_io);
+    if (saved) {
+      check(cut == num_double_words, "a save only succeeds if it was complete");
+      check(loads(&rebooted, new_words), "a complete save is loaded");
+    } else {
+      check(loads(&rebooted, old_words), "an interrupted save leaves the previous copy");
+      ++old_loaded;
+    }
+  }
+  printf("Interrupted saves: %u cut points, the previous copy survived %u of them\n", num_double_words + 1,
+         old_loaded);
+}
+
+static void check_corruption() {
+  config_store_t store;
+  memset(mock_pages, 0xFF, sizeof(mock_pages));
+  config_store_init(&store, &mock_io);
+  uint32_t old_words[CONFIG_WORDS];
+  uint32_t new_words[CONFIG_WORDS];
+  fill_config(old_words, 1);
+  fill_config(new_words, 2);
+  config_store_save(&store, old_words, CATS_CONFIG_VERSION, sizeof(cats_config_t));
+  config_store_save(&store, new_words, CATS_CONFIG_VERSION, sizeof(cats_config_t));
+  const uint32_t newest = (uint32_t)store.current;
+
+  /* a flipped bit in the payload of the newest copy */
+  mock_pages[newest][sizeof(config_store_header_t) + 17] ^= 0x04;
+  config_store_init(&store, &mock_io);
+  check(loads(&store, old_words), "a corrupted payload falls back to the previous copy");
+  mock_pages[newest][sizeof(config_store_header_t) + 17] ^= 0x04;
+
+  /* a flipped bit in the sequence number */
+  mock_pages[newest][offsetof(config_store_header_t, seq)] ^= 0x80;
+  config_store_init(&store, &mock_io);
+  check(loads(&store, old_words), "a corrupted header falls back to the previous copy");
+
+  /* both copies corrupted */
+  mock_pages[1 - newest][sizeof(config_store_header_t)] ^= 0x01;
+  config_store_init(&store, &mock_io);
+  check(store.current < 0, "no copy is loaded if both are corrupted");
+}
+
+static void check_seq_wrap() {
+  config_store_t store;
+  memset(mock_pages, 0xFF, sizeof(mock_pages));
+  config_store_init(&store, &mock_io);
+  uint32_t words[CONFIG_WORDS];
+  fill_config(words, 5);
+  config_store_save(&store, words, CATS_CONFIG_VERSION, sizeof(cats_config_t));
+  /* as if the config had been saved 2^32 - 2 times; the copy above doesn't fit this number until the second save
+   * below replaces it */
+  store.seq = UINT32_MAX - 2;
+  for (uint32_t i = 0; i < 4; ++i) {
+    fill_config(words, 6 + i);
+    config_store_save(&store, words, CATS_CONFIG_VERSION, sizeof(cats_config_t));
+    config_store_t rebooted;
+    config_store_init(&rebooted, &mock_io);
+    check(i == 0 || loads(&rebooted, words), "the newest copy wins across the wrap around of the sequence number");
+  }
+}
+
+static void check_eeprom_takeover() {
+  ee_mock_count = 0;
+  check(!cc_load_eeprom(), "an empty EEPROM emulation holds no config");
+
+  /* the defaults on the first boot, then some settings changed by the user */
+  cats_config_u defaults;
+  cats_config_u old_config;
+  cc_defaults();
+  memcpy(&defaults, &global_cats_config, sizeof(defaults));
+  memcpy(&old_config, &defaults, sizeof(old_config));
+  ee_mock_save(old_config.config_array, BASELINE_CONFIG_WORDS);
+  old_config.config.boot_state = CATS_CONFIG;
+  old_config.config.control_settings.main_altitude = 300;
+  old_config.config.timers[1].duration = 1234;
+  old_config.config.action_array[EV_TOUCHDOWN][0] = 0;
+  old_config.config.action_array[EV_TOUCHDOWN][1] = 0;
+  ee_mock_save(old_config.config_array, BASELINE_CONFIG_WORDS);
+
+  memset(&global_cats_config, 0xA5, sizeof(global_cats_config));
+  check(cc_load_eeprom(), "the config of older firmware is found");
+  check(memcmp(global_cats_config.config_array, old_config.config_array, BASELINE_CONFIG_WORDS * sizeof(uint32_t)) ==
+            0,
+        "the fields of the older firmware are taken over");
+  check(memcmp(&global_cats_config.config_array[BASELINE_CONFIG_WORDS], &defaults.config_array[BASELINE_CONFIG_WORDS],
+               (CONFIG_WORDS - BASELINE_CONFIG_WORDS) * sizeof(uint32_t)) == 0,
+        "the fields the older firmware didn't know keep their defaults");
+  check(global_cats_config.config.rec_retention_size == defaults.config.rec_retention_size &&
+            global_cats_config.config.rec_sync_window == defaults.config.rec_sync_window,
+        "retention and sync window keep their defaults");
+  printf("EEPROM takeover: %zu of %zu words written by the older firmware, %u variables stored\n",
+         BASELINE_CONFIG_WORDS, CONFIG_WORDS, ee_mock_count);
+}
+
+/* cc_save() of the older firmware: only the words which differ from what is read back are written */
+static void ee_mock_save(const uint32_t *words, uint32_t num_words) {
+  for (uint32_t i = 0; i < num_words; ++i) {
+    uint32_t stored = 0;
+    EE_ReadVariable32bits((uint16_t)(i + 1), &stored);
+    if (stored != words[i] && ee_mock_count < sizeof(ee_mock_values) / sizeof(ee_mock_values[0])) {
+      ee_mock_addresses[ee_mock_count] = (uint16_t)(i + 1);
+      ee_mock_values[ee_mock_count] = words[i];
+      ++ee_mock_count;
+    }
+  }
+}
+
+static void compare_boot(uint32_t num_saves, uint32_t changed_words) {
+  /* what the store reads: both headers, the payload for its CRC and once more for the copy */
+  const uint32_t store_reads = CONFIG_STORE_NUM_PAGES * sizeof(config_store_header_t) + 2 * sizeof(cats_config_t);
+  const uint32_t ee_reads = ee_boot_reads(num_saves, changed_words);
+  printf("Config: %zu bytes, %zu words\n", sizeof(cats_config_t), CONFIG_WORDS);
+  printf("Flash read at boot after %u saves of %u changed words:\n", num_saves, changed_words);
+  printf("  EEPROM emulation: %8u bytes (lower bound)\n", ee_reads);
+  printf("  A/B config store: %8u bytes\n", store_reads);
+  printf("Flash written per save: EEPROM emulation %u bytes, config store one %u byte page erase and %zu bytes\n",
+         changed_words * EE_ELEMENT_SIZE, MOCK_PAGE_SIZE, sizeof(config_store_header_t) + sizeof(cats_config_t));
+}
+
+/* Bytes read by EE_Init() and one EE_ReadVariable32bits() per config word */
+static uint32_t ee_boot_reads(uint32_t num_saves, uint32_t changed_words) {
+  /* virtual address of every element in the active page */
+  static uint16_t elements[EE_ELEMENTS_PER_PAGE];
+  uint32_t num_elements = 0;
+  for (uint32_t save = 0; save <= num_saves; ++save) {
+    /* the first save writes every word, the following ones only the changed words */
+    const uint32_t count = save == 0 ? CONFIG_WORDS : changed_words;
+    for (uint32_t i = 0; i < count; ++i) {
+      if (num_elements == EE_ELEMENTS_PER_PAGE) {
+        /* page transfer: the latest value of every variable goes into the next page */
+        for (num_elements = 0; num_elements < CONFIG_WORDS; ++num_elements) {
+          elements[num_elements] = (uint16_t)(num_elements + 1);
+        }
+      }
+      elements[num_elements++] = (uint16_t)((save * changed_words + i) % CONFIG_WORDS + 1);
+    }
+  }
+
+  /* EE_Init() reads every double word of the emulation to find corrupted ones */
+  uint32_t reads = EE_PAGES_NUMBER * MOCK_PAGE_SIZE;
+  for (uint32_t addr = 1; addr <= CONFIG_WORDS; ++addr) {
+    for (uint32_t i = num_elements; i > 0; --i) {
+      reads += EE_ELEMENT_SIZE;
+      if (elements[i - 1] == addr) {
+        break;
+      }
+    }
+  }
+  return reads;
+}
@@ -0,0 +1,395 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Runs LittleFS and the raw flight partition with the board configuration (lfs/lfs_custom.c, lfs/raw_partition.c) on
+ * top of the emulated flash and replays the write pattern of the recorder: LOG_BLOCK_SIZE appends to a new extent of
+ * the raw partition after erasing it ahead, or with -l to a new flight file with lfs_file_sync every -S bytes. All
+ * timings are simulated flash time. With -k the flights are indexed and the oldest ones are deleted to make room like
+ * after a real flight (lfs/flight_index.c), the raw partition wraps around once it is full.
+ *
+ *   flash_bench [-i <image>] [-w] [-l] [-n <flights>] [-s <flight size>] [-r <record rate>] [-S <sync interval>]
+ *               [-k <retention size>]
+ */
+
+#include "w25q_emu.h"
+#include "drivers/w25q.h"
+#include "lfs/lfs_custom.h"
+#include "lfs/raw_partition.h"
+#include "lfs/flight_index.h"
+#include "util/crc32.h"
+#include "util/log.h"
+#include "util/log_format.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/** Private Types **/
+
+typedef struct {
+  const char *image_path;
+  const w25q_emu_config_t *config;
+  uint32_t num_flights;
+  uint32_t flight_size;
+  uint32_t record_rate; /* bytes per second produced by the recorder */
+  uint32_t sync_interval;
+  bool use_lfs;             /* write the flights to LittleFS files instead of the raw partition */
+  uint32_t retention_size; /* KiB, see rec_retention_size in config/cats_config.h */
+} bench_options_t;
+
+/** Private Function Declarations **/
+
+static bool parse_options(int argc, char **argv, bench_options_t *options);
+static double ns_to_ms(uint64_t ns) { return (double)ns / 1e6; }
+static int mount(uint32_t retention_size);
+static int write_flight(const bench_options_t *options, uint32_t flight_idx);
+static bool write_block(const bench_options_t *options, lfs_file_t *file, const uint8_t *block, uint32_t *since_sync,
+                        uint64_t *max_sync_ns);
+static void fill_block(uint8_t *block, uint32_t *seed);
+static void read_flights();
+static void print_stats(const char *title);
+
+/** Stubs for the firmware functions lfs_custom.c and raw_partition.c depend on **/
+
+void HAL_GPIO_TogglePin(__attribute__((unused)) GPIO_TypeDef *GPIOx, __attribute__((unused)) uint16_t GPIO_Pin) {}
+
+osStatus_t osMutexAcquire(__attribute__((unused)) osMutexId_t mutex_id, __attribute__((unused)) uint32_t timeout) {
+  return osOK;
+}
+
+osStatus_t osMutexRelease(__attribute__((unused)) osMutexId_t mutex_id) { return osOK; }
+
+void log_log(__attribute__((unused)) int level, __attribute__((unused)) const char *file,
+             __attribute__((unused)) int line, const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  vprintf(format, args);
+  va_end(args);
+  putchar('\n');
+}
+
+void cli_print(const char *str) { fputs(str, stdout); }
+
+void cli_printf(const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  vprintf(format, args);
+  va_end(args);
+}
+
+/** Exported Function Definitions **/
+
+int main(int argc, char **argv) {
+  bench_options_t options = {
+      .image_path = NULL,
+      .config = &w25q_emu_typical,
+      .num_flights = 4,
+      .flight_size = 2 * 1024 * 1024,
+      .record_rate = 20000,
+      .sync_interval = 16 * LOG_BLOCK_SIZE,
+      .use_lfs = false,
+      .retention_size = 0,
+  };
+  if (!parse_options(argc, argv, &options)) {
+    fprintf(stderr,
+            "Usage: flash_bench [-i <image>] [-w] [-l] [-n <flights>] [-s <flight size>] [-r <record rate>] "
+            "[-S <sync interval>] [-k <retention size>]\n"
+            "  -i  flash image file, the flash is kept in RAM otherwise\n"
+            "  -w  use the worst case instead of the typical timings\n"
+            "  -l  write the flights to LittleFS files instead of the raw partition\n"
+            "  -n  number of flights to record, default 4\n"
+            "  -s  size of each flight in bytes, default 2 MiB\n"
+            "  -r  rate at which the recorder produces data in B/s, default 20000\n"
+            "  -S  bytes between lfs_file_sync calls, default %u\n"
+            "  -k  KiB kept free for the next flight by deleting the oldest ones, default 0 (off)\n",
+            16 * LOG_BLOCK_SIZE);
+    return EXIT_FAILURE;
+  }
+
+  if (!w25q_emu_open(options.config, options.image_path) || w25q_init() != W25Q_OK) {
+    fprintf(stderr, "Can't set up the flash emulation\n");
+    return EXIT_FAILURE;
+  }
+  printf("Flash: %lu KiB, %s timings\n", (unsigned long)w25q.capacity_in_kilobytes,
+         options.config == &w25q_emu_typical ? "typical" : "worst case");
+  crc32_init();
+
+  w25q_emu_reset_stats();
+  if (mount(options.retention_size) != LFS_ERR_OK) {
+    fprintf(stderr, "Can't mount the file system\n");
+    return EXIT_FAILURE;
+  }
+  print_stats("mount");
+
+  /* continue the numbering of an existing image */
+  const uint32_t first_flight = flight_counter;
+
+  for (uint32_t i = 0; i < options.num_flights; ++i) {
+    w25q_emu_reset_stats();
+    if (write_flight(&options, first_flight + i + 1) != LFS_ERR_OK) {
+      fprintf(stderr, "Writing flight %u failed, the flash is probably full\n", first_flight + i + 1);
+      break;
+    }
+    /* what task_recorder does after a flight */
+    flight_counter = first_flight + i + 1;
+    save_flight_counter();
+    flight_index_add(flight_counter, NULL);
+    flight_index_apply_retention(options.retention_size * 1024);
+  }
+
+  const lfs_ssize_t used_blocks = lfs_fs_size(&lfs);
+  printf("File system: %ld of %lu blocks used, raw partition: %lu KiB free, %lu flights indexed\n", (long)used_blocks,
+         (unsigned long)lfs_cfg.block_count, (unsigned long)raw_partition_get_free() / 1024,
+         (unsigned long)flight_index_get_count());
+
+  /* mounting a file system with many files and the read path after all flights */
+  lfs_unmount(&lfs);
+  w25q_emu_reset_stats();
+  mount(options.retention_size);
+  print_stats("remount");
+  read_flights();
+
+  lfs_unmount(&lfs);
+  w25q_emu_close();
+  return EXIT_SUCCESS;
+}
+
+/** Private Function Definitions **/
+
+static bool parse_options(int argc, char **argv, bench_options_t *options) {
+  int opt;
+  while ((opt = getopt(argc, argv, "i:wln:s:r:S:k:")) != -1) {
+    switch (opt) {
+      case 'i':
+        options->image_path = optarg;
+        break;
+      case 'w':
+        options->config = &w25q_emu_worst_case;
+        break;
+      case 'l':
+        options->use_lfs = true;
+        break;
+      case 'n':
+        options->num_flights = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      case 's':
+        options->flight_size = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      case 'r':
+        options->record_rate = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      case 'S':
+        options->sync_interval = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      case 'k':
+        options->retention_size = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      default:
+        return false;
+    }
+  }
+  return options->record_rate > 0;
+}
+
+/* Same steps as init_lfs() in tasks/task_init.c */
+static int mount(uint32_t retention_size) {
+  const bool layout_valid = raw_partition_check_layout();
+  int err = layout_valid ? lfs_mount(&lfs, &lfs_cfg) : LFS_ERR_INVAL;
+  if (err != LFS_ERR_OK) {
+    printf("Formatting the flash\n");
+    lfs_format(&lfs, &lfs_cfg);
+    err = lfs_mount(&lfs, &lfs_cfg);
+    raw_partition_format();
+  }
+  if (err == LFS_ERR_OK) {
+    flight_counter = 0;
+    if (lfs_file_open(&lfs, &fc_file, "flight_counter", LFS_O_RDONLY) == LFS_ERR_OK) {
+      lfs_file_read(&lfs, &fc_file, &flight_counter, sizeof(flight_counter));
+      lfs_file_close(&lfs, &fc_file);
+    }
+    lfs_mkdir(&lfs, "flights");
+    lfs_mkdir(&lfs, "stats");
+    raw_partition_init();
+    flight_index_init();
+    flight_index_apply_retention(retention_size * 1024);
+  }
+  return err;
+}
+
+/**
+ * Write one flight the way task_recorder does and report the throughput. The recorder produces data at a constant
+ * rate while the flash is busy, the largest backlog is the amount of RAM the lanes need to bridge the slowest writes.
+ */
+static int write_flight(const bench_options_t *options, uint32_t flight_idx) {
+  lfs_file_t file;
+  if (options->use_lfs) {
+    char filename[MAX_FILENAME_SIZE];
+    snprintf(filename, sizeof(filename), "flights/flight_%05u", flight_idx);
+    const int err = lfs_file_open(&lfs, &file, filename, LFS_O_WRONLY | LFS_O_CREAT);
+    if (err != LFS_ERR_OK) {
+      return err;
+    }
+  } else {
+    /* what task_rec_writer does while the rocket waits on the pad */
+    while (!raw_partition_erase_ahead(options->flight_size + LOG_BLOCK_SIZE)) {
+    }
+    print_stats("pre-erase");
+    w25q_emu_reset_stats();
+    if (!raw_partition_open(flight_idx)) {
+      return LFS_ERR_NOSPC;
+    }
+  }
+
+  uint8_t block[LOG_BLOCK_SIZE];
+  uint32_t seed = flight_idx;
+  const w25q_emu_stats_t *stats = w25q_emu_get_stats();
+  uint64_t max_write_ns = 0;
+  uint64_t max_sync_ns = 0;
+  uint64_t max_backlog = 0;
+  uint64_t now_ns = 0;
+  uint32_t since_sync = 0;
+  uint32_t written = 0;
+  for (; written < options->flight_size; written += LOG_BLOCK_SIZE) {
+    /* the block can only be written once the recorder has produced it */
+    const uint64_t ready_ns = (uint64_t)(written + LOG_BLOCK_SIZE) * 1000000000ULL / options->record_rate;
+    if (now_ns < ready_ns) {
+      now_ns = ready_ns;
+    }
+    fill_block(block, &seed);
+
+    uint64_t start_ns = stats->time_ns;
+    if (!write_block(options, &file, block, &since_sync, &max_sync_ns)) {
+      if (options->use_lfs) {
+        lfs_file_close(&lfs, &file);
+      } else {
+        raw_partition_close();
+      }
+      return LFS_ERR_NOSPC;
+    }
+    if (stats->time_ns - start_ns > max_write_ns) {
+      max_write_ns = stats->time_ns - start_ns;
+    }
+    now_ns += stats->time_ns - start_ns;
+
+    /* data produced until now which is not on the flash yet */
+    uint64_t produced = now_ns * options->record_rate / 1000000000ULL;
+    if (produced > options->flight_size) {
+      produced = options->flight_size;
+    }
+    const uint64_t backlog = produced > written + LOG_BLOCK_SIZE ? produced - written - LOG_BLOCK_SIZE : 0;
+    if (backlog > max_backlog) {
+      max_backlog = backlog;
+    }
+  }
+  int err = LFS_ERR_OK;
+  if (options->use_lfs) {
+    err = lfs_file_close(&lfs, &file);
+  } else if (!raw_partition_close()) {
+    err = LFS_ERR_IO;
+  }
+
+  printf("Flight %u: %u bytes, %.0f B/s while writing, slowest write %.1f ms, slowest sync %.1f ms, "
+         "max. backlog %lu bytes, %u sector erases, %u program violations\n",
+         flight_idx, written, (double)written * 1e9 / (double)stats->time_ns,
+         ns_to_ms(max_write_ns), ns_to_ms(max_sync_ns), (unsigned long)max_backlog, stats->sector_erases,
+         stats->program_violations);
+  if ((uint64_t)written * 1000000000ULL < (uint64_t)options->record_rate * stats->time_ns) {
+    printf("The flash can't keep up with %u B/s!\n", options->record_rate);
+  }
+  return err;
+}
+
+/**
+ * Write one block to the flight file or the raw partition.
+ *
+ * @return false if the flash is full
+ */
+static bool write_block(const bench_options_t *options, lfs_file_t *file, const uint8_t *block, uint32_t *since_sync,
+                        uint64_t *max_sync_ns) {
+  if (!options->use_lfs) {
+    return raw_partition_append(block, LOG_BLOCK_SIZE);
+  }
+  if (lfs_file_write(&lfs, file, block, LOG_BLOCK_SIZE) != LOG_BLOCK_SIZE) {
+    return false;
+  }
+  *since_sync += LOG_BLOCK_SIZE;
+  if (*since_sync >= options->sync_interval) {
+    const w25q_emu_stats_t *stats = w25q_emu_get_stats();
+    const uint64_t sync_start_ns = stats->time_ns;
+    lfs_file_sync(&lfs, file);
+    *since_sync = 0;
+    if (stats->time_ns - sync_start_ns > *max_sync_ns) {
+      *max_sync_ns = stats->time_ns - sync_start_ns;
+    }
+  }
+  return true;
+}
+
+/* The raw partition finds the end of an interrupted flight by the sync words, the rest is pseudo random */
+static void fill_block(uint8_t *block, uint32_t *seed) {
+  const uint32_t sync = LOG_BLOCK_SYNC;
+  memcpy(block, &sync, sizeof(sync));
+  for (uint32_t i = sizeof(sync); i < LOG_BLOCK_SIZE; ++i) {
+    *seed = *seed * 1103515245U + 12345U;
+    block[i] = (uint8_t)(*seed >> 16);
+  }
+}
+
+/* Read every indexed flight back and compare it to what was written; the read jumps show how fragmented the files
+ * are */
+static void read_flights() {
+  uint8_t buf[4096];
+  uint8_t expected[LOG_BLOCK_SIZE];
+  const uint32_t newest = flight_index_get_newest();
+  for (uint32_t i = flight_index_get_oldest(); i != 0 && i <= newest; ++i) {
+    flight_file_t file;
+    if (flight_file_open(&file, i) != LFS_ERR_OK) {
+      continue;
+    }
+    w25q_emu_reset_stats();
+    lfs_ssize_t read = 0;
+    uint64_t total = 0;
+    uint32_t seed = i;
+    uint32_t bad_blocks = 0;
+    while ((read = flight_file_read(&file, buf, sizeof(buf))) > 0) {
+      for (lfs_ssize_t offset = 0; offset < read; offset += LOG_BLOCK_SIZE) {
+        fill_block(expected, &seed);
+        if (read - offset < LOG_BLOCK_SIZE || memcmp(&buf[offset], expected, LOG_BLOCK_SIZE) != 0) {
+          ++bad_blocks;
+        }
+      }
+      total += (uint64_t)read;
+    }
+    flight_file_close(&file);
+    const w25q_emu_stats_t *stats = w25q_emu_get_stats();
+    printf("Read flight %u: %lu bytes in %.1f ms (%.0f B/s), %u reads, %u jumps, %u bad blocks\n", i,
+           (unsigned long)total, ns_to_ms(stats->time_ns),
+           (double)total * 1e9 / (double)(stats->time_ns ? stats->time_ns : 1), stats->reads, stats->read_jumps,
+           bad_blocks);
+  }
+}
+
+static void print_stats(const char *title) {
+  const w25q_emu_stats_t *stats = w25q_emu_get_stats();
+  printf("%s: %.1f ms (read %.1f ms, program %.1f ms, erase %.1f ms), %u reads, %u page programs, %u erases\n",
+         title, ns_to_ms(stats->time_ns), ns_to_ms(stats->read_ns), ns_to_ms(stats->program_ns),
+         ns_to_ms(stats->erase_ns), stats->reads, stats->page_programs, stats->sector_erases + stats->block_erases);
+}
@@ -0,0 +1,220 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Checks the migration from the old flash layout, LittleFS on the whole flash, to LittleFS in front of the raw flight
+ * partition (see lfs/raw_partition.h) on the emulated flash. It follows init_lfs() and erase_recordings():
+ *
+ *   - an old file system with a flight which reaches beyond the start of the raw partition is mounted as it is, the
+ *     raw partition is not set up and neither the flight index nor the retention delete the flight
+ *   - erasing the recordings repartitions the flash and keeps the flight counter
+ *   - a blank flash is not taken for an old file system
+ *
+ * Exits with a failure if one of the checks fails.
+ */
+
+#include "w25q_emu.h"
+#include "drivers/w25q.h"
+#include "lfs/lfs_custom.h"
+#include "lfs/raw_partition.h"
+#include "lfs/flight_index.h"
+#include "util/crc32.h"
+#include "util/log.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Private Constants **/
+
+/* The flight is bigger than the LittleFS partition of the new layout */
+#define OLD_FLIGHT_NUMBER 3
+#define OLD_FLIGHT_SIZE   (6 * 1024 * 1024)
+#define OLD_BLOCK_COUNT   8192
+
+/** Private Variables **/
+
+static uint32_t failed_checks = 0;
+
+/** Private Function Declarations **/
+
+static void check(bool condition, const char *what);
+static bool write_old_flash();
+static uint32_t checksum_file(const char *path, uint32_t *size);
+static void fill_chunk(uint8_t *chunk, uint32_t len, uint32_t offset);
+
+/** Stubs for the firmware functions lfs_custom.c and raw_partition.c depend on **/
+
+void HAL_GPIO_TogglePin(__attribute__((unused)) GPIO_TypeDef *GPIOx, __attribute__((unused)) uint16_t GPIO_Pin) {}
+
+osStatus_t osMutexAcquire(__attribute__((unused)) osMutexId_t mutex_id, __attribute__((unused)) uint32_t timeout) {
+  return osOK;
+}
+
+osStatus_t osMutexRelease(__attribute__((unused)) osMutexId_t mutex_id) { return osOK; }
+
+void log_log(__attribute__((unused)) int level, __attribute__((unused)) const char *file,
+             __attribute__((unused)) int line, __attribute__((unused)) const char *format, ...) {}
+
+void cli_print(const char *str) { fputs(str, stdout); }
+
+void cli_printf(const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  vprintf(format, args);
+  va_end(args);
+}
+
+/** Exported Function Definitions **/
+
+int main() {
+  if (!w25q_emu_open(&w25q_emu_typical, NULL) || w25q_init() != W25Q_OK) {
+    fprintf(stderr, "Can't set up the flash emulation\n");
+    return EXIT_FAILURE;
+  }
+  crc32_init();
+
+  /* a blank flash is formatted with the new layout */
+  check(!raw_partition_check_layout(), "a blank flash has no partition table");
+  check(lfs_mount_legacy() != 0 && !lfs_legacy_layout, "a blank flash has no old file system");
+
+  if (!write_old_flash()) {
+    fprintf(stderr, "Can't write the old file system\n");
+    return EXIT_FAILURE;
+  }
+  uint32_t old_size = 0;
+  const uint32_t old_checksum = checksum_file("flights/flight_00003", &old_size);
+
+  /* boot with the old layout */
+  check(!raw_partition_check_layout(), "the old layout has no partition table");
+  check(lfs_mount_legacy() == 0 && lfs_legacy_layout, "the old file system is mounted");
+  check(lfs_has_recordings(), "the old file system holds a flight");
+  check(!raw_partition_format(), "the raw partition is not formatted over the old file system");
+  check(lfs_get_free_space() > RAW_PARTITION_FIRST_SECTOR * w25q.sector_size,
+        "the free space is taken from the old file system");
+  /* the flight is too old for the flight index */
+  flight_counter = OLD_FLIGHT_NUMBER + 2 * FLIGHT_INDEX_MAX_FLIGHTS;
+  raw_partition_init();
+  flight_index_init();
+  check(flight_index_apply_retention(4096 * 1024), "the retention doesn't need any space");
+  uint32_t size = 0;
+  check(checksum_file("flights/flight_00003", &size) == old_checksum && size == old_size,
+        "the old flight is kept intact");
+
+  /* erase the recordings, the ones which are not indexed go with the old file system */
+  flight_index_remove_all();
+  check(lfs_repartition() == 0 && !lfs_legacy_layout, "the flash is repartitioned");
+  check(!lfs_has_recordings(), "the recordings are erased");
+  flight_index_init();
+  lfs_unmount(&lfs);
+
+  /* boot with the new layout */
+  flight_counter = 0;
+  check(raw_partition_check_layout(), "the new layout has a partition table");
+  check(lfs_mount(&lfs, &lfs_cfg) == 0, "LittleFS of the new layout is mounted");
+  lfs_file_t file;
+  check(lfs_file_open(&lfs, &file, "flight_counter", LFS_O_RDONLY) == 0 &&
+            lfs_file_read(&lfs, &file, &flight_counter, sizeof(flight_counter)) == sizeof(flight_counter) &&
+            flight_counter == OLD_FLIGHT_NUMBER + 2 * FLIGHT_INDEX_MAX_FLIGHTS,
+        "the flight counter is kept");
+  lfs_file_close(&lfs, &file);
+  check(lfs_get_free_space() <= RAW_PARTITION_FIRST_SECTOR * w25q.sector_size, "LittleFS ends at the raw partition");
+  raw_partition_init();
+  check(raw_partition_open(flight_counter + 1), "a flight can be recorded into the raw partition");
+  raw_partition_close();
+  lfs_unmount(&lfs);
+  w25q_emu_close();
+
+  if (failed_checks > 0) {
+    printf("%u checks FAILED\n", failed_checks);
+    return EXIT_FAILURE;
+  }
+  printf("All checks passed\n");
+  return EXIT_SUCCESS;
+}
+
+/** Private Function Definitions **/
+
+static void check(bool condition, const char *what) {
+  if (!condition) {
+    printf("FAILED: %s\n", what);
+    ++failed_checks;
+  }
+}
+
+/* What an older firmware left on the flash: LittleFS on all sectors with one flight and its stats */
+static bool write_old_flash() {
+  struct lfs_config old_cfg = lfs_cfg;
+  old_cfg.block_count = OLD_BLOCK_COUNT;
+  if (lfs_format(&lfs, &old_cfg) != 0 || lfs_mount(&lfs, &old_cfg) != 0) {
+    return false;
+  }
+  lfs_mkdir(&lfs, "flights");
+  lfs_mkdir(&lfs, "stats");
+  lfs_file_t file;
+  uint32_t number = OLD_FLIGHT_NUMBER;
+  lfs_file_open(&lfs, &file, "flight_counter", LFS_O_WRONLY | LFS_O_CREAT);
+  lfs_file_write(&lfs, &file, &number, sizeof(number));
+  lfs_file_close(&lfs, &file);
+  lfs_file_open(&lfs, &file, "stats/stats_00003", LFS_O_WRONLY | LFS_O_CREAT);
+  lfs_file_write(&lfs, &file, &number, sizeof(number));
+  lfs_file_close(&lfs, &file);
+
+  if (lfs_file_open(&lfs, &file, "flights/flight_00003", LFS_O_WRONLY | LFS_O_CREAT) != 0) {
+    return false;
+  }
+  static uint8_t chunk[4096];
+  for (uint32_t offset = 0; offset < OLD_FLIGHT_SIZE; offset += sizeof(chunk)) {
+    fill_chunk(chunk, sizeof(chunk), offset);
+    if (lfs_file_write(&lfs, &file, chunk, sizeof(chunk)) != (lfs_ssize_t)sizeof(chunk)) {
+      lfs_file_close(&lfs, &file);
+      return false;
+    }
+  }
+  lfs_file_close(&lfs, &file);
+  return lfs_unmount(&lfs) == 0;
+}
+
+static uint32_t checksum_file(const char *path, uint32_t *size) {
+  lfs_file_t file;
+  *size = 0;
+  if (lfs_file_open(&lfs, &file, path, LFS_O_RDONLY) != 0) {
+    return 0;
+  }
+  static uint8_t chunk[4096];
+  static uint8_t expected[4096];
+  uint32_t checksum = 0;
+  lfs_ssize_t read = 0;
+  while ((read = lfs_file_read(&lfs, &file, chunk, sizeof(chunk))) > 0) {
+    fill_chunk(expected, (uint32_t)read, *size);
+    if (memcmp(chunk, expected, (size_t)read) != 0) {
+      checksum ^= 0xFFFFFFFFU;
+    }
+    checksum ^= crc32_compute(chunk, (uint32_t)read);
+    *size += (uint32_t)read;
+  }
+  lfs_file_close(&lfs, &file);
+  return checksum;
+}
+
+static void fill_chunk(uint8_t *chunk, uint32_t len, uint32_t offset) {
+  for (uint32_t i = 0; i < len; ++i) {
+    chunk[i] = (uint8_t)((offset + i) * 2654435761U >> 24);
+  }
+}
@@ -0,0 +1,326 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Model of the recorder pipeline with the flash latency of the emulated chip: the producers fill the lanes at a
+ * constant rate, task_recorder serializes the lanes into flight log blocks and task_rec_writer appends the blocks to
+ * the raw partition (lfs/raw_partition.c on the emulated flash). The recorder holds one of the buffers while it fills
+ * it and has to wait for a free one after submitting a block, exactly like acquire_buffer(); with a single buffer
+ * serialization and flash writes can't overlap at all.
+ *
+ * The model runs in simulated time with a step of BENCH_STEP_NS. The lanes are modelled as one ring with the total
+ * size of all REC_LANE_* rings, records which don't fit anymore are dropped. Above half of the size the recorder would
+ * already shed load by decimation (see record()), the time spent there is reported separately. The flight log blocks
+ * hold -z times their payload size of packed records and serializing costs -c ns per packed byte.
+ *
+ * Every combination of the typical and the worst case timings of the W25Q256JV, with and without erasing the raw
+ * partition ahead for REC_PREERASE_SIZE bytes, and 1 to -b buffers is run. The flash is filled with old data first so
+ * that every sector has to be erased. The report shows the sustained write rate, the highest lane fill, the dropped
+ * and shed data, the slowest single write and the time the recorder waited for a buffer. The stall column is how long
+ * the lanes and the spare buffers can bridge a flash stall at the given rate.
+ *
+ * A worst case sector erase (400 ms for 4 KiB) is not only longer than the buffers can bridge, it also limits the
+ * sustained rate to about 10 KB/s. Without the erase ahead, or once a flight outlasts the erased headroom (-t 400),
+ * records are dropped with any number of buffers.
+ *
+ *   pipeline_bench [-r <record rate>] [-t <flight duration>] [-b <max. buffers>] [-z <codec ratio>] [-c <ns per byte>]
+ *
+ * Exits with a failure if REC_NUM_BUFFERS drops records with the erase ahead under the worst case timings.
+ */
+
+#include "w25q_emu.h"
+#include "drivers/w25q.h"
+#include "lfs/lfs_custom.h"
+#include "lfs/raw_partition.h"
+#include "util/crc32.h"
+#include "util/log.h"
+#include "util/log_format.h"
+#include "util/recorder.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/** Private Constants **/
+
+#define BENCH_STEP_NS 50000ULL
+#define BENCH_LANE_SIZE (REC_LANE_IMU_SIZE + REC_LANE_BARO_SIZE + REC_LANE_STATE_EST_SIZE + REC_LANE_EVENT_SIZE)
+
+/** Private Types **/
+
+typedef struct {
+  uint32_t record_rate; /* packed record bytes per second */
+  uint32_t duration;    /* s */
+  uint32_t max_buffers;
+  double codec_ratio;
+  double serialize_ns; /* per packed byte */
+} bench_options_t;
+
+typedef struct {
+  const w25q_emu_config_t *config;
+  bool pre_erase;
+  uint32_t num_buffers;
+} bench_scenario_t;
+
+typedef struct {
+  uint64_t written;
+  uint64_t dropped;
+  uint64_t shed_ns;
+  uint64_t max_write_ns;
+  uint64_t recorder_wait_ns;
+  double max_fill;
+} bench_result_t;
+
+/** Private Variables **/
+
+static bench_options_t options = {
+    .record_rate = 2 * REC_NOMINAL_DATA_RATE, .duration = 120, .max_buffers = 4, .codec_ratio = 2.0,
+    .serialize_ns = 50.0};
+
+/** Private Function Declarations **/
+
+static bool parse_options(int argc, char **argv);
+static bool run_scenario(const bench_scenario_t *scenario, bench_result_t *result);
+static void fill_block(uint8_t *block, uint32_t *seed);
+
+/** Stubs for the firmware functions lfs_custom.c and raw_partition.c depend on **/
+
+void HAL_GPIO_TogglePin(__attribute__((unused)) GPIO_TypeDef *GPIOx, __attribute__((unused)) uint16_t GPIO_Pin) {}
+
+osStatus_t osMutexAcquire(__attribute__((unused)) osMutexId_t mutex_id, __attribute__((unused)) uint32_t timeout) {
+  return osOK;
+}
+
+osStatus_t osMutexRelease(__attribute__((unused)) osMutexId_t mutex_id) { return osOK; }
+
+void log_log(__attribute__((unused)) int level, __attribute__((unused)) const char *file,
+             __attribute__((unused)) int line, __attribute__((unused)) const char *format, ...) {}
+
+void cli_print(const char *str) { fputs(str, stdout); }
+
+void cli_printf(const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  vprintf(format, args);
+  va_end(args);
+}
+
+/** Exported Function Definitions **/
+
+int main(int argc, char **argv) {
+  if (!parse_options(argc, argv)) {
+    fprintf(stderr,
+            "Usage: pipeline_bench [-r <record rate>] [-t <flight duration>] [-b <max. buffers>] [-z <codec ratio>] "
+            "[-c <ns per byte>]\n"
+            "  -r  packed record bytes produced per second, default %u\n"
+            "  -t  duration of the flight in s, default 120\n"
+            "  -b  largest number of buffers to try, default 4\n"
+            "  -z  packed record bytes per encoded byte, default 2.0\n"
+            "  -c  serialization time per packed byte in ns, default 50\n",
+            2 * REC_NOMINAL_DATA_RATE);
+    return EXIT_FAILURE;
+  }
+  crc32_init();
+
+  const double block_records = (double)LOG_BLOCK_PAYLOAD_SIZE * options.codec_ratio;
+  printf("%u B/s of records for %u s, lanes %u B, blocks of %.0f B of records, %.0f ns/B serialization, "
+         "REC_NUM_BUFFERS %u\n\n",
+         options.record_rate, options.duration, BENCH_LANE_SIZE, block_records, options.serialize_ns,
+         REC_NUM_BUFFERS);
+  printf("%-7s %-9s %7s %9s %8s %9s %8s %9s %9s %9s\n", "timing", "pre-erase", "buffers", "stall ms", "B/s",
+         "max fill", "dropped", "shed ms", "write ms", "wait ms");
+
+  bool firmware_drops = false;
+  const w25q_emu_config_t *configs[] = {&w25q_emu_typical, &w25q_emu_worst_case};
+  for (uint32_t c = 0; c < 2; ++c) {
+    for (uint32_t p = 0; p < 2; ++p) {
+      for (uint32_t n = 1; n <= options.max_buffers; ++n) {
+        const bench_scenario_t scenario = {.config = configs[c], .pre_erase = p == 0, .num_buffers = n};
+        bench_result_t result = {};
+        if (!run_scenario(&scenario, &result)) {
+          fprintf(stderr, "Can't set up the flash emulation\n");
+          return EXIT_FAILURE;
+        }
+        /* the lanes and every buffer except the one being written can take data during a stall */
+        const double stall_ms =
+            ((double)BENCH_LANE_SIZE + (double)(n - 1) * block_records) * 1000.0 / options.record_rate;
+        printf("%-7s %-9s %7u %9.0f %8.0f %8.0f%% %8lu %9.0f %9.1f %9.0f%s\n", c == 0 ? "typical" : "worst",
+               scenario.pre_erase ? "yes" : "no", n, stall_ms,
+               (double)result.written / options.duration, result.max_fill * 100.0, (unsigned long)result.dropped,
+               (double)result.shed_ns / 1e6, (double)result.max_write_ns / 1e6,
+               (double)result.recorder_wait_ns / 1e6, n == REC_NUM_BUFFERS ? "  <- REC_NUM_BUFFERS" : "");
+        if (c == 1 && scenario.pre_erase && n == REC_NUM_BUFFERS && result.dropped > 0) {
+          firmware_drops = true;
+        }
+      }
+    }
+  }
+
+  if (firmware_drops) {
+    printf("\nREC_NUM_BUFFERS drops records with the erase ahead under the worst case timings!\n");
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+/** Private Function Definitions **/
+
+static bool parse_options(int argc, char **argv) {
+  int opt;
+  while ((opt = getopt(argc, argv, "r:t:b:z:c:")) != -1) {
+    switch (opt) {
+      case 'r':
+        options.record_rate = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      case 't':
+        options.duration = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      case 'b':
+        options.max_buffers = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      case 'z':
+        options.codec_ratio = strtod(optarg, NULL);
+        break;
+      case 'c':
+        options.serialize_ns = strtod(optarg, NULL);
+        break;
+      default:
+        return false;
+    }
+  }
+  return options.record_rate > 0 && options.duration > 0 && options.max_buffers > 0 && options.codec_ratio > 0.0;
+}
+
+/**
+ * Record one flight with the given number of buffers.
+ *
+ * @return false if the flash emulation can't be set up
+ */
+static bool run_scenario(const bench_scenario_t *scenario, bench_result_t *result) {
+  if (!w25q_emu_open(scenario->config, NULL) || w25q_init() != W25Q_OK) {
+    return false;
+  }
+  /* a chip which already recorded flights, nothing is blank */
+  memset(w25q_emu_get_memory(), 0, (size_t)w25q.sector_count * w25q.sector_size);
+  lfs_format(&lfs, &lfs_cfg);
+  if (lfs_mount(&lfs, &lfs_cfg) != LFS_ERR_OK || !raw_partition_format()) {
+    w25q_emu_close();
+    return false;
+  }
+  lfs_mkdir(&lfs, "flights");
+  raw_partition_init();
+  /* what task_rec_writer does while the rocket waits on the pad */
+  while (scenario->pre_erase && !raw_partition_erase_ahead(REC_PREERASE_SIZE)) {
+  }
+  raw_partition_open(1);
+
+  const w25q_emu_stats_t *stats = w25q_emu_get_stats();
+  const double block_records = (double)LOG_BLOCK_PAYLOAD_SIZE * options.codec_ratio;
+  const double bytes_per_step = (double)options.record_rate * (double)BENCH_STEP_NS / 1e9;
+  uint8_t block[LOG_BLOCK_SIZE];
+  uint32_t seed = 1;
+
+  double lane = 0.0;
+  /* task_recorder: packed bytes in the current block, busy serializing until rec_busy_until */
+  double block_fill = 0.0;
+  bool block_submitted = false;
+  uint64_t rec_busy_until = 0;
+  uint32_t free_buffers = scenario->num_buffers - 1;
+  /* task_rec_writer */
+  uint32_t pending_blocks = 0;
+  bool writing = false;
+  uint64_t writer_busy_until = 0;
+
+  const uint64_t end_ns = (uint64_t)options.duration * 1000000000ULL;
+  for (uint64_t now = 0; now < end_ns; now += BENCH_STEP_NS) {
+    /* producers */
+    lane += bytes_per_step;
+    if (lane > BENCH_LANE_SIZE) {
+      result->dropped += (uint64_t)(lane - BENCH_LANE_SIZE + 0.5);
+      lane = BENCH_LANE_SIZE;
+    }
+    if (lane / BENCH_LANE_SIZE > result->max_fill) {
+      result->max_fill = lane / BENCH_LANE_SIZE;
+    }
+    if (lane > BENCH_LANE_SIZE / 2) {
+      result->shed_ns += BENCH_STEP_NS;
+    }
+
+    /* task_rec_writer */
+    if (writing && now >= writer_busy_until) {
+      writing = false;
+      ++free_buffers;
+    }
+    if (!writing && pending_blocks > 0) {
+      --pending_blocks;
+      fill_block(block, &seed);
+      const uint64_t start_ns = stats->time_ns;
+      if (raw_partition_append(block, LOG_BLOCK_SIZE)) {
+        result->written += LOG_BLOCK_SIZE;
+      }
+      const uint64_t write_ns = stats->time_ns - start_ns;
+      if (write_ns > result->max_write_ns) {
+        result->max_write_ns = write_ns;
+      }
+      writer_busy_until = now + write_ns;
+      writing = true;
+    }
+
+    /* task_recorder */
+    if (now < rec_busy_until) {
+      continue;
+    }
+    if (block_fill >= block_records) {
+      /* submit_buffer() followed by acquire_buffer() */
+      if (!block_submitted) {
+        ++pending_blocks;
+        block_submitted = true;
+      }
+      if (free_buffers == 0) {
+        result->recorder_wait_ns += BENCH_STEP_NS;
+        continue;
+      }
+      --free_buffers;
+      block_fill = 0.0;
+      block_submitted = false;
+    }
+    if (lane > 0.0) {
+      const double taken = lane < block_records - block_fill ? lane : block_records - block_fill;
+      lane -= taken;
+      block_fill += taken;
+      rec_busy_until = now + (uint64_t)(taken * options.serialize_ns);
+    }
+  }
+
+  raw_partition_close();
+  lfs_unmount(&lfs);
+  w25q_emu_close();
+  return true;
+}
+
+/* The raw partition finds the end of an interrupted flight by the sync words, the rest is pseudo random */
+static void fill_block(uint8_t *block, uint32_t *seed) {
+  const uint32_t sync = LOG_BLOCK_SYNC;
+  memcpy(block, &sync, sizeof(sync));
+  for (uint32_t i = sizeof(sync); i < LOG_BLOCK_SIZE; ++i) {
+    *seed = *seed * 1103515245U + 12345U;
+    block[i] = (uint8_t)(*seed >> 16);
+  }
+}
@@ -0,0 +1,318 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Runs the real QSPI flash driver (drivers/w25q.c) on top of the HAL mock and checks and benchmarks its state machine:
+ *   - functional check: erase, unaligned writes across pages and read back, without any command the chip would
+ *     reject,
+ *   - command check: the exact commands and bus cycles w25q_write_buffer() needs for aligned and unaligned writes,
+ *   - memory-mapped reads: switching between the mapped window and indirect program operations,
+ *   - the write pattern of the recorder, LOG_BLOCK_SIZE appends with the recorder working in between, comparing the
+ *     CPU time the flash task spends in the driver with and without waiting for every program operation,
+ *   - erasing ahead while the recorder is idle.
+ * All timings are simulated.
+ *
+ *   qspi_bench [-b] [-n <blocks>] [-r <record rate>]
+ */
+
+#include "qspi_mock.h"
+#include "drivers/w25q.h"
+#include "util/log_format.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/** Private Types **/
+
+typedef struct {
+  bool kernel_running;
+  uint32_t num_blocks;
+  uint32_t record_rate; /* bytes per second produced by the recorder */
+} bench_options_t;
+
+/** Private Function Declarations **/
+
+static bool parse_options(int argc, char **argv, bench_options_t *options);
+static double ns_to_us(uint64_t ns) { return (double)ns / 1e3; }
+static bool check_driver(void);
+static bool check_write_commands(void);
+static bool check_write(uint32_t addr, uint32_t num_bytes);
+static bool check_memory_mapped(void);
+static void bench_recorder(const bench_options_t *options, bool wait_for_program);
+static void bench_erase_ahead(const bench_options_t *options);
+static bool no_violations(const qspi_mock_stats_t *stats);
+static void print_stats(const char *title, uint32_t num_ops);
+
+/** Stubs for the firmware functions drivers/w25q.c depends on **/
+
+void log_log(__attribute__((unused)) int level, __attribute__((unused)) const char *file,
+             __attribute__((unused)) int line, __attribute__((unused)) const char *format, ...) {}
+
+void log_raw(__attribute__((unused)) const char *format, ...) {}
+
+/** Exported Function Definitions **/
+
+int main(int argc, char **argv) {
+  bench_options_t options = {
+      .kernel_running = true,
+      .num_blocks = 1024,
+      .record_rate = 20000,
+  };
+  if (!parse_options(argc, argv, &options)) {
+    fprintf(stderr,
+            "Usage: qspi_bench [-b] [-n <blocks>] [-r <record rate>]\n"
+            "  -b  scheduler not running, the driver blocks instead of using DMA and interrupts\n"
+            "  -n  number of blocks to write, default 1024\n"
+            "  -r  rate at which the recorder produces data in B/s, default 20000\n");
+    return EXIT_FAILURE;
+  }
+
+  if (!qspi_mock_open(&qspi_mock_typical) || w25q_init() != W25Q_OK) {
+    fprintf(stderr, "Can't set up the QSPI mock\n");
+    return EXIT_FAILURE;
+  }
+  qspi_mock_set_kernel_running(options.kernel_running);
+  printf("Flash: %lu KiB, %s\n", (unsigned long)w25q.capacity_in_kilobytes,
+         options.kernel_running ? "DMA and interrupts" : "blocking");
+
+  if (!check_driver() || !check_write_commands() || !check_memory_mapped()) {
+    qspi_mock_close();
+    return EXIT_FAILURE;
+  }
+  bench_recorder(&options, true);
+  bench_recorder(&options, false);
+  bench_erase_ahead(&options);
+
+  qspi_mock_close();
+  return EXIT_SUCCESS;
+}
+
+/** Private Function Definitions **/
+
+static bool parse_options(int argc, char **argv, bench_options_t *options) {
+  int opt;
+  while ((opt = getopt(argc, argv, "bn:r:")) != -1) {
+    switch (opt) {
+      case 'b':
+        options->kernel_running = false;
+        break;
+      case 'n':
+        options->num_blocks = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      case 'r':
+        options->record_rate = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      default:
+        return false;
+    }
+  }
+  return options->record_rate > 0 && options->num_blocks > 0;
+}
+
+static bool check_driver(void) {
+  static uint8_t write_buf[3 * 4096];
+  static uint8_t read_buf[3 * 4096];
+  for (uint32_t i = 0; i < sizeof(write_buf); ++i) {
+    write_buf[i] = (uint8_t)(i * 7 + (i >> 8));
+  }
+
+  qspi_mock_reset_stats();
+  bool ok = true;
+  for (uint32_t sector = 0; sector < 4 && ok; ++sector) {
+    ok = w25q_sector_erase(sector) == W25Q_OK;
+  }
+  /* start and end in the middle of a page, and a single byte */
+  const uint32_t addr = 100;
+  ok = ok && w25q_write_buffer(write_buf, addr, sizeof(write_buf) - 1000) == W25Q_OK;
+  ok = ok && w25q_write_buffer(&write_buf[sizeof(write_buf) - 1000], addr + sizeof(write_buf) - 1000, 1) == W25Q_OK;
+  ok = ok && w25q_read_buffer(read_buf, addr, sizeof(read_buf) - 999) == W25Q_OK;
+  ok = ok && memcmp(read_buf, write_buf, sizeof(read_buf) - 999) == 0;
+  ok = ok && w25q_read_buffer(read_buf, addr + sizeof(read_buf) - 999, 16) == W25Q_OK;
+  for (uint32_t i = 0; i < 16 && ok; ++i) {
+    ok = read_buf[i] == 0xFF;
+  }
+  ok = ok && w25q_sync() == W25Q_OK && !w25q_is_busy();
+
+  const qspi_mock_stats_t *stats = qspi_mock_get_stats();
+  if (!ok || !no_violations(stats)) {
+    printf("Driver check failed\n");
+    return false;
+  }
+  printf("Driver check passed\n");
+  return true;
+}
+
+/* Per page w25q_write_buffer() may only send one write enable and one program command, and wait once for the
+ * previous page */
+static bool check_write_commands(void) {
+  bool ok = w25q_block_erase_64k(1) == W25Q_OK && w25q_sync() == W25Q_OK;
+  const uint32_t base = w25q.block_size;
+  /* a LittleFS block, a recorder block, unaligned start and end, a single byte */
+  ok = ok && check_write(base, 4096);
+  ok = ok && check_write(base + 4096, LOG_BLOCK_SIZE);
+  ok = ok && check_write(base + 8192 + 200, 1000);
+  ok = ok && check_write(base + 12288 + 255, 1);
+  printf("Command check %s\n", ok ? "passed" : "failed");
+  return ok;
+}
+
+static bool check_write(uint32_t addr, uint32_t num_bytes) {
+  static uint8_t buf[4096];
+  memset(buf, 0x5A, sizeof(buf));
+  if (w25q_sync() != W25Q_OK || num_bytes > sizeof(buf)) {
+    return false;
+  }
+
+  /* instruction on 1 line, address on 1 line, data on 4 lines */
+  const uint32_t page_size = w25q.page_size;
+  const uint32_t num_pages = (addr + num_bytes - 1) / page_size - addr / page_size + 1;
+  const uint64_t expected_cycles = num_pages * (8 + 8 + 32) + num_bytes * 2;
+
+  qspi_mock_reset_stats();
+  const bool written = w25q_write_buffer(buf, addr, num_bytes) == W25Q_OK;
+  const qspi_mock_stats_t *stats = qspi_mock_get_stats();
+  /* the chip is idle before the first page */
+  const bool ok = written && no_violations(stats) && stats->commands[0x06] == num_pages &&
+                  stats->commands[0x34] == num_pages && stats->commands[0x05] == num_pages - 1 &&
+                  stats->bus_cycles == expected_cycles;
+  if (!ok) {
+    printf("  write of %u bytes at 0x%x: %u write enable, %u programs, %u status polls, %llu bus cycles; "
+           "expected %u, %u, %u, %llu\n",
+           num_bytes, addr, stats->commands[0x06], stats->commands[0x34], stats->commands[0x05],
+           (unsigned long long)stats->bus_cycles, num_pages, num_pages, num_pages - 1,
+           (unsigned long long)expected_cycles);
+  }
+  return ok && w25q_sync() == W25Q_OK;
+}
+
+/* Reads go through the window while program and erase commands have to leave memory-mapped mode first; the window
+ * of the mock faults if the driver touches it afterwards */
+static bool check_memory_mapped(void) {
+  static uint8_t page[256];
+  static uint8_t read_buf[256];
+  if (!qspi_mock_has_window()) {
+    printf("Memory-mapped check skipped, the window can't be mapped at 0x%lx\n", (unsigned long)QSPI_BASE);
+    return w25q_map(0, 1) == NULL;
+  }
+  for (uint32_t i = 0; i < sizeof(page); ++i) {
+    page[i] = (uint8_t)(255 - i);
+  }
+  const uint32_t sector = 8;
+  const uint32_t addr = sector * w25q.sector_size;
+
+  bool ok = w25q_sector_erase(sector) == W25Q_OK && w25q_sync() == W25Q_OK;
+  qspi_mock_reset_stats();
+  /* mapping has to wait for the erase of the sector */
+  ok = ok && w25q_sector_erase(sector + 1) == W25Q_OK && w25q_is_sector_empty(sector + 1);
+  ok = ok && w25q_write_buffer(page, addr, sizeof(page)) == W25Q_OK;
+  const uint8_t *mapped = w25q_map(addr, sizeof(page));
+  ok = ok && mapped != NULL && memcmp(mapped, page, sizeof(page)) == 0;
+  /* stays in memory-mapped mode */
+  ok = ok && w25q_read_buffer(read_buf, addr, sizeof(read_buf)) == W25Q_OK &&
+       memcmp(read_buf, page, sizeof(page)) == 0;
+  ok = ok && !w25q_is_sector_empty(sector) && w25q_is_sector_empty(sector + 1);
+  /* leaves it for the next program and comes back for the next read */
+  ok = ok && w25q_write_buffer(page, addr + sizeof(page), sizeof(page)) == W25Q_OK;
+  ok = ok && w25q_read_buffer(read_buf, addr + sizeof(page), sizeof(read_buf)) == W25Q_OK &&
+       memcmp(read_buf, page, sizeof(page)) == 0;
+
+  const qspi_mock_stats_t *stats = qspi_mock_get_stats();
+  ok = ok && no_violations(stats) && stats->mapped_violations == 0 && stats->mapped_switches == 3;
+  printf("Memory-mapped check %s: %u switches to memory-mapped mode\n", ok ? "passed" : "failed",
+         stats->mapped_switches);
+  return ok;
+}
+
+/* The recorder hands the flash task a block every LOG_BLOCK_SIZE / record_rate seconds */
+static void bench_recorder(const bench_options_t *options, bool wait_for_program) {
+  static uint8_t block[LOG_BLOCK_SIZE];
+  memset(block, 0xA5, sizeof(block));
+  const uint32_t num_sectors = (options->num_blocks * LOG_BLOCK_SIZE + w25q.sector_size - 1) / w25q.sector_size;
+  const uint32_t first_sector = 16;
+  for (uint32_t i = 0; i < num_sectors; ++i) {
+    w25q_sector_erase(first_sector + i);
+  }
+  w25q_sync();
+
+  const uint64_t interval_ns = (uint64_t)LOG_BLOCK_SIZE * 1000000000ULL / options->record_rate;
+  uint64_t max_block_ns = 0;
+  qspi_mock_reset_stats();
+  for (uint32_t i = 0; i < options->num_blocks; ++i) {
+    const uint64_t start_ns = qspi_mock_get_stats()->elapsed_ns;
+    w25q_write_buffer(block, first_sector * w25q.sector_size + i * LOG_BLOCK_SIZE, LOG_BLOCK_SIZE);
+    /* what the driver did before the program and erase operations finished in the background */
+    if (wait_for_program) {
+      w25q_sync();
+    }
+    const uint64_t block_ns = qspi_mock_get_stats()->elapsed_ns - start_ns;
+    if (block_ns > max_block_ns) {
+      max_block_ns = block_ns;
+    }
+    if (block_ns < interval_ns) {
+      qspi_mock_advance(interval_ns - block_ns);
+    }
+  }
+  w25q_sync();
+  print_stats(wait_for_program ? "recorder, waiting for every program" : "recorder, programming in the background",
+              options->num_blocks);
+  printf("  longest block: %.1f us, recorder interval: %.1f us\n", ns_to_us(max_block_ns), ns_to_us(interval_ns));
+}
+
+/* Erase one sector per block interval while the recorder doesn't write, like raw_partition_erase_ahead() */
+static void bench_erase_ahead(const bench_options_t *options) {
+  const uint64_t interval_ns = (uint64_t)LOG_BLOCK_SIZE * 1000000000ULL / options->record_rate;
+  const uint32_t first_sector = 1024;
+  const uint32_t num_sectors = 64;
+  uint32_t erased = 0;
+  qspi_mock_reset_stats();
+  while (erased < num_sectors) {
+    if (!w25q_is_busy()) {
+      w25q_sector_erase(first_sector + erased);
+      ++erased;
+    }
+    qspi_mock_advance(interval_ns);
+  }
+  w25q_sync();
+  print_stats("erase ahead", num_sectors);
+}
+
+static bool no_violations(const qspi_mock_stats_t *stats) {
+  return stats->busy_violations == 0 && stats->wel_violations == 0 && stats->program_violations == 0 &&
+         stats->timeouts == 0 && stats->mapped_violations == 0;
+}
+
+static void print_stats(const char *title, uint32_t num_ops) {
+  const qspi_mock_stats_t *stats = qspi_mock_get_stats();
+  printf("%s:\n", title);
+  printf("  elapsed: %.1f ms, driver CPU: %.1f ms (%.1f us per op), slept: %.1f ms\n",
+         ns_to_us(stats->elapsed_ns) / 1e3, ns_to_us(stats->cpu_ns) / 1e3, ns_to_us(stats->cpu_ns) / num_ops,
+         ns_to_us(stats->sleep_ns) / 1e3);
+  printf("  commands: %u write enable, %u status polls, %u programs, %u erases, %u reads\n", stats->commands[0x06],
+         stats->commands[0x05], stats->commands[0x34], stats->commands[0x21], stats->commands[0xEC]);
+  printf("  transfers: %u blocking, %u DMA, polls: %u blocking, %u interrupt\n", stats->blocking_transfers,
+         stats->dma_transfers, stats->blocking_polls, stats->irq_polls);
+  printf("  bus: %llu cycles, %llu status reads while polling\n", (unsigned long long)stats->bus_cycles,
+         (unsigned long long)stats->poll_reads);
+  if (!no_violations(stats)) {
+    printf("  violations: %u busy, %u write enable, %u program, %u timeouts\n", stats->busy_violations,
+           stats->wel_violations, stats->program_violations, stats->timeouts);
+  }
+}
@@ -0,0 +1,588 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* memfd_create */
+#define _GNU_SOURCE
+
+#include "qspi_mock.h"
+#include "main.h"
+#include "cmsis_os.h"
+
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/** Private Constants **/
+
+#define MOCK_PAGE_SIZE   256U
+#define MOCK_SECTOR_SIZE 4096U
+#define MOCK_BLOCK_SIZE  65536U
+
+#define MOCK_STATUS_BUSY 0x01U
+#define MOCK_STATUS_WEL  0x02U
+#define MOCK_STATUS2_QE  0x02U
+
+#define MOCK_NEVER UINT64_MAX
+
+const qspi_mock_config_t qspi_mock_typical = {
+    .jedec_id = 0xEF4019,
+    .qspi_clock_hz = 40000000,
+    .hal_call_ns = 2000,
+    .irq_wakeup_ns = 5000,
+    .page_program_us = 400,
+    .sector_erase_us = 45000,
+    .block_erase_32k_us = 120000,
+    .block_erase_64k_us = 150000,
+    .chip_erase_ms = 80000,
+};
+
+/** Exported Variables **/
+
+/* Used by drivers/w25q.c */
+QSPI_HandleTypeDef hqspi;
+
+/** Private Variables **/
+
+static qspi_mock_config_t mock_config;
+static qspi_mock_stats_t mock_stats;
+static uint8_t *mock_memory = NULL;
+/* The flash content is mapped a second time at the address of the memory-mapped QSPI window. The window is only
+ * readable while the peripheral is in memory-mapped mode, a stale pointer of the driver faults right away. */
+static uint8_t *mock_window = NULL;
+static int mock_fd = -1;
+static uint32_t mock_capacity = 0;
+static bool mock_kernel_running = false;
+
+static uint64_t mock_now_ns = 0;
+static uint64_t mock_reset_ns = 0;
+
+/* chip state */
+static bool mock_wel = false;
+static uint64_t mock_busy_until_ns = 0;
+/* command waiting for its data phase */
+static QSPI_CommandTypeDef mock_pending_cmd;
+static bool mock_cmd_pending = false;
+
+/* thread flags of the only thread and the time at which the interrupt setting them fires */
+static uint32_t mock_thread_flags = 0;
+static uint64_t mock_flags_ready_ns = 0;
+
+/** Private Function Declarations **/
+
+static uint64_t cycles_to_ns(uint64_t cycles) { return cycles * 1000000000ULL / mock_config.qspi_clock_hz; }
+static uint32_t lines(uint32_t mode, uint32_t one, uint32_t two, uint32_t four);
+static uint32_t command_cycles(const QSPI_CommandTypeDef *cmd);
+static uint32_t data_cycles(const QSPI_CommandTypeDef *cmd);
+static uint64_t transfer_ns(const QSPI_CommandTypeDef *cmd);
+static void spend_cpu(uint64_t ns);
+static bool chip_busy() { return mock_now_ns < mock_busy_until_ns; }
+static uint8_t read_status(uint32_t instruction);
+static void execute_command(const QSPI_CommandTypeDef *cmd);
+static void start_erase(uint32_t addr, uint32_t size, uint64_t busy_us);
+static void program(const uint8_t *data, const QSPI_CommandTypeDef *cmd);
+static void read_data(uint8_t *data, const QSPI_CommandTypeDef *cmd);
+static bool start_data_phase(const QSPI_HandleTypeDef *hqspi);
+static uint64_t poll_match_time(const QSPI_CommandTypeDef *cmd, const QSPI_AutoPollingTypeDef *cfg);
+static void count_poll_reads(const QSPI_CommandTypeDef *cmd, const QSPI_AutoPollingTypeDef *cfg, uint64_t end_ns);
+static void raise_irq(uint64_t at_ns, void (*callback)(QSPI_HandleTypeDef *));
+static bool map_window(void);
+static bool is_mem_mapped(const QSPI_HandleTypeDef *hqspi);
+static void window_fault_handler(int sig, siginfo_t *info, void *context);
+
+/** Exported Function Definitions **/
+
+bool qspi_mock_open(const qspi_mock_config_t *config) {
+  mock_config = *config;
+  const uint32_t capacity_exp = config->jedec_id & 0xFFU;
+  if (capacity_exp < 16 || capacity_exp > 26) {
+    return false;
+  }
+  mock_capacity = 1U << capacity_exp;
+  mock_fd = memfd_create("qspi_mock", 0);
+  if (mock_fd < 0 || ftruncate(mock_fd, mock_capacity) != 0) {
+    qspi_mock_close();
+    return false;
+  }
+  mock_memory = mmap(NULL, mock_capacity, PROT_READ | PROT_WRITE, MAP_SHARED, mock_fd, 0);
+  if (mock_memory == MAP_FAILED) {
+    mock_memory = NULL;
+    qspi_mock_close();
+    return false;
+  }
+  memset(mock_memory, 0xFF, mock_capacity);
+  /* without the window the driver falls back to indirect reads */
+  map_window();
+  hqspi.State = HAL_QSPI_STATE_READY;
+  mock_wel = false;
+  mock_busy_until_ns = 0;
+  mock_cmd_pending = false;
+  qspi_mock_reset_stats();
+  return true;
+}
+
+void qspi_mock_close(void) {
+  if (mock_window != NULL) {
+    munmap(mock_window, mock_capacity);
+    mock_window = NULL;
+  }
+  if (mock_memory != NULL) {
+    munmap(mock_memory, mock_capacity);
+    mock_memory = NULL;
+  }
+  if (mock_fd >= 0) {
+    close(mock_fd);
+    mock_fd = -1;
+  }
+}
+
+bool qspi_mock_has_window(void) { return mock_window != NULL; }
+
+void qspi_mock_set_kernel_running(bool running) { mock_kernel_running = running; }
+
+void qspi_mock_advance(uint64_t ns) { mock_now_ns += ns; }
+
+const qspi_mock_stats_t *qspi_mock_get_stats(void) {
+  mock_stats.elapsed_ns = mock_now_ns - mock_reset_ns;
+  return &mock_stats;
+}
+
+void qspi_mock_reset_stats(void) {
+  memset(&mock_stats, 0, sizeof(mock_stats));
+  mock_reset_ns = mock_now_ns;
+}
+
+uint8_t *qspi_mock_get_memory(void) { return mock_memory; }
+
+/** HAL QSPI **/
+
+HAL_StatusTypeDef HAL_QSPI_Command(QSPI_HandleTypeDef *hqspi, QSPI_CommandTypeDef *cmd,
+                                   __attribute__((unused)) uint32_t Timeout) {
+  /* the HAL rejects indirect operations until memory-mapped mode is aborted */
+  if (is_mem_mapped(hqspi)) {
+    ++mock_stats.mapped_violations;
+    return HAL_BUSY;
+  }
+  ++mock_stats.commands[cmd->Instruction & 0xFFU];
+  spend_cpu(mock_config.hal_call_ns);
+  if (cmd->DataMode != QSPI_DATA_NONE) {
+    /* sent together with the data phase */
+    mock_pending_cmd = *cmd;
+    mock_cmd_pending = true;
+    return HAL_OK;
+  }
+  /* the HAL waits for the transfer complete flag */
+  mock_stats.bus_cycles += command_cycles(cmd);
+  spend_cpu(transfer_ns(cmd));
+  execute_command(cmd);
+  hqspi->State = HAL_QSPI_STATE_READY;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_QSPI_Transmit(QSPI_HandleTypeDef *hqspi, uint8_t *pData,
+                                    __attribute__((unused)) uint32_t Timeout) {
+  if (!start_data_phase(hqspi)) {
+    return HAL_ERROR;
+  }
+  ++mock_stats.blocking_transfers;
+  mock_stats.bus_cycles += command_cycles(&mock_pending_cmd) + data_cycles(&mock_pending_cmd);
+  spend_cpu(transfer_ns(&mock_pending_cmd));
+  program(pData, &mock_pending_cmd);
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_QSPI_Receive(QSPI_HandleTypeDef *hqspi, uint8_t *pData,
+                                   __attribute__((unused)) uint32_t Timeout) {
+  if (!start_data_phase(hqspi)) {
+    return HAL_ERROR;
+  }
+  ++mock_stats.blocking_transfers;
+  mock_stats.bus_cycles += command_cycles(&mock_pending_cmd) + data_cycles(&mock_pending_cmd);
+  spend_cpu(transfer_ns(&mock_pending_cmd));
+  read_data(pData, &mock_pending_cmd);
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_QSPI_Transmit_DMA(QSPI_HandleTypeDef *hqspi, uint8_t *pData) {
+  if (!start_data_phase(hqspi)) {
+    return HAL_ERROR;
+  }
+  ++mock_stats.dma_transfers;
+  spend_cpu(mock_config.hal_call_ns);
+  mock_stats.bus_cycles += command_cycles(&mock_pending_cmd) + data_cycles(&mock_pending_cmd);
+  const uint64_t done_ns = mock_now_ns + transfer_ns(&mock_pending_cmd);
+  /* the chip takes the data as it arrives, programming only starts at the end of the transfer */
+  const uint64_t now_ns = mock_now_ns;
+  mock_now_ns = done_ns;
+  program(pData, &mock_pending_cmd);
+  mock_now_ns = now_ns;
+  raise_irq(done_ns, HAL_QSPI_TxCpltCallback);
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_QSPI_Receive_DMA(QSPI_HandleTypeDef *hqspi, uint8_t *pData) {
+  if (!start_data_phase(hqspi)) {
+    return HAL_ERROR;
+  }
+  ++mock_stats.dma_transfers;
+  spend_cpu(mock_config.hal_call_ns);
+  mock_stats.bus_cycles += command_cycles(&mock_pending_cmd) + data_cycles(&mock_pending_cmd);
+  read_data(pData, &mock_pending_cmd);
+  raise_irq(mock_now_ns + transfer_ns(&mock_pending_cmd), HAL_QSPI_RxCpltCallback);
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_QSPI_AutoPolling(QSPI_HandleTypeDef *hqspi, QSPI_CommandTypeDef *cmd,
+                                       QSPI_AutoPollingTypeDef *cfg, uint32_t Timeout) {
+  /* the HAL rejects indirect operations until memory-mapped mode is aborted */
+  if (is_mem_mapped(hqspi)) {
+    ++mock_stats.mapped_violations;
+    return HAL_BUSY;
+  }
+  ++mock_stats.commands[cmd->Instruction & 0xFFU];
+  ++mock_stats.blocking_polls;
+  spend_cpu(mock_config.hal_call_ns);
+  const uint64_t match_ns = poll_match_time(cmd, cfg);
+  const uint64_t timeout_ns = mock_now_ns + (uint64_t)Timeout * 1000000ULL;
+  if (match_ns > timeout_ns) {
+    count_poll_reads(cmd, cfg, timeout_ns);
+    spend_cpu(timeout_ns - mock_now_ns);
+    ++mock_stats.timeouts;
+    hqspi->State = HAL_QSPI_STATE_READY;
+    return HAL_TIMEOUT;
+  }
+  /* the HAL spins on the status match flag */
+  count_poll_reads(cmd, cfg, match_ns);
+  spend_cpu(match_ns - mock_now_ns);
+  hqspi->State = HAL_QSPI_STATE_READY;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_QSPI_AutoPolling_IT(QSPI_HandleTypeDef *hqspi, QSPI_CommandTypeDef *cmd,
+                                          QSPI_AutoPollingTypeDef *cfg) {
+  /* the HAL rejects indirect operations until memory-mapped mode is aborted */
+  if (is_mem_mapped(hqspi)) {
+    ++mock_stats.mapped_violations;
+    return HAL_BUSY;
+  }
+  ++mock_stats.commands[cmd->Instruction & 0xFFU];
+  ++mock_stats.irq_polls;
+  spend_cpu(mock_config.hal_call_ns);
+  const uint64_t match_ns = poll_match_time(cmd, cfg);
+  hqspi->State = HAL_QSPI_STATE_READY;
+  if (match_ns != MOCK_NEVER) {
+    count_poll_reads(cmd, cfg, match_ns);
+    raise_irq(match_ns, HAL_QSPI_StatusMatchCallback);
+  }
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_QSPI_MemoryMapped(QSPI_HandleTypeDef *hqspi, QSPI_CommandTypeDef *cmd,
+                                        __attribute__((unused)) QSPI_MemoryMappedTypeDef *cfg) {
+  ++mock_stats.commands[cmd->Instruction & 0xFFU];
+  spend_cpu(mock_config.hal_call_ns);
+  if (is_mem_mapped(hqspi)) {
+    ++mock_stats.mapped_violations;
+    return HAL_BUSY;
+  }
+  if (mock_window == NULL || mprotect(mock_window, mock_capacity, PROT_READ) != 0) {
+    return HAL_ERROR;
+  }
+  /* the data read through the window would be garbage */
+  if (chip_busy()) {
+    ++mock_stats.busy_violations;
+  }
+  ++mock_stats.mapped_switches;
+  hqspi->State = HAL_QSPI_STATE_BUSY_MEM_MAPPED;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_QSPI_Abort(QSPI_HandleTypeDef *hqspi) {
+  if (is_mem_mapped(hqspi)) {
+    mprotect(mock_window, mock_capacity, PROT_NONE);
+  }
+  mock_cmd_pending = false;
+  hqspi->State = HAL_QSPI_STATE_READY;
+  return HAL_OK;
+}
+
+/** CMSIS-RTOS **/
+
+osKernelState_t osKernelGetState(void) { return mock_kernel_running ? osKernelRunning : osKernelReady; }
+
+osThreadId_t osThreadGetId(void) { return (osThreadId_t)&mock_thread_flags; }
+
+uint32_t osThreadFlagsSet(__attribute__((unused)) osThreadId_t thread_id, uint32_t flags) {
+  mock_thread_flags |= flags;
+  return mock_thread_flags;
+}
+
+uint32_t osThreadFlagsClear(uint32_t flags) {
+  const uint32_t old_flags = mock_thread_flags;
+  mock_thread_flags &= ~flags;
+  return old_flags;
+}
+
+uint32_t osThreadFlagsWait(uint32_t flags, __attribute__((unused)) uint32_t options, uint32_t timeout) {
+  const uint64_t timeout_ns = mock_now_ns + (uint64_t)timeout * 1000000ULL;
+  const uint32_t set_flags = mock_thread_flags & flags;
+  if (set_flags == 0 || mock_flags_ready_ns > timeout_ns) {
+    mock_stats.sleep_ns += timeout_ns - mock_now_ns;
+    mock_now_ns = timeout_ns;
+    ++mock_stats.timeouts;
+    return (uint32_t)osFlagsErrorTimeout;
+  }
+  const uint64_t wakeup_ns = (mock_flags_ready_ns > mock_now_ns ? mock_flags_ready_ns : mock_now_ns) +
+                             mock_config.irq_wakeup_ns;
+  mock_stats.sleep_ns += wakeup_ns - mock_now_ns;
+  mock_now_ns = wakeup_ns;
+  mock_thread_flags &= ~set_flags;
+  return set_flags;
+}
+
+osStatus_t osDelay(uint32_t ticks) {
+  mock_now_ns += (uint64_t)ticks * 1000000ULL;
+  return osOK;
+}
+
+uint32_t osKernelGetTickCount(void) { return (uint32_t)(mock_now_ns / 1000000ULL); }
+
+/** Private Function Definitions **/
+
+static uint32_t lines(uint32_t mode, uint32_t one, uint32_t two, uint32_t four) {
+  if (mode == one) {
+    return 1;
+  }
+  if (mode == two) {
+    return 2;
+  }
+  if (mode == four) {
+    return 4;
+  }
+  return 0;
+}
+
+/* Instruction, address and dummy phases */
+static uint32_t command_cycles(const QSPI_CommandTypeDef *cmd) {
+  uint32_t cycles = cmd->DummyCycles;
+  const uint32_t instruction_lines =
+      lines(cmd->InstructionMode, QSPI_INSTRUCTION_1_LINE, QSPI_INSTRUCTION_2_LINES, QSPI_INSTRUCTION_4_LINES);
+  if (instruction_lines > 0) {
+    cycles += 8 / instruction_lines;
+  }
+  const uint32_t address_lines =
+      lines(cmd->AddressMode, QSPI_ADDRESS_1_LINE, QSPI_ADDRESS_2_LINES, QSPI_ADDRESS_4_LINES);
+  if (address_lines > 0) {
+    cycles += 32 / address_lines;
+  }
+  return cycles;
+}
+
+static uint32_t data_cycles(const QSPI_CommandTypeDef *cmd) {
+  const uint32_t data_lines = lines(cmd->DataMode, QSPI_DATA_1_LINE, QSPI_DATA_2_LINES, QSPI_DATA_4_LINES);
+  return data_lines > 0 ? 8 * cmd->NbData / data_lines : 0;
+}
+
+static uint64_t transfer_ns(const QSPI_CommandTypeDef *cmd) {
+  return cycles_to_ns(command_cycles(cmd) + data_cycles(cmd));
+}
+
+static void spend_cpu(uint64_t ns) {
+  mock_now_ns += ns;
+  mock_stats.cpu_ns += ns;
+}
+
+static uint8_t read_status(uint32_t instruction) {
+  switch (instruction) {
+    case 0x05:
+      return (chip_busy() ? MOCK_STATUS_BUSY : 0) | (mock_wel ? MOCK_STATUS_WEL : 0);
+    case 0x35:
+      return MOCK_STATUS2_QE;
+    default:
+      return 0;
+  }
+}
+
+static void execute_command(const QSPI_CommandTypeDef *cmd) {
+  /* only the status register can be read and the reset be issued while the chip is busy */
+  if (chip_busy() && cmd->Instruction != 0x05 && cmd->Instruction != 0x66 && cmd->Instruction != 0x99) {
+    ++mock_stats.busy_violations;
+    return;
+  }
+  switch (cmd->Instruction) {
+    case 0x06:
+      mock_wel = true;
+      break;
+    case 0x99:
+      mock_wel = false;
+      mock_busy_until_ns = 0;
+      break;
+    case 0x21:
+      start_erase(cmd->Address, MOCK_SECTOR_SIZE, mock_config.sector_erase_us);
+      break;
+    case 0x52:
+      start_erase(cmd->Address, MOCK_BLOCK_SIZE / 2, mock_config.block_erase_32k_us);
+      break;
+    case 0xDC:
+      start_erase(cmd->Address, MOCK_BLOCK_SIZE, mock_config.block_erase_64k_us);
+      break;
+    case 0xC7:
+      start_erase(0, mock_capacity, (uint64_t)mock_config.chip_erase_ms * 1000);
+      break;
+    default:
+      /* enable reset, 4 byte address mode */
+      break;
+  }
+}
+
+static void start_erase(uint32_t addr, uint32_t size, uint64_t busy_us) {
+  if (!mock_wel) {
+    ++mock_stats.wel_violations;
+    return;
+  }
+  mock_wel = false;
+  addr = (addr % mock_capacity) & ~(size - 1);
+  memset(&mock_memory[addr], 0xFF, size);
+  mock_busy_until_ns = mock_now_ns + busy_us * 1000;
+}
+
+static void program(const uint8_t *data, const QSPI_CommandTypeDef *cmd) {
+  if (chip_busy()) {
+    ++mock_stats.busy_violations;
+    return;
+  }
+  if (!mock_wel) {
+    ++mock_stats.wel_violations;
+    return;
+  }
+  mock_wel = false;
+  /* the address wraps around at the end of the page */
+  const uint32_t page = (cmd->Address % mock_capacity) & ~(MOCK_PAGE_SIZE - 1);
+  uint32_t offset = cmd->Address % MOCK_PAGE_SIZE;
+  for (uint32_t i = 0; i < cmd->NbData; ++i) {
+    uint8_t *cell = &mock_memory[page + offset];
+    if ((data[i] & ~*cell) != 0) {
+      ++mock_stats.program_violations;
+    }
+    *cell &= data[i];
+    offset = (offset + 1) % MOCK_PAGE_SIZE;
+  }
+  mock_stats.bytes_programmed += cmd->NbData;
+  mock_busy_until_ns = mock_now_ns + (uint64_t)mock_config.page_program_us * 1000;
+}
+
+static void read_data(uint8_t *data, const QSPI_CommandTypeDef *cmd) {
+  switch (cmd->Instruction) {
+    case 0x9F:
+      for (uint32_t i = 0; i < cmd->NbData; ++i) {
+        data[i] = i < 3 ? (uint8_t)(mock_config.jedec_id >> (8 * (2 - i))) : 0;
+      }
+      break;
+    case 0x05:
+    case 0x35:
+    case 0x15:
+      memset(data, read_status(cmd->Instruction), cmd->NbData);
+      break;
+    default:
+      if (chip_busy()) {
+        ++mock_stats.busy_violations;
+        memset(data, 0xFF, cmd->NbData);
+        break;
+      }
+      for (uint32_t i = 0; i < cmd->NbData; ++i) {
+        data[i] = mock_memory[(cmd->Address + i) % mock_capacity];
+      }
+      mock_stats.bytes_read += cmd->NbData;
+      break;
+  }
+}
+
+static bool start_data_phase(const QSPI_HandleTypeDef *hqspi) {
+  (void)hqspi;
+  if (!mock_cmd_pending) {
+    return false;
+  }
+  mock_cmd_pending = false;
+  return true;
+}
+
+/* Time at which the polled status register matches, MOCK_NEVER if it doesn't change on its own */
+static uint64_t poll_match_time(const QSPI_CommandTypeDef *cmd, const QSPI_AutoPollingTypeDef *cfg) {
+  const uint64_t first_ns = mock_now_ns + transfer_ns(cmd);
+  const uint32_t status = read_status(cmd->Instruction);
+  if ((status & cfg->Mask) == (cfg->Match & cfg->Mask)) {
+    return first_ns;
+  }
+  /* only the busy bit clears over time */
+  if ((cfg->Mask & MOCK_STATUS_BUSY) && (cfg->Match & MOCK_STATUS_BUSY) == 0 &&
+      ((status & ~MOCK_STATUS_BUSY) & cfg->Mask) == (cfg->Match & cfg->Mask)) {
+    return mock_busy_until_ns > first_ns ? mock_busy_until_ns : first_ns;
+  }
+  return MOCK_NEVER;
+}
+
+/* The peripheral reads the status register every `Interval` cycles until `end_ns` */
+static void count_poll_reads(const QSPI_CommandTypeDef *cmd, const QSPI_AutoPollingTypeDef *cfg, uint64_t end_ns) {
+  const uint32_t read_cycles = command_cycles(cmd) + data_cycles(cmd);
+  const uint64_t first_ns = mock_now_ns + cycles_to_ns(read_cycles);
+  const uint64_t reads = 1 + (end_ns > first_ns ? (end_ns - first_ns) / cycles_to_ns(read_cycles + cfg->Interval) : 0);
+  mock_stats.poll_reads += reads;
+  mock_stats.poll_cycles += reads * read_cycles;
+}
+
+/* The interrupt handler of the HAL calls the callback; the waiting thread only sees the flags at `at_ns` */
+static void raise_irq(uint64_t at_ns, void (*callback)(QSPI_HandleTypeDef *)) {
+  mock_flags_ready_ns = at_ns;
+  callback(&hqspi);
+}
+
+static bool map_window(void) {
+#ifdef MAP_FIXED_NOREPLACE
+  const int flags = MAP_SHARED | MAP_FIXED_NOREPLACE;
+#else
+  const int flags = MAP_SHARED;
+#endif
+  void *window = mmap((void *)QSPI_BASE, mock_capacity, PROT_NONE, flags, mock_fd, 0);
+  if (window == MAP_FAILED) {
+    return false;
+  }
+  if (window != (void *)QSPI_BASE) {
+    munmap(window, mock_capacity);
+    return false;
+  }
+  mock_window = window;
+
+  struct sigaction action = {.sa_sigaction = window_fault_handler, .sa_flags = SA_SIGINFO | SA_RESETHAND};
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGSEGV, &action, NULL);
+  return true;
+}
+
+static bool is_mem_mapped(const QSPI_HandleTypeDef *hqspi) { return hqspi->State == HAL_QSPI_STATE_BUSY_MEM_MAPPED; }
+
+static void window_fault_handler(__attribute__((unused)) int sig, siginfo_t *info,
+                                 __attribute__((unused)) void *context) {
+  const uint8_t *addr = (const uint8_t *)info->si_addr;
+  if (mock_window != NULL && addr >= mock_window && addr < mock_window + mock_capacity) {
+    static const char msg[] = "Access to the QSPI window outside of memory-mapped mode\n";
+    write(STDERR_FILENO, msg, sizeof(msg) - 1);
+    _exit(EXIT_FAILURE);
+  }
+  /* any other fault; the handler was reset, so the access faults again with the default action */
+}
@@ -0,0 +1,121 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host mock of the STM32 HAL QSPI functions and of the CMSIS-RTOS calls used by drivers/w25q.c, so that the real
+ * driver and its state machine can be run and benchmarked on a PC.
+ *
+ * Behind the mock sits a simulated W25Q chip: the commands used by the driver, the write enable latch, NOR program and
+ * erase semantics and busy times on a simulated clock. DMA transfers and interrupt driven auto-polling complete by
+ * calling the HAL callbacks of the driver right away, just like the interrupt handlers would; the thread flags they
+ * set only become visible to the waiting thread at the simulated time the interrupt would fire. The time the driver
+ * spins on the CPU is accounted separately from the time the calling thread sleeps and other tasks could run.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Exported Types **/
+
+typedef struct {
+  uint32_t jedec_id; /* e.g. 0xEF4019 for the W25Q256 */
+  uint32_t qspi_clock_hz;
+  uint32_t hal_call_ns;   /* CPU time of a HAL call apart from the bus transfer */
+  uint32_t irq_wakeup_ns; /* from the interrupt until the waiting thread runs again */
+  /* busy times of the chip */
+  uint32_t page_program_us;
+  uint32_t sector_erase_us;
+  uint32_t block_erase_32k_us;
+  uint32_t block_erase_64k_us;
+  uint32_t chip_erase_ms;
+} qspi_mock_config_t;
+
+typedef struct {
+  uint64_t elapsed_ns;    /* simulated time */
+  uint64_t cpu_ns;        /* CPU time spent in the driver: HAL calls, blocking transfers and blocking polls */
+  uint64_t sleep_ns;      /* time the calling thread slept waiting for an interrupt */
+  uint32_t commands[256]; /* HAL_QSPI_Command and auto-polling calls per instruction */
+  /* QSPI clock cycles of the commands and data phases, and of the status reads done by auto-polling */
+  uint64_t bus_cycles;
+  uint64_t poll_cycles;
+  uint64_t poll_reads;
+  uint32_t blocking_transfers;
+  uint32_t dma_transfers;
+  uint32_t blocking_polls;
+  uint32_t irq_polls;
+  uint64_t bytes_programmed;
+  uint64_t bytes_read;
+  /* commands the chip ignored because it was busy, programs and erases without the write enable latch set and
+   * programs which tried to set a bit from 0 to 1 */
+  uint32_t busy_violations;
+  uint32_t wel_violations;
+  uint32_t program_violations;
+  uint32_t timeouts;
+  /* switches to memory-mapped mode and indirect operations the HAL rejected because the peripheral was still in it */
+  uint32_t mapped_switches;
+  uint32_t mapped_violations;
+} qspi_mock_stats_t;
+
+/** Exported Variables **/
+
+/* Typical timings of the W25Q256JV datasheet at the QSPI clock of the board (80 MHz / 2) */
+extern const qspi_mock_config_t qspi_mock_typical;
+
+/** Exported Functions **/
+
+/**
+ * Set up the simulated chip; the content is erased. Has to be called before w25q_init().
+ *
+ * @param config - timing model and chip ID; copied
+ * @return true if successful
+ */
+bool qspi_mock_open(const qspi_mock_config_t *config);
+
+void qspi_mock_close(void);
+
+/**
+ * Select whether the driver sees a running scheduler, i.e. uses DMA and interrupts, or has to block.
+ *
+ * @param running - value reported by osKernelGetState()
+ */
+void qspi_mock_set_kernel_running(bool running);
+
+/**
+ * Let simulated time pass outside of the driver, e.g. while the caller does other work.
+ *
+ * @param ns - time in ns
+ */
+void qspi_mock_advance(uint64_t ns);
+
+/** Statistics since the last qspi_mock_reset_stats(). **/
+const qspi_mock_stats_t *qspi_mock_get_stats(void);
+
+void qspi_mock_reset_stats(void);
+
+/**
+ * The memory-mapped window is emulated by mapping the flash content at QSPI_BASE, which is only readable while the
+ * peripheral is in memory-mapped mode. Reading it in indirect mode ends the program with an error.
+ *
+ * @return true if the window could be mapped; the driver has to fall back to indirect reads otherwise
+ */
+bool qspi_mock_has_window(void);
+
+/** Raw access to the flash content. **/
+uint8_t *qspi_mock_get_memory(void);
@@ -0,0 +1,165 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Runs the on-device storage benchmark (lfs/storage_bench.h) on the flash emulation. The latencies are the simulated
+ * flash times of the emulation, i.e. what the driver would wait for the chip; the time the CPU spends in the driver
+ * and in LittleFS is not included. That makes the LittleFS results a lower bound, but it shows how many flash
+ * operations a change adds or saves.
+ *
+ *   storage_bench [-w] [-o <csv file>] [-v <version>]
+ *
+ * With -o the results are appended to a CSV file in the same format as STORAGE_BENCH_FILE on the board.
+ */
+
+#include "w25q_emu.h"
+#include "drivers/w25q.h"
+#include "lfs/lfs_custom.h"
+#include "lfs/raw_partition.h"
+#include "lfs/storage_bench.h"
+#include "util/crc32.h"
+#include "util/cycle_counter.h"
+#include "util/log.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/** Private Types **/
+
+typedef struct {
+  bool worst_case;
+  const char *csv_path;
+  const char *version;
+} bench_options_t;
+
+/** Private Function Declarations **/
+
+static bool parse_options(int argc, char **argv, bench_options_t *options);
+static bool save_csv(const storage_bench_results_t *results, const bench_options_t *options);
+
+/** Stubs for the firmware functions lfs_custom.c and raw_partition.c depend on **/
+
+void HAL_GPIO_TogglePin(__attribute__((unused)) GPIO_TypeDef *GPIOx, __attribute__((unused)) uint16_t GPIO_Pin) {}
+
+osStatus_t osMutexAcquire(__attribute__((unused)) osMutexId_t mutex_id, __attribute__((unused)) uint32_t timeout) {
+  return osOK;
+}
+
+osStatus_t osMutexRelease(__attribute__((unused)) osMutexId_t mutex_id) { return osOK; }
+
+void log_log(__attribute__((unused)) int level, __attribute__((unused)) const char *file,
+             __attribute__((unused)) int line, const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  vprintf(format, args);
+  va_end(args);
+  putchar('\n');
+}
+
+void log_raw(const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  vprintf(format, args);
+  va_end(args);
+  putchar('\n');
+}
+
+void cli_print(const char *str) { fputs(str, stdout); }
+
+void cli_printf(const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  vprintf(format, args);
+  va_end(args);
+}
+
+/** Exported Function Definitions **/
+
+int main(int argc, char **argv) {
+  bench_options_t options = {.worst_case = false, .csv_path = NULL, .version = "host"};
+  if (!parse_options(argc, argv, &options)) {
+    fprintf(stderr,
+            "Usage: storage_bench [-w] [-o <csv file>] [-v <version>]\n"
+            "  -w  worst case instead of typical flash timings\n"
+            "  -o  append the results to a CSV file\n"
+            "  -v  version written to the CSV file, default \"host\"\n");
+    return EXIT_FAILURE;
+  }
+
+  if (!w25q_emu_open(options.worst_case ? &w25q_emu_worst_case : &w25q_emu_typical, NULL) || w25q_init() != W25Q_OK) {
+    fprintf(stderr, "Can't set up the flash emulation\n");
+    return EXIT_FAILURE;
+  }
+  crc32_init();
+  cycle_counter_init();
+  lfs_format(&lfs, &lfs_cfg);
+  if (lfs_mount(&lfs, &lfs_cfg) != LFS_ERR_OK || !raw_partition_format()) {
+    fprintf(stderr, "Can't set up the file system\n");
+    return EXIT_FAILURE;
+  }
+  raw_partition_init();
+
+  storage_bench_results_t results;
+  const bool passed = storage_bench_run(&results);
+  storage_bench_print(&results);
+  const bool saved = options.csv_path == NULL || save_csv(&results, &options);
+
+  lfs_unmount(&lfs);
+  w25q_emu_close();
+  return passed && saved ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/** Private Function Definitions **/
+
+static bool parse_options(int argc, char **argv, bench_options_t *options) {
+  int opt;
+  while ((opt = getopt(argc, argv, "wo:v:")) != -1) {
+    switch (opt) {
+      case 'w':
+        options->worst_case = true;
+        break;
+      case 'o':
+        options->csv_path = optarg;
+        break;
+      case 'v':
+        options->version = optarg;
+        break;
+      default:
+        return false;
+    }
+  }
+  return true;
+}
+
+static bool save_csv(const storage_bench_results_t *results, const bench_options_t *options) {
+  FILE *file = fopen(options->csv_path, "a");
+  if (file == NULL) {
+    fprintf(stderr, "Can't open %s\n", options->csv_path);
+    return false;
+  }
+  char line[128];
+  for (uint32_t i = 0; i < NUM_STORAGE_BENCH_TESTS; ++i) {
+    if (results->tests[i].count > 0) {
+      storage_bench_format(results, (storage_bench_test_e)i, options->version, line, sizeof(line));
+      fputs(line, file);
+    }
+  }
+  return fclose(file) == 0;
+}
@@ -0,0 +1,399 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Records a synthetic flight on a small emulated flash until it runs full and checks the storage tiers of the
+ * recorder (util/rec_tier.h): the bulk data is thinned out tier by tier, every flight state and event makes it into
+ * the log, every block carries the tier it was written in and no record in it was supposed to be left out. The
+ * records are written into LOG_BLOCK_SIZE blocks with the flags of the real log format, the record content itself is
+ * synthetic. The free space is tracked like in task_rec_writer: raw_partition_get_free(), or with -l
+ * lfs_get_free_space() every REC_SPACE_CHECK_INTERVAL bytes and an estimate in between.
+ *
+ *   tier_bench [-l] [-m <flash size>] [-t <flight duration>]
+ *
+ * Exits with a failure if one of the checks fails.
+ */
+
+#include "w25q_emu.h"
+#include "drivers/w25q.h"
+#include "lfs/lfs_custom.h"
+#include "lfs/raw_partition.h"
+#include "util/crc32.h"
+#include "util/log.h"
+#include "util/log_format.h"
+#include "util/rec_tier.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/** Private Constants **/
+
+#define BENCH_FLIGHT_NUMBER 1
+#define BENCH_TICK_MS       10 /* CONTROL_SAMPLING_FREQ */
+/* record type indices */
+#define BENCH_FLIGHT_STATE 7
+#define BENCH_EVENT_INFO   10
+
+/* Same as in tasks/task_recorder.c */
+#define REC_SPACE_CHECK_INTERVAL (64 * LOG_BLOCK_SIZE)
+
+/* Rough encoded size of each record type in bytes, the tag byte included; indexed by the record type index */
+static const uint8_t bench_rec_sizes[NUM_REC_TYPES] = {
+    12, /* IMU */
+    8,  /* BARO */
+    8,  /* MAGNETO */
+    6,  /* ACCELEROMETER */
+    10, /* FLIGHT_INFO */
+    12, /* ORIENTATION_INFO */
+    12, /* FILTERED_DATA_INFO */
+    7,  /* FLIGHT_STATE */
+    7,  /* COVARIANCE_INFO */
+    8,  /* SENSOR_INFO */
+    7,  /* EVENT_INFO */
+    7,  /* ERROR_INFO */
+};
+
+/* Number of IDs of each sampled record type, every ID is recorded at CONTROL_SAMPLING_FREQ; 0 for event driven
+ * records. Adds up to about REC_NOMINAL_DATA_RATE. */
+static const uint8_t bench_rec_ids[NUM_REC_TYPES] = {3, 3, 1, 1, 1, 1, 1, 0, 1, 0, 0, 0};
+
+/** Private Types **/
+
+typedef struct {
+  const char *name;
+  uint32_t time_ms;  /* from liftoff */
+  uint32_t type_idx; /* FLIGHT_STATE or EVENT_INFO */
+} bench_event_t;
+
+typedef struct {
+  bool use_lfs;
+  uint32_t flash_size; /* MiB */
+  uint32_t duration;   /* s */
+} bench_options_t;
+
+/** Private Variables **/
+
+static bench_options_t options = {.use_lfs = false, .flash_size = 8, .duration = 600};
+
+static lfs_file_t flight_file;
+static uint8_t block[LOG_BLOCK_SIZE];
+static uint32_t block_len = 0;
+static uint32_t block_seq = 0;
+static uint32_t lfs_free_space = 0;
+static uint32_t bytes_since_space_check = 0;
+static rec_storage_tier_e tier = REC_TIER_FULL;
+static bool flash_full = false;
+
+/** Private Function Declarations **/
+
+static bool parse_options(int argc, char **argv);
+static uint32_t get_event_time(const bench_event_t *event);
+static void add_record(uint32_t type_idx, uint8_t id, uint32_t ts);
+static void submit_block();
+static uint32_t get_free_space();
+static bool check_log(const bench_event_t *events, uint32_t num_events);
+
+/** Stubs for the firmware functions lfs_custom.c and raw_partition.c depend on **/
+
+void HAL_GPIO_TogglePin(__attribute__((unused)) GPIO_TypeDef *GPIOx, __attribute__((unused)) uint16_t GPIO_Pin) {}
+
+osStatus_t osMutexAcquire(__attribute__((unused)) osMutexId_t mutex_id, __attribute__((unused)) uint32_t timeout) {
+  return osOK;
+}
+
+osStatus_t osMutexRelease(__attribute__((unused)) osMutexId_t mutex_id) { return osOK; }
+
+void log_log(__attribute__((unused)) int level, __attribute__((unused)) const char *file,
+             __attribute__((unused)) int line, const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  vprintf(format, args);
+  va_end(args);
+  putchar('\n');
+}
+
+void cli_print(const char *str) { fputs(str, stdout); }
+
+void cli_printf(const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  vprintf(format, args);
+  va_end(args);
+}
+
+/** Exported Function Definitions **/
+
+int main(int argc, char **argv) {
+  if (!parse_options(argc, argv)) {
+    fprintf(stderr,
+            "Usage: tier_bench [-l] [-m <flash size>] [-t <flight duration>]\n"
+            "  -l  write the flight to a LittleFS file instead of the raw partition\n"
+            "  -m  size of the flash in MiB, a power of two from 8 to 256, default 8\n"
+            "  -t  duration of the flight in s, default 600\n");
+    return EXIT_FAILURE;
+  }
+
+  /* LittleFS always takes the first RAW_PARTITION_FIRST_SECTOR sectors, the raw partition gets the rest */
+  w25q_emu_config_t config = w25q_emu_typical;
+  config.jedec_id = 0xEF4000U | (uint32_t)__builtin_ctz(options.flash_size * 1024 * 1024);
+  if (!w25q_emu_open(&config, NULL) || w25q_init() != W25Q_OK) {
+    fprintf(stderr, "Can't set up the flash emulation\n");
+    return EXIT_FAILURE;
+  }
+  crc32_init();
+  lfs_format(&lfs, &lfs_cfg);
+  if (lfs_mount(&lfs, &lfs_cfg) != LFS_ERR_OK || !raw_partition_format()) {
+    fprintf(stderr, "Can't set up the file system\n");
+    return EXIT_FAILURE;
+  }
+  lfs_mkdir(&lfs, "flights");
+  raw_partition_init();
+
+  /* what task_recorder does for REC_CMD_WRITE */
+  if (options.use_lfs) {
+    lfs_file_open(&lfs, &flight_file, "flights/flight_00001", LFS_O_WRONLY | LFS_O_CREAT);
+    lfs_free_space = lfs_get_free_space();
+  } else if (!raw_partition_open(BENCH_FLIGHT_NUMBER)) {
+    fprintf(stderr, "Can't open the raw partition\n");
+    return EXIT_FAILURE;
+  }
+  printf("Flash: %lu KiB, flight to %s with %lu KiB free\n", (unsigned long)w25q.capacity_in_kilobytes,
+         options.use_lfs ? "LittleFS" : "the raw partition", (unsigned long)get_free_space() / 1024);
+  tier = rec_tier_from_free_space(get_free_space());
+
+  const uint32_t duration_ms = options.duration * 1000;
+  const bench_event_t events[] = {
+      {"THRUSTING state", 0, BENCH_FLIGHT_STATE},
+      {"liftoff event", 0, BENCH_EVENT_INFO},
+      {"COASTING state", 3000, BENCH_FLIGHT_STATE},
+      {"APOGEE state", 25000, BENCH_FLIGHT_STATE},
+      {"apogee event", 25000, BENCH_EVENT_INFO},
+      {"MAIN state", duration_ms - 60000, BENCH_FLIGHT_STATE},
+      {"main altitude event", duration_ms - 60000, BENCH_EVENT_INFO},
+      {"TOUCHDOWN state", duration_ms, BENCH_FLIGHT_STATE},
+  };
+  const uint32_t num_events = sizeof(events) / sizeof(events[0]);
+  /* the events are told apart by their ID */
+  _Static_assert(sizeof(events) / sizeof(events[0]) <= REC_ID_MASK + 1, "Too many events");
+
+  uint32_t tier_shift = 0;
+  uint32_t decimation_counters[NUM_REC_TYPES] = {};
+  for (uint32_t ts = 0; ts <= duration_ms; ts += BENCH_TICK_MS) {
+    for (uint32_t i = 0; i < num_events; ++i) {
+      if (get_event_time(&events[i]) == ts) {
+        add_record(events[i].type_idx, (uint8_t)i, ts);
+      }
+    }
+    for (uint32_t type_idx = 0; type_idx < NUM_REC_TYPES; ++type_idx) {
+      if (bench_rec_ids[type_idx] == 0 || !rec_tier_keeps(type_idx, tier, &tier_shift)) {
+        continue;
+      }
+      if (decimation_counters[type_idx]++ % (1U << tier_shift) != 0) {
+        continue;
+      }
+      for (uint8_t id = 0; id < bench_rec_ids[type_idx]; ++id) {
+        add_record(type_idx, id, ts);
+      }
+    }
+  }
+  submit_block();
+
+  const uint32_t free_space = get_free_space();
+  if (options.use_lfs) {
+    lfs_file_close(&lfs, &flight_file);
+  } else {
+    raw_partition_close();
+  }
+  printf("Touchdown after %u s: %u blocks, %lu KiB free\n", options.duration, block_seq,
+         (unsigned long)free_space / 1024);
+
+  const bool passed = !flash_full && check_log(events, num_events);
+  printf("%s\n", passed ? "PASSED" : "FAILED");
+  lfs_unmount(&lfs);
+  w25q_emu_close();
+  return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/** Private Function Definitions **/
+
+static bool parse_options(int argc, char **argv) {
+  int opt;
+  while ((opt = getopt(argc, argv, "lm:t:")) != -1) {
+    switch (opt) {
+      case 'l':
+        options.use_lfs = true;
+        break;
+      case 'm':
+        options.flash_size = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      case 't':
+        options.duration = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      default:
+        return false;
+    }
+  }
+  /* the first 4 MiB are LittleFS */
+  return options.flash_size >= 8 && options.flash_size <= 256 && (options.flash_size & (options.flash_size - 1)) == 0;
+}
+
+static uint32_t get_event_time(const bench_event_t *event) {
+  return event->time_ms / BENCH_TICK_MS * BENCH_TICK_MS;
+}
+
+/* A record: tag byte like the record codec, the timestamp and filler up to the size of the type */
+static void add_record(uint32_t type_idx, uint8_t id, uint32_t ts) {
+  const uint32_t size = bench_rec_sizes[type_idx];
+  if (block_len + size > LOG_BLOCK_PAYLOAD_SIZE) {
+    submit_block();
+  }
+  uint8_t *record = &block[sizeof(log_block_header_t) + block_len];
+  memset(record, 0x5A, size);
+  record[0] = (uint8_t)((type_idx << 4) | id);
+  memcpy(&record[1], &ts, sizeof(ts));
+  block_len += size;
+}
+
+/* Write the block like task_rec_writer and move to the next tier if the free space calls for it */
+static void submit_block() {
+  if (block_len == 0) {
+    return;
+  }
+  log_block_header_t header = {.sync = LOG_BLOCK_SYNC,
+                               .crc = 0,
+                               .seq = block_seq++,
+                               .len = (uint16_t)block_len,
+                               .flags = (uint16_t)((tier << LOG_BLOCK_TIER_SHIFT) & LOG_BLOCK_TIER_MASK)};
+  memcpy(block, &header, sizeof(header));
+  memset(&block[sizeof(header) + block_len], 0, LOG_BLOCK_PAYLOAD_SIZE - block_len);
+  header.crc = crc32_compute(&block[LOG_BLOCK_CRC_OFFSET], LOG_BLOCK_SIZE - LOG_BLOCK_CRC_OFFSET);
+  memcpy(block, &header, sizeof(header));
+  block_len = 0;
+
+  bool written;
+  if (options.use_lfs) {
+    written = lfs_file_write(&lfs, &flight_file, block, LOG_BLOCK_SIZE) == LOG_BLOCK_SIZE;
+    bytes_since_space_check += LOG_BLOCK_SIZE;
+  } else {
+    written = raw_partition_append(block, LOG_BLOCK_SIZE);
+  }
+  if (!written && !flash_full) {
+    printf("Block %u could not be written, the flash is full\n", header.seq);
+    flash_full = true;
+  }
+
+  const rec_storage_tier_e new_tier = written ? rec_tier_from_free_space(get_free_space()) : REC_TIER_CRITICAL;
+  if (new_tier > tier) {
+    printf("Storage tier %u from block %u on, %lu KiB free\n", new_tier, block_seq,
+           (unsigned long)get_free_space() / 1024);
+    tier = new_tier;
+  }
+}
+
+/* Same as in tasks/task_recorder.c */
+static uint32_t get_free_space() {
+  if (!options.use_lfs) {
+    return raw_partition_get_free();
+  }
+  if (bytes_since_space_check >= REC_SPACE_CHECK_INTERVAL) {
+    lfs_free_space = lfs_get_free_space();
+    bytes_since_space_check = 0;
+  }
+  return lfs_free_space > bytes_since_space_check ? lfs_free_space - bytes_since_space_check : 0;
+}
+
+/**
+ * Read the flight back and check every block.
+ *
+ * @param events - flight states and events which were recorded
+ * @param num_events - number of events
+ * @return true if all events are there and all records match the tiers of their blocks
+ */
+static bool check_log(const bench_event_t *events, uint32_t num_events) {
+  flight_file_t file;
+  if (flight_file_open(&file, BENCH_FLIGHT_NUMBER) != LFS_ERR_OK) {
+    printf("The flight can't be opened\n");
+    return false;
+  }
+  uint32_t num_blocks = 0;
+  uint32_t bad_blocks = 0;
+  uint32_t bad_records = 0;
+  uint32_t last_tier = REC_TIER_FULL;
+  uint32_t tier_errors = 0;
+  uint32_t found_events = 0;
+  bool found[REC_ID_MASK + 1] = {};
+  uint32_t records[NUM_REC_TYPES] = {};
+  uint8_t buf[LOG_BLOCK_SIZE];
+  while (flight_file_read(&file, buf, sizeof(buf)) == LOG_BLOCK_SIZE) {
+    log_block_header_t header;
+    memcpy(&header, buf, sizeof(header));
+    if (header.sync != LOG_BLOCK_SYNC || header.seq != num_blocks || header.len > LOG_BLOCK_PAYLOAD_SIZE ||
+        header.crc != crc32_compute(&buf[LOG_BLOCK_CRC_OFFSET], LOG_BLOCK_SIZE - LOG_BLOCK_CRC_OFFSET)) {
+      ++bad_blocks;
+      ++num_blocks;
+      continue;
+    }
+    ++num_blocks;
+    /* The tier is the one at the time the block was written, the records in it were taken at least with the tier of
+     * the previous block */
+    const uint32_t block_tier = (header.flags & LOG_BLOCK_TIER_MASK) >> LOG_BLOCK_TIER_SHIFT;
+    const uint32_t record_tier = last_tier;
+    if (block_tier < last_tier) {
+      ++tier_errors;
+    }
+    last_tier = block_tier;
+
+    uint32_t idx = sizeof(header);
+    while (idx < sizeof(header) + header.len) {
+      const uint32_t type_idx = buf[idx] >> 4;
+      const uint8_t id = buf[idx] & 0x0F;
+      if (type_idx >= NUM_REC_TYPES) {
+        ++bad_records;
+        break;
+      }
+      uint32_t tier_shift = 0;
+      if (!rec_tier_keeps(type_idx, (rec_storage_tier_e)record_tier, &tier_shift)) {
+        ++tier_errors;
+      }
+      ++records[type_idx];
+      uint32_t ts = 0;
+      memcpy(&ts, &buf[idx + 1], sizeof(ts));
+      if (id < num_events && events[id].type_idx == type_idx && get_event_time(&events[id]) == ts && !found[id]) {
+        found[id] = true;
+        ++found_events;
+      }
+      idx += bench_rec_sizes[type_idx];
+    }
+  }
+  flight_file_close(&file);
+
+  printf("Read back %u blocks: %u corrupted, %u bad records, %u records against their tier, %u of %u events\n",
+         num_blocks, bad_blocks, bad_records, tier_errors, found_events, num_events);
+  for (uint32_t i = 0; i < num_events; ++i) {
+    if (!found[i]) {
+      printf("Missing: %s\n", events[i].name);
+    }
+  }
+  printf("Records: IMU %u, MAGNETO %u, COVARIANCE_INFO %u, FLIGHT_STATE %u, EVENT_INFO %u\n", records[0], records[2],
+         records[8], records[7], records[10]);
+  return num_blocks == block_seq && bad_blocks == 0 && bad_records == 0 && tier_errors == 0 &&
+         found_events == num_events;
+}
@@ -0,0 +1,376 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "w25q_emu.h"
+#include "drivers/w25q.h"
+#include "util/cycle_counter.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/** Private Constants **/
+
+#define W25Q_EMU_PAGE_SIZE   256
+#define W25Q_EMU_SECTOR_SIZE 4096
+#define W25Q_EMU_BLOCK_SIZE  (64 * 1024)
+
+/* Write enable and read status register commands */
+#define W25Q_EMU_WRITE_ENABLE_CYCLES 8
+#define W25Q_EMU_READ_STATUS_CYCLES  16
+
+/** Exported Variables **/
+
+w25q_t w25q = {.id = W25QINVALID};
+
+/* Core clock of the target, used by the cycle counter below */
+uint32_t SystemCoreClock = 80000000;
+
+/* Instruction on 1 line, 32 bit address on 1 (program, erase) or 4 (read) lines, 6 dummy cycles for the quad read and
+ * the status polling the driver does after every command */
+const w25q_emu_config_t w25q_emu_typical = {
+    .jedec_id = 0xEF4019,
+    .qspi_clock_hz = 40000000,
+    .read_overhead_cycles = 8 + 8 + 6 + W25Q_EMU_READ_STATUS_CYCLES,
+    .program_overhead_cycles = W25Q_EMU_WRITE_ENABLE_CYCLES + 8 + 32 + W25Q_EMU_READ_STATUS_CYCLES,
+    .command_overhead_cycles = W25Q_EMU_WRITE_ENABLE_CYCLES + 8 + 32 + W25Q_EMU_READ_STATUS_CYCLES,
+    .page_program_us = 400,
+    .sector_erase_us = 45000,
+    .block_erase_32k_us = 120000,
+    .block_erase_64k_us = 150000,
+    .chip_erase_ms = 80000,
+};
+
+const w25q_emu_config_t w25q_emu_worst_case = {
+    .jedec_id = 0xEF4019,
+    .qspi_clock_hz = 40000000,
+    .read_overhead_cycles = 8 + 8 + 6 + W25Q_EMU_READ_STATUS_CYCLES,
+    .program_overhead_cycles = W25Q_EMU_WRITE_ENABLE_CYCLES + 8 + 32 + W25Q_EMU_READ_STATUS_CYCLES,
+    .command_overhead_cycles = W25Q_EMU_WRITE_ENABLE_CYCLES + 8 + 32 + W25Q_EMU_READ_STATUS_CYCLES,
+    .page_program_us = 3000,
+    .sector_erase_us = 400000,
+    .block_erase_32k_us = 1600000,
+    .block_erase_64k_us = 2000000,
+    .chip_erase_ms = 400000,
+};
+
+/** Private Variables **/
+
+static w25q_emu_config_t emu_config;
+static w25q_emu_stats_t emu_stats;
+static uint8_t *emu_memory = NULL;
+static uint32_t emu_capacity = 0;
+static bool emu_mapped = false;
+static uint32_t emu_next_read_addr = 0;
+static uint32_t emu_next_program_addr = 0;
+/* Simulated time which is not reset with the statistics */
+static uint64_t emu_clock_ns = 0;
+
+/** Private Function Declarations **/
+
+static uint32_t capacity_from_id(uint32_t jedec_id);
+static uint64_t cycles_to_ns(uint64_t cycles);
+static void account(uint64_t *bucket, uint64_t ns);
+static w25q_status_e erase(uint32_t addr, uint32_t size, uint64_t busy_ns);
+
+/** Exported Function Definitions **/
+
+bool w25q_emu_open(const w25q_emu_config_t *config, const char *image_path) {
+  w25q_emu_close();
+  emu_config = *config;
+  emu_capacity = capacity_from_id(config->jedec_id);
+  if (emu_capacity == 0) {
+    return false;
+  }
+
+  if (image_path == NULL) {
+    emu_memory = malloc(emu_capacity);
+    if (emu_memory == NULL) {
+      return false;
+    }
+    memset(emu_memory, 0xFF, emu_capacity);
+    emu_mapped = false;
+  } else {
+    const int fd = open(image_path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat st;
+    const bool is_new = fstat(fd, &st) == 0 && st.st_size == 0;
+    if (ftruncate(fd, emu_capacity) != 0) {
+      close(fd);
+      return false;
+    }
+    void *mapping = mmap(NULL, emu_capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+      return false;
+    }
+    emu_memory = mapping;
+    emu_mapped = true;
+    if (is_new) {
+      memset(emu_memory, 0xFF, emu_capacity);
+    }
+  }
+  w25q_emu_reset_stats();
+  return true;
+}
+
+void w25q_emu_close(void) {
+  if (emu_memory == NULL) {
+    return;
+  }
+  if (emu_mapped) {
+    msync(emu_memory, emu_capacity, MS_SYNC);
+    munmap(emu_memory, emu_capacity);
+  } else {
+    free(emu_memory);
+  }
+  emu_memory = NULL;
+}
+
+const w25q_emu_stats_t *w25q_emu_get_stats(void) { return &emu_stats; }
+
+void w25q_emu_reset_stats(void) { memset(&emu_stats, 0, sizeof(emu_stats)); }
+
+uint8_t *w25q_emu_get_memory(void) { return emu_memory; }
+
+/* The cycle counter of the host builds counts the simulated flash time only, the time spent on the CPU is not part of
+ * the emulation */
+void cycle_counter_init() {}
+
+uint32_t cycle_counter_get() { return (uint32_t)(emu_clock_ns * (SystemCoreClock / 1000000U) / 1000U); }
+
+/* The same chip description as the real driver derives from the JEDEC ID */
+w25q_status_e w25q_init(void) {
+  if (emu_memory == NULL) {
+    return W25Q_ERR_INIT;
+  }
+  uint32_t device_id = 0;
+  w25q_read_id(&device_id);
+  switch (device_id & 0x0000FFFF) {
+    case 0x4020:
+      w25q.id = W25Q512;
+      break;
+    case 0x4019:
+      w25q.id = W25Q256;
+      break;
+    case 0x4018:
+      w25q.id = W25Q128;
+      break;
+    case 0x4017:
+      w25q.id = W25Q64;
+      break;
+    case 0x4016:
+      w25q.id = W25Q32;
+      break;
+    default:
+      return W25Q_ERR_INIT;
+  }
+  w25q.block_count = emu_capacity / W25Q_EMU_BLOCK_SIZE;
+  w25q.page_size = W25Q_EMU_PAGE_SIZE;
+  w25q.sector_size = W25Q_EMU_SECTOR_SIZE;
+  w25q.sector_count = w25q.block_count * 16;
+  w25q.page_count = (w25q.sector_count * w25q.sector_size) / w25q.page_size;
+  w25q.block_size = w25q.sector_size * 16;
+  w25q.capacity_in_kilobytes = (w25q.sector_count * w25q.sector_size) / 1024;
+  return W25Q_OK;
+}
+
+w25q_status_e w25q_reset(void) {
+  account(&emu_stats.time_ns, cycles_to_ns(16));
+  return W25Q_OK;
+}
+
+w25q_status_e w25q_read_id(uint32_t *device_id) {
+  account(&emu_stats.time_ns, cycles_to_ns(8 + 24));
+  *device_id = emu_config.jedec_id;
+  return W25Q_OK;
+}
+
+w25q_status_e w25q_sector_erase(uint32_t sector_idx) {
+  ++emu_stats.sector_erases;
+  return erase(sector_idx * W25Q_EMU_SECTOR_SIZE, W25Q_EMU_SECTOR_SIZE, emu_config.sector_erase_us * 1000ULL);
+}
+
+/* Like the driver this erases the first half of the 64K block */
+w25q_status_e w25q_block_erase_32k(uint32_t block_idx) {
+  ++emu_stats.block_erases;
+  return erase(block_idx * W25Q_EMU_BLOCK_SIZE, 32 * 1024, emu_config.block_erase_32k_us * 1000ULL);
+}
+
+w25q_status_e w25q_block_erase_64k(uint32_t block_idx) {
+  ++emu_stats.block_erases;
+  return erase(block_idx * W25Q_EMU_BLOCK_SIZE, W25Q_EMU_BLOCK_SIZE, emu_config.block_erase_64k_us * 1000ULL);
+}
+
+w25q_status_e w25q_chip_erase(void) {
+  ++emu_stats.chip_erases;
+  return erase(0, emu_capacity, emu_config.chip_erase_ms * 1000000ULL);
+}
+
+w25q_status_e w25q_write_page(uint8_t *buf, uint32_t write_addr, uint16_t num_bytes_to_write) {
+  if (write_addr >= emu_capacity || num_bytes_to_write > W25Q_EMU_PAGE_SIZE) {
+    return W25Q_ERR_INVALID_PARAM;
+  }
+  /* the address wraps around at the end of the page */
+  const uint32_t page_start = write_addr & ~(uint32_t)(W25Q_EMU_PAGE_SIZE - 1);
+  uint32_t offset = write_addr - page_start;
+  for (uint32_t i = 0; i < num_bytes_to_write; ++i) {
+    uint8_t *cell = &emu_memory[page_start + offset];
+    if ((*cell & buf[i]) != buf[i]) {
+      ++emu_stats.program_violations;
+    }
+    *cell &= buf[i];
+    offset = (offset + 1) % W25Q_EMU_PAGE_SIZE;
+  }
+
+  if (write_addr != emu_next_program_addr) {
+    ++emu_stats.program_jumps;
+  }
+  emu_next_program_addr = write_addr + num_bytes_to_write;
+  ++emu_stats.page_programs;
+  emu_stats.bytes_programmed += num_bytes_to_write;
+  account(&emu_stats.program_ns, cycles_to_ns(emu_config.program_overhead_cycles + 2ULL * num_bytes_to_write) +
+                                     emu_config.page_program_us * 1000ULL);
+  return W25Q_OK;
+}
+
+/* Same page splitting as the driver, which also sends an extra write enable and status poll per page */
+w25q_status_e w25q_write_buffer(uint8_t *buf, uint32_t write_addr, uint32_t num_bytes_to_write) {
+  if (write_addr + num_bytes_to_write > emu_capacity) {
+    return W25Q_ERR_INVALID_PARAM;
+  }
+  uint32_t current_size = W25Q_EMU_PAGE_SIZE - (write_addr % W25Q_EMU_PAGE_SIZE);
+  if (current_size > num_bytes_to_write) {
+    current_size = num_bytes_to_write;
+  }
+  uint32_t current_addr = write_addr;
+  const uint32_t end_addr = write_addr + num_bytes_to_write;
+  while (current_addr < end_addr) {
+    account(&emu_stats.program_ns, cycles_to_ns(W25Q_EMU_WRITE_ENABLE_CYCLES + W25Q_EMU_READ_STATUS_CYCLES));
+    const w25q_status_e err = w25q_write_page(buf, current_addr, (uint16_t)current_size);
+    if (err != W25Q_OK) {
+      return err;
+    }
+    current_addr += current_size;
+    buf += current_size;
+    current_size = ((current_addr + W25Q_EMU_PAGE_SIZE) > end_addr) ? (end_addr - current_addr) : W25Q_EMU_PAGE_SIZE;
+  }
+  return W25Q_OK;
+}
+
+w25q_status_e w25q_read_buffer(uint8_t *buf, uint32_t read_addr, uint32_t num_bytes_to_read) {
+  if (read_addr + num_bytes_to_read > emu_capacity) {
+    return W25Q_ERR_INVALID_PARAM;
+  }
+  memcpy(buf, &emu_memory[read_addr], num_bytes_to_read);
+  if (read_addr != emu_next_read_addr) {
+    ++emu_stats.read_jumps;
+  }
+  emu_next_read_addr = read_addr + num_bytes_to_read;
+  ++emu_stats.reads;
+  emu_stats.bytes_read += num_bytes_to_read;
+  account(&emu_stats.read_ns, cycles_to_ns(emu_config.read_overhead_cycles + 2ULL * num_bytes_to_read));
+  return W25Q_OK;
+}
+
+w25q_status_e w25q_read_status_reg(uint8_t status_reg_num, uint8_t *status_reg_val) {
+  if (status_reg_num < 1 || status_reg_num > 3) {
+    return W25Q_ERR_INVALID_PARAM;
+  }
+  account(&emu_stats.time_ns, cycles_to_ns(W25Q_EMU_READ_STATUS_CYCLES));
+  /* never busy, the busy time is accounted for in the commands */
+  *status_reg_val = 0;
+  return W25Q_OK;
+}
+
+/* The busy time of every operation is accounted for when it is issued, see tools/flash_emu/qspi_mock.h for the
+ * background operations of the real driver */
+w25q_status_e w25q_sync(void) { return W25Q_OK; }
+
+bool w25q_is_busy(void) { return false; }
+
+/* The data is read through the window at the speed of the bus, without the command overhead of w25q_read_buffer() */
+const uint8_t *w25q_map(uint32_t addr, uint32_t len) {
+  if (len > emu_capacity || addr > emu_capacity - len) {
+    return NULL;
+  }
+  ++emu_stats.reads;
+  emu_stats.bytes_read += len;
+  account(&emu_stats.read_ns, cycles_to_ns(2ULL * len));
+  return &emu_memory[addr];
+}
+
+uint32_t w25q_sector_to_page(uint32_t sector_idx) { return (sector_idx * w25q.sector_size) / w25q.page_size; }
+
+uint32_t w25q_block_to_page(uint32_t block_idx) { return (block_idx * w25q.block_size) / w25q.page_size; }
+
+bool w25q_is_sector_empty(uint32_t sector_idx) {
+  /* the driver reads the sector in chunks of 32 bytes */
+  uint8_t chunk[32];
+  const uint32_t start = sector_idx * W25Q_EMU_SECTOR_SIZE;
+  for (uint32_t i = 0; i < W25Q_EMU_SECTOR_SIZE; i += sizeof(chunk)) {
+    if (w25q_read_buffer(chunk, start + i, sizeof(chunk)) != W25Q_OK) {
+      return false;
+    }
+    for (uint32_t j = 0; j < sizeof(chunk); ++j) {
+      if (chunk[j] != 0xFF) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+/** Private Function Definitions **/
+
+static uint32_t capacity_from_id(uint32_t jedec_id) {
+  /* the lower byte is log2 of the capacity in bytes */
+  const uint32_t log2_capacity = jedec_id & 0xFF;
+  if (log2_capacity < 0x15 || log2_capacity > 0x20) {
+    return 0;
+  }
+  /* W25Q512 (0x20) would be 4 GiB according to this, the chip has 64 MiB */
+  return log2_capacity == 0x20 ? 64U * 1024 * 1024 : 1U << log2_capacity;
+}
+
+static uint64_t cycles_to_ns(uint64_t cycles) { return cycles * 1000000000ULL / emu_config.qspi_clock_hz; }
+
+static void account(uint64_t *bucket, uint64_t ns) {
+  if (bucket != &emu_stats.time_ns) {
+    *bucket += ns;
+  }
+  emu_stats.time_ns += ns;
+  emu_clock_ns += ns;
+  if (ns > emu_stats.max_op_ns) {
+    emu_stats.max_op_ns = ns;
+  }
+}
+
+static w25q_status_e erase(uint32_t addr, uint32_t size, uint64_t busy_ns) {
+  if (addr + size > emu_capacity || addr % size != 0) {
+    return W25Q_ERR_INVALID_PARAM;
+  }
+  memset(&emu_memory[addr], 0xFF, size);
+  account(&emu_stats.erase_ns, cycles_to_ns(emu_config.command_overhead_cycles) + busy_ns);
+  return W25Q_OK;
+}
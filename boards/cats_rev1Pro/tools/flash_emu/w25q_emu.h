@@ -0,0 +1,96 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host emulation of the W25Q flash driver (drivers/w25q.h).
+ *
+ * The flash content is kept in RAM or in a memory mapped image file and follows the NOR semantics of the real chip:
+ * programming can only clear bits, erasing sets a whole sector/block to 0xFF and a page program wraps around at the
+ * end of the 256 byte page. Every operation advances a simulated clock according to a latency model, so LittleFS and
+ * the recorder write pattern can be benchmarked on a PC with the timings of the real hardware.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Exported Types **/
+
+typedef struct {
+  uint32_t jedec_id; /* e.g. 0xEF4019 for the W25Q256 */
+  /* QSPI clock and the bus cycles spent on instruction, address and dummy phases */
+  uint32_t qspi_clock_hz;
+  uint32_t read_overhead_cycles;
+  uint32_t program_overhead_cycles;
+  uint32_t command_overhead_cycles;
+  /* busy times of the chip */
+  uint32_t page_program_us;
+  uint32_t sector_erase_us;
+  uint32_t block_erase_32k_us;
+  uint32_t block_erase_64k_us;
+  uint32_t chip_erase_ms;
+} w25q_emu_config_t;
+
+typedef struct {
+  uint64_t time_ns; /* simulated time spent in the driver */
+  uint64_t read_ns;
+  uint64_t program_ns;
+  uint64_t erase_ns;
+  uint64_t bytes_read;
+  uint64_t bytes_programmed;
+  uint32_t reads;
+  uint32_t page_programs;
+  uint32_t sector_erases;
+  uint32_t block_erases;
+  uint32_t chip_erases;
+  /* page programs which tried to set a bit from 0 to 1, i.e. writes to flash which wasn't erased */
+  uint32_t program_violations;
+  /* reads and programs which didn't continue where the previous one ended */
+  uint32_t read_jumps;
+  uint32_t program_jumps;
+  uint64_t max_op_ns; /* longest single flash operation */
+} w25q_emu_stats_t;
+
+/** Exported Variables **/
+
+/* Typical and maximum timings of the W25Q256JV datasheet at the QSPI clock of the board (80 MHz / 2) */
+extern const w25q_emu_config_t w25q_emu_typical;
+extern const w25q_emu_config_t w25q_emu_worst_case;
+
+/** Exported Functions **/
+
+/**
+ * Set up the emulated chip. Has to be called before w25q_init().
+ *
+ * @param config - timing model and chip ID; copied
+ * @param image_path - file which backs the flash content; NULL to keep it in RAM. A new file is created erased.
+ * @return true if successful
+ */
+bool w25q_emu_open(const w25q_emu_config_t *config, const char *image_path);
+
+/** Release the flash content, an image file is written back. **/
+void w25q_emu_close(void);
+
+/** Statistics since the last w25q_emu_reset_stats(). **/
+const w25q_emu_stats_t *w25q_emu_get_stats(void);
+
+void w25q_emu_reset_stats(void);
+
+/** Raw access to the flash content, e.g. to inject bit errors. **/
+uint8_t *w25q_emu_get_memory(void);
@@ -0,0 +1,131 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Downloads flights from the board over USB with the binary transfer protocol (src/util/flight_transfer.h). With -r an
+ * existing output file is resumed from its current size.
+ *
+ *   cats_download [-d <device>] [-o <output>] [-r] <flight_number> [<flight_number> ...]
+ */
+
+#include "xfer_host.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/** Private Function Declarations **/
+
+static double time_s(void);
+
+/** Exported Function Definitions **/
+
+int main(int argc, char **argv) {
+  const char *device = "/dev/ttyACM0";
+  const char *output = NULL;
+  bool resume = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "d:o:r")) != -1) {
+    switch (opt) {
+      case 'd':
+        device = optarg;
+        break;
+      case 'o':
+        output = optarg;
+        break;
+      case 'r':
+        resume = true;
+        break;
+      default:
+        optind = argc + 1;
+        break;
+    }
+  }
+  if (optind >= argc || (output != NULL && argc - optind > 1)) {
+    fprintf(stderr,
+            "usage: %s [-d <device>] [-o <output>] [-r] <flight_number> [<flight_number> ...]\n"
+            "  -d  serial device of the board, default /dev/ttyACM0\n"
+            "  -o  output file, only for a single flight; default flight_XXXXX\n"
+            "  -r  resume the download into an existing output file\n",
+            argv[0]);
+    return 1;
+  }
+
+  const int fd = xfer_open_serial(device);
+  if (fd < 0) {
+    fprintf(stderr, "Can't open %s\n", device);
+    return 1;
+  }
+
+  int ret = 0;
+  for (int i = optind; i < argc; ++i) {
+    if (i > optind) {
+      /* the board listens for lost end frames for a moment before it returns to the CLI */
+      usleep(2 * XFER_ACK_TIMEOUT * 1000);
+    }
+    const uint32_t flight_number = (uint32_t)strtoul(argv[i], NULL, 10);
+    char path[64];
+    if (output == NULL) {
+      snprintf(path, sizeof(path), "flight_%05u", flight_number);
+    } else {
+      snprintf(path, sizeof(path), "%s", output);
+    }
+
+    uint32_t offset = 0;
+    struct stat st;
+    if (resume && stat(path, &st) == 0) {
+      offset = (uint32_t)st.st_size;
+    }
+    FILE *out = fopen(path, offset > 0 ? "r+b" : "wb");
+    if (out == NULL) {
+      fprintf(stderr, "Can't open %s\n", path);
+      ret = 1;
+      continue;
+    }
+
+    xfer_rx_stats_t stats;
+    const double start = time_s();
+    const xfer_error_e result = xfer_receive_file(fd, flight_number, offset, out, 0, &stats);
+    const double duration = time_s() - start;
+    fclose(out);
+
+    if (result == XFER_OK) {
+      printf("%s: %u bytes%s in %.2f s (%.0f KiB/s), %u NAKs, %u timeouts, %u corrupted frames\n", path,
+             stats.file_size, offset > 0 ? " (resumed)" : "", duration, stats.bytes_received / 1024.0 / duration,
+             stats.naks_sent, stats.timeouts, stats.bad_frames);
+    } else {
+      fprintf(stderr, "%s: download failed after %u bytes: %s%s\n", path, offset + stats.bytes_received,
+              xfer_error_string(result), result == XFER_ERR_TIMEOUT ? ", resume it with -r" : "");
+      ret = 1;
+    }
+  }
+
+  close(fd);
+  return ret;
+}
+
+/** Private Function Definitions **/
+
+static double time_s(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,302 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "xfer_host.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+/** Private Constants **/
+
+/* Room for a few frames and the text the CLI prints before the transfer starts */
+#define RX_BUFFER_SIZE (4 * XFER_MAX_FRAME_SIZE)
+
+/* Acknowledge after half of the window so the board never has to wait for an acknowledgement */
+#define ACK_INTERVAL (XFER_WINDOW / 2)
+
+/** Private Types **/
+
+typedef struct {
+  int fd;
+  FILE *out;
+  uint32_t start_offset;
+  uint32_t expected; /* end of the data received without gaps */
+  uint32_t abort_after;
+  bool have_info;
+  bool nak_pending;   /* a NAK was sent and the board didn't resend the data yet */
+  uint32_t since_ack; /* data frames since the last acknowledgement */
+  xfer_rx_stats_t *stats;
+} receiver_t;
+
+/** Private Function Declarations **/
+
+static bool send_frame(int fd, uint8_t type, uint32_t offset);
+static bool write_all(int fd, const void *data, size_t len);
+static bool handle_frame(receiver_t *rx, const xfer_frame_header_t *header, const uint8_t *payload,
+                         xfer_error_e *result);
+
+/** Exported Function Definitions **/
+
+int xfer_open_serial(const char *path) {
+  const int fd = open(path, O_RDWR | O_NOCTTY);
+  if (fd < 0) {
+    return -1;
+  }
+  struct termios tty;
+  if (tcgetattr(fd, &tty) != 0) {
+    close(fd);
+    return -1;
+  }
+  cfmakeraw(&tty);
+  /* the baud rate doesn't matter for a CDC device */
+  cfsetispeed(&tty, B115200);
+  cfsetospeed(&tty, B115200);
+  tty.c_cc[VMIN] = 0;
+  tty.c_cc[VTIME] = 0;
+  if (tcsetattr(fd, TCSANOW, &tty) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+xfer_error_e xfer_receive_file(int fd, uint32_t flight_number, uint32_t offset, FILE *out, uint32_t abort_after,
+                               xfer_rx_stats_t *stats) {
+  memset(stats, 0, sizeof(*stats));
+  receiver_t rx = {.fd = fd,
+                   .out = out,
+                   .start_offset = offset,
+                   .expected = offset,
+                   .abort_after = abort_after,
+                   .stats = stats};
+  if (fseek(out, offset, SEEK_SET) != 0) {
+    return XFER_ERR_BAD_OFFSET;
+  }
+
+  /* whatever the board sent before belongs to an earlier session */
+  tcflush(fd, TCIFLUSH);
+  /* the leading CR terminates anything a previous session left in the command line of the CLI */
+  char command[64];
+  const int command_len = snprintf(command, sizeof(command), "\rflight_dump %u %u\r", flight_number, offset);
+  if (!write_all(fd, command, (size_t)command_len)) {
+    return XFER_ERR_SEND;
+  }
+
+  static uint8_t rx_buf[RX_BUFFER_SIZE];
+  xfer_parser_t parser;
+  xfer_parser_init(&parser, rx_buf, sizeof(rx_buf));
+
+  xfer_error_e result = XFER_ERR_TIMEOUT;
+  uint32_t timeouts = 0;
+  while (timeouts <= XFER_HOST_MAX_TIMEOUTS) {
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    const int ready = poll(&pfd, 1, XFER_HOST_TIMEOUT);
+    if (ready < 0 && errno != EINTR) {
+      result = XFER_ERR_SEND;
+      break;
+    }
+
+    bool got_frame = false;
+    if (ready > 0) {
+      uint8_t *space = NULL;
+      const uint32_t space_len = xfer_parser_space(&parser, &space);
+      const ssize_t len = read(fd, space, space_len);
+      if (len < 0 && errno != EAGAIN && errno != EINTR) {
+        result = XFER_ERR_SEND;
+        break;
+      }
+      xfer_parser_commit(&parser, len > 0 ? (uint32_t)len : 0);
+
+      xfer_frame_header_t header;
+      const uint8_t *payload = NULL;
+      while (xfer_parser_next(&parser, &header, &payload)) {
+        got_frame = true;
+        ++stats->frames_received;
+        if (handle_frame(&rx, &header, payload, &result)) {
+          stats->bad_frames = parser.bad_frames;
+          stats->skipped_bytes = parser.skipped_bytes;
+          return result;
+        }
+      }
+      if (parser.bad_frames > stats->bad_frames) {
+        /* a corrupted frame is most likely the next one we need */
+        stats->bad_frames = parser.bad_frames;
+        if (rx.have_info && !rx.nak_pending) {
+          send_frame(fd, XFER_FRAME_NAK, rx.expected);
+          ++stats->naks_sent;
+          rx.nak_pending = true;
+        }
+      }
+    }
+
+    if (got_frame) {
+      timeouts = 0;
+    } else if (ready == 0) {
+      ++timeouts;
+      ++stats->timeouts;
+      if (rx.have_info) {
+        /* ask for everything after the received data again */
+        send_frame(fd, XFER_FRAME_NAK, rx.expected);
+        ++stats->naks_sent;
+        rx.nak_pending = true;
+      }
+    }
+  }
+  stats->bad_frames = parser.bad_frames;
+  stats->skipped_bytes = parser.skipped_bytes;
+  return result;
+}
+
+const char *xfer_error_string(uint32_t error) {
+  switch (error) {
+    case XFER_OK:
+      return "ok";
+    case XFER_ERR_NOT_FOUND:
+      return "flight not found";
+    case XFER_ERR_BUSY:
+      return "the recorder is active";
+    case XFER_ERR_NO_MEMORY:
+      return "out of memory";
+    case XFER_ERR_READ:
+      return "reading the flight failed";
+    case XFER_ERR_SEND:
+      return "communication error";
+    case XFER_ERR_TIMEOUT:
+      return "timeout";
+    case XFER_ERR_ABORTED:
+      return "aborted";
+    case XFER_ERR_BAD_OFFSET:
+      return "offset past the end of the flight";
+    case XFER_ERR_PROTOCOL:
+      return "protocol error";
+    default:
+      return "unknown error";
+  }
+}
+
+/** Private Function Definitions **/
+
+/**
+ * Process a frame from the board.
+ *
+ * @param rx - receiver state
+ * @param header - frame header
+ * @param payload - frame payload
+ * @param result[out] - result of the transfer if it ended
+ * @return true if the transfer ended
+ */
+static bool handle_frame(receiver_t *rx, const xfer_frame_header_t *header, const uint8_t *payload,
+                         xfer_error_e *result) {
+  xfer_rx_stats_t *stats = rx->stats;
+  switch (header->type) {
+    case XFER_FRAME_INFO: {
+      xfer_info_t info;
+      if (header->len < sizeof(info)) {
+        *result = XFER_ERR_PROTOCOL;
+        return true;
+      }
+      memcpy(&info, payload, sizeof(info));
+      if (info.start_offset != rx->start_offset) {
+        *result = XFER_ERR_PROTOCOL;
+        return true;
+      }
+      stats->file_size = info.file_size;
+      rx->have_info = true;
+    } break;
+    case XFER_FRAME_DATA: {
+      if (!rx->have_info) {
+        /* data of an earlier transfer */
+        break;
+      }
+      if (header->offset == rx->expected && rx->expected + header->len <= stats->file_size) {
+        if (fwrite(payload, 1, header->len, rx->out) != header->len) {
+          send_frame(rx->fd, XFER_FRAME_ABORT, rx->expected);
+          *result = XFER_ERR_READ;
+          return true;
+        }
+        rx->expected += header->len;
+        stats->bytes_received += header->len;
+        rx->nak_pending = false;
+        if (rx->abort_after > 0 && stats->bytes_received >= rx->abort_after) {
+          send_frame(rx->fd, XFER_FRAME_ABORT, rx->expected);
+          *result = XFER_ERR_ABORTED;
+          return true;
+        }
+      } else if (header->offset > rx->expected) {
+        /* a frame was lost, go back to the gap right away instead of waiting for the timeout */
+        if (!rx->nak_pending) {
+          send_frame(rx->fd, XFER_FRAME_NAK, rx->expected);
+          ++stats->naks_sent;
+          rx->nak_pending = true;
+        }
+        break;
+      }
+      /* duplicates count as well, the board resends them if an acknowledgement was lost */
+      if (++rx->since_ack >= ACK_INTERVAL || rx->expected == stats->file_size) {
+        send_frame(rx->fd, XFER_FRAME_ACK, rx->expected);
+        ++stats->acks_sent;
+        rx->since_ack = 0;
+      }
+    } break;
+    case XFER_FRAME_END:
+      if (rx->have_info && rx->expected == stats->file_size) {
+        *result = XFER_OK;
+        return true;
+      }
+      break;
+    case XFER_FRAME_ERROR: {
+      xfer_error_t error = {.error = XFER_ERR_PROTOCOL};
+      if (header->len >= sizeof(error)) {
+        memcpy(&error, payload, sizeof(error));
+      }
+      stats->board_error = error.error;
+      *result = (xfer_error_e)error.error;
+      return true;
+    }
+    default:
+      break;
+  }
+  return false;
+}
+
+static bool send_frame(int fd, uint8_t type, uint32_t offset) {
+  uint8_t frame[XFER_FRAME_OVERHEAD];
+  const uint32_t len = xfer_finish_frame(frame, type, 0, offset, 0);
+  return write_all(fd, frame, len);
+}
+
+static bool write_all(int fd, const void *data, size_t len) {
+  const uint8_t *bytes = (const uint8_t *)data;
+  while (len > 0) {
+    const ssize_t written = write(fd, bytes, len);
+    if (written < 0) {
+      if (errno == EINTR || errno == EAGAIN) {
+        continue;
+      }
+      return false;
+    }
+    bytes += written;
+    len -= (size_t)written;
+  }
+  return true;
+}
@@ -0,0 +1,79 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host side of the binary flight download, see src/util/flight_transfer.h.
+ */
+
+#pragma once
+
+#include "util/flight_transfer.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+/** Exported Defines **/
+
+/* The receiver asks the board to continue from the received offset if no frame arrives for this long */
+#define XFER_HOST_TIMEOUT 200
+/* Give up if no frame arrives for this many timeouts in a row */
+#define XFER_HOST_MAX_TIMEOUTS 15
+
+/** Exported Types **/
+
+typedef struct {
+  uint32_t file_size;
+  uint32_t bytes_received; /* payload bytes written to the output in this session */
+  uint32_t frames_received;
+  uint32_t acks_sent;
+  uint32_t naks_sent;
+  uint32_t timeouts;
+  uint32_t bad_frames;    /* frames with a wrong CRC */
+  uint32_t skipped_bytes; /* bytes outside of valid frames */
+  uint32_t board_error;   /* xfer_error_e reported by the board */
+} xfer_rx_stats_t;
+
+/** Exported Functions **/
+
+/**
+ * Open a serial port in raw mode.
+ *
+ * @param path - device, e.g. /dev/ttyACM0
+ * @return file descriptor, -1 on error
+ */
+int xfer_open_serial(const char *path);
+
+/**
+ * Start a flight download on the board and receive the file.
+ *
+ * @param fd - serial port
+ * @param flight_number - flight to download
+ * @param offset - offset at which the download starts; the output is written from this offset on
+ * @param out - output file
+ * @param abort_after - cancel the transfer after this many bytes, 0 to receive the whole file
+ * @param stats[out] - transfer statistics
+ * @return XFER_OK if the whole file was received
+ */
+xfer_error_e xfer_receive_file(int fd, uint32_t flight_number, uint32_t offset, FILE *out, uint32_t abort_after,
+                               xfer_rx_stats_t *stats);
+
+/**
+ * @param error - xfer_error_e
+ * @return description of the error
+ */
+const char *xfer_error_string(uint32_t error);
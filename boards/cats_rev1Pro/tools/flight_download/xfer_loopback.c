@@ -0,0 +1,308 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Loopback test of the flight download over a pseudo terminal. The board side (src/util/flight_transfer.c) runs in a
+ * thread on the master side of the pty and serves a random file, the receiver (xfer_host.c) downloads it through the
+ * slave side exactly like from the board. The board side can drop and corrupt frames and write text between them.
+ *
+ * The scenarios are a clean transfer, a transfer with faults and an aborted transfer which is resumed; the received
+ * file is compared with the original after each of them.
+ *
+ *   xfer_loopback [-s <file size>] [-p <fault probability in percent>] [-x <seed>]
+ */
+
+#define _GNU_SOURCE
+
+#include "xfer_host.h"
+#include "util/crc32.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/** Private Types **/
+
+typedef struct {
+  int fd;
+  const uint8_t *data;
+  uint32_t size;
+  uint32_t fault_percent;
+  uint32_t rng;
+  /* injected faults */
+  uint32_t dropped;
+  uint32_t corrupted;
+  uint32_t text;
+  xfer_stats_t stats;
+  xfer_error_e result;
+} board_t;
+
+/** Private Function Declarations **/
+
+static void *board_thread(void *arg);
+static int32_t board_read(void *ctx, uint32_t offset, uint8_t *buf, uint32_t len);
+static bool board_send(void *ctx, const uint8_t *buf, uint32_t len);
+static uint32_t board_receive(void *ctx, uint8_t *buf, uint32_t len, uint32_t timeout);
+static uint32_t board_get_time(void *ctx);
+static uint32_t next_random(uint32_t *state);
+static bool run_scenario(const char *name, int master, const char *slave_path, const uint8_t *data, uint32_t size,
+                         uint32_t fault_percent, uint32_t seed);
+static bool run_transfer(board_t *board, int slave, FILE *out, uint32_t offset, uint32_t abort_after,
+                         xfer_error_e *result, double *duration);
+static double time_s(void);
+
+/** Exported Function Definitions **/
+
+int main(int argc, char **argv) {
+  uint32_t size = 1024 * 1024;
+  uint32_t fault_percent = 2;
+  uint32_t seed = 1;
+  int opt;
+  while ((opt = getopt(argc, argv, "s:p:x:")) != -1) {
+    switch (opt) {
+      case 's':
+        size = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      case 'p':
+        fault_percent = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      case 'x':
+        seed = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-s <file size>] [-p <fault probability in percent>] [-x <seed>]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  const int master = posix_openpt(O_RDWR | O_NOCTTY);
+  if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+    fprintf(stderr, "Can't create a pseudo terminal\n");
+    return 1;
+  }
+  const char *slave_path = ptsname(master);
+
+  uint8_t *data = malloc(size);
+  uint32_t rng = seed;
+  for (uint32_t i = 0; i < size; ++i) {
+    data[i] = (uint8_t)next_random(&rng);
+  }
+
+  bool ok = true;
+  ok &= run_scenario("clean", master, slave_path, data, size, 0, seed);
+  ok &= run_scenario("faults", master, slave_path, data, size, fault_percent, seed);
+  ok &= run_scenario("resume", master, slave_path, data, size, 0, seed);
+  ok &= run_scenario("empty", master, slave_path, data, 0, 0, seed);
+  ok &= run_scenario("unaligned", master, slave_path, data, size > 1000 ? size - 1000 : size, fault_percent, seed);
+
+  free(data);
+  close(master);
+  printf("%s\n", ok ? "All transfers passed" : "Some transfers FAILED");
+  return ok ? 0 : 1;
+}
+
+/** Private Function Definitions **/
+
+static bool run_scenario(const char *name, int master, const char *slave_path, const uint8_t *data, uint32_t size,
+                         uint32_t fault_percent, uint32_t seed) {
+  const int slave = xfer_open_serial(slave_path);
+  FILE *out = tmpfile();
+  if (slave < 0 || out == NULL) {
+    fprintf(stderr, "%s: can't open the pty or the output file\n", name);
+    return false;
+  }
+  board_t board = {.fd = master, .data = data, .size = size, .fault_percent = fault_percent, .rng = seed};
+
+  bool ok = true;
+  xfer_error_e result = XFER_OK;
+  double duration = 0;
+  uint32_t offset = 0;
+  if (strcmp(name, "resume") == 0) {
+    /* cancel half way and continue from the received size */
+    ok = run_transfer(&board, slave, out, 0, size / 2, &result, &duration) && result == XFER_ERR_ABORTED;
+    fflush(out);
+    fseek(out, 0, SEEK_END);
+    offset = (uint32_t)ftell(out);
+  }
+  ok = ok && run_transfer(&board, slave, out, offset, 0, &result, &duration) && result == XFER_OK;
+
+  /* compare with the original */
+  fflush(out);
+  fseek(out, 0, SEEK_END);
+  const long received_size = ftell(out);
+  uint8_t *received = malloc(size > 0 ? size : 1);
+  fseek(out, 0, SEEK_SET);
+  ok = ok && received_size == (long)size && fread(received, 1, size, out) == size && memcmp(received, data, size) == 0;
+
+  printf("%-10s %s: %u bytes from offset %u in %.2f s (%.0f KiB/s), board: %s, %u frames, %u bytes resent, %u NAKs, "
+         "%u timeouts; injected: %u dropped, %u corrupted, %u text\n",
+         name, ok ? "ok    " : "FAILED", size, offset, duration, (size - offset) / 1024.0 / duration,
+         xfer_error_string(board.result), board.stats.frames_sent, board.stats.bytes_resent, board.stats.naks,
+         board.stats.timeouts, board.dropped, board.corrupted, board.text);
+
+  free(received);
+  fclose(out);
+  close(slave);
+  return ok;
+}
+
+static bool run_transfer(board_t *board, int slave, FILE *out, uint32_t offset, uint32_t abort_after,
+                         xfer_error_e *result, double *duration) {
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, board_thread, board) != 0) {
+    return false;
+  }
+  xfer_rx_stats_t stats;
+  const double start = time_s();
+  *result = xfer_receive_file(slave, 0, offset, out, abort_after, &stats);
+  *duration = time_s() - start;
+  pthread_join(thread, NULL);
+  if (*result != XFER_OK && *result != XFER_ERR_ABORTED) {
+    fprintf(stderr, "receiver: %s after %u bytes\n", xfer_error_string(*result), stats.bytes_received);
+  }
+  return true;
+}
+
+/* Plays the CLI: waits for the flight_dump command and runs the transfer */
+static void *board_thread(void *arg) {
+  board_t *board = (board_t *)arg;
+  /* skip everything up to the command line, like the CLI does with an unknown command */
+  char command[64];
+  unsigned flight_number = 0;
+  unsigned offset = 0;
+  while (true) {
+    uint32_t len = 0;
+    char c = 0;
+    while (board_receive(board, (uint8_t *)&c, 1, 2000) == 1 && c != '\r') {
+      if (len < sizeof(command) - 1) {
+        command[len++] = c;
+      }
+    }
+    if (c != '\r') {
+      board->result = XFER_ERR_TIMEOUT;
+      return NULL;
+    }
+    command[len] = '\0';
+    if (sscanf(command, "flight_dump %u %u", &flight_number, &offset) >= 1) {
+      break;
+    }
+  }
+  /* the CLI echoes the command before the transfer starts */
+  static const char echo[] = "\r\nflight_dump\r\n";
+  board_send(board, (const uint8_t *)echo, sizeof(echo) - 1);
+
+  const xfer_io_t io = {.read = board_read,
+                        .send = board_send,
+                        .receive = board_receive,
+                        .get_time = board_get_time,
+                        .ctx = board};
+  board->result = xfer_send_file(&io, flight_number, board->size, offset, &board->stats);
+
+  /* like the firmware, drop whatever the receiver sends after the transfer */
+  uint8_t discard[64];
+  while (board_receive(board, discard, sizeof(discard), 100) > 0) {
+  }
+  return NULL;
+}
+
+static int32_t board_read(void *ctx, uint32_t offset, uint8_t *buf, uint32_t len) {
+  const board_t *board = (const board_t *)ctx;
+  if (offset + len > board->size) {
+    return -1;
+  }
+  memcpy(buf, &board->data[offset], len);
+  return (int32_t)len;
+}
+
+static bool board_send(void *ctx, const uint8_t *buf, uint32_t len) {
+  board_t *board = (board_t *)ctx;
+  if (len == 0) {
+    return true;
+  }
+  uint8_t frame[XFER_MAX_FRAME_SIZE + 64];
+  if (len > sizeof(frame)) {
+    return false;
+  }
+  memcpy(frame, buf, len);
+
+  if (board->fault_percent > 0) {
+    const uint32_t roll = next_random(&board->rng) % 100;
+    if (roll < board->fault_percent) {
+      ++board->dropped;
+      return true;
+    }
+    if (roll < 2 * board->fault_percent) {
+      ++board->corrupted;
+      frame[next_random(&board->rng) % len] ^= (uint8_t)(1 + next_random(&board->rng) % 255);
+    } else if (roll < 3 * board->fault_percent) {
+      static const char text[] = "12345  INFO  task_recorder.c:123: log output in between\n";
+      ++board->text;
+      if (write(board->fd, text, sizeof(text) - 1) < 0) {
+        return false;
+      }
+    }
+  }
+
+  const uint8_t *bytes = frame;
+  while (len > 0) {
+    const ssize_t written = write(board->fd, bytes, len);
+    if (written < 0) {
+      if (errno == EINTR || errno == EAGAIN) {
+        continue;
+      }
+      return false;
+    }
+    bytes += written;
+    len -= (uint32_t)written;
+  }
+  return true;
+}
+
+static uint32_t board_receive(void *ctx, uint8_t *buf, uint32_t len, uint32_t timeout) {
+  const board_t *board = (const board_t *)ctx;
+  struct pollfd pfd = {.fd = board->fd, .events = POLLIN};
+  if (poll(&pfd, 1, (int)timeout) <= 0) {
+    return 0;
+  }
+  const ssize_t received = read(board->fd, buf, len);
+  return received > 0 ? (uint32_t)received : 0;
+}
+
+static uint32_t board_get_time(__attribute__((unused)) void *ctx) { return (uint32_t)(time_s() * 1000.0); }
+
+/* xorshift32 */
+static uint32_t next_random(uint32_t *state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
+  return x;
+}
+
+static double time_s(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,156 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host versions of the arm_math matrix functions used by control/kalman_filter.c. The firmware links the prebuilt
+ * Cortex-M4 library, which can't run on the host. The functions follow the generic C code of CMSIS-DSP 1.7: the same
+ * dimension checks as with ARM_MATH_MATRIX_CHECK, the same summation order and the Gauss-Jordan inverse which only
+ * swaps rows if a pivot is exactly zero.
+ */
+
+#include "arm_math.h"
+
+#include <string.h>
+
+void arm_mat_init_f32(arm_matrix_instance_f32 *S, uint16_t nRows, uint16_t nColumns, float32_t *pData) {
+  S->numRows = nRows;
+  S->numCols = nColumns;
+  S->pData = pData;
+}
+
+arm_status arm_mat_mult_f32(const arm_matrix_instance_f32 *pSrcA, const arm_matrix_instance_f32 *pSrcB,
+                            arm_matrix_instance_f32 *pDst) {
+  if ((pSrcA->numCols != pSrcB->numRows) || (pSrcA->numRows != pDst->numRows) || (pSrcB->numCols != pDst->numCols)) {
+    return ARM_MATH_SIZE_MISMATCH;
+  }
+  for (uint32_t i = 0; i < pSrcA->numRows; i++) {
+    for (uint32_t j = 0; j < pSrcB->numCols; j++) {
+      float32_t sum = 0.0f;
+      for (uint32_t k = 0; k < pSrcA->numCols; k++) {
+        sum += pSrcA->pData[i * pSrcA->numCols + k] * pSrcB->pData[k * pSrcB->numCols + j];
+      }
+      pDst->pData[i * pDst->numCols + j] = sum;
+    }
+  }
+  return ARM_MATH_SUCCESS;
+}
+
+arm_status arm_mat_add_f32(const arm_matrix_instance_f32 *pSrcA, const arm_matrix_instance_f32 *pSrcB,
+                           arm_matrix_instance_f32 *pDst) {
+  if ((pSrcA->numRows != pSrcB->numRows) || (pSrcA->numCols != pSrcB->numCols) ||
+      (pSrcA->numRows != pDst->numRows) || (pSrcA->numCols != pDst->numCols)) {
+    return ARM_MATH_SIZE_MISMATCH;
+  }
+  for (uint32_t i = 0; i < (uint32_t)pSrcA->numRows * pSrcA->numCols; i++) {
+    pDst->pData[i] = pSrcA->pData[i] + pSrcB->pData[i];
+  }
+  return ARM_MATH_SUCCESS;
+}
+
+arm_status arm_mat_sub_f32(const arm_matrix_instance_f32 *pSrcA, const arm_matrix_instance_f32 *pSrcB,
+                           arm_matrix_instance_f32 *pDst) {
+  if ((pSrcA->numRows != pSrcB->numRows) || (pSrcA->numCols != pSrcB->numCols) ||
+      (pSrcA->numRows != pDst->numRows) || (pSrcA->numCols != pDst->numCols)) {
+    return ARM_MATH_SIZE_MISMATCH;
+  }
+  for (uint32_t i = 0; i < (uint32_t)pSrcA->numRows * pSrcA->numCols; i++) {
+    pDst->pData[i] = pSrcA->pData[i] - pSrcB->pData[i];
+  }
+  return ARM_MATH_SUCCESS;
+}
+
+arm_status arm_mat_scale_f32(const arm_matrix_instance_f32 *pSrc, float32_t scale, arm_matrix_instance_f32 *pDst) {
+  if ((pSrc->numRows != pDst->numRows) || (pSrc->numCols != pDst->numCols)) {
+    return ARM_MATH_SIZE_MISMATCH;
+  }
+  for (uint32_t i = 0; i < (uint32_t)pSrc->numRows * pSrc->numCols; i++) {
+    pDst->pData[i] = pSrc->pData[i] * scale;
+  }
+  return ARM_MATH_SUCCESS;
+}
+
+arm_status arm_mat_trans_f32(const arm_matrix_instance_f32 *pSrc, arm_matrix_instance_f32 *pDst) {
+  if ((pSrc->numRows != pDst->numCols) || (pSrc->numCols != pDst->numRows)) {
+    return ARM_MATH_SIZE_MISMATCH;
+  }
+  for (uint32_t i = 0; i < pSrc->numRows; i++) {
+    for (uint32_t j = 0; j < pSrc->numCols; j++) {
+      pDst->pData[j * pDst->numCols + i] = pSrc->pData[i * pSrc->numCols + j];
+    }
+  }
+  return ARM_MATH_SUCCESS;
+}
+
+/* Like the library version, the source matrix is used as working memory and overwritten */
+arm_status arm_mat_inverse_f32(const arm_matrix_instance_f32 *src, arm_matrix_instance_f32 *dst) {
+  if ((src->numRows != src->numCols) || (dst->numRows != dst->numCols) || (src->numRows != dst->numRows)) {
+    return ARM_MATH_SIZE_MISMATCH;
+  }
+  const uint32_t n = src->numRows;
+  float32_t *a = src->pData;
+  float32_t *b = dst->pData;
+
+  for (uint32_t i = 0; i < n; i++) {
+    for (uint32_t j = 0; j < n; j++) {
+      b[i * n + j] = (i == j) ? 1.0f : 0.0f;
+    }
+  }
+
+  for (uint32_t l = 0; l < n; l++) {
+    /* only look for another pivot row if the pivot is zero */
+    if (a[l * n + l] == 0.0f) {
+      uint32_t i = l + 1;
+      while ((i < n) && (a[i * n + l] == 0.0f)) {
+        i++;
+      }
+      if (i == n) {
+        return ARM_MATH_SINGULAR;
+      }
+      for (uint32_t j = 0; j < n; j++) {
+        float32_t tmp = a[l * n + j];
+        a[l * n + j] = a[i * n + j];
+        a[i * n + j] = tmp;
+        tmp = b[l * n + j];
+        b[l * n + j] = b[i * n + j];
+        b[i * n + j] = tmp;
+      }
+    }
+
+    const float32_t pivot = a[l * n + l];
+    for (uint32_t j = l; j < n; j++) {
+      a[l * n + j] = a[l * n + j] / pivot;
+    }
+    for (uint32_t j = 0; j < n; j++) {
+      b[l * n + j] = b[l * n + j] / pivot;
+    }
+
+    for (uint32_t i = 0; i < n; i++) {
+      if (i == l) {
+        continue;
+      }
+      const float32_t factor = a[i * n + l];
+      for (uint32_t j = l; j < n; j++) {
+        a[i * n + j] = a[i * n + j] - factor * a[l * n + j];
+      }
+      for (uint32_t j = 0; j < n; j++) {
+        b[i * n + j] = b[i * n + j] - factor * b[l * n + j];
+      }
+    }
+  }
+  return ARM_MATH_SUCCESS;
+}
@@ -0,0 +1,190 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "bench_flight.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+/** Private Constants **/
+
+#define BENCH_NOISE_BARO 1.5f /* m */
+#define BENCH_NOISE_ACC  0.5f /* m/s^2 */
+#define BENCH_GRAVITY    9.81f
+
+/** Exported Variables **/
+
+bench_sample_t bench_samples[BENCH_MAX_STEPS];
+uint32_t bench_num_samples = 0;
+
+/** Private Variables **/
+
+static uint32_t rng_state = 0x2545F491U;
+
+/** Private Function Declarations **/
+
+static float get_noise(float std);
+
+/** Exported Function Definitions **/
+
+/* Boost, coast with drag, drogue and main descent; the baros see the height plus their own offset and noise */
+void bench_generate_flight() {
+  static const float baro_offset[NUM_PRESSURE] = {0.5f, -0.8f, 1.2f};
+  float height = 0;
+  float speed = 0;
+  float t = 0;
+  flight_fsm_e fsm = READY;
+
+  while (bench_num_samples < BENCH_MAX_STEPS && fsm != TOUCHDOWN) {
+    float acc = 0;
+    switch (fsm) {
+      case READY:
+        if (t >= 2.0f) {
+          fsm = THRUSTING_1;
+        }
+        break;
+      case THRUSTING_1:
+        acc = 60.0f - BENCH_GRAVITY - 0.0004f * speed * speed;
+        if (t >= 5.0f) {
+          fsm = COASTING;
+        }
+        break;
+      case COASTING:
+        acc = -BENCH_GRAVITY - 0.0004f * speed * speed;
+        if (speed < 0) {
+          fsm = APOGEE;
+        }
+        break;
+      case APOGEE:
+        fsm = DROGUE;
+        break;
+      case DROGUE:
+        acc = -BENCH_GRAVITY + 0.016f * speed * speed;
+        if (height < 300.0f) {
+          fsm = MAIN;
+        }
+        break;
+      case MAIN:
+        acc = -BENCH_GRAVITY + 0.27f * speed * speed;
+        if (height <= 0) {
+          fsm = TOUCHDOWN;
+        }
+        break;
+      default:
+        break;
+    }
+    speed += acc * BENCH_DT;
+    height += speed * BENCH_DT;
+
+    bench_sample_t *sample = &bench_samples[bench_num_samples++];
+    sample->t = t;
+    sample->fsm = fsm;
+    sample->faulty_baro = 0;
+    if (t >= 8.0f) {
+      sample->faulty_baro |= 1U << 2;
+    }
+    if (t >= 20.0f && t < 35.0f) {
+      sample->faulty_baro |= 1U << 1;
+    }
+    for (int i = 0; i < NUM_PRESSURE; i++) {
+      sample->agl[i] = height + baro_offset[i] + get_noise(BENCH_NOISE_BARO);
+    }
+    for (int i = 0; i < NUM_ACC; i++) {
+      sample->acc[i] = acc + get_noise(BENCH_NOISE_ACC);
+    }
+    sample->true_height = height;
+    sample->true_speed = speed;
+    t += BENCH_DT;
+  }
+}
+
+bool bench_read_flight(const char *path) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    fprintf(stderr, "Can't open %s\n", path);
+    return false;
+  }
+  char line[256];
+  while (fgets(line, sizeof(line), file) != NULL && bench_num_samples < BENCH_MAX_STEPS) {
+    bench_sample_t *sample = &bench_samples[bench_num_samples];
+    int fsm = 0;
+    unsigned faulty_baro = 0;
+    /* the header line and other lines which don't start with a number are skipped */
+    if (sscanf(line, "%f,%d,%u,%f,%f,%f,%f,%f,%f", &sample->t, &fsm, &faulty_baro, &sample->agl[0], &sample->agl[1],
+               &sample->agl[2], &sample->acc[0], &sample->acc[1], &sample->acc[2]) != 9) {
+      continue;
+    }
+    sample->fsm = (flight_fsm_e)fsm;
+    sample->faulty_baro = (uint8_t)faulty_baro;
+    sample->true_height = NAN;
+    sample->true_speed = NAN;
+    bench_num_samples++;
+  }
+  fclose(file);
+  if (bench_num_samples == 0) {
+    fprintf(stderr, "No samples in %s\n", path);
+    return false;
+  }
+  return true;
+}
+
+bool bench_write_flight(const char *path) {
+  FILE *file = fopen(path, "w");
+  if (file == NULL) {
+    fprintf(stderr, "Can't open %s\n", path);
+    return false;
+  }
+  fprintf(file, "t,fsm,faulty_baro,agl0,agl1,agl2,acc0,acc1,acc2\n");
+  for (uint32_t i = 0; i < bench_num_samples; i++) {
+    const bench_sample_t *sample = &bench_samples[i];
+    /* %.9g keeps every float exact */
+    fprintf(file, "%.9g,%d,%u,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g\n", sample->t, (int)sample->fsm,
+            (unsigned)sample->faulty_baro, sample->agl[0], sample->agl[1], sample->agl[2], sample->acc[0],
+            sample->acc[1], sample->acc[2]);
+  }
+  fclose(file);
+  return true;
+}
+
+void bench_get_input(const bench_sample_t *sample, state_estimation_data_t *data, sensor_elimination_t *elimination) {
+  memset(data, 0, sizeof(*data));
+  memset(elimination, 0, sizeof(*elimination));
+  for (int i = 0; i < NUM_PRESSURE; i++) {
+    data->calculated_AGL[i] = sample->agl[i];
+    elimination->faulty_baro[i] = (sample->faulty_baro >> i) & 1U;
+    elimination->num_faulty_baros += elimination->faulty_baro[i];
+  }
+  for (int i = 0; i < NUM_ACC; i++) {
+    data->acceleration[i] = sample->acc[i];
+  }
+}
+
+/** Private Function Definitions **/
+
+/* Normal distribution from a xorshift generator, Box-Muller */
+static float get_noise(float std) {
+  float u[2];
+  for (int i = 0; i < 2; i++) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    u[i] = ((float)(rng_state >> 8) + 1.0f) / 16777217.0f;
+  }
+  return std * sqrtf(-2.0f * logf(u[0])) * cosf(2.0f * (float)M_PI * u[1]);
+}
@@ -0,0 +1,83 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Flight data for the Kalman filter benchmarks: a synthetic flight or the state estimation input of a recorded one.
+ *
+ * The synthetic flight has noisy baros and accelerometers, one baro eliminated after 8 s and a second one from 20 s to
+ * 35 s, so all three update variants run. A recorded flight is read from a CSV file with the input of every step:
+ *   t,fsm,faulty_baro,agl0,agl1,agl2,acc0,acc1,acc2
+ * where fsm is the flight_fsm_e value and faulty_baro a bit mask of the eliminated baros.
+ */
+
+#pragma once
+
+#include "util/types.h"
+
+/** Exported Defines **/
+
+#define BENCH_DT         (1.0f / 100.0f) /* CONTROL_SAMPLING_FREQ */
+#define BENCH_MAX_STEPS  (100 * 3600)
+#define BENCH_PRESSURE_0 101325.0f
+
+/** Exported Types **/
+
+typedef struct {
+  float t;
+  flight_fsm_e fsm;
+  uint8_t faulty_baro; /* bit mask */
+  float agl[NUM_PRESSURE];
+  float acc[NUM_ACC];
+  float true_height; /* NAN if unknown */
+  float true_speed;  /* NAN if unknown */
+} bench_sample_t;
+
+/** Exported Variables **/
+
+extern bench_sample_t bench_samples[BENCH_MAX_STEPS];
+extern uint32_t bench_num_samples;
+
+/** Exported Functions **/
+
+/** Generate the synthetic flight. **/
+void bench_generate_flight();
+
+/**
+ * Read a recorded flight.
+ *
+ * @param path - CSV file
+ * @return false if the file can't be read or contains no samples
+ */
+bool bench_read_flight(const char *path);
+
+/**
+ * Write the flight in the format read by bench_read_flight.
+ *
+ * @param path - CSV file
+ * @return false if the file can't be written
+ */
+bool bench_write_flight(const char *path);
+
+/**
+ * Filter input of a sample.
+ *
+ * @param sample - sample of the flight
+ * @param data[out] - state estimation data
+ * @param elimination[out] - eliminated sensors
+ */
+void bench_get_input(const bench_sample_t *sample, state_estimation_data_t *data, sensor_elimination_t *elimination);
@@ -0,0 +1,386 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Replays a flight through control/kalman_filter.c twice, once on the fixed size kernels (control/kalman_kernels.h)
+ * and once on the arm_math functions (KALMAN_USE_ARM_MATH, host versions in arm_math_host.c), and compares them:
+ *   - lock step: before every step the arm_math filter gets the state of the kernel filter. The prediction has to be
+ *     bit identical (x_hat and the upper triangle of P_hat). The update uses a different operation order and is only
+ *     checked against BENCH_MAX_UPDATE_DIFF, relative to the largest element of each result; the largest distance of a
+ *     single element in ulp is printed for information, small elements of P_bar and K reach tens of ulp.
+ *   - free running: both filters run on their own; the estimates may drift apart by BENCH_MAX_HEIGHT_DIFF and
+ *     BENCH_MAX_SPEED_DIFF at most.
+ * Afterwards the time per kalman_step() of both paths is measured, which is only an indication for the target.
+ *
+ * The flight is synthetic or replayed from a CSV file, see bench_flight.h.
+ *
+ *   kalman_bench [-i <input.csv>] [-w <output.csv>] [-n <repetitions>]
+ *
+ * Exits with a failure if one of the checks fails.
+ */
+
+#include "bench_flight.h"
+#include "control/kalman_filter.h"
+
+#include <float.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/** Private Constants **/
+
+/* Limit for the difference of the update, relative to the largest element of the reference; about 80 float epsilons */
+#define BENCH_MAX_UPDATE_DIFF 1e-5
+/* Limits for the drift of the free running filters */
+#define BENCH_MAX_HEIGHT_DIFF 0.01 /* m */
+#define BENCH_MAX_SPEED_DIFF  0.01 /* m/s */
+
+/** Private Types **/
+
+typedef struct {
+  const char *input;
+  const char *output;
+  uint32_t repetitions;
+} bench_options_t;
+
+typedef struct {
+  uint32_t steps[NUM_PRESSURE + 1]; /* per number of baros */
+  uint32_t x_hat_mismatch;
+  uint32_t P_hat_mismatch;
+  double x_bar_diff;
+  double P_bar_diff;
+  double K_diff;
+  uint32_t max_ulp;
+  double height_diff;
+  double speed_diff;
+  double kernel_rms; /* against the true height */
+  double arm_rms;
+  /* of the kernels against the true height and velocity, before and from apogee on */
+  double ascent_height_rms;
+  double ascent_speed_rms;
+  double descent_height_rms;
+  double descent_speed_rms;
+} bench_result_t;
+
+/** Private Variables **/
+
+static bench_options_t options = {.input = NULL, .output = NULL, .repetitions = 20};
+
+/** The arm_math build of kalman_filter.c, see CMakeLists.txt **/
+
+void arm_init_filter_struct(kalman_filter_t *filter);
+void arm_initialize_matrices(kalman_filter_t *filter);
+void arm_reset_kalman(kalman_filter_t *filter, float initial_pressure);
+void arm_kalman_set_phase(kalman_filter_t *filter, kalman_phase_e phase);
+void arm_kalman_prediction(kalman_filter_t *filter, state_estimation_data_t *data, sensor_elimination_t *elimination,
+                           flight_fsm_e fsm_state);
+cats_error_e arm_kalman_update_full(kalman_filter_t *filter, state_estimation_data_t *data);
+cats_error_e arm_kalman_update_eliminated(kalman_filter_t *filter, state_estimation_data_t *data,
+                                          sensor_elimination_t *elimination);
+cats_error_e arm_kalman_update_2_eliminated(kalman_filter_t *filter, state_estimation_data_t *data,
+                                            sensor_elimination_t *elimination);
+cats_error_e arm_kalman_step(kalman_filter_t *filter, state_estimation_data_t *data, sensor_elimination_t *elimination,
+                             flight_fsm_e fsm_state);
+
+/** Private Function Declarations **/
+
+static bool parse_options(int argc, char **argv);
+static void setup_filter(kalman_filter_t *filter, bool use_arm);
+static void step_filter(kalman_filter_t *filter, bool use_arm, const bench_sample_t *sample, flight_fsm_e *old_fsm);
+static void compare_lock_step(bench_result_t *result);
+static void compare_free_running(bench_result_t *result);
+static double time_steps(bool use_arm);
+static double get_max_diff(const float *a, const float *ref, uint32_t len, uint32_t *max_ulp);
+static uint32_t get_ulp_distance(float a, float b);
+
+/** Stubs for the firmware functions kalman_filter.c depends on **/
+
+void log_log(__attribute__((unused)) int level, __attribute__((unused)) const char *file,
+             __attribute__((unused)) int line, __attribute__((unused)) const char *format, ...) {}
+
+/** Exported Function Definitions **/
+
+int main(int argc, char **argv) {
+  if (!parse_options(argc, argv)) {
+    fprintf(stderr,
+            "Usage: kalman_bench [-i <input.csv>] [-w <output.csv>] [-n <repetitions>]\n"
+            "  -i  replay the state estimation input from a CSV file instead of a synthetic flight\n"
+            "  -w  write the input of the flight to a CSV file\n"
+            "  -n  number of replays for the timing, default 20\n");
+    return EXIT_FAILURE;
+  }
+
+  if (options.input != NULL) {
+    if (!bench_read_flight(options.input)) {
+      return EXIT_FAILURE;
+    }
+  } else {
+    bench_generate_flight();
+  }
+  if (options.output != NULL && !bench_write_flight(options.output)) {
+    return EXIT_FAILURE;
+  }
+
+  bench_result_t result = {0};
+  compare_lock_step(&result);
+  compare_free_running(&result);
+
+  const double kernel_ns = time_steps(false);
+  const double arm_ns = time_steps(true);
+
+  printf("%u steps: %u with 3 baros, %u with 2 baros, %u with 1 baro\n", bench_num_samples, result.steps[3],
+         result.steps[2], result.steps[1]);
+  printf("prediction:   x_hat differs in %u steps, P_hat (upper triangle) in %u steps\n", result.x_hat_mismatch,
+         result.P_hat_mismatch);
+  printf("update:       max. relative difference x_bar %.2e, P_bar %.2e, K %.2e (limit %.0e), max. %u ulp in one "
+         "element\n",
+         result.x_bar_diff, result.P_bar_diff, result.K_diff, BENCH_MAX_UPDATE_DIFF, result.max_ulp);
+  printf("free running: max. difference height %.2e m, velocity %.2e m/s\n", result.height_diff, result.speed_diff);
+  if (!isnan(result.kernel_rms)) {
+    printf("height error: RMS kernels %.3f m, arm_math %.3f m\n", result.kernel_rms, result.arm_rms);
+    printf("RMS error:    ascent %.3f m, %.3f m/s, descent %.3f m, %.3f m/s\n", result.ascent_height_rms,
+           result.ascent_speed_rms, result.descent_height_rms, result.descent_speed_rms);
+  }
+  printf("kalman_step:  kernels %.1f ns, arm_math %.1f ns (%.1fx)\n", kernel_ns, arm_ns, arm_ns / kernel_ns);
+
+  const bool passed = result.x_hat_mismatch == 0 && result.P_hat_mismatch == 0 &&
+                      result.x_bar_diff <= BENCH_MAX_UPDATE_DIFF && result.P_bar_diff <= BENCH_MAX_UPDATE_DIFF &&
+                      result.K_diff <= BENCH_MAX_UPDATE_DIFF && result.height_diff <= BENCH_MAX_HEIGHT_DIFF &&
+                      result.speed_diff <= BENCH_MAX_SPEED_DIFF;
+  printf("%s\n", passed ? "PASSED" : "FAILED");
+  return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/** Private Function Definitions **/
+
+static bool parse_options(int argc, char **argv) {
+  int opt;
+  while ((opt = getopt(argc, argv, "i:w:n:")) != -1) {
+    switch (opt) {
+      case 'i':
+        options.input = optarg;
+        break;
+      case 'w':
+        options.output = optarg;
+        break;
+      case 'n':
+        options.repetitions = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      default:
+        return false;
+    }
+  }
+  return options.repetitions > 0;
+}
+
+/* Same as in task_state_est */
+static void setup_filter(kalman_filter_t *filter, bool use_arm) {
+  memset(filter, 0, sizeof(*filter));
+  filter->t_sampl = BENCH_DT;
+  if (use_arm) {
+    arm_init_filter_struct(filter);
+    arm_initialize_matrices(filter);
+    arm_reset_kalman(filter, BENCH_PRESSURE_0);
+  } else {
+    init_filter_struct(filter);
+    initialize_matrices(filter);
+    reset_kalman(filter, BENCH_PRESSURE_0);
+  }
+}
+
+static void step_filter(kalman_filter_t *filter, bool use_arm, const bench_sample_t *sample, flight_fsm_e *old_fsm) {
+  state_estimation_data_t data;
+  sensor_elimination_t elimination;
+  bench_get_input(sample, &data, &elimination);
+
+  if ((sample->fsm == APOGEE) && (sample->fsm != *old_fsm)) {
+    if (use_arm) {
+      arm_kalman_set_phase(filter, KALMAN_PHASE_DESCENT);
+    } else {
+      kalman_set_phase(filter, KALMAN_PHASE_DESCENT);
+    }
+  }
+  *old_fsm = sample->fsm;
+
+  if (use_arm) {
+    arm_kalman_step(filter, &data, &elimination, sample->fsm);
+  } else {
+    kalman_step(filter, &data, &elimination, sample->fsm);
+  }
+}
+
+static void compare_lock_step(bench_result_t *result) {
+  static kalman_filter_t kernel_filter;
+  static kalman_filter_t arm_filter;
+  setup_filter(&kernel_filter, false);
+  setup_filter(&arm_filter, true);
+
+  for (uint32_t i = 0; i < bench_num_samples; i++) {
+    state_estimation_data_t data;
+    sensor_elimination_t elimination;
+    bench_get_input(&bench_samples[i], &data, &elimination);
+
+    memcpy(arm_filter.x_bar_data, kernel_filter.x_bar_data, sizeof(arm_filter.x_bar_data));
+    memcpy(arm_filter.P_bar_data, kernel_filter.P_bar_data, sizeof(arm_filter.P_bar_data));
+    memcpy(arm_filter.x_hat_data, kernel_filter.x_hat_data, sizeof(arm_filter.x_hat_data));
+    memcpy(arm_filter.P_hat_data, kernel_filter.P_hat_data, sizeof(arm_filter.P_hat_data));
+
+    kalman_prediction(&kernel_filter, &data, &elimination, bench_samples[i].fsm);
+    arm_kalman_prediction(&arm_filter, &data, &elimination, bench_samples[i].fsm);
+
+    if (memcmp(kernel_filter.x_hat_data, arm_filter.x_hat_data, sizeof(kernel_filter.x_hat_data)) != 0) {
+      result->x_hat_mismatch++;
+    }
+    static const uint8_t upper[6] = {0, 1, 2, 4, 5, 8};
+    for (int j = 0; j < 6; j++) {
+      if (memcmp(&kernel_filter.P_hat_data[upper[j]], &arm_filter.P_hat_data[upper[j]], sizeof(float32_t)) != 0) {
+        result->P_hat_mismatch++;
+        break;
+      }
+    }
+
+    /* the update of both starts from the same prediction */
+    memcpy(arm_filter.x_hat_data, kernel_filter.x_hat_data, sizeof(arm_filter.x_hat_data));
+    memcpy(arm_filter.P_hat_data, kernel_filter.P_hat_data, sizeof(arm_filter.P_hat_data));
+
+    const uint32_t num_baros = NUM_PRESSURE - elimination.num_faulty_baros;
+    const float *kernel_K = NULL;
+    const float *arm_K = NULL;
+    uint32_t K_len = 0;
+    switch (num_baros) {
+      case 3:
+        kalman_update_full(&kernel_filter, &data);
+        arm_kalman_update_full(&arm_filter, &data);
+        kernel_K = kernel_filter.K_full_data;
+        arm_K = arm_filter.K_full_data;
+        K_len = 9;
+        break;
+      case 2:
+        kalman_update_eliminated(&kernel_filter, &data, &elimination);
+        arm_kalman_update_eliminated(&arm_filter, &data, &elimination);
+        kernel_K = kernel_filter.K_eliminated_data;
+        arm_K = arm_filter.K_eliminated_data;
+        K_len = 6;
+        break;
+      case 1:
+        kalman_update_2_eliminated(&kernel_filter, &data, &elimination);
+        arm_kalman_update_2_eliminated(&arm_filter, &data, &elimination);
+        kernel_K = kernel_filter.K_2_eliminated_data;
+        arm_K = arm_filter.K_2_eliminated_data;
+        K_len = 3;
+        break;
+      default:
+        continue;
+    }
+    result->steps[num_baros]++;
+
+    double diff = get_max_diff(kernel_filter.x_bar_data, arm_filter.x_bar_data, 3, &result->max_ulp);
+    result->x_bar_diff = fmax(result->x_bar_diff, diff);
+    diff = get_max_diff(kernel_filter.P_bar_data, arm_filter.P_bar_data, 9, &result->max_ulp);
+    result->P_bar_diff = fmax(result->P_bar_diff, diff);
+    diff = get_max_diff(kernel_K, arm_K, K_len, &result->max_ulp);
+    result->K_diff = fmax(result->K_diff, diff);
+  }
+}
+
+static void compare_free_running(bench_result_t *result) {
+  static kalman_filter_t kernel_filter;
+  static kalman_filter_t arm_filter;
+  setup_filter(&kernel_filter, false);
+  setup_filter(&arm_filter, true);
+  flight_fsm_e kernel_fsm = READY;
+  flight_fsm_e arm_fsm = READY;
+  double kernel_sum = 0;
+  double arm_sum = 0;
+  /* height and velocity, ascent and descent */
+  double phase_sum[2][2] = {{0}};
+  uint32_t phase_steps[2] = {0};
+
+  for (uint32_t i = 0; i < bench_num_samples; i++) {
+    step_filter(&kernel_filter, false, &bench_samples[i], &kernel_fsm);
+    step_filter(&arm_filter, true, &bench_samples[i], &arm_fsm);
+
+    result->height_diff = fmax(result->height_diff, fabs(kernel_filter.x_bar_data[0] - arm_filter.x_bar_data[0]));
+    result->speed_diff = fmax(result->speed_diff, fabs(kernel_filter.x_bar_data[1] - arm_filter.x_bar_data[1]));
+    kernel_sum += pow(kernel_filter.x_bar_data[0] - bench_samples[i].true_height, 2);
+    arm_sum += pow(arm_filter.x_bar_data[0] - bench_samples[i].true_height, 2);
+    const int descent = bench_samples[i].fsm >= APOGEE ? 1 : 0;
+    phase_sum[descent][0] += pow(kernel_filter.x_bar_data[0] - bench_samples[i].true_height, 2);
+    phase_sum[descent][1] += pow(kernel_filter.x_bar_data[1] - bench_samples[i].true_speed, 2);
+    phase_steps[descent]++;
+  }
+  /* NAN for a replayed flight */
+  result->kernel_rms = sqrt(kernel_sum / bench_num_samples);
+  result->arm_rms = sqrt(arm_sum / bench_num_samples);
+  result->ascent_height_rms = sqrt(phase_sum[0][0] / fmax(phase_steps[0], 1));
+  result->ascent_speed_rms = sqrt(phase_sum[0][1] / fmax(phase_steps[0], 1));
+  result->descent_height_rms = sqrt(phase_sum[1][0] / fmax(phase_steps[1], 1));
+  result->descent_speed_rms = sqrt(phase_sum[1][1] / fmax(phase_steps[1], 1));
+}
+
+/* Average time of a kalman_step() in ns */
+static double time_steps(bool use_arm) {
+  static kalman_filter_t filter;
+  struct timespec start;
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (uint32_t rep = 0; rep < options.repetitions; rep++) {
+    setup_filter(&filter, use_arm);
+    flight_fsm_e old_fsm = READY;
+    for (uint32_t i = 0; i < bench_num_samples; i++) {
+      step_filter(&filter, use_arm, &bench_samples[i], &old_fsm);
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  const double elapsed = (double)(end.tv_sec - start.tv_sec) * 1e9 + (double)(end.tv_nsec - start.tv_nsec);
+  return elapsed / ((double)options.repetitions * bench_num_samples);
+}
+
+/* Largest difference relative to the largest element of the reference */
+static double get_max_diff(const float *a, const float *ref, uint32_t len, uint32_t *max_ulp) {
+  double scale = DBL_MIN;
+  double diff = 0;
+  for (uint32_t i = 0; i < len; i++) {
+    scale = fmax(scale, fabs(ref[i]));
+    diff = fmax(diff, fabs((double)a[i] - (double)ref[i]));
+    const uint32_t ulp = get_ulp_distance(a[i], ref[i]);
+    if (ulp > *max_ulp) {
+      *max_ulp = ulp;
+    }
+  }
+  return diff / scale;
+}
+
+static uint32_t get_ulp_distance(float a, float b) {
+  int32_t ia;
+  int32_t ib;
+  memcpy(&ia, &a, sizeof(ia));
+  memcpy(&ib, &b, sizeof(ib));
+  /* map the sign magnitude representation to a monotonic one */
+  if (ia < 0) {
+    ia = INT32_MIN - ia;
+  }
+  if (ib < 0) {
+    ib = INT32_MIN - ib;
+  }
+  return ia > ib ? (uint32_t)ia - (uint32_t)ib : (uint32_t)ib - (uint32_t)ia;
+}
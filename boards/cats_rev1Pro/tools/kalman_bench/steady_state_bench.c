@@ -0,0 +1,316 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Validates the steady state gains of the altitude Kalman filter (control/kalman_steady_state.h) against the full
+ * filter:
+ *   - convergence: the covariance recursion of the full filter runs from the reset covariance in every phase and with
+ *     every number of baros and its gain has to end up at the solved one. A gain can overshoot and pass through
+ *     KALMAN_STEADY_STATE_TOLERANCE before it settles, so kalman_step() with the steady state gains enabled must not
+ *     switch over before the step from which on the gain of the recursion stays within the tolerance.
+ *   - flight: the filter with the steady state gains and the full filter run on the same flight (see bench_flight.h),
+ *     their estimates may only differ by a fraction of the baro noise. The time per kalman_step() of both is measured,
+ *     which is only an indication for the target.
+ *
+ *   steady_state_bench [-i <input.csv>] [-n <repetitions>]
+ *
+ * Exits with a failure if one of the checks fails.
+ */
+
+#include "bench_flight.h"
+#include "control/kalman_filter.h"
+#include "control/kalman_kernels.h"
+#include "control/kalman_steady_state.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/** Private Constants **/
+
+/* one hour of filter steps */
+#define BENCH_CONVERGENCE_STEPS (100 * 3600)
+/* relative to the largest element of the gain */
+#define BENCH_MAX_GAIN_DIFF   1e-3
+#define BENCH_MAX_HEIGHT_DIFF 1.0 /* m */
+#define BENCH_MAX_SPEED_DIFF  1.0 /* m/s */
+
+/** Private Types **/
+
+typedef struct {
+  const char *input;
+  uint32_t repetitions;
+} bench_options_t;
+
+typedef struct {
+  double height_diff;
+  double speed_diff;
+  double full_rms; /* against the true height */
+  double steady_rms;
+  uint32_t steady_steps;
+} bench_result_t;
+
+/** Private Variables **/
+
+static bench_options_t options = {.input = NULL, .repetitions = 20};
+
+static kalman_gains_t gains;
+
+/** Private Function Declarations **/
+
+static bool parse_options(int argc, char **argv);
+static bool check_convergence();
+static uint32_t get_switch_step(kalman_phase_e phase, uint32_t num_baros);
+static void setup_filter(kalman_filter_t *filter, bool steady_state);
+static void step_filter(kalman_filter_t *filter, const bench_sample_t *sample, flight_fsm_e *old_fsm);
+static void compare_flight(bench_result_t *result);
+static double time_steps(bool steady_state);
+static double get_max_diff(const float *a, const float *ref, uint32_t len);
+
+/** Stubs for the firmware functions kalman_filter.c depends on **/
+
+void log_log(__attribute__((unused)) int level, __attribute__((unused)) const char *file,
+             __attribute__((unused)) int line, __attribute__((unused)) const char *format, ...) {}
+
+/** Exported Function Definitions **/
+
+int main(int argc, char **argv) {
+  if (!parse_options(argc, argv)) {
+    fprintf(stderr,
+            "Usage: steady_state_bench [-i <input.csv>] [-n <repetitions>]\n"
+            "  -i  replay the state estimation input from a CSV file instead of a synthetic flight\n"
+            "  -n  number of replays for the timing, default 20\n");
+    return EXIT_FAILURE;
+  }
+
+  if (options.input != NULL) {
+    if (!bench_read_flight(options.input)) {
+      return EXIT_FAILURE;
+    }
+  } else {
+    bench_generate_flight();
+  }
+
+  kalman_filter_t filter;
+  setup_filter(&filter, false);
+  if (!kalman_solve_steady_state(&filter, &gains)) {
+    printf("The steady state could not be solved for all configurations\n");
+    printf("FAILED\n");
+    return EXIT_FAILURE;
+  }
+
+  bool passed = check_convergence();
+
+  bench_result_t result = {0};
+  compare_flight(&result);
+  const double full_ns = time_steps(false);
+  const double steady_ns = time_steps(true);
+
+  printf("flight:  %u of %u steps with the steady state gain\n", result.steady_steps, bench_num_samples);
+  printf("         max. difference height %.3f m, velocity %.3f m/s\n", result.height_diff, result.speed_diff);
+  if (!isnan(result.full_rms)) {
+    printf("         height error: RMS full filter %.3f m, steady state %.3f m\n", result.full_rms, result.steady_rms);
+  }
+  printf("kalman_step: full filter %.1f ns, steady state %.1f ns (%.1fx)\n", full_ns, steady_ns, full_ns / steady_ns);
+
+  passed = passed && result.height_diff <= BENCH_MAX_HEIGHT_DIFF && result.speed_diff <= BENCH_MAX_SPEED_DIFF;
+  printf("%s\n", passed ? "PASSED" : "FAILED");
+  return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/** Private Function Definitions **/
+
+static bool parse_options(int argc, char **argv) {
+  int opt;
+  while ((opt = getopt(argc, argv, "i:n:")) != -1) {
+    switch (opt) {
+      case 'i':
+        options.input = optarg;
+        break;
+      case 'n':
+        options.repetitions = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      default:
+        return false;
+    }
+  }
+  return options.repetitions > 0;
+}
+
+/* Runs the covariance recursion of the full filter with the kernels of kalman_filter.c */
+static bool check_convergence() {
+  static const char *phase_names[KALMAN_NUM_PHASES] = {"ascent", "descent"};
+  static const float32_t zero[3] = {0, 0, 0};
+  bool passed = true;
+
+  for (uint32_t phase = 0; phase < KALMAN_NUM_PHASES; phase++) {
+    for (uint32_t num = NUM_PRESSURE; num >= 1; num--) {
+      kalman_filter_t filter;
+      setup_filter(&filter, false);
+      kalman_set_phase(&filter, (kalman_phase_e)phase);
+
+      const float32_t *ref = gains.K[phase][num - 1];
+      float32_t K[9] = {0};
+      float32_t x[3];
+      uint32_t settled = 0;
+      uint32_t first_settled = 0;
+      double diff = 0;
+      for (uint32_t step = 1; step <= BENCH_CONVERGENCE_STEPS; step++) {
+        kk_predict_cov(filter.Ad_data, filter.P_bar_data, filter.GdQGd_T_data, filter.P_hat_data);
+        if (num == 3) {
+          kk_update_3(filter.H_full_data, filter.R_full_data, filter.P_hat_data, zero, zero, K, x, filter.P_bar_data);
+        } else if (num == 2) {
+          kk_update_2(filter.H_eliminated_data, filter.R_eliminated_data, filter.P_hat_data, zero, zero, K, x,
+                      filter.P_bar_data);
+        } else {
+          kk_update_1(filter.H_2_eliminated_data, filter.R_2_eliminated_data[0], filter.P_hat_data, zero, 0, K, x,
+                      filter.P_bar_data);
+        }
+        diff = get_max_diff(K, ref, 3 * num);
+        if (diff > KALMAN_STEADY_STATE_TOLERANCE) {
+          settled = 0;
+        } else if (settled == 0) {
+          settled = step;
+          if (first_settled == 0) {
+            first_settled = step;
+          }
+        }
+      }
+
+      const uint32_t switch_step = get_switch_step((kalman_phase_e)phase, num);
+      const bool ok = diff <= BENCH_MAX_GAIN_DIFF && switch_step > 0 && switch_step >= settled;
+      printf("%-7s %u baros: K = [", phase_names[phase], num);
+      for (uint32_t i = 0; i < 3 * num; i++) {
+        printf(i == 0 ? "%.4g" : (i % num == 0 ? "; %.4g" : " %.4g"), ref[i]);
+      }
+      printf("], full filter within %.0f %% first after %u steps, for good after %u, switch after %u, final "
+             "difference %.1e%s\n",
+             KALMAN_STEADY_STATE_TOLERANCE * 100.0, first_settled, settled, switch_step, diff, ok ? "" : " FAILED");
+      passed = passed && ok;
+    }
+  }
+  return passed;
+}
+
+/* Step of the first update with the steady state gain when kalman_step() runs from a reset, 0 if it never switches */
+static uint32_t get_switch_step(kalman_phase_e phase, uint32_t num_baros) {
+  static kalman_filter_t filter;
+  setup_filter(&filter, true);
+  kalman_set_phase(&filter, phase);
+
+  state_estimation_data_t data;
+  sensor_elimination_t elimination;
+  memset(&data, 0, sizeof(data));
+  memset(&elimination, 0, sizeof(elimination));
+  for (uint32_t i = num_baros; i < NUM_PRESSURE; i++) {
+    elimination.faulty_baro[i] = 1;
+  }
+  elimination.num_faulty_baros = (uint8_t)(NUM_PRESSURE - num_baros);
+
+  for (uint32_t step = 1; step <= BENCH_CONVERGENCE_STEPS; step++) {
+    kalman_step(&filter, &data, &elimination, READY);
+    if (filter.steady_state) {
+      return step;
+    }
+  }
+  return 0;
+}
+
+/* Same as in task_state_est */
+static void setup_filter(kalman_filter_t *filter, bool steady_state) {
+  memset(filter, 0, sizeof(*filter));
+  filter->t_sampl = BENCH_DT;
+  init_filter_struct(filter);
+  initialize_matrices(filter);
+  if (steady_state) {
+    kalman_enable_steady_state(filter, &gains);
+  }
+  reset_kalman(filter, BENCH_PRESSURE_0);
+}
+
+static void step_filter(kalman_filter_t *filter, const bench_sample_t *sample, flight_fsm_e *old_fsm) {
+  state_estimation_data_t data;
+  sensor_elimination_t elimination;
+  bench_get_input(sample, &data, &elimination);
+
+  if ((sample->fsm == APOGEE) && (sample->fsm != *old_fsm)) {
+    kalman_set_phase(filter, KALMAN_PHASE_DESCENT);
+  }
+  *old_fsm = sample->fsm;
+
+  kalman_step(filter, &data, &elimination, sample->fsm);
+}
+
+static void compare_flight(bench_result_t *result) {
+  static kalman_filter_t full_filter;
+  static kalman_filter_t steady_filter;
+  setup_filter(&full_filter, false);
+  setup_filter(&steady_filter, true);
+  flight_fsm_e full_fsm = READY;
+  flight_fsm_e steady_fsm = READY;
+  double full_sum = 0;
+  double steady_sum = 0;
+
+  for (uint32_t i = 0; i < bench_num_samples; i++) {
+    step_filter(&full_filter, &bench_samples[i], &full_fsm);
+    step_filter(&steady_filter, &bench_samples[i], &steady_fsm);
+    if (steady_filter.steady_state) {
+      result->steady_steps++;
+    }
+
+    result->height_diff = fmax(result->height_diff, fabs(full_filter.x_bar_data[0] - steady_filter.x_bar_data[0]));
+    result->speed_diff = fmax(result->speed_diff, fabs(full_filter.x_bar_data[1] - steady_filter.x_bar_data[1]));
+    full_sum += pow(full_filter.x_bar_data[0] - bench_samples[i].true_height, 2);
+    steady_sum += pow(steady_filter.x_bar_data[0] - bench_samples[i].true_height, 2);
+  }
+  /* NAN for a replayed flight */
+  result->full_rms = sqrt(full_sum / bench_num_samples);
+  result->steady_rms = sqrt(steady_sum / bench_num_samples);
+}
+
+/* Average time of a kalman_step() in ns */
+static double time_steps(bool steady_state) {
+  static kalman_filter_t filter;
+  struct timespec start;
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (uint32_t rep = 0; rep < options.repetitions; rep++) {
+    setup_filter(&filter, steady_state);
+    flight_fsm_e old_fsm = READY;
+    for (uint32_t i = 0; i < bench_num_samples; i++) {
+      step_filter(&filter, &bench_samples[i], &old_fsm);
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  const double elapsed = (double)(end.tv_sec - start.tv_sec) * 1e9 + (double)(end.tv_nsec - start.tv_nsec);
+  return elapsed / ((double)options.repetitions * bench_num_samples);
+}
+
+/* Largest difference relative to the largest element of the reference */
+static double get_max_diff(const float *a, const float *ref, uint32_t len) {
+  double scale = 0;
+  double diff = 0;
+  for (uint32_t i = 0; i < len; i++) {
+    scale = fmax(scale, fabs(ref[i]));
+    diff = fmax(diff, fabs((double)a[i] - (double)ref[i]));
+  }
+  return scale > 0 ? diff / scale : diff;
+}
@@ -0,0 +1,132 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host side decoder for the flight logs written by the recorder (see util/log_format.h).
+ *
+ * The decoder takes the record layouts from the header block of the log, so it keeps working for logs recorded by
+ * older firmware versions. Column names come from util/rec_schema.h. Every (record type, ID) pair is decoded into
+ * its own Series which stores one contiguous array per struct member.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace cats {
+
+struct Column {
+  std::string name;
+  uint8_t kind = 0; /* rec_field_kind_e */
+  uint8_t width = 0;
+  /* `width` bytes per row, little endian */
+  std::vector<uint8_t> data;
+
+  double value(size_t row) const;
+};
+
+struct Series {
+  std::string name; /* record type name followed by the ID, e.g. "IMU2" */
+  uint32_t type_idx = 0;
+  uint8_t id = 0;
+  size_t rows = 0;
+  std::vector<Column> columns;
+};
+
+/* The recorder switched to another storage tier because the flash ran full, see util/rec_tier.h */
+struct TierChange {
+  uint32_t block = 0; /* first block written in the new tier */
+  uint8_t tier = 0;   /* rec_storage_tier_e */
+};
+
+struct FlightLog {
+  std::string board;
+  std::string code_version;
+  uint32_t flight_counter = 0;
+  uint16_t schema_version = 0;
+  std::vector<uint16_t> sample_rates; /* per record type index, 0 for event driven records */
+
+  /* only the series which contain at least one record */
+  std::vector<Series> series;
+
+  uint32_t num_blocks = 0;
+  uint32_t bad_blocks = 0;
+  uint32_t missing_blocks = 0; /* gaps in the sequence numbers, includes the corrupted blocks */
+  uint32_t bad_records = 0;
+  size_t num_records = 0;
+  std::vector<TierChange> tier_changes;
+};
+
+/* Read-only memory mapping of a whole file */
+class MappedFile {
+ public:
+  explicit MappedFile(const std::string &path);
+  ~MappedFile();
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  const uint8_t *data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  const uint8_t *data_ = nullptr;
+  size_t size_ = 0;
+#ifdef _WIN32
+  void *file_ = nullptr;
+  void *mapping_ = nullptr;
+#endif
+};
+
+/**
+ * Decode a flight log in a single pass. Corrupted blocks are counted and skipped.
+ *
+ * @param data - content of the flight file
+ * @param size - size of the flight file in bytes
+ * @return decoded flight; throws std::runtime_error if the data is not a flight log
+ */
+FlightLog decode_flight_log(const uint8_t *data, size_t size);
+
+/** Memory map and decode a flight file. **/
+FlightLog decode_flight_file(const std::string &path);
+
+/**
+ * Write one CSV file per series, named <prefix>_<series name>.csv.
+ *
+ * @param log - decoded flight
+ * @param prefix - path prefix of the CSV files
+ */
+void write_csv(const FlightLog &log, const std::string &prefix);
+
+/**
+ * Write all series into one binary columnar file:
+ *
+ *   "CATC", u32 version, u32 number of series
+ *   per series: u8 name length, name, u32 rows, u8 number of columns
+ *     per column: u8 name length, name, u8 kind (rec_field_kind_e), rows * width bytes
+ *
+ * All values are little endian and the column data is stored contiguously, e.g. for numpy.frombuffer.
+ *
+ * @param log - decoded flight
+ * @param path - output file
+ */
+void write_columnar(const FlightLog &log, const std::string &path);
+
+}  // namespace cats
@@ -0,0 +1,144 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Checks the host CRC32 of src/util/crc32.c and measures its throughput.
+ *
+ * The CRC is compared against the published check values of CRC-32/ISO-HDLC (the zlib CRC) and against a bitwise
+ * reference implementation for every length up to a few blocks at every alignment, so that the slicing loop and the
+ * byte tail are both covered. The throughput is measured on whole flight log blocks, which is what the decoder checks.
+ *
+ *   crc32_bench [-m <MiB to checksum>]
+ *
+ * Exits with a failure if one of the checks fails.
+ */
+
+#include "util/crc32.h"
+#include "util/log_format.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/** Private Constants **/
+
+#define MAX_CHECK_LEN   (3 * LOG_BLOCK_SIZE)
+#define MAX_CHECK_SHIFT 8
+
+/** Private Variables **/
+
+static uint32_t failed_checks = 0;
+
+/** Private Function Declarations **/
+
+static void check(bool condition, const char *what);
+static uint32_t crc32_reference(const uint8_t *data, uint32_t len);
+
+/** Exported Function Definitions **/
+
+int main(int argc, char **argv) {
+  uint32_t mebibytes = 1024;
+  int opt = 0;
+  while ((opt = getopt(argc, argv, "m:")) != -1) {
+    switch (opt) {
+      case 'm':
+        mebibytes = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-m <MiB to checksum>]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  crc32_init();
+
+  /* check values of CRC-32/ISO-HDLC */
+  check(crc32_compute("", 0) == 0x00000000U, "CRC of no data");
+  check(crc32_compute("123456789", 9) == 0xCBF43926U, "CRC of \"123456789\"");
+  check(crc32_compute("The quick brown fox jumps over the lazy dog", 43) == 0x414FA339U, "CRC of the quick brown fox");
+
+  uint8_t *data = malloc(MAX_CHECK_LEN + MAX_CHECK_SHIFT);
+  srand(1);
+  for (uint32_t i = 0; i < MAX_CHECK_LEN + MAX_CHECK_SHIFT; ++i) {
+    data[i] = (uint8_t)rand();
+  }
+  uint32_t mismatches = 0;
+  for (uint32_t shift = 0; shift < MAX_CHECK_SHIFT; ++shift) {
+    for (uint32_t len = 0; len <= MAX_CHECK_LEN; ++len) {
+      if (crc32_compute(&data[shift], len) != crc32_reference(&data[shift], len)) {
+        ++mismatches;
+      }
+    }
+  }
+  check(mismatches == 0, "CRC matches the bitwise reference for every length and alignment");
+  free(data);
+
+  /* throughput on flight log blocks */
+  const uint32_t num_blocks = 1024;
+  uint8_t *blocks = malloc(num_blocks * LOG_BLOCK_SIZE);
+  for (uint32_t i = 0; i < num_blocks * LOG_BLOCK_SIZE; ++i) {
+    blocks[i] = (uint8_t)(i * 31 + (i >> 9));
+  }
+  const uint32_t rounds = (uint32_t)(((uint64_t)mebibytes << 20) / (num_blocks * LOG_BLOCK_SIZE));
+  volatile uint32_t sink = 0;
+  struct timespec start;
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (uint32_t r = 0; r < rounds; ++r) {
+    for (uint32_t i = 0; i < num_blocks; ++i) {
+      sink ^= crc32_compute(&blocks[i * LOG_BLOCK_SIZE + LOG_BLOCK_CRC_OFFSET], LOG_BLOCK_SIZE - LOG_BLOCK_CRC_OFFSET);
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  free(blocks);
+  const double seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+  const double bytes = (double)rounds * num_blocks * (LOG_BLOCK_SIZE - LOG_BLOCK_CRC_OFFSET);
+  printf("CRC32 of %u blocks of %d B: %.2f s, %.0f MB/s\n", rounds * num_blocks, LOG_BLOCK_SIZE, seconds,
+         bytes / seconds / 1e6);
+
+  if (failed_checks > 0) {
+    printf("%u checks FAILED\n", failed_checks);
+    return EXIT_FAILURE;
+  }
+  printf("All checks passed\n");
+  return EXIT_SUCCESS;
+}
+
+/** Private Function Definitions **/
+
+static void check(bool condition, const char *what) {
+  if (!condition) {
+    printf("FAILED: %s\n", what);
+    ++failed_checks;
+  }
+}
+
+/* One bit at a time, straight from the definition of the reflected CRC */
+static uint32_t crc32_reference(const uint8_t *data, uint32_t len) {
+  uint32_t crc = 0xFFFFFFFFU;
+  for (uint32_t i = 0; i < len; ++i) {
+    crc ^= data[i];
+    for (uint32_t j = 0; j < 8; ++j) {
+      crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320U : crc >> 1;
+    }
+  }
+  return ~crc;
+}
@@ -0,0 +1,177 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "cats_log/flight_log.hpp"
+
+extern "C" {
+#include "util/rec_codec.h"
+}
+
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+
+namespace cats {
+
+namespace {
+
+constexpr uint32_t kColumnarVersion = 1;
+constexpr size_t kWriteBufferSize = 1 << 20;
+
+/* Buffered writer on top of stdio, flushes in big chunks */
+class Writer {
+ public:
+  explicit Writer(const std::string &path) : file_(fopen(path.c_str(), "wb")), buffer_(new char[kWriteBufferSize]) {
+    if (file_ == nullptr) {
+      throw std::runtime_error("can't create " + path);
+    }
+  }
+  ~Writer() {
+    flush();
+    fclose(file_);
+  }
+  Writer(const Writer &) = delete;
+  Writer &operator=(const Writer &) = delete;
+
+  /* make sure that at least `len` bytes can be appended */
+  char *reserve(size_t len) {
+    if (used_ + len > kWriteBufferSize) {
+      flush();
+    }
+    return buffer_.get() + used_;
+  }
+  void commit(size_t len) { used_ += len; }
+
+  void write(const void *data, size_t len) {
+    if (len > kWriteBufferSize) {
+      flush();
+      fwrite(data, 1, len, file_);
+      return;
+    }
+    memcpy(reserve(len), data, len);
+    commit(len);
+  }
+  void put(char c) { write(&c, 1); }
+  template <typename T>
+  void put_le(T value) {
+    /* the host is little endian like the target */
+    write(&value, sizeof(value));
+  }
+  void put_name(const std::string &name) {
+    put_le(static_cast<uint8_t>(name.size()));
+    write(name.data(), name.size());
+  }
+
+  void flush() {
+    if (used_ > 0) {
+      fwrite(buffer_.get(), 1, used_, file_);
+      used_ = 0;
+    }
+  }
+
+ private:
+  FILE *file_;
+  std::unique_ptr<char[]> buffer_;
+  size_t used_ = 0;
+};
+
+template <typename T>
+T load(const uint8_t *src) {
+  T value;
+  memcpy(&value, src, sizeof(value));
+  return value;
+}
+
+/* Longest textual representation of a column value: a float in its shortest round-trip form */
+constexpr size_t kMaxValueLength = 32;
+
+size_t format_value(const Column &column, size_t row, char *out) {
+  const uint8_t *src = column.data.data() + row * column.width;
+  std::to_chars_result result{};
+  switch (column.kind) {
+    case REC_FIELD_U8:
+      result = std::to_chars(out, out + kMaxValueLength, src[0]);
+      break;
+    case REC_FIELD_I8:
+      result = std::to_chars(out, out + kMaxValueLength, static_cast<int8_t>(src[0]));
+      break;
+    case REC_FIELD_U16:
+      result = std::to_chars(out, out + kMaxValueLength, load<uint16_t>(src));
+      break;
+    case REC_FIELD_I16:
+      result = std::to_chars(out, out + kMaxValueLength, load<int16_t>(src));
+      break;
+    case REC_FIELD_U32:
+      result = std::to_chars(out, out + kMaxValueLength, load<uint32_t>(src));
+      break;
+    case REC_FIELD_I32:
+      result = std::to_chars(out, out + kMaxValueLength, load<int32_t>(src));
+      break;
+    default:
+      result = std::to_chars(out, out + kMaxValueLength, load<float>(src));
+      break;
+  }
+  return static_cast<size_t>(result.ptr - out);
+}
+
+}  // namespace
+
+void write_csv(const FlightLog &log, const std::string &prefix) {
+  for (const Series &series : log.series) {
+    Writer writer(prefix + "_" + series.name + ".csv");
+    for (size_t j = 0; j < series.columns.size(); ++j) {
+      if (j > 0) {
+        writer.put(',');
+      }
+      writer.write(series.columns[j].name.data(), series.columns[j].name.size());
+    }
+    writer.put('\n');
+
+    const size_t line_length = series.columns.size() * (kMaxValueLength + 1);
+    for (size_t row = 0; row < series.rows; ++row) {
+      char *line = writer.reserve(line_length);
+      size_t len = 0;
+      for (size_t j = 0; j < series.columns.size(); ++j) {
+        len += format_value(series.columns[j], row, line + len);
+        line[len++] = j + 1 < series.columns.size() ? ',' : '\n';
+      }
+      writer.commit(len);
+    }
+  }
+}
+
+void write_columnar(const FlightLog &log, const std::string &path) {
+  Writer writer(path);
+  writer.write("CATC", 4);
+  writer.put_le(kColumnarVersion);
+  writer.put_le(static_cast<uint32_t>(log.series.size()));
+  for (const Series &series : log.series) {
+    writer.put_name(series.name);
+    writer.put_le(static_cast<uint32_t>(series.rows));
+    writer.put_le(static_cast<uint8_t>(series.columns.size()));
+    for (const Column &column : series.columns) {
+      writer.put_name(column.name);
+      writer.put_le(column.kind);
+      writer.write(column.data.data(), column.data.size());
+    }
+  }
+}
+
+}  // namespace cats
@@ -0,0 +1,399 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "cats_log/flight_log.hpp"
+
+extern "C" {
+#include "util/crc32.h"
+#include "util/log_format.h"
+#include "util/rec_codec.h"
+}
+#include "util/rec_schema.h"
+
+#include <array>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace cats {
+
+namespace {
+
+/* Record IDs occupy the lower four bits of rec_entry_type_e */
+constexpr uint32_t kNumIds = 16;
+constexpr size_t kInitialRows = 4096;
+
+struct TypeInfo {
+  const char *name;
+  std::vector<const char *> fields;
+};
+
+#define CATS_FIELD_NAME(type, member, kind) #member,
+#define CATS_ENUM_NAME(type, member) #member,
+#define CATS_TYPE_INFO(name, type, fields) {#name, {fields(CATS_FIELD_NAME, CATS_ENUM_NAME)}},
+
+const std::vector<TypeInfo> kTypes = {REC_TYPES(CATS_TYPE_INFO)};
+
+/* "raw_orientation[2]" -> "raw_orientation_2" */
+std::string column_name(uint32_t type_idx, uint32_t field_idx) {
+  if (type_idx >= kTypes.size() || field_idx >= kTypes[type_idx].fields.size()) {
+    return "field" + std::to_string(field_idx);
+  }
+  std::string name = kTypes[type_idx].fields[field_idx];
+  std::string result;
+  for (char c : name) {
+    if (c == '[') {
+      result += '_';
+    } else if (c != ']') {
+      result += c;
+    }
+  }
+  return result;
+}
+
+std::string type_name(uint32_t type_idx) {
+  return type_idx < kTypes.size() ? kTypes[type_idx].name : "TYPE" + std::to_string(type_idx);
+}
+
+uint8_t field_width(uint8_t kind) {
+  switch (kind) {
+    case REC_FIELD_U8:
+    case REC_FIELD_I8:
+      return 1;
+    case REC_FIELD_U16:
+    case REC_FIELD_I16:
+      return 2;
+    default:
+      return 4;
+  }
+}
+
+std::string fixed_string(const char *str, size_t max_len) { return std::string(str, strnlen(str, max_len)); }
+
+class Decoder {
+ public:
+  Decoder(const uint8_t *data, size_t size) : data_(data), size_(size) {}
+
+  FlightLog run() {
+    const size_t num_blocks = size_ / LOG_BLOCK_SIZE;
+    if (num_blocks == 0 || !read_header()) {
+      throw std::runtime_error("not a flight log");
+    }
+    log_.num_blocks = static_cast<uint32_t>(num_blocks);
+
+    uint32_t expected_seq = 1;
+    for (size_t i = 1; i < num_blocks; ++i) {
+      const uint8_t *block = data_ + i * LOG_BLOCK_SIZE;
+      log_block_header_t header;
+      if (!check_block(block, header) || (header.flags & LOG_BLOCK_FLAG_HEADER)) {
+        ++log_.bad_blocks;
+        continue;
+      }
+      if (header.seq > expected_seq) {
+        log_.missing_blocks += header.seq - expected_seq;
+      }
+      expected_seq = header.seq + 1;
+      const auto tier = static_cast<uint8_t>((header.flags & LOG_BLOCK_TIER_MASK) >> LOG_BLOCK_TIER_SHIFT);
+      if (tier != (log_.tier_changes.empty() ? 0 : log_.tier_changes.back().tier)) {
+        log_.tier_changes.push_back({static_cast<uint32_t>(i), tier});
+      }
+      decode_payload(block + sizeof(header), header.len, header.flags);
+    }
+
+    for (auto &series : series_) {
+      if (series.rows > 0) {
+        for (Column &column : series.columns) {
+          column.data.resize(series.rows * column.width);
+        }
+        log_.series.push_back(std::move(series));
+      }
+    }
+    return std::move(log_);
+  }
+
+ private:
+  static bool check_block(const uint8_t *block, log_block_header_t &header) {
+    memcpy(&header, block, sizeof(header));
+    return header.sync == LOG_BLOCK_SYNC && header.len <= LOG_BLOCK_PAYLOAD_SIZE &&
+           header.crc == crc32_compute(block + LOG_BLOCK_CRC_OFFSET, LOG_BLOCK_SIZE - LOG_BLOCK_CRC_OFFSET);
+  }
+
+  bool read_header() {
+    log_block_header_t block_header;
+    if (!check_block(data_, block_header) || !(block_header.flags & LOG_BLOCK_FLAG_HEADER)) {
+      return false;
+    }
+    const uint8_t *payload = data_ + sizeof(block_header);
+    log_file_header_t header;
+    if (block_header.len < sizeof(header)) {
+      return false;
+    }
+    memcpy(&header, payload, sizeof(header));
+    if (memcmp(header.magic, LOG_FILE_MAGIC, LOG_FILE_MAGIC_SIZE) != 0 || header.format_version != LOG_FORMAT_VERSION ||
+        header.num_types > REC_CODEC_NUM_TYPES || sizeof(header) + header.layout_table_size > block_header.len) {
+      return false;
+    }
+    log_.board = fixed_string(header.board, sizeof(header.board));
+    log_.code_version = fixed_string(header.code_version, sizeof(header.code_version));
+    log_.flight_counter = header.flight_counter;
+    log_.schema_version = header.schema_version;
+    log_.sample_rates.assign(header.sample_rates, header.sample_rates + header.num_types);
+
+    /* the layout table: size, number of fields and (kind, offset) per field for every type */
+    const uint8_t *table = payload + sizeof(header);
+    const uint8_t *table_end = table + header.layout_table_size;
+    for (uint32_t i = 0; i < header.num_types; ++i) {
+      if (table + 2 > table_end) {
+        return false;
+      }
+      rec_layout_t &layout = layouts_[i];
+      layout.size = table[0];
+      layout.num_fields = table[1];
+      table += 2;
+      if (layout.size > REC_CODEC_MAX_ELEM_SIZE || layout.num_fields > REC_CODEC_MAX_FIELDS ||
+          table + 2 * layout.num_fields > table_end) {
+        return false;
+      }
+      for (uint32_t j = 0; j < layout.num_fields; ++j) {
+        layout.fields[j].kind = table[0];
+        layout.fields[j].offset = table[1];
+        table += 2;
+        if (layout.fields[j].offset + field_width(layout.fields[j].kind) > layout.size) {
+          return false;
+        }
+      }
+    }
+    num_types_ = header.num_types;
+    rec_codec_init(&codec_, layouts_.data());
+
+    series_.resize(num_types_ * kNumIds);
+    capacity_.assign(series_.size(), 0);
+    for (uint32_t type_idx = 0; type_idx < num_types_; ++type_idx) {
+      for (uint32_t id = 0; id < kNumIds; ++id) {
+        Series &series = series_[type_idx * kNumIds + id];
+        series.name = type_name(type_idx) + std::to_string(id);
+        series.type_idx = type_idx;
+        series.id = static_cast<uint8_t>(id);
+        const rec_layout_t &layout = layouts_[type_idx];
+        for (uint32_t j = 0; j < layout.num_fields; ++j) {
+          Column column;
+          column.name = column_name(type_idx, j);
+          column.kind = layout.fields[j].kind;
+          column.width = field_width(column.kind);
+          series.columns.push_back(std::move(column));
+        }
+      }
+    }
+    return true;
+  }
+
+  void decode_payload(const uint8_t *payload, uint32_t len, uint16_t flags) {
+    uint8_t elem[REC_CODEC_MAX_ELEM_SIZE];
+    uint32_t idx = 0;
+    if (flags & LOG_BLOCK_FLAG_ENCODED) {
+      rec_codec_reset(&codec_);
+      while (idx < len) {
+        uint32_t type_idx = 0;
+        uint8_t id = 0;
+        const int32_t used = rec_codec_decode(&codec_, payload + idx, len - idx, &type_idx, &id, elem);
+        if (used <= 0 || type_idx >= num_types_) {
+          ++log_.bad_records;
+          return;
+        }
+        idx += static_cast<uint32_t>(used);
+        append(type_idx, id, elem);
+      }
+    } else {
+      /* raw records: 4 byte record type followed by the record struct */
+      while (idx + sizeof(uint32_t) <= len) {
+        uint32_t rec_type = 0;
+        memcpy(&rec_type, payload + idx, sizeof(rec_type));
+        const uint32_t pure_type = rec_type & ~(kNumIds - 1);
+        const uint32_t type_idx = pure_type == 0 ? num_types_ : static_cast<uint32_t>(__builtin_ctz(pure_type)) - 4;
+        if (type_idx >= num_types_ || idx + sizeof(rec_type) + layouts_[type_idx].size > len) {
+          ++log_.bad_records;
+          return;
+        }
+        append(type_idx, static_cast<uint8_t>(rec_type & (kNumIds - 1)), payload + idx + sizeof(rec_type));
+        idx += sizeof(rec_type) + layouts_[type_idx].size;
+      }
+    }
+  }
+
+  void append(uint32_t type_idx, uint8_t id, const uint8_t *elem) {
+    Series &series = series_[type_idx * kNumIds + id];
+    size_t &capacity = capacity_[type_idx * kNumIds + id];
+    if (series.rows == capacity) {
+      /* grow all columns at once, the rows are written in place below */
+      capacity = capacity == 0 ? kInitialRows : 2 * capacity;
+      for (Column &column : series.columns) {
+        column.data.resize(capacity * column.width);
+      }
+    }
+    const rec_layout_t &layout = layouts_[type_idx];
+    for (uint32_t j = 0; j < layout.num_fields; ++j) {
+      Column &column = series.columns[j];
+      uint8_t *dst = column.data.data() + series.rows * column.width;
+      const uint8_t *src = elem + layout.fields[j].offset;
+      /* constant size copies instead of a memcpy call per field */
+      switch (column.width) {
+        case 1:
+          dst[0] = src[0];
+          break;
+        case 2:
+          memcpy(dst, src, 2);
+          break;
+        default:
+          memcpy(dst, src, 4);
+          break;
+      }
+    }
+    ++series.rows;
+    ++log_.num_records;
+  }
+
+  const uint8_t *data_;
+  size_t size_;
+  FlightLog log_;
+  std::array<rec_layout_t, REC_CODEC_NUM_TYPES> layouts_{};
+  uint32_t num_types_ = 0;
+  rec_codec_t codec_{};
+  /* indexed by type_idx * kNumIds + id */
+  std::vector<Series> series_;
+  std::vector<size_t> capacity_;
+};
+
+}  // namespace
+
+double Column::value(size_t row) const {
+  const uint8_t *src = data.data() + row * width;
+  switch (kind) {
+    case REC_FIELD_U8:
+      return src[0];
+    case REC_FIELD_I8:
+      return static_cast<int8_t>(src[0]);
+    case REC_FIELD_U16: {
+      uint16_t v;
+      memcpy(&v, src, sizeof(v));
+      return v;
+    }
+    case REC_FIELD_I16: {
+      int16_t v;
+      memcpy(&v, src, sizeof(v));
+      return v;
+    }
+    case REC_FIELD_U32: {
+      uint32_t v;
+      memcpy(&v, src, sizeof(v));
+      return v;
+    }
+    case REC_FIELD_I32: {
+      int32_t v;
+      memcpy(&v, src, sizeof(v));
+      return v;
+    }
+    default: {
+      float v;
+      memcpy(&v, src, sizeof(v));
+      return v;
+    }
+  }
+}
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string &path) {
+  file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                      nullptr);
+  if (file_ == INVALID_HANDLE_VALUE) {
+    throw std::runtime_error("can't open " + path);
+  }
+  LARGE_INTEGER size;
+  GetFileSizeEx(file_, &size);
+  size_ = static_cast<size_t>(size.QuadPart);
+  if (size_ == 0) {
+    return;
+  }
+  mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (mapping_ == nullptr) {
+    CloseHandle(file_);
+    throw std::runtime_error("can't map " + path);
+  }
+  data_ = static_cast<const uint8_t *>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+}
+
+MappedFile::~MappedFile() {
+  if (data_ != nullptr) {
+    UnmapViewOfFile(data_);
+  }
+  if (mapping_ != nullptr) {
+    CloseHandle(mapping_);
+  }
+  CloseHandle(file_);
+}
+
+#else
+
+MappedFile::MappedFile(const std::string &path) {
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("can't open " + path);
+  }
+  struct stat st {};
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    throw std::runtime_error("can't stat " + path);
+  }
+  size_ = static_cast<size_t>(st.st_size);
+  if (size_ > 0) {
+    void *mapping = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED) {
+      close(fd);
+      throw std::runtime_error("can't map " + path);
+    }
+    /* the file is read front to back exactly once */
+    madvise(mapping, size_, MADV_SEQUENTIAL);
+    data_ = static_cast<const uint8_t *>(mapping);
+  }
+  close(fd);
+}
+
+MappedFile::~MappedFile() {
+  if (data_ != nullptr) {
+    munmap(const_cast<uint8_t *>(data_), size_);
+  }
+}
+
+#endif
+
+FlightLog decode_flight_log(const uint8_t *data, size_t size) { return Decoder(data, size).run(); }
+
+FlightLog decode_flight_file(const std::string &path) {
+  MappedFile file(path);
+  return decode_flight_log(file.data(), file.size());
+}
+
+}  // namespace cats
@@ -0,0 +1,145 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Converts dumped flight files to CSV or to the binary columnar format. The files are distributed over all cores.
+ *
+ *   cats_log_convert [--csv] [--bin] [-o <output directory>] [-j <threads>] <flight file>...
+ */
+
+#include "cats_log/flight_log.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Options {
+  bool csv = false;
+  bool columnar = false;
+  std::string output_dir = ".";
+  unsigned threads = 0;
+  std::vector<std::string> files;
+};
+
+void print_usage() {
+  fprintf(stderr,
+          "Usage: cats_log_convert [--csv] [--bin] [-o <output directory>] [-j <threads>] <flight file>...\n"
+          "  --csv  write one CSV file per record type and ID\n"
+          "  --bin  write one binary columnar file (.catc) per flight\n"
+          "  -o     output directory, defaults to the current directory\n"
+          "  -j     number of worker threads, defaults to the number of cores\n");
+}
+
+bool parse_options(int argc, char **argv, Options &options) {
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg == "--csv") {
+      options.csv = true;
+    } else if (arg == "--bin") {
+      options.columnar = true;
+    } else if (arg == "-o" && i + 1 < argc) {
+      options.output_dir = argv[++i];
+    } else if (arg == "-j" && i + 1 < argc) {
+      options.threads = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+    } else if (arg == "-h" || arg == "--help" || arg[0] == '-') {
+      return false;
+    } else {
+      options.files.push_back(arg);
+    }
+  }
+  return !options.files.empty();
+}
+
+std::string base_name(const std::string &path) {
+  const size_t pos = path.find_last_of("/\\");
+  return pos == std::string::npos ? path : path.substr(pos + 1);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  Options options;
+  if (!parse_options(argc, argv, options)) {
+    print_usage();
+    return EXIT_FAILURE;
+  }
+
+  unsigned num_threads = options.threads > 0 ? options.threads : std::thread::hardware_concurrency();
+  num_threads = std::max(1U, std::min<unsigned>(num_threads, static_cast<unsigned>(options.files.size())));
+
+  std::atomic<size_t> next_file{0};
+  std::atomic<size_t> bytes_in{0};
+  std::atomic<int> failures{0};
+  std::mutex print_mutex;
+  const auto start = std::chrono::steady_clock::now();
+
+  auto worker = [&]() {
+    size_t idx;
+    while ((idx = next_file.fetch_add(1)) < options.files.size()) {
+      const std::string &path = options.files[idx];
+      try {
+        cats::MappedFile file(path);
+        const cats::FlightLog log = cats::decode_flight_log(file.data(), file.size());
+        const std::string prefix = options.output_dir + "/" + base_name(path);
+        if (options.csv) {
+          cats::write_csv(log, prefix);
+        }
+        if (options.columnar) {
+          cats::write_columnar(log, prefix + ".catc");
+        }
+        bytes_in += file.size();
+
+        std::lock_guard<std::mutex> lock(print_mutex);
+        printf("%s: flight %u, %s %s, %zu records in %zu series, %u blocks, %u corrupted, %u missing\n", path.c_str(),
+               log.flight_counter, log.board.c_str(), log.code_version.c_str(), log.num_records, log.series.size(),
+               log.num_blocks, log.bad_blocks, log.missing_blocks);
+        for (const cats::TierChange &change : log.tier_changes) {
+          printf("%s: storage tier %u from block %u on, the flash ran full\n", path.c_str(), change.tier, change.block);
+        }
+      } catch (const std::exception &e) {
+        ++failures;
+        std::lock_guard<std::mutex> lock(print_mutex);
+        fprintf(stderr, "%s: %s\n", path.c_str(), e.what());
+      }
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (unsigned i = 0; i < num_threads; ++i) {
+    workers.emplace_back(worker);
+  }
+  for (auto &t : workers) {
+    t.join();
+  }
+
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  printf("Processed %zu files (%.1f MB) in %.3f s on %u threads: %.1f MB/s\n", options.files.size(),
+         static_cast<double>(bytes_in) / 1e6, seconds, num_threads,
+         seconds > 0 ? static_cast<double>(bytes_in) / 1e6 / seconds : 0.0);
+  return failures > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,631 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Compression ratio and cost of the record codec (src/util/rec_codec.h) on a synthetic flight and on recorded ones.
+ *
+ * The synthetic flight produces every record type at the rates of the firmware (2 IMUs, 3 baros, magnetometer and
+ * high-g accelerometer at CONTROL_SAMPLING_FREQ plus the state estimation output) with sensor noise on a simple
+ * boost/coast/descent trajectory. Recorded flights are read with -i, either flight logs as written by the recorder
+ * (util/log_format.h, raw or encoded blocks; the layouts are taken from the header block) or files of the old format
+ * which is just the 4 byte record type followed by the record struct.
+ *
+ * The records are packed into LOG_BLOCK_SIZE blocks once raw and once encoded, the codec is reset at the start of
+ * every block like in task_recorder. The report lists the bytes per second of flight for each record type and for the
+ * whole flash footprint including the block headers and padding, the encode and decode time per record on this host
+ * and whether every record survives the round trip.
+ *
+ * With -o the synthetic flight is written as an encoded flight log, e.g. as input for tools/log_decoder.
+ *
+ *   codec_bench [-t <synthetic flight duration in s>] [-r <timing repetitions>] [-o <flight log>] [-i <flight log>]...
+ *
+ * Exits with a failure if a record doesn't survive the round trip.
+ */
+
+#include "util/recorder.h"
+#include "util/rec_schema.h"
+#include "util/crc32.h"
+
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/** Private Constants **/
+
+#define BENCH_RATE       100 /* CONTROL_SAMPLING_FREQ */
+#define BENCH_MAX_INPUTS 16
+#define BENCH_RAW_TYPE_SIZE sizeof(rec_entry_type_e)
+
+static const char *const type_names[NUM_REC_TYPES] = {"IMU",         "BARO",         "MAGNETO",
+                                                      "ACCEL",       "FLIGHT_INFO",  "ORIENTATION",
+                                                      "FILTERED",    "FLIGHT_STATE", "COVARIANCE",
+                                                      "SENSOR_INFO", "EVENT_INFO",   "ERROR_INFO"};
+
+/** Private Types **/
+
+typedef struct {
+  uint8_t type_idx;
+  uint8_t id;
+  uint8_t elem[REC_CODEC_MAX_ELEM_SIZE];
+} bench_record_t;
+
+typedef struct {
+  bench_record_t *records;
+  uint32_t count;
+  uint32_t capacity;
+  rec_layout_t layouts[REC_CODEC_NUM_TYPES];
+} bench_flight_t;
+
+typedef struct {
+  uint64_t raw_bytes[NUM_REC_TYPES];
+  uint64_t encoded_bytes[NUM_REC_TYPES];
+  uint32_t raw_blocks;
+  uint32_t encoded_blocks;
+  double encode_ns; /* per record */
+  double decode_ns; /* per record */
+  uint32_t mismatches;
+} bench_result_t;
+
+/** Private Variables **/
+
+#define REC_FIELD(type, member, kind) {kind, offsetof(type, member)},
+#define REC_ENUM_KIND(type, member) \
+  (sizeof(((type *)0)->member) == 1 ? REC_FIELD_U8 : sizeof(((type *)0)->member) == 2 ? REC_FIELD_U16 : REC_FIELD_I32)
+#define REC_ENUM_FIELD(type, member) REC_FIELD(type, member, REC_ENUM_KIND(type, member))
+#define REC_COUNT_FIELD(...) +1
+#define REC_LAYOUT(name, type, fields) \
+  {sizeof(type), 0 fields(REC_COUNT_FIELD, REC_COUNT_FIELD), {fields(REC_FIELD, REC_ENUM_FIELD)}},
+
+/* Same table as in util/recorder.c */
+static const rec_layout_t firmware_layouts[NUM_REC_TYPES] = {REC_TYPES(REC_LAYOUT)};
+
+/* Event triggered by each flight state of the synthetic flight */
+static const cats_event_e fsm_events[] = {
+    [THRUSTING_1] = EV_LIFTOFF, [COASTING] = EV_MAX_V, [DROGUE] = EV_APOGEE, [MAIN] = EV_POST_APOGEE,
+    [TOUCHDOWN] = EV_TOUCHDOWN};
+
+static uint32_t rng_state = 0x12345678;
+
+/** Private Function Declarations **/
+
+static void add_record(bench_flight_t *flight, uint32_t type_idx, uint8_t id, const void *elem, uint32_t size);
+static float noise(float amplitude);
+static void generate_flight(bench_flight_t *flight, uint32_t duration_s);
+static bool read_flight(bench_flight_t *flight, const char *path);
+static bool read_container(bench_flight_t *flight, const uint8_t *data, size_t size);
+static bool read_old_format(bench_flight_t *flight, const uint8_t *data, size_t size);
+static void run_bench(const bench_flight_t *flight, uint32_t repetitions, bench_result_t *result);
+static uint32_t pack_blocks(const bench_flight_t *flight, bool encoded, uint64_t *bytes_per_type, uint8_t *out);
+static uint32_t unpack_blocks(const bench_flight_t *flight, const uint8_t *blocks, uint32_t num_blocks);
+static bool fields_equal(const rec_layout_t *layout, const uint8_t *a, const uint8_t *b);
+static bool write_flight_log(const bench_flight_t *flight, const char *path);
+static double elapsed_ns(const struct timespec *start);
+static void print_result(const char *title, const bench_flight_t *flight, const bench_result_t *result);
+
+/** Exported Function Definitions **/
+
+int main(int argc, char **argv) {
+  uint32_t duration_s = 180;
+  uint32_t repetitions = 20;
+  const char *output = NULL;
+  const char *inputs[BENCH_MAX_INPUTS] = {};
+  uint32_t num_inputs = 0;
+  int opt = 0;
+  while ((opt = getopt(argc, argv, "t:r:o:i:")) != -1) {
+    switch (opt) {
+      case 't':
+        duration_s = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      case 'r':
+        repetitions = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      case 'o':
+        output = optarg;
+        break;
+      case 'i':
+        if (num_inputs < BENCH_MAX_INPUTS) {
+          inputs[num_inputs++] = optarg;
+        }
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-t <duration in s>] [-r <repetitions>] [-o <flight log>] [-i <flight log>]...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+  if (repetitions == 0) {
+    repetitions = 1;
+  }
+
+  crc32_init();
+  uint32_t mismatches = 0;
+
+  bench_flight_t flight = {};
+  memcpy(flight.layouts, firmware_layouts, sizeof(firmware_layouts));
+  generate_flight(&flight, duration_s);
+  bench_result_t result = {};
+  run_bench(&flight, repetitions, &result);
+  char title[128];
+  snprintf(title, sizeof(title), "Synthetic flight (-t %u)", duration_s);
+  print_result(title, &flight, &result);
+  mismatches += result.mismatches;
+  if (output != NULL && !write_flight_log(&flight, output)) {
+    fprintf(stderr, "%s: can't be written\n", output);
+  }
+  free(flight.records);
+
+  for (uint32_t i = 0; i < num_inputs; ++i) {
+    bench_flight_t recorded = {};
+    memcpy(recorded.layouts, firmware_layouts, sizeof(firmware_layouts));
+    if (!read_flight(&recorded, inputs[i])) {
+      fprintf(stderr, "%s: no records found\n", inputs[i]);
+      free(recorded.records);
+      return EXIT_FAILURE;
+    }
+    bench_result_t recorded_result = {};
+    run_bench(&recorded, repetitions, &recorded_result);
+    print_result(inputs[i], &recorded, &recorded_result);
+    mismatches += recorded_result.mismatches;
+    free(recorded.records);
+  }
+
+  if (mismatches > 0) {
+    printf("FAILED: %u records changed in the round trip\n", mismatches);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+/** Private Function Definitions **/
+
+static void add_record(bench_flight_t *flight, uint32_t type_idx, uint8_t id, const void *elem, uint32_t size) {
+  if (flight->count == flight->capacity) {
+    flight->capacity = flight->capacity == 0 ? 65536 : 2 * flight->capacity;
+    flight->records = realloc(flight->records, flight->capacity * sizeof(bench_record_t));
+  }
+  bench_record_t *record = &flight->records[flight->count++];
+  memset(record, 0, sizeof(*record));
+  record->type_idx = (uint8_t)type_idx;
+  record->id = id;
+  memcpy(record->elem, elem, size < REC_CODEC_MAX_ELEM_SIZE ? size : REC_CODEC_MAX_ELEM_SIZE);
+}
+
+/* Uniform noise in [-amplitude, amplitude] */
+static float noise(float amplitude) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return amplitude * ((float)(rng_state & 0xFFFF) / 32767.5f - 1.0f);
+}
+
+/* 10 s on the pad, 3 s of boost at 80 m/s^2, coast to the apogee, 20 m/s under the drogue and 6 m/s under the main
+ * chute from 300 m, another 10 s on the ground */
+static void generate_flight(bench_flight_t *flight, uint32_t duration_s) {
+  const float dt = 1.0f / BENCH_RATE;
+  const float g = 9.81f;
+  float height = 0.0f;
+  float velocity = 0.0f;
+  float height_cov = 10.0f;
+  float velocity_cov = 10.0f;
+  flight_fsm_e fsm = READY;
+  float t_touchdown = -1.0f;
+  for (uint32_t step = 0; step < duration_s * BENCH_RATE; ++step) {
+    const float t = (float)step * dt;
+    const timestamp_t ts = 1000 + step * (1000 / BENCH_RATE);
+    float acceleration = 0.0f;
+    flight_fsm_e next_fsm = fsm;
+    if (t >= 10.0f && t < 13.0f) {
+      acceleration = 80.0f;
+      next_fsm = THRUSTING_1;
+    } else if (fsm == THRUSTING_1 || fsm == COASTING) {
+      acceleration = -g - 0.002f * velocity * fabsf(velocity);
+      next_fsm = velocity > 0.0f ? COASTING : DROGUE;
+    } else if (fsm == DROGUE || fsm == MAIN) {
+      const float v_target = fsm == DROGUE ? -20.0f : -6.0f;
+      acceleration = (v_target - velocity) * 2.0f;
+      if (fsm == DROGUE && height < 300.0f) {
+        next_fsm = MAIN;
+      }
+      if (height <= 0.0f) {
+        height = 0.0f;
+        velocity = 0.0f;
+        acceleration = 0.0f;
+        next_fsm = TOUCHDOWN;
+        t_touchdown = t;
+      }
+    }
+    if (fsm != TOUCHDOWN) {
+      velocity += acceleration * dt;
+      height += velocity * dt;
+    }
+    if (t_touchdown > 0.0f && t > t_touchdown + 10.0f) {
+      break;
+    }
+
+    /* task_imu_read */
+    const float specific_force = fsm == READY || fsm == TOUCHDOWN ? g : acceleration + g;
+    const magneto_data_t magneto = {ts, 0.21f + noise(0.002f), -0.05f + noise(0.002f), 0.43f + noise(0.002f)};
+    add_record(flight, get_rec_type_index(MAGNETO), 0, &magneto, sizeof(magneto));
+    const accel_data_t accel = {ts, (int8_t)noise(1.0f), (int8_t)noise(1.0f),
+                                (int8_t)lrintf(specific_force / g / 0.78f + noise(1.0f))};
+    add_record(flight, get_rec_type_index(ACCELEROMETER), 0, &accel, sizeof(accel));
+    for (uint8_t i = 0; i < NUM_IMU; ++i) {
+      const imu_data_t imu = {ts,
+                              (int16_t)lrintf(noise(6.0f)),
+                              (int16_t)lrintf(noise(6.0f)),
+                              (int16_t)lrintf(3.0f + noise(6.0f)),
+                              (int16_t)lrintf(noise(12.0f)),
+                              (int16_t)lrintf(noise(12.0f)),
+                              (int16_t)lrintf(specific_force / g * 1024.0f + noise(12.0f))};
+      add_record(flight, get_rec_type_index(IMU), i, &imu, sizeof(imu));
+    }
+    /* task_baro_read */
+    for (uint8_t i = 0; i < NUM_BARO; ++i) {
+      const float pressure = 101325.0f * powf(1.0f - 2.25577e-5f * height, 5.25588f);
+      const baro_data_t baro = {ts, (int32_t)lrintf(pressure + noise(4.0f)),
+                                (int32_t)lrintf(2000.0f - 0.65f * height + noise(2.0f))};
+      add_record(flight, get_rec_type_index(BARO), i, &baro, sizeof(baro));
+    }
+    /* task_state_est */
+    const filtered_data_info_t filtered = {ts, height + noise(0.5f), acceleration + noise(0.3f), height + noise(0.2f),
+                                           acceleration + noise(0.1f)};
+    add_record(flight, get_rec_type_index(FILTERED_DATA_INFO), 0, &filtered, sizeof(filtered));
+    orientation_info_t orientation = {.ts = ts};
+    for (uint32_t i = 0; i < 4; ++i) {
+      orientation.estimated_orientation[i] = (int16_t)lrintf((i == 0 ? 1000.0f : 0.0f) + noise(3.0f));
+      orientation.raw_orientation[i] = (int16_t)lrintf((i == 0 ? 1000.0f : 0.0f) + noise(8.0f));
+    }
+    add_record(flight, get_rec_type_index(ORIENTATION_INFO), 0, &orientation, sizeof(orientation));
+    height_cov = 0.99f * height_cov + 0.01f * 0.8f;
+    velocity_cov = 0.99f * velocity_cov + 0.01f * 0.3f;
+    const covariance_info_t cov = {ts, height_cov, velocity_cov};
+    add_record(flight, get_rec_type_index(COVARIANCE_INFO), 0, &cov, sizeof(cov));
+    const flight_info_t flight_info = {ts, height + noise(0.05f), velocity + noise(0.05f), acceleration + noise(0.05f)};
+    add_record(flight, get_rec_type_index(FLIGHT_INFO), 0, &flight_info, sizeof(flight_info));
+
+    /* task_flight_fsm and task_peripherals */
+    if (next_fsm != fsm) {
+      fsm = next_fsm;
+      const flight_state_t flight_state = {.ts = ts, .flight_or_drop_state.flight_state = fsm};
+      add_record(flight, get_rec_type_index(FLIGHT_STATE), 0, &flight_state, sizeof(flight_state));
+      const event_info_t event_info = {.ts = ts, .event = fsm_events[fsm], .action_idx = 0};
+      add_record(flight, get_rec_type_index(EVENT_INFO), 0, &event_info, sizeof(event_info));
+    }
+    if (step % (10 * BENCH_RATE) == 0) {
+      const sensor_info_t sensor_info = {.ts = ts};
+      add_record(flight, get_rec_type_index(SENSOR_INFO), 0, &sensor_info, sizeof(sensor_info));
+    }
+  }
+}
+
+static bool read_flight(bench_flight_t *flight, const char *path) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    return false;
+  }
+  fseek(file, 0, SEEK_END);
+  const long size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  if (size <= 0) {
+    fclose(file);
+    return false;
+  }
+  uint8_t *data = malloc((size_t)size);
+  const size_t read = fread(data, 1, (size_t)size, file);
+  fclose(file);
+
+  uint32_t sync = 0;
+  memcpy(&sync, data, read >= sizeof(sync) ? sizeof(sync) : 0);
+  const bool ok = sync == LOG_BLOCK_SYNC ? read_container(flight, data, read) : read_old_format(flight, data, read);
+  free(data);
+  return ok && flight->count > 0;
+}
+
+/* Flight log as written by the recorder, blocks with a bad CRC are skipped */
+static bool read_container(bench_flight_t *flight, const uint8_t *data, size_t size) {
+  rec_codec_t codec;
+  for (size_t offset = 0; offset + LOG_BLOCK_SIZE <= size; offset += LOG_BLOCK_SIZE) {
+    const uint8_t *block = &data[offset];
+    log_block_header_t header;
+    memcpy(&header, block, sizeof(header));
+    if (header.sync != LOG_BLOCK_SYNC || header.len > LOG_BLOCK_PAYLOAD_SIZE ||
+        crc32_compute(&block[LOG_BLOCK_CRC_OFFSET], LOG_BLOCK_SIZE - LOG_BLOCK_CRC_OFFSET) != header.crc) {
+      continue;
+    }
+    const uint8_t *payload = &block[sizeof(header)];
+    if (header.flags & LOG_BLOCK_FLAG_HEADER) {
+      /* take the layouts of the firmware which wrote the log */
+      log_file_header_t file_header;
+      memcpy(&file_header, payload, sizeof(file_header));
+      if (file_header.num_types > REC_CODEC_NUM_TYPES) {
+        return false;
+      }
+      uint32_t idx = sizeof(file_header);
+      for (uint32_t i = 0; i < file_header.num_types && idx + 2 <= header.len; ++i) {
+        rec_layout_t *layout = &flight->layouts[i];
+        layout->size = payload[idx++];
+        layout->num_fields = payload[idx++];
+        if (layout->num_fields > REC_CODEC_MAX_FIELDS || layout->size > REC_CODEC_MAX_ELEM_SIZE) {
+          return false;
+        }
+        for (uint32_t j = 0; j < layout->num_fields; ++j) {
+          layout->fields[j].kind = payload[idx++];
+          layout->fields[j].offset = payload[idx++];
+        }
+      }
+      rec_codec_init(&codec, flight->layouts);
+      continue;
+    }
+    if (header.flags & LOG_BLOCK_FLAG_ENCODED) {
+      rec_codec_reset(&codec);
+      uint32_t idx = 0;
+      while (idx < header.len) {
+        uint32_t type_idx = 0;
+        uint8_t id = 0;
+        uint8_t elem[REC_CODEC_MAX_ELEM_SIZE];
+        const int32_t used = rec_codec_decode(&codec, &payload[idx], header.len - idx, &type_idx, &id, elem);
+        if (used <= 0) {
+          break;
+        }
+        add_record(flight, type_idx, id, elem, flight->layouts[type_idx].size);
+        idx += (uint32_t)used;
+      }
+    } else if (!read_old_format(flight, payload, header.len)) {
+      continue;
+    }
+  }
+  return true;
+}
+
+/* 4 byte record type followed by the record struct, up to the first unknown record type */
+static bool read_old_format(bench_flight_t *flight, const uint8_t *data, size_t size) {
+  size_t idx = 0;
+  while (idx + BENCH_RAW_TYPE_SIZE <= size) {
+    uint32_t rec_type = 0;
+    memcpy(&rec_type, &data[idx], BENCH_RAW_TYPE_SIZE);
+    const uint32_t type_idx = get_rec_type_index((rec_entry_type_e)rec_type);
+    if (type_idx >= NUM_REC_TYPES || (rec_type & ~(uint32_t)(REC_ID_MASK | (1U << (type_idx + 4)))) != 0) {
+      break;
+    }
+    const uint32_t elem_size = flight->layouts[type_idx].size;
+    if (idx + BENCH_RAW_TYPE_SIZE + elem_size > size) {
+      break;
+    }
+    add_record(flight, type_idx, get_id_from_record_type((rec_entry_type_e)rec_type), &data[idx + BENCH_RAW_TYPE_SIZE],
+               elem_size);
+    idx += BENCH_RAW_TYPE_SIZE + elem_size;
+  }
+  return idx > 0;
+}
+
+static void run_bench(const bench_flight_t *flight, uint32_t repetitions, bench_result_t *result) {
+  /* one record per block is the worst case */
+  uint8_t *blocks = malloc((size_t)(flight->count + 1) * LOG_BLOCK_SIZE);
+
+  uint64_t unused[NUM_REC_TYPES];
+  result->raw_blocks = pack_blocks(flight, false, result->raw_bytes, blocks);
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (uint32_t i = 0; i < repetitions; ++i) {
+    result->encoded_blocks = pack_blocks(flight, true, i == 0 ? result->encoded_bytes : unused, blocks);
+  }
+  result->encode_ns = elapsed_ns(&start) / repetitions / flight->count;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (uint32_t i = 0; i < repetitions; ++i) {
+    result->mismatches = unpack_blocks(flight, blocks, result->encoded_blocks);
+  }
+  result->decode_ns = elapsed_ns(&start) / repetitions / flight->count;
+  free(blocks);
+}
+
+/**
+ * Pack the records into blocks like task_recorder does, see append_records().
+ *
+ * @param flight - records
+ * @param encoded - encode the records, otherwise they are stored as record type and struct
+ * @param bytes_per_type[out] - record bytes per record type index
+ * @param out - blocks; only the payload and its length are written
+ * @return number of blocks
+ */
+static uint32_t pack_blocks(const bench_flight_t *flight, bool encoded, uint64_t *bytes_per_type, uint8_t *out) {
+  memset(bytes_per_type, 0, NUM_REC_TYPES * sizeof(uint64_t));
+  rec_codec_t codec;
+  rec_codec_init(&codec, flight->layouts);
+  uint32_t num_blocks = 0;
+  log_block_header_t *header = NULL;
+  uint8_t *payload = NULL;
+  for (uint32_t i = 0; i < flight->count; ++i) {
+    const bench_record_t *record = &flight->records[i];
+    const uint32_t raw_size = BENCH_RAW_TYPE_SIZE + flight->layouts[record->type_idx].size;
+    uint8_t temp[REC_CODEC_MAX_ENC_SIZE];
+    uint32_t size = raw_size;
+    if (encoded && header != NULL && (uint32_t)header->len + REC_CODEC_MAX_ENC_SIZE > LOG_BLOCK_PAYLOAD_SIZE) {
+      /* the record might not fit anymore, encode it on the side first */
+      size = rec_codec_encode(&codec, record->type_idx, record->id, record->elem, temp);
+    }
+    if (header == NULL || header->len + size > LOG_BLOCK_PAYLOAD_SIZE) {
+      header = (log_block_header_t *)&out[num_blocks * LOG_BLOCK_SIZE];
+      payload = &out[num_blocks * LOG_BLOCK_SIZE + sizeof(log_block_header_t)];
+      header->len = 0;
+      ++num_blocks;
+      rec_codec_reset(&codec);
+      size = raw_size;
+    }
+    if (encoded) {
+      if ((uint32_t)header->len + REC_CODEC_MAX_ENC_SIZE <= LOG_BLOCK_PAYLOAD_SIZE) {
+        size = rec_codec_encode(&codec, record->type_idx, record->id, record->elem, &payload[header->len]);
+      } else {
+        memcpy(&payload[header->len], temp, size);
+      }
+    } else {
+      const uint32_t rec_type = (1U << (record->type_idx + 4)) | record->id;
+      memcpy(&payload[header->len], &rec_type, BENCH_RAW_TYPE_SIZE);
+      memcpy(&payload[header->len + BENCH_RAW_TYPE_SIZE], record->elem, raw_size - BENCH_RAW_TYPE_SIZE);
+    }
+    header->len = (uint16_t)(header->len + size);
+    bytes_per_type[record->type_idx] += size;
+  }
+  return num_blocks;
+}
+
+/* Decode the encoded blocks and compare every record with the original, returns the number of mismatches */
+static uint32_t unpack_blocks(const bench_flight_t *flight, const uint8_t *blocks, uint32_t num_blocks) {
+  rec_codec_t codec;
+  rec_codec_init(&codec, flight->layouts);
+  uint32_t mismatches = 0;
+  uint32_t record_idx = 0;
+  for (uint32_t i = 0; i < num_blocks; ++i) {
+    const log_block_header_t *header = (const log_block_header_t *)&blocks[i * LOG_BLOCK_SIZE];
+    const uint8_t *payload = &blocks[i * LOG_BLOCK_SIZE + sizeof(log_block_header_t)];
+    rec_codec_reset(&codec);
+    uint32_t idx = 0;
+    while (idx < header->len && record_idx < flight->count) {
+      uint32_t type_idx = 0;
+      uint8_t id = 0;
+      uint8_t elem[REC_CODEC_MAX_ELEM_SIZE];
+      const int32_t used = rec_codec_decode(&codec, &payload[idx], header->len - idx, &type_idx, &id, elem);
+      if (used <= 0) {
+        break;
+      }
+      const bench_record_t *record = &flight->records[record_idx++];
+      if (type_idx != record->type_idx || id != record->id ||
+          !fields_equal(&flight->layouts[type_idx], elem, record->elem)) {
+        ++mismatches;
+      }
+      idx += (uint32_t)used;
+    }
+  }
+  return mismatches + (flight->count - record_idx);
+}
+
+/* Compare the fields of two records, the padding of the structs is not part of the encoding */
+static bool fields_equal(const rec_layout_t *layout, const uint8_t *a, const uint8_t *b) {
+  static const uint8_t widths[] = {[REC_FIELD_U8] = 1, [REC_FIELD_I8] = 1,  [REC_FIELD_U16] = 2, [REC_FIELD_I16] = 2,
+                                   [REC_FIELD_U32] = 4, [REC_FIELD_I32] = 4, [REC_FIELD_F32] = 4};
+  for (uint32_t i = 0; i < layout->num_fields; ++i) {
+    const rec_field_t *field = &layout->fields[i];
+    if (memcmp(&a[field->offset], &b[field->offset], widths[field->kind]) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* Write the flight as an encoded flight log with the header block of util/recorder.c */
+static bool write_flight_log(const bench_flight_t *flight, const char *path) {
+  uint8_t *blocks = malloc((size_t)(flight->count + 2) * LOG_BLOCK_SIZE);
+  uint64_t unused[NUM_REC_TYPES];
+  const uint32_t num_blocks = 1 + pack_blocks(flight, true, unused, &blocks[LOG_BLOCK_SIZE]);
+
+  uint8_t *payload = &blocks[sizeof(log_block_header_t)];
+  memset(payload, 0, LOG_BLOCK_PAYLOAD_SIZE);
+  log_file_header_t file_header = {.format_version = LOG_FORMAT_VERSION,
+                                   .schema_version = LOG_SCHEMA_VERSION,
+                                   .flight_counter = 1,
+                                   .num_types = NUM_REC_TYPES,
+                                   .num_phases = NUM_REC_PHASES};
+  memcpy(file_header.magic, LOG_FILE_MAGIC, LOG_FILE_MAGIC_SIZE);
+  strncpy(file_header.board, "codec_bench", sizeof(file_header.board) - 1);
+  uint32_t idx = sizeof(file_header);
+  for (uint32_t i = 0; i < NUM_REC_TYPES; ++i) {
+    file_header.sample_rates[i] = i == get_rec_type_index(FLIGHT_STATE) || i >= get_rec_type_index(SENSOR_INFO)
+                                      ? 0
+                                      : BENCH_RATE;
+    const rec_layout_t *layout = &flight->layouts[i];
+    payload[idx++] = layout->size;
+    payload[idx++] = layout->num_fields;
+    for (uint32_t j = 0; j < layout->num_fields; ++j) {
+      payload[idx++] = layout->fields[j].kind;
+      payload[idx++] = layout->fields[j].offset;
+    }
+  }
+  file_header.layout_table_size = (uint16_t)(idx - sizeof(file_header));
+  memcpy(payload, &file_header, sizeof(file_header));
+  /* no decimation */
+  idx += NUM_REC_PHASES * NUM_REC_TYPES;
+
+  for (uint32_t i = 0; i < num_blocks; ++i) {
+    uint8_t *block = &blocks[i * LOG_BLOCK_SIZE];
+    log_block_header_t header;
+    memcpy(&header, block, sizeof(header));
+    header.sync = LOG_BLOCK_SYNC;
+    header.seq = i;
+    header.flags = i == 0 ? LOG_BLOCK_FLAG_HEADER : LOG_BLOCK_FLAG_ENCODED;
+    if (i == 0) {
+      header.len = (uint16_t)idx;
+    }
+    memset(&block[sizeof(header) + header.len], 0, LOG_BLOCK_PAYLOAD_SIZE - header.len);
+    memcpy(block, &header, sizeof(header));
+    header.crc = crc32_compute(&block[LOG_BLOCK_CRC_OFFSET], LOG_BLOCK_SIZE - LOG_BLOCK_CRC_OFFSET);
+    memcpy(block, &header, sizeof(header));
+  }
+
+  FILE *file = fopen(path, "wb");
+  const bool ok = file != NULL && fwrite(blocks, LOG_BLOCK_SIZE, num_blocks, file) == num_blocks;
+  if (file != NULL) {
+    fclose(file);
+  }
+  free(blocks);
+  return ok;
+}
+
+static double elapsed_ns(const struct timespec *start) {
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return (double)(end.tv_sec - start->tv_sec) * 1e9 + (double)(end.tv_nsec - start->tv_nsec);
+}
+
+static void print_result(const char *title, const bench_flight_t *flight, const bench_result_t *result) {
+  /* the flight duration is taken from the timestamps */
+  timestamp_t first_ts = UINT32_MAX;
+  timestamp_t last_ts = 0;
+  for (uint32_t i = 0; i < flight->count; ++i) {
+    timestamp_t ts;
+    memcpy(&ts, flight->records[i].elem, sizeof(ts));
+    first_ts = ts < first_ts ? ts : first_ts;
+    last_ts = ts > last_ts ? ts : last_ts;
+  }
+  const double seconds = last_ts > first_ts ? (double)(last_ts - first_ts + 1000 / BENCH_RATE) / 1000.0 : 1.0;
+
+  printf("%s: %u records in %.1f s\n", title, flight->count, seconds);
+  printf("  %-13s %12s %12s %7s\n", "record type", "raw B/s", "encoded B/s", "ratio");
+  uint64_t raw_total = 0;
+  uint64_t encoded_total = 0;
+  for (uint32_t i = 0; i < NUM_REC_TYPES; ++i) {
+    if (result->raw_bytes[i] == 0) {
+      continue;
+    }
+    printf("  %-13s %12.0f %12.0f %7.2f\n", type_names[i], (double)result->raw_bytes[i] / seconds,
+           (double)result->encoded_bytes[i] / seconds, (double)result->raw_bytes[i] / (double)result->encoded_bytes[i]);
+    raw_total += result->raw_bytes[i];
+    encoded_total += result->encoded_bytes[i];
+  }
+  printf("  %-13s %12.0f %12.0f %7.2f\n", "records", (double)raw_total / seconds, (double)encoded_total / seconds,
+         (double)raw_total / (double)encoded_total);
+  const double raw_flash = (double)result->raw_blocks * LOG_BLOCK_SIZE;
+  const double encoded_flash = (double)result->encoded_blocks * LOG_BLOCK_SIZE;
+  printf("  %-13s %12.0f %12.0f %7.2f   (%u vs. %u blocks incl. headers and padding)\n", "flash", raw_flash / seconds,
+         encoded_flash / seconds, raw_flash / encoded_flash, result->raw_blocks, result->encoded_blocks);
+  printf("  encode %.1f ns/record, decode %.1f ns/record on this host; round trip %s\n\n", result->encode_ns,
+         result->decode_ns, result->mismatches == 0 ? "OK" : "FAILED");
+}
@@ -0,0 +1,295 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Checks the SPSC byte ring of the recorder (src/util/rec_ring.h) on the host.
+ *
+ * The edge cases are checked first on a single thread: an empty ring, a completely full ring, a write which doesn't
+ * fit, a record which wraps around the end of the buffer and the free running indices overflowing 2^32.
+ *
+ * Then a producer and a consumer thread run concurrently on a small ring so that it is full and empty all the time
+ * and nearly every few records wrap around. The producer writes variable size records like record() does, the
+ * consumer drains them like task_recorder does: whole records in place from the span returned by rec_ring_peek() and
+ * only the record which wraps around with rec_ring_copy(). Every record carries a sequence number and a payload
+ * derived from it, the consumer checks both. The indices start just below 2^32 so that they overflow during the run.
+ *
+ *   rec_ring_stress [-n <number of records>] [-s <ring size>]
+ *
+ * Exits with a failure if one of the checks fails.
+ */
+
+#include "util/rec_ring.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/** Private Constants **/
+
+/* Record: 1 byte size, 4 byte sequence number, payload; between the smallest and the biggest recorder record */
+#define REC_HEADER_SIZE 5
+#define REC_MIN_SIZE    8
+#define REC_MAX_SIZE    48
+
+/* The indices overflow after this many bytes */
+#define START_INDEX (UINT32_MAX - 4096)
+
+/** Private Types **/
+
+typedef struct {
+  rec_ring_t ring;
+  uint32_t num_records;
+  /* producer side */
+  uint64_t full_count;
+  /* consumer side */
+  uint64_t empty_count;
+  uint64_t wrapped_records;
+  uint64_t bytes_read;
+  uint32_t max_length;
+  uint32_t errors;
+} stress_state_t;
+
+/** Private Variables **/
+
+static uint32_t failed_checks = 0;
+
+/** Private Function Declarations **/
+
+static void check(bool condition, const char *what);
+static uint32_t record_size(uint32_t seq);
+static void fill_record(uint8_t *record, uint32_t seq);
+static bool check_record(const uint8_t *record, uint32_t size, uint32_t seq);
+static void check_edges();
+static void *producer(void *arg);
+static void *consumer(void *arg);
+
+/** Exported Function Definitions **/
+
+int main(int argc, char **argv) {
+  uint32_t num_records = 10000000;
+  uint32_t ring_size = 256;
+  int opt = 0;
+  while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+    switch (opt) {
+      case 'n':
+        num_records = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      case 's':
+        ring_size = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-n <number of records>] [-s <ring size>]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+  if (ring_size < REC_MAX_SIZE || (ring_size & (ring_size - 1)) != 0) {
+    fprintf(stderr, "The ring size has to be a power of two >= %d\n", REC_MAX_SIZE);
+    return EXIT_FAILURE;
+  }
+
+  check_edges();
+
+  uint8_t *buffer = malloc(ring_size);
+  stress_state_t state = {.num_records = num_records};
+  rec_ring_init(&state.ring, buffer, ring_size);
+  state.ring.head = START_INDEX;
+  state.ring.tail = START_INDEX;
+
+  struct timespec start;
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  pthread_t producer_thread;
+  pthread_t consumer_thread;
+  pthread_create(&consumer_thread, NULL, consumer, &state);
+  pthread_create(&producer_thread, NULL, producer, &state);
+  pthread_join(producer_thread, NULL);
+  pthread_join(consumer_thread, NULL);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  const double seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+
+  printf("Concurrent run: %u records, %llu bytes through a %u byte ring in %.2f s (%.1f MB/s)\n", num_records,
+         (unsigned long long)state.bytes_read, ring_size, seconds, (double)state.bytes_read / seconds / 1e6);
+  printf("  ring full: %llu times, ring empty: %llu times, wrapped records: %llu, max. fill: %u bytes\n",
+         (unsigned long long)state.full_count, (unsigned long long)state.empty_count,
+         (unsigned long long)state.wrapped_records, state.max_length);
+  check(state.errors == 0, "every record arrives intact and in order");
+  check(state.wrapped_records > 0, "records wrapped around the end of the ring");
+  check(state.full_count > 0 && state.empty_count > 0, "the ring ran full and empty");
+  check(state.max_length <= ring_size, "the fill level never exceeds the ring size");
+  check(rec_ring_get_length(&state.ring) == 0, "the ring is empty at the end");
+  check(state.ring.head < START_INDEX, "the indices overflowed");
+  free(buffer);
+
+  if (failed_checks > 0) {
+    printf("%u checks FAILED\n", failed_checks);
+    return EXIT_FAILURE;
+  }
+  printf("All checks passed\n");
+  return EXIT_SUCCESS;
+}
+
+/** Private Function Definitions **/
+
+static void check(bool condition, const char *what) {
+  if (!condition) {
+    printf("FAILED: %s\n", what);
+    ++failed_checks;
+  }
+}
+
+/* Deterministic size of the record with the given sequence number */
+static uint32_t record_size(uint32_t seq) {
+  return REC_MIN_SIZE + (seq * 2654435761U >> 16) % (REC_MAX_SIZE - REC_MIN_SIZE + 1);
+}
+
+static void fill_record(uint8_t *record, uint32_t seq) {
+  const uint32_t size = record_size(seq);
+  record[0] = (uint8_t)size;
+  memcpy(&record[1], &seq, sizeof(seq));
+  for (uint32_t i = REC_HEADER_SIZE; i < size; ++i) {
+    record[i] = (uint8_t)(seq * 31 + i);
+  }
+}
+
+static bool check_record(const uint8_t *record, uint32_t size, uint32_t seq) {
+  uint8_t expected[REC_MAX_SIZE];
+  fill_record(expected, seq);
+  return size == record_size(seq) && memcmp(record, expected, size) == 0;
+}
+
+static void check_edges() {
+  uint8_t buffer[64];
+  uint8_t data[64];
+  uint8_t out[64];
+  for (uint32_t i = 0; i < sizeof(data); ++i) {
+    data[i] = (uint8_t)(i + 1);
+  }
+  rec_ring_t ring;
+  const uint8_t *span = NULL;
+
+  rec_ring_init(&ring, buffer, sizeof(buffer));
+  check(rec_ring_get_length(&ring) == 0 && rec_ring_get_free(&ring) == sizeof(buffer), "a new ring is empty");
+  check(rec_ring_peek(&ring, &span) == 0, "peeking an empty ring returns nothing");
+
+  /* full */
+  check(rec_ring_write(&ring, data, sizeof(buffer)), "the whole ring can be filled");
+  check(rec_ring_get_free(&ring) == 0, "a full ring has no space");
+  check(!rec_ring_write(&ring, data, 1), "a write to a full ring is rejected");
+  check(rec_ring_peek(&ring, &span) == sizeof(buffer) && memcmp(span, data, sizeof(buffer)) == 0,
+        "a full ring is readable in one span");
+  rec_ring_consume(&ring, sizeof(buffer));
+  check(rec_ring_get_length(&ring) == 0, "a consumed ring is empty");
+
+  /* a rejected write leaves the ring untouched */
+  check(rec_ring_write(&ring, data, 40), "a record fits into the empty ring");
+  check(!rec_ring_write(&ring, data, 25), "a record bigger than the free space is rejected");
+  check(rec_ring_get_length(&ring) == 40, "a rejected write doesn't change the ring");
+  check(rec_ring_write(&ring, data, 24), "a record filling the ring exactly fits");
+  rec_ring_consume(&ring, 64);
+
+  /* wrap around: move the position to offset 54 so that the next 20 bytes wrap around the end of the buffer */
+  rec_ring_write(&ring, data, 54);
+  rec_ring_consume(&ring, 54);
+  check(rec_ring_write(&ring, data, 20), "a record wrapping around the end fits");
+  check(rec_ring_peek(&ring, &span) == 10, "the span ends at the end of the buffer");
+  rec_ring_copy(&ring, out, 20);
+  check(memcmp(out, data, 20) == 0, "a wrapped record is copied in one piece");
+  rec_ring_consume(&ring, 20);
+
+  /* free running indices overflowing 2^32 */
+  ring.head = UINT32_MAX - 9;
+  ring.tail = UINT32_MAX - 9;
+  check(rec_ring_write(&ring, data, 30), "a write across the index overflow succeeds");
+  check(rec_ring_get_length(&ring) == 30 && rec_ring_get_free(&ring) == 34, "the fill level survives the overflow");
+  rec_ring_copy(&ring, out, 30);
+  check(memcmp(out, data, 30) == 0, "a record across the index overflow is intact");
+  rec_ring_consume(&ring, 30);
+  check(ring.head == 20 && rec_ring_get_length(&ring) == 0, "the indices wrapped around");
+
+  rec_ring_write(&ring, data, 10);
+  rec_ring_flush(&ring);
+  check(rec_ring_get_length(&ring) == 0 && rec_ring_get_free(&ring) == sizeof(buffer), "a flushed ring is empty");
+}
+
+/* Writes the records like record(): all or nothing, retries while the ring is full */
+static void *producer(void *arg) {
+  stress_state_t *state = (stress_state_t *)arg;
+  uint8_t record[REC_MAX_SIZE];
+  for (uint32_t seq = 0; seq < state->num_records; ++seq) {
+    fill_record(record, seq);
+    while (!rec_ring_write(&state->ring, record, record[0])) {
+      ++state->full_count;
+      sched_yield();
+    }
+  }
+  return NULL;
+}
+
+/* Drains the ring like task_recorder: whole records in place, a wrapped record is copied */
+static void *consumer(void *arg) {
+  stress_state_t *state = (stress_state_t *)arg;
+  rec_ring_t *ring = &state->ring;
+  uint32_t seq = 0;
+  while (seq < state->num_records) {
+    const uint32_t length = rec_ring_get_length(ring);
+    if (length == 0) {
+      ++state->empty_count;
+      sched_yield();
+      continue;
+    }
+    if (length > state->max_length) {
+      state->max_length = length;
+    }
+    const uint8_t *span = NULL;
+    const uint32_t span_len = rec_ring_peek(ring, &span);
+    uint32_t idx = 0;
+    while (idx < span_len && span[idx] <= span_len - idx) {
+      if (!check_record(&span[idx], span[idx], seq)) {
+        ++state->errors;
+      }
+      idx += span[idx];
+      ++seq;
+    }
+    if (idx > 0) {
+      rec_ring_consume(ring, idx);
+      state->bytes_read += idx;
+      continue;
+    }
+    /* the next record wraps around the end of the buffer */
+    uint8_t size = 0;
+    rec_ring_copy(ring, &size, 1);
+    if (size < REC_MIN_SIZE || size > length) {
+      ++state->errors;
+      break;
+    }
+    uint8_t record[REC_MAX_SIZE];
+    rec_ring_copy(ring, record, size);
+    if (!check_record(record, size, seq)) {
+      ++state->errors;
+    }
+    rec_ring_consume(ring, size);
+    state->bytes_read += size;
+    ++state->wrapped_records;
+    ++seq;
+  }
+  return NULL;
+}
@@ -0,0 +1,172 @@
+/*
+ * CATS Flight Software
+ * Copyright (C) 2021 Control and Telemetry Systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Generates cli/settings_hash.h: a perfect hash of the setting names in cli/settings_schema.h, so that the CLI finds
+ * a setting with one hash and one string compare instead of comparing all names.
+ *
+ * The generator looks for the smallest power of two table and a seed for which cli_settings_hash() puts every name
+ * into its own slot. The slots hold the index into value_table plus one, 0 marks an empty slot. The index of every name
+ * is written out as well, cli/settings.c checks it against the schema so that a stale hash doesn't compile.
+ *
+ *   settings_gen <output file>
+ *
+ * Fails if two settings have the same name.
+ */
+
+#include "cli/settings_schema.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+/** Private Constants **/
+
+#define GEN_MAX_SEEDS 1000000U
+#define GEN_MAX_BITS  10
+
+#define GEN_NAME(name, ...) #name,
+
+static const char *const gen_names[] = {CLI_SETTINGS(GEN_NAME, GEN_NAME, GEN_NAME, GEN_NAME)};
+#define GEN_NUM_NAMES (sizeof(gen_names) / sizeof(gen_names[0]))
+
+/** Private Variables **/
+
+static uint16_t gen_slots[1U << GEN_MAX_BITS];
+
+/** Private Function Declarations **/
+
+static bool has_duplicates();
+static bool try_seed(uint32_t bits, uint32_t seed);
+static bool write_header(const char *path, uint32_t bits, uint32_t seed);
+
+/** Exported Function Definitions **/
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    fprintf(stderr, "Usage: settings_gen <output file>\n");
+    return EXIT_FAILURE;
+  }
+  if (GEN_NUM_NAMES > UINT8_MAX - 1) {
+    fprintf(stderr, "Too many settings for 8 bit slots\n");
+    return EXIT_FAILURE;
+  }
+  if (has_duplicates()) {
+    return EXIT_FAILURE;
+  }
+
+  uint32_t bits = 1;
+  while ((1U << bits) < GEN_NUM_NAMES) {
+    ++bits;
+  }
+  for (; bits <= GEN_MAX_BITS; ++bits) {
+    for (uint32_t seed = 0; seed < GEN_MAX_SEEDS; ++seed) {
+      if (try_seed(bits, seed)) {
+        printf("%zu settings, %u slots, seed 0x%08X\n", GEN_NUM_NAMES, 1U << bits, seed);
+        return write_header(argv[1], bits, seed) ? EXIT_SUCCESS : EXIT_FAILURE;
+      }
+    }
+  }
+  fprintf(stderr, "No perfect hash found\n");
+  return EXIT_FAILURE;
+}
+
+/** Private Function Definitions **/
+
+/* The CLI compares the names without case, so they have to differ in more than that */
+static bool has_duplicates() {
+  bool found = false;
+  for (uint32_t i = 0; i < GEN_NUM_NAMES; ++i) {
+    for (uint32_t j = i + 1; j < GEN_NUM_NAMES; ++j) {
+      if (strcasecmp(gen_names[i], gen_names[j]) == 0) {
+        fprintf(stderr, "Setting %s is defined twice\n", gen_names[i]);
+        found = true;
+      }
+    }
+  }
+  return found;
+}
+
+static bool try_seed(uint32_t bits, uint32_t seed) {
+  memset(gen_slots, 0, sizeof(gen_slots));
+  for (uint32_t i = 0; i < GEN_NUM_NAMES; ++i) {
+    const uint32_t slot = cli_settings_hash(gen_names[i], (uint32_t)strlen(gen_names[i]), seed) >> (32 - bits);
+    if (gen_slots[slot] != 0) {
+      return false;
+    }
+    gen_slots[slot] = (uint16_t)(i + 1);
+  }
+  return true;
+}
+
+static bool write_header(const char *path, uint32_t bits, uint32_t seed) {
+  FILE *file = fopen(path, "w");
+  if (file == NULL) {
+    fprintf(stderr, "Can't open %s\n", path);
+    return false;
+  }
+  fprintf(file,
+          "/*\n"
+          " * CATS Flight Software\n"
+          " * Copyright (C) 2021 Control and Telemetry Systems\n"
+          " *\n"
+          " * This program is free software: you can redistribute it and/or modify\n"
+          " * it under the terms of the GNU General Public License as published by\n"
+          " * the Free Software Foundation, either version 3 of the License, or\n"
+          " * (at your option) any later version.\n"
+          " *\n"
+          " * This program is distributed in the hope that it will be useful,\n"
+          " * but WITHOUT ANY WARRANTY; without even the implied warranty of\n"
+          " * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the\n"
+          " * GNU General Public License for more details.\n"
+          " *\n"
+          " * You should have received a copy of the GNU General Public License\n"
+          " * along with this program.  If not, see <https://www.gnu.org/licenses/>.\n"
+          " */\n"
+          "\n"
+          "/*\n"
+          " * Generated by tools/settings_gen from cli/settings_schema.h, do not edit.\n"
+          " */\n"
+          "\n"
+          "#pragma once\n"
+          "\n"
+          "#define CLI_SETTINGS_COUNT     %zu\n"
+          "#define CLI_SETTINGS_HASH_SEED 0x%08XU\n"
+          "#define CLI_SETTINGS_HASH_BITS %u\n"
+          "\n"
+          "/* value_table index + 1 of every slot, 0 if the slot is empty */\n"
+          "// clang-format off\n"
+          "#define CLI_SETTINGS_HASH_SLOTS \\\n"
+          "  {",
+          GEN_NUM_NAMES, seed, bits);
+  const uint32_t num_slots = 1U << bits;
+  for (uint32_t slot = 0; slot < num_slots; ++slot) {
+    const bool line_end = slot % 16 == 15 && slot + 1 < num_slots;
+    fprintf(file, "%u%s", gen_slots[slot], slot + 1 < num_slots ? (line_end ? ", \\\n   " : ", ") : "}\n");
+  }
+  fprintf(file,
+          "\n"
+          "/* value_table index of every setting */\n");
+  for (uint32_t i = 0; i < GEN_NUM_NAMES; ++i) {
+    fprintf(file, "#define CLI_SETTINGS_INDEX_%s %u\n", gen_names[i], i);
+  }
+  fprintf(file, "// clang-format on\n");
+  return fclose(file) == 0;
+}